@@ -0,0 +1,133 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ConjugateGradientSolver_H
+#define ConjugateGradientSolver_H
+
+#include "MultigridSolver.h"
+#include "VariableIdImage.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <vector>
+
+/** This class solves the 5-point Poisson system of a hole (the same system that PoissonEditing
+  * assembles) with the preconditioned conjugate gradient method. The operator is applied directly
+  * from the neighbor table of the hole, so the matrix is never built.
+  *
+  * Iteration stops when the relative residual reaches the tolerance or, if a quantization step is
+  * set, as soon as further iterations are not expected to change the rounded value of any pixel.
+  * The remaining change of each pixel is estimated from the size of the last update and the
+  * convergence rate of the residual over the last few iterations. Rigorous bounds based on the
+  * smallest eigenvalue of A are too pessimistic to ever stop earlier than the tolerance.
+  *
+  * Large holes iterate the channels together in the interleaved layout of a multi-channel image, so
+  * each stencil application (and V-cycle of the preconditioner) reads the neighbor table once for
+  * all of them. Each channel still has its own step sizes and stops on its own, so the result does
+  * not depend on the layout.
+  */
+class ConjugateGradientSolver
+{
+public:
+  /** The values of a variable in all of the channels are stored next to each other. */
+  typedef MultigridSolver::InterleavedMatrixType InterleavedMatrixType;
+
+  /** Enumerate the preconditioners. The diagonal of the system is constant, so JACOBI is plain
+    * conjugate gradient. MULTIGRID uses one V-cycle of MultigridSolver per iteration. */
+  enum class PreconditionerEnum {JACOBI, MULTIGRID};
+
+  /** Specify which preconditioner to use. This must be called before Compute(). */
+  void SetPreconditioner(const PreconditionerEnum preconditioner);
+
+  /** Prepare the operator (and the preconditioner) for the hole numbered in 'variableIds'. */
+  void Compute(const VariableIdImage& variableIds);
+
+  /** Solve A X = B for each column of B. If X already has the size of B it is used as the initial
+    * guess, otherwise the iteration starts from zero. */
+  void Solve(const Eigen::MatrixXd& B, Eigen::MatrixXd& X);
+
+  /** Set the relative residual at which to stop iterating. */
+  void SetTolerance(const double tolerance);
+
+  /** Set the number of variables from which the channels are solved together in the interleaved
+    * layout. This saves reading the neighbor table once per channel, but multiplies the size of the
+    * work vectors, which only pays off once the vectors of a single channel do not fit in the cache
+    * anymore. Smaller holes are solved one channel after the other. */
+  void SetMinimumNumberOfInterleavedVariables(const std::size_t minimumNumberOfInterleavedVariables);
+
+  /** Set the maximum number of iterations per channel. */
+  void SetMaximumNumberOfIterations(const unsigned int maximumNumberOfIterations);
+
+  /** Set the spacing of the values that the solution will be rounded to (for example 1 for 8-bit
+    * output), or 0 to only stop on the tolerance. */
+  void SetQuantizationStep(const double quantizationStep);
+
+  /** Get the largest number of iterations that any channel needed in the last Solve(). */
+  unsigned int GetNumberOfIterations() const;
+
+  /** Get the largest relative residual of any channel at the end of the last Solve(). */
+  double GetRelativeResidual() const;
+
+protected:
+
+  /** Solve() with the number of channels as TChannels, or from B if it is 0. */
+  template <unsigned int TChannels>
+  void SolveChannels(const Eigen::MatrixXd& B, Eigen::MatrixXd& X);
+
+  /** Compute y = A x for each channel. */
+  template <unsigned int TChannels>
+  void Apply(const InterleavedMatrixType& x, InterleavedMatrixType& y) const;
+
+  /** Compute z ~= A^-1 r for each channel. */
+  void Precondition(const InterleavedMatrixType& r, InterleavedMatrixType& z);
+
+  /** Check that no value of 'channel' of 'x' rounds differently anywhere within 'errorBound' of it.
+    * Values that are within a hundredth of a step of a rounding boundary can not be decided, so
+    * they are accepted once the error bound is that small. */
+  bool IsQuantizationConverged(const InterleavedMatrixType& x, const unsigned int channel,
+                               const double errorBound) const;
+
+  /** The ids of the (up, left, right, down) neighbors of each variable, or -1. */
+  std::vector<int> NeighborIds;
+
+  /** The preconditioner. */
+  PreconditionerEnum Preconditioner = PreconditionerEnum::MULTIGRID;
+  MultigridSolver Multigrid;
+
+  /** The holes from which the channels are interleaved (about 16 MB per work vector of a channel). */
+  std::size_t MinimumNumberOfInterleavedVariables = 1 << 21;
+
+  /** The stopping criteria. */
+  double Tolerance = 1e-8;
+  unsigned int MaximumNumberOfIterations = 1000;
+  double QuantizationStep = 0.0;
+
+  /** The rate estimate is unreliable when convergence is this slow, so the quantization test is
+    * skipped. */
+  double MaximumQuantizationRate = 0.95;
+
+  /** The state at the end of the last Solve(). */
+  unsigned int NumberOfIterations = 0;
+  double RelativeResidual = 0.0;
+};
+
+#include "ConjugateGradientSolver.hpp"
+
+#endif
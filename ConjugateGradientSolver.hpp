@@ -0,0 +1,325 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ConjugateGradientSolver_HPP
+#define ConjugateGradientSolver_HPP
+
+#include "ConjugateGradientSolver.h" // Appease syntax parser
+
+#include "ParallelHelpers.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <stdexcept>
+
+inline void ConjugateGradientSolver::SetPreconditioner(const PreconditionerEnum preconditioner)
+{
+  this->Preconditioner = preconditioner;
+}
+
+inline void ConjugateGradientSolver::Compute(const VariableIdImage& variableIds)
+{
+  variableIds.ComputeNeighborIds(this->NeighborIds);
+
+  if(this->Preconditioner == PreconditionerEnum::MULTIGRID)
+  {
+    this->Multigrid.Compute(variableIds);
+  }
+}
+
+template <unsigned int TChannels>
+void ConjugateGradientSolver::Apply(const InterleavedMatrixType& x, InterleavedMatrixType& y) const
+{
+  const unsigned int numberOfChannels = TChannels > 0 ? TChannels : x.cols();
+  ParallelHelpers::ParallelFor(x.rows(), [&](const std::size_t variableId)
+  {
+    // The neighbor ids are loaded once for all of the channels
+    const int* neighbors = &this->NeighborIds[4 * variableId];
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      double stencilSum = -4.0 * x.data()[variableId * numberOfChannels + channel];
+      for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+      {
+        if(neighbors[neighbor] >= 0)
+        {
+          stencilSum += x.data()[neighbors[neighbor] * numberOfChannels + channel];
+        }
+      }
+      y.data()[variableId * numberOfChannels + channel] = stencilSum;
+    }
+  }, ParallelHelpers::MinimumPixelsPerThread);
+}
+
+inline void ConjugateGradientSolver::Precondition(const InterleavedMatrixType& r, InterleavedMatrixType& z)
+{
+  if(this->Preconditioner == PreconditionerEnum::MULTIGRID)
+  {
+    this->Multigrid.Precondition(r, z);
+  }
+  else
+  {
+    z = r / -4.0;
+  }
+}
+
+inline bool ConjugateGradientSolver::IsQuantizationConverged(const InterleavedMatrixType& x, const unsigned int channel,
+                                                             const double errorBound) const
+{
+  const double step = this->QuantizationStep;
+  if(step <= 0.0 || errorBound >= 0.5 * step)
+  {
+    return false; // Every value could still move to a neighboring level
+  }
+
+  if(errorBound <= 0.01 * step)
+  {
+    return true;
+  }
+
+  for(InterleavedMatrixType::Index variableId = 0; variableId < x.rows(); ++variableId)
+  {
+    const double value = x(variableId, channel);
+    if(std::floor((value - errorBound) / step + 0.5) != std::floor((value + errorBound) / step + 0.5))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline void ConjugateGradientSolver::Solve(const Eigen::MatrixXd& B, Eigen::MatrixXd& X)
+{
+  if(B.rows() * 4 != static_cast<Eigen::MatrixXd::Index>(this->NeighborIds.size()))
+  {
+    throw std::runtime_error("ConjugateGradientSolver: The right hand side does not match the hole!");
+  }
+
+  if(X.rows() != B.rows() || X.cols() != B.cols())
+  {
+    X = Eigen::MatrixXd::Zero(B.rows(), B.cols());
+  }
+
+  if(B.cols() > 1 && static_cast<std::size_t>(B.rows()) < this->MinimumNumberOfInterleavedVariables)
+  {
+    unsigned int numberOfIterations = 0;
+    double relativeResidual = 0.0;
+    for(int channel = 0; channel < B.cols(); ++channel)
+    {
+      Eigen::MatrixXd x = X.col(channel);
+      SolveChannels<1>(B.col(channel), x);
+      X.col(channel) = x;
+      numberOfIterations = std::max(numberOfIterations, this->NumberOfIterations);
+      relativeResidual = std::max(relativeResidual, this->RelativeResidual);
+    }
+    this->NumberOfIterations = numberOfIterations;
+    this->RelativeResidual = relativeResidual;
+    return;
+  }
+
+  // The channel counts of common images get kernels with a fixed number of channels
+  switch(B.cols())
+  {
+    case 1:
+      SolveChannels<1>(B, X);
+      break;
+    case 3:
+      SolveChannels<3>(B, X);
+      break;
+    case 4:
+      SolveChannels<4>(B, X);
+      break;
+    default:
+      SolveChannels<0>(B, X);
+      break;
+  }
+}
+
+template <unsigned int TChannels>
+void ConjugateGradientSolver::SolveChannels(const Eigen::MatrixXd& B, Eigen::MatrixXd& X)
+{
+  // The per-channel scalars have a fixed size if the number of channels does, so the passes over
+  // the interleaved vectors can keep them in registers
+  typedef Eigen::Matrix<double, 1, TChannels == 0 ? Eigen::Dynamic : static_cast<int>(TChannels)> ChannelVectorType;
+
+  const unsigned int numberOfChannels = TChannels > 0 ? TChannels : B.cols();
+  const std::size_t numberOfVariables = B.rows();
+  const InterleavedMatrixType b = B;
+  InterleavedMatrixType x = X;
+  InterleavedMatrixType r(B.rows(), numberOfChannels);
+  InterleavedMatrixType z(B.rows(), numberOfChannels);
+  InterleavedMatrixType p = InterleavedMatrixType::Zero(B.rows(), numberOfChannels);
+  InterleavedMatrixType q(B.rows(), numberOfChannels);
+
+  // Compute the inner product of 'u' and 'v' in each channel, in one pass over both
+  auto channelDots = [&](const InterleavedMatrixType& u, const InterleavedMatrixType& v)
+  {
+    ChannelVectorType dots = ChannelVectorType::Zero(numberOfChannels);
+    for(std::size_t variableId = 0; variableId < numberOfVariables; ++variableId)
+    {
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        dots[channel] += u.data()[variableId * numberOfChannels + channel] * v.data()[variableId * numberOfChannels + channel];
+      }
+    }
+    return dots;
+  };
+
+  Apply<TChannels>(x, r);
+  r = b - r;
+
+  const ChannelVectorType bNorms = channelDots(b, b).cwiseSqrt();
+  ChannelVectorType residualNorms = channelDots(r, r).cwiseSqrt();
+
+  // Channels that have stopped take steps of size 0, so they are not changed anymore
+  std::vector<unsigned int> iterations(numberOfChannels, 0);
+  std::vector<bool> isIterating(numberOfChannels);
+
+  // The most recent residual norms of each channel, to estimate its convergence rate
+  std::vector<std::deque<double> > residualHistories(numberOfChannels);
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    residualHistories[channel].push_back(residualNorms[channel]);
+    isIterating[channel] = this->MaximumNumberOfIterations > 0 && residualNorms[channel] > this->Tolerance * bNorms[channel];
+  }
+
+  ChannelVectorType rz = ChannelVectorType::Zero(numberOfChannels);
+  ChannelVectorType alpha(numberOfChannels);
+  ChannelVectorType beta(numberOfChannels);
+  for(unsigned int iteration = 0; std::find(isIterating.begin(), isIterating.end(), true) != isIterating.end(); ++iteration)
+  {
+    Precondition(r, z);
+
+    // A and the preconditioner are both negative definite, so all of the inner products below
+    // have consistent signs.
+    const ChannelVectorType previousRz = rz;
+    rz = channelDots(r, z);
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      beta[channel] = (iteration > 0 && isIterating[channel]) ? rz[channel] / previousRz[channel] : 0.0;
+    }
+    for(std::size_t variableId = 0; variableId < numberOfVariables; ++variableId)
+    {
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        const std::size_t value = variableId * numberOfChannels + channel;
+        p.data()[value] = z.data()[value] + beta[channel] * p.data()[value];
+      }
+    }
+
+    Apply<TChannels>(p, q);
+    const ChannelVectorType pq = channelDots(p, q);
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      alpha[channel] = isIterating[channel] ? rz[channel] / pq[channel] : 0.0;
+    }
+
+    // Update the solution and the residual, and measure the residual, in one pass
+    ChannelVectorType residualSquares = ChannelVectorType::Zero(numberOfChannels);
+    for(std::size_t variableId = 0; variableId < numberOfVariables; ++variableId)
+    {
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        const std::size_t value = variableId * numberOfChannels + channel;
+        x.data()[value] += alpha[channel] * p.data()[value];
+        const double residual = r.data()[value] - alpha[channel] * q.data()[value];
+        r.data()[value] = residual;
+        residualSquares[channel] += residual * residual;
+      }
+    }
+    residualNorms = residualSquares.cwiseSqrt();
+
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      if(!isIterating[channel])
+      {
+        continue;
+      }
+
+      ++iterations[channel];
+      std::deque<double>& residualHistory = residualHistories[channel];
+      residualHistory.push_back(residualNorms[channel]);
+      if(residualHistory.size() > 6)
+      {
+        residualHistory.pop_front();
+      }
+
+      isIterating[channel] = iterations[channel] < this->MaximumNumberOfIterations &&
+                             residualNorms[channel] > this->Tolerance * bNorms[channel];
+
+      // The remaining change of x is the sum of the remaining updates. With a convergence rate
+      // of 'rate' per iteration, this is about rate / (1 - rate) times the last update. CG does
+      // not converge at an even rate, so a safety factor of 2 is applied to the estimate.
+      if(isIterating[channel] && this->QuantizationStep > 0.0 && residualHistory.size() > 2)
+      {
+        const double rate = std::pow(residualHistory.back() / residualHistory.front(),
+                                     1.0 / (residualHistory.size() - 1));
+        if(rate < this->MaximumQuantizationRate)
+        {
+          const double lastUpdate = std::abs(alpha[channel]) * p.col(channel).cwiseAbs().maxCoeff();
+          isIterating[channel] = !IsQuantizationConverged(x, channel, 2.0 * lastUpdate * rate / (1.0 - rate));
+        }
+      }
+    }
+  }
+
+  X = x;
+  this->NumberOfIterations = 0;
+  this->RelativeResidual = 0.0;
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    this->NumberOfIterations = std::max(this->NumberOfIterations, iterations[channel]);
+    if(bNorms[channel] > 0.0)
+    {
+      this->RelativeResidual = std::max(this->RelativeResidual, residualNorms[channel] / bNorms[channel]);
+    }
+  }
+}
+
+inline void ConjugateGradientSolver::SetTolerance(const double tolerance)
+{
+  this->Tolerance = tolerance;
+}
+
+inline void ConjugateGradientSolver::SetMinimumNumberOfInterleavedVariables(const std::size_t minimumNumberOfInterleavedVariables)
+{
+  this->MinimumNumberOfInterleavedVariables = minimumNumberOfInterleavedVariables;
+}
+
+inline void ConjugateGradientSolver::SetMaximumNumberOfIterations(const unsigned int maximumNumberOfIterations)
+{
+  this->MaximumNumberOfIterations = maximumNumberOfIterations;
+}
+
+inline void ConjugateGradientSolver::SetQuantizationStep(const double quantizationStep)
+{
+  this->QuantizationStep = quantizationStep;
+}
+
+inline unsigned int ConjugateGradientSolver::GetNumberOfIterations() const
+{
+  return this->NumberOfIterations;
+}
+
+inline double ConjugateGradientSolver::GetRelativeResidual() const
+{
+  return this->RelativeResidual;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef DomainDecompositionSolver_H
+#define DomainDecompositionSolver_H
+
+#include "VariableIdImage.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <memory>
+#include <vector>
+
+/** This class solves the 5-point Poisson system of a hole (the same system that PoissonEditing
+  * assembles) directly, with a factorization that runs on all of the threads. The bounding box of
+  * the hole is cut in two by a line of pixels (the interface), and the two halves are cut again, until
+  * the subdomains have at most MaximumLeafSize variables. The interiors of subdomains that do not
+  * touch each other are independent, so all of the subdomains of a level are eliminated concurrently,
+  * each leaving the Schur complement of its interior on the interfaces around it. Each interface
+  * system is assembled from the Schur complements of the two subdomains that it separates, and is
+  * itself eliminated one level up (this is nested dissection). The dense operations of the few
+  * large interfaces at the top of the tree are split over the threads instead.
+  *
+  * The solve substitutes forward up the tree and backward down it, again one level at a time. The
+  * result is the same as that of a sparse LDLT factorization up to round-off.
+  *
+  * A factorization that is computed as updatable keeps a partition that does not depend on the hole
+  * (the whole id buffer is cut, including the pixels that are not hole pixels) and keeps the Schur
+  * complements. When pixels enter or leave the hole, only the subdomains that contain them or their
+  * neighbors, and the ancestors of those, have to be eliminated again (see Update()). The
+  * eliminations are shared between copies of the solver, so a copy is a cheap snapshot of the factorization.
+  */
+class DomainDecompositionSolver
+{
+public:
+  /** Partition the hole numbered in 'variableIds' and factorize its system. If 'updatable' is true,
+    * the factorization can later be changed with Update(). */
+  void Compute(const VariableIdImage& variableIds, const bool updatable = false);
+
+  /** Factorize the system of a changed hole. 'variableIds' must number the new hole over the same
+    * region as the one given to Compute(), and 'changedPixels' must hold every pixel that entered or
+    * left the hole. */
+  void Update(const VariableIdImage& variableIds, const std::vector<itk::Index<2> >& changedPixels);
+
+  /** Solve A X = B for each column of B. */
+  void Solve(const Eigen::MatrixXd& B, Eigen::MatrixXd& X);
+
+  /** Get the largest relative residual of any column at the end of the last Solve(). */
+  double GetRelativeResidual() const;
+
+  /** Get the number of subdomains (the leaves and the interfaces) of the partition. */
+  std::size_t GetNumberOfSubdomains() const;
+
+  /** Get the number of subdomains that the last Compute() or Update() eliminated. */
+  std::size_t GetNumberOfEliminatedSubdomains() const;
+
+protected:
+
+  /** The elimination of a subdomain. The system is solved for -A, which is positive definite. An
+    * elimination is never changed once it is complete (a new one replaces it), so it can be shared
+    * by copies of the solver. */
+  struct Elimination
+  {
+    /** The pixels (offsets in the id buffer) that are eliminated here: the hole pixels of the
+      * interface, or all of the hole pixels of a leaf. */
+    std::vector<int> Variables;
+
+    /** The pixels of the enclosing interfaces that border this subdomain. */
+    std::vector<int> Boundary;
+
+    /** The Cholesky factor L of the block of Variables (in its lower triangle). */
+    Eigen::MatrixXd Factor;
+
+    /** L^-1 times the block (Variables, Boundary). */
+    Eigen::MatrixXd Coupling;
+
+    /** The Schur complement left on the Boundary (in its lower triangle). It is released once the
+      * parent has been eliminated, unless the factorization is updatable. */
+    Eigen::MatrixXd SchurComplement;
+  };
+
+  /** A subdomain of the partition. */
+  struct Subdomain
+  {
+    /** The enclosing interface, and the subdomains on either side of the interface, or -1. */
+    int Parent = -1;
+    int Children[2] = {-1, -1};
+
+    /** The box [MinimumX, MaximumX) x [MinimumY, MaximumY) of the subdomain in the id buffer. */
+    std::size_t Box[4] = {0, 0, 0, 0};
+
+    /** The part of Box whose hole pixels are eliminated here: the interface, or all of Box for a leaf. */
+    std::size_t VariableBox[4] = {0, 0, 0, 0};
+
+    std::shared_ptr<Elimination> Eliminated;
+  };
+
+  /** Add the subdomain of the box [minimumX, maximumX) x [minimumY, maximumY) of the id buffer, and
+    * (recursively) its children. Unless the factorization is updatable, the box is first shrunk to
+    * its hole pixels. Return its index, or -1 if the box is empty. */
+  int Partition(std::size_t minimumX, std::size_t minimumY, std::size_t maximumX, std::size_t maximumY,
+                const int parent, const unsigned int level);
+
+  /** Find the variables and the boundary of 'subdomainId', assemble its block and the Schur
+    * complements of its children, and factorize it. */
+  void Eliminate(const int subdomainId);
+
+  /** Call function(subdomainId) for each subdomain of 'subdomainIds' (which must not depend on each
+    * other), concurrently if there are enough of them to keep all of the threads busy. */
+  template <typename TFunction>
+  void ForEachSubdomain(const std::vector<int>& subdomainIds, TFunction function);
+
+  /** Get the position of each pixel of 'pixels' in the front of 'elimination' (its Variables
+    * followed by its Boundary), or -1. */
+  static void ComputeFrontPositions(const Elimination& elimination, const std::vector<int>& pixels,
+                                    std::vector<int>& positions);
+
+  /** The largest number of variables of a subdomain that is not split (or the largest number of
+    * pixels, if the factorization is updatable). */
+  static const unsigned int MaximumLeafSize = 64;
+
+  /** The region that the id buffer covers, and the id buffer itself. */
+  itk::ImageRegion<2> Region;
+  std::vector<int> Ids;
+  std::size_t NumberOfVariables = 0;
+
+  bool Updatable = false;
+
+  /** The subdomains, and the indices of the subdomains at each level of the tree (the root is level 0). */
+  std::vector<Subdomain> Subdomains;
+  std::vector<std::vector<int> > Levels;
+
+  /** The subdomain that eliminates each pixel of the id buffer (only if the factorization is
+    * updatable). The partition does not change, so this is shared by copies of the solver. */
+  std::shared_ptr<const std::vector<int> > SubdomainOfPixel;
+
+  std::size_t NumberOfEliminatedSubdomains = 0;
+
+  /** The state at the end of the last Solve(). */
+  double RelativeResidual = 0.0;
+};
+
+#include "DomainDecompositionSolver.hpp"
+
+#endif
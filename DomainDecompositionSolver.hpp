@@ -0,0 +1,564 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef DomainDecompositionSolver_HPP
+#define DomainDecompositionSolver_HPP
+
+#include "DomainDecompositionSolver.h" // Appease syntax parser
+
+#include "ParallelHelpers.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+inline void DomainDecompositionSolver::Compute(const VariableIdImage& variableIds, const bool updatable)
+{
+  this->Region = variableIds.GetRegion();
+  this->Ids = variableIds.GetIds();
+  this->NumberOfVariables = variableIds.GetNumberOfVariables();
+  this->Updatable = updatable;
+
+  this->Subdomains.clear();
+  this->Levels.clear();
+  this->SubdomainOfPixel.reset();
+  Partition(0, 0, this->Region.GetSize()[0], this->Region.GetSize()[1], -1, 0);
+
+  if(this->Updatable)
+  {
+    const std::size_t width = this->Region.GetSize()[0];
+    std::shared_ptr<std::vector<int> > subdomainOfPixel = std::make_shared<std::vector<int> >(this->Ids.size(), -1);
+    for(std::size_t subdomainId = 0; subdomainId < this->Subdomains.size(); ++subdomainId)
+    {
+      const std::size_t* variableBox = this->Subdomains[subdomainId].VariableBox;
+      for(std::size_t y = variableBox[1]; y < variableBox[3]; ++y)
+      {
+        for(std::size_t x = variableBox[0]; x < variableBox[2]; ++x)
+        {
+          (*subdomainOfPixel)[y * width + x] = static_cast<int>(subdomainId);
+        }
+      }
+    }
+    this->SubdomainOfPixel = subdomainOfPixel;
+  }
+
+  // Eliminate the leaves first
+  for(std::size_t level = this->Levels.size(); level-- > 0;)
+  {
+    ForEachSubdomain(this->Levels[level], [this](const int subdomainId)
+    {
+      Eliminate(subdomainId);
+    });
+  }
+  this->NumberOfEliminatedSubdomains = this->Subdomains.size();
+}
+
+inline void DomainDecompositionSolver::Update(const VariableIdImage& variableIds,
+                                              const std::vector<itk::Index<2> >& changedPixels)
+{
+  if(!this->Updatable)
+  {
+    throw std::runtime_error("DomainDecompositionSolver: Update() needs a factorization that was computed as updatable!");
+  }
+
+  if(!(variableIds.GetRegion() == this->Region))
+  {
+    throw std::runtime_error("DomainDecompositionSolver: The changed hole must be numbered over the region of the factorization!");
+  }
+
+  this->Ids = variableIds.GetIds();
+  this->NumberOfVariables = variableIds.GetNumberOfVariables();
+
+  // The block of a subdomain changes if one of its variables or of their neighbors changed, and its
+  // Schur complement changes with it, so all of its ancestors have to be eliminated again too.
+  const std::size_t width = this->Region.GetSize()[0];
+  const std::size_t height = this->Region.GetSize()[1];
+  std::vector<bool> isChanged(this->Subdomains.size(), false);
+  for(std::size_t pixel = 0; pixel < changedPixels.size(); ++pixel)
+  {
+    if(!this->Region.IsInside(changedPixels[pixel]))
+    {
+      throw std::runtime_error("DomainDecompositionSolver: A changed pixel is outside of the region of the factorization!");
+    }
+
+    const std::size_t offset = variableIds.GetOffset(changedPixels[pixel]);
+    const std::size_t x = offset % width;
+    const std::size_t y = offset / width;
+    const bool hasNeighbor[5] = {true, y > 0, x > 0, x + 1 < width, y + 1 < height};
+    const std::size_t neighborOffsets[5] = {offset, offset - width, offset - 1, offset + 1, offset + width};
+    for(unsigned int neighbor = 0; neighbor < 5; ++neighbor)
+    {
+      if(!hasNeighbor[neighbor])
+      {
+        continue;
+      }
+
+      for(int subdomainId = (*this->SubdomainOfPixel)[neighborOffsets[neighbor]];
+          subdomainId >= 0 && !isChanged[subdomainId]; subdomainId = this->Subdomains[subdomainId].Parent)
+      {
+        isChanged[subdomainId] = true;
+      }
+    }
+  }
+
+  this->NumberOfEliminatedSubdomains = 0;
+  std::vector<int> changedSubdomainIds;
+  for(std::size_t level = this->Levels.size(); level-- > 0;)
+  {
+    changedSubdomainIds.clear();
+    for(std::size_t item = 0; item < this->Levels[level].size(); ++item)
+    {
+      if(isChanged[this->Levels[level][item]])
+      {
+        changedSubdomainIds.push_back(this->Levels[level][item]);
+      }
+    }
+
+    ForEachSubdomain(changedSubdomainIds, [this](const int subdomainId)
+    {
+      Eliminate(subdomainId);
+    });
+    this->NumberOfEliminatedSubdomains += changedSubdomainIds.size();
+  }
+}
+
+inline int DomainDecompositionSolver::Partition(std::size_t minimumX, std::size_t minimumY, std::size_t maximumX,
+                                                std::size_t maximumY, const int parent, const unsigned int level)
+{
+  const std::size_t width = this->Region.GetSize()[0];
+
+  bool isLeaf = false;
+  if(this->Updatable)
+  {
+    // The partition must not depend on the hole, which may change later
+    if(maximumX <= minimumX || maximumY <= minimumY)
+    {
+      return -1;
+    }
+    isLeaf = (maximumX - minimumX) * (maximumY - minimumY) <= MaximumLeafSize;
+  }
+  else
+  {
+    // Shrink the box to its hole pixels
+    std::size_t numberOfVariables = 0;
+    std::size_t holeMinimumX = maximumX;
+    std::size_t holeMinimumY = maximumY;
+    std::size_t holeMaximumX = minimumX;
+    std::size_t holeMaximumY = minimumY;
+    for(std::size_t y = minimumY; y < maximumY; ++y)
+    {
+      for(std::size_t x = minimumX; x < maximumX; ++x)
+      {
+        if(this->Ids[y * width + x] >= 0)
+        {
+          ++numberOfVariables;
+          holeMinimumX = std::min(holeMinimumX, x);
+          holeMinimumY = std::min(holeMinimumY, y);
+          holeMaximumX = std::max(holeMaximumX, x + 1);
+          holeMaximumY = std::max(holeMaximumY, y + 1);
+        }
+      }
+    }
+
+    if(numberOfVariables == 0)
+    {
+      return -1;
+    }
+
+    minimumX = holeMinimumX;
+    minimumY = holeMinimumY;
+    maximumX = holeMaximumX;
+    maximumY = holeMaximumY;
+    isLeaf = numberOfVariables <= MaximumLeafSize;
+  }
+
+  const int subdomainId = static_cast<int>(this->Subdomains.size());
+  this->Subdomains.push_back(Subdomain());
+  if(this->Levels.size() <= level)
+  {
+    this->Levels.resize(level + 1);
+  }
+  this->Levels[level].push_back(subdomainId);
+
+  // Small subdomains are eliminated as a whole. Larger ones are cut across their longer side.
+  const std::size_t box[4] = {minimumX, minimumY, maximumX, maximumY};
+  std::size_t variableBox[4] = {minimumX, minimumY, maximumX, maximumY};
+  int children[2] = {-1, -1};
+  if(!isLeaf && maximumX - minimumX >= maximumY - minimumY)
+  {
+    const std::size_t interfaceX = (minimumX + maximumX) / 2;
+    variableBox[0] = interfaceX;
+    variableBox[2] = interfaceX + 1;
+    children[0] = Partition(minimumX, minimumY, interfaceX, maximumY, subdomainId, level + 1);
+    children[1] = Partition(interfaceX + 1, minimumY, maximumX, maximumY, subdomainId, level + 1);
+  }
+  else if(!isLeaf)
+  {
+    const std::size_t interfaceY = (minimumY + maximumY) / 2;
+    variableBox[1] = interfaceY;
+    variableBox[3] = interfaceY + 1;
+    children[0] = Partition(minimumX, minimumY, maximumX, interfaceY, subdomainId, level + 1);
+    children[1] = Partition(minimumX, interfaceY + 1, maximumX, maximumY, subdomainId, level + 1);
+  }
+
+  // The recursion may have moved the subdomains
+  Subdomain& subdomain = this->Subdomains[subdomainId];
+  subdomain.Parent = parent;
+  subdomain.Children[0] = children[0];
+  subdomain.Children[1] = children[1];
+  std::copy(box, box + 4, subdomain.Box);
+  std::copy(variableBox, variableBox + 4, subdomain.VariableBox);
+
+  return subdomainId;
+}
+
+inline void DomainDecompositionSolver::ComputeFrontPositions(const Elimination& elimination,
+                                                             const std::vector<int>& pixels,
+                                                             std::vector<int>& positions)
+{
+  positions.resize(pixels.size());
+  for(std::size_t pixel = 0; pixel < pixels.size(); ++pixel)
+  {
+    std::vector<int>::const_iterator position =
+        std::lower_bound(elimination.Variables.begin(), elimination.Variables.end(), pixels[pixel]);
+    if(position != elimination.Variables.end() && *position == pixels[pixel])
+    {
+      positions[pixel] = static_cast<int>(position - elimination.Variables.begin());
+      continue;
+    }
+
+    position = std::lower_bound(elimination.Boundary.begin(), elimination.Boundary.end(), pixels[pixel]);
+    if(position != elimination.Boundary.end() && *position == pixels[pixel])
+    {
+      positions[pixel] = static_cast<int>(elimination.Variables.size() + (position - elimination.Boundary.begin()));
+      continue;
+    }
+
+    positions[pixel] = -1;
+  }
+}
+
+inline void DomainDecompositionSolver::Eliminate(const int subdomainId)
+{
+  const Subdomain& subdomain = this->Subdomains[subdomainId];
+  const std::vector<int>& ids = this->Ids;
+  const std::size_t width = this->Region.GetSize()[0];
+  const std::size_t height = this->Region.GetSize()[1];
+  const std::size_t minimumX = subdomain.Box[0];
+  const std::size_t minimumY = subdomain.Box[1];
+  const std::size_t maximumX = subdomain.Box[2];
+  const std::size_t maximumY = subdomain.Box[3];
+
+  std::shared_ptr<Elimination> elimination = std::make_shared<Elimination>();
+
+  // Offsets in the id buffer are in raster order, so the variables come out sorted
+  for(std::size_t y = subdomain.VariableBox[1]; y < subdomain.VariableBox[3]; ++y)
+  {
+    for(std::size_t x = subdomain.VariableBox[0]; x < subdomain.VariableBox[2]; ++x)
+    {
+      if(ids[y * width + x] >= 0)
+      {
+        elimination->Variables.push_back(static_cast<int>(y * width + x));
+      }
+    }
+  }
+
+  // The boundary is made of the hole pixels just outside of the box. Those are on the interfaces of
+  // the ancestors of this subdomain.
+  std::vector<int>& boundary = elimination->Boundary;
+  for(std::size_t x = minimumX; x < maximumX; ++x)
+  {
+    if(minimumY > 0 && ids[minimumY * width + x] >= 0 && ids[(minimumY - 1) * width + x] >= 0)
+    {
+      boundary.push_back(static_cast<int>((minimumY - 1) * width + x));
+    }
+    if(maximumY < height && ids[(maximumY - 1) * width + x] >= 0 && ids[maximumY * width + x] >= 0)
+    {
+      boundary.push_back(static_cast<int>(maximumY * width + x));
+    }
+  }
+  for(std::size_t y = minimumY; y < maximumY; ++y)
+  {
+    if(minimumX > 0 && ids[y * width + minimumX] >= 0 && ids[y * width + minimumX - 1] >= 0)
+    {
+      boundary.push_back(static_cast<int>(y * width + minimumX - 1));
+    }
+    if(maximumX < width && ids[y * width + maximumX - 1] >= 0 && ids[y * width + maximumX] >= 0)
+    {
+      boundary.push_back(static_cast<int>(y * width + maximumX));
+    }
+  }
+  std::sort(boundary.begin(), boundary.end());
+  boundary.erase(std::unique(boundary.begin(), boundary.end()), boundary.end());
+
+  const std::size_t numberOfVariables = elimination->Variables.size();
+  const std::size_t numberOfBoundaryVariables = boundary.size();
+
+  // The front holds the block of the variables and their boundary (only the lower triangle is used)
+  Eigen::MatrixXd front = Eigen::MatrixXd::Zero(numberOfVariables + numberOfBoundaryVariables,
+                                                numberOfVariables + numberOfBoundaryVariables);
+
+  // The entries of -A between the variables, and between the variables and the boundary. The entries
+  // with the variables of the children were already assembled in the children.
+  std::vector<int> neighbors(4);
+  std::vector<int> neighborPositions;
+  for(std::size_t variable = 0; variable < numberOfVariables; ++variable)
+  {
+    front(variable, variable) = 4.0;
+
+    const std::size_t offset = elimination->Variables[variable];
+    const std::size_t x = offset % width;
+    const std::size_t y = offset / width;
+    neighbors[0] = y > 0 && ids[offset - width] >= 0 ? static_cast<int>(offset - width) : -1;
+    neighbors[1] = x > 0 && ids[offset - 1] >= 0 ? static_cast<int>(offset - 1) : -1;
+    neighbors[2] = x + 1 < width && ids[offset + 1] >= 0 ? static_cast<int>(offset + 1) : -1;
+    neighbors[3] = y + 1 < height && ids[offset + width] >= 0 ? static_cast<int>(offset + width) : -1;
+    ComputeFrontPositions(*elimination, neighbors, neighborPositions);
+    for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+    {
+      const int position = neighborPositions[neighbor];
+      if(neighbors[neighbor] >= 0 && position >= 0)
+      {
+        front(std::max<int>(variable, position), std::min<int>(variable, position)) = -1.0;
+      }
+    }
+  }
+
+  // Add the Schur complements of the children
+  std::vector<int> positions;
+  for(unsigned int child = 0; child < 2; ++child)
+  {
+    const int childId = subdomain.Children[child];
+    if(childId < 0)
+    {
+      continue;
+    }
+
+    Elimination& childElimination = *this->Subdomains[childId].Eliminated;
+    ComputeFrontPositions(*elimination, childElimination.Boundary, positions);
+    const Eigen::MatrixXd& update = childElimination.SchurComplement;
+    for(std::size_t column = 0; column < positions.size(); ++column)
+    {
+      for(std::size_t row = column; row < positions.size(); ++row)
+      {
+        front(std::max(positions[row], positions[column]), std::min(positions[row], positions[column])) +=
+            update(row, column);
+      }
+    }
+
+    if(!this->Updatable)
+    {
+      childElimination.SchurComplement.resize(0, 0);
+    }
+  }
+
+  // Factorize the block of the variables
+  Eigen::LLT<Eigen::MatrixXd> llt(front.topLeftCorner(numberOfVariables, numberOfVariables));
+  if(llt.info() != Eigen::Success)
+  {
+    throw std::runtime_error("Decomposition failed!");
+  }
+  elimination->Factor = llt.matrixLLT();
+
+  // Eliminate the variables from the boundary: Coupling = L^-1 F_VU and S = F_UU - Coupling^T Coupling.
+  // The columns are split over the threads (this only runs in parallel for the large subdomains at
+  // the top of the tree, which are eliminated one at a time).
+  const std::size_t blockSize = 64;
+  const std::size_t numberOfBlocks = (numberOfBoundaryVariables + blockSize - 1) / blockSize;
+
+  Eigen::MatrixXd& coupling = elimination->Coupling;
+  coupling = front.bottomLeftCorner(numberOfBoundaryVariables, numberOfVariables).transpose();
+  ParallelHelpers::ParallelForDynamic(numberOfBlocks, [&](const std::size_t block)
+  {
+    const std::size_t begin = block * blockSize;
+    const std::size_t size = std::min(blockSize, numberOfBoundaryVariables - begin);
+    elimination->Factor.triangularView<Eigen::Lower>().solveInPlace(coupling.middleCols(begin, size));
+  });
+
+  Eigen::MatrixXd& update = elimination->SchurComplement;
+  update = front.bottomRightCorner(numberOfBoundaryVariables, numberOfBoundaryVariables);
+  ParallelHelpers::ParallelForDynamic(numberOfBlocks, [&](const std::size_t block)
+  {
+    // Only the lower triangle is needed, so each block of columns starts at the diagonal
+    const std::size_t begin = block * blockSize;
+    const std::size_t size = std::min(blockSize, numberOfBoundaryVariables - begin);
+    update.block(begin, begin, numberOfBoundaryVariables - begin, size).noalias() -=
+        coupling.rightCols(numberOfBoundaryVariables - begin).transpose() * coupling.middleCols(begin, size);
+  });
+
+  // Replace (rather than change) the previous elimination, which copies of the solver may still use
+  this->Subdomains[subdomainId].Eliminated = elimination;
+}
+
+template <typename TFunction>
+void DomainDecompositionSolver::ForEachSubdomain(const std::vector<int>& subdomainIds, TFunction function)
+{
+  if(subdomainIds.size() >= ParallelHelpers::GetNumberOfThreads())
+  {
+    ParallelHelpers::ParallelForDynamic(subdomainIds.size(), [&](const std::size_t item)
+    {
+      function(subdomainIds[item]);
+    });
+  }
+  else
+  {
+    // Too few subdomains to keep the threads busy, so each one splits its own work over the threads
+    for(std::size_t item = 0; item < subdomainIds.size(); ++item)
+    {
+      function(subdomainIds[item]);
+    }
+  }
+}
+
+inline void DomainDecompositionSolver::Solve(const Eigen::MatrixXd& B, Eigen::MatrixXd& X)
+{
+  const std::size_t numberOfColumns = B.cols();
+  const std::vector<int>& ids = this->Ids;
+
+  // Solve -A X = -B. X first holds the right hand side, then the forward substitution, then the solution.
+  X = -B;
+
+  // Substitute forward from the leaves to the root. Like the Schur complements, the updates of the
+  // right hand side are passed on to the parents.
+  std::vector<Eigen::MatrixXd> updates(this->Subdomains.size());
+  for(std::size_t level = this->Levels.size(); level-- > 0;)
+  {
+    ForEachSubdomain(this->Levels[level], [&](const int subdomainId)
+    {
+      const Subdomain& subdomain = this->Subdomains[subdomainId];
+      const Elimination& elimination = *subdomain.Eliminated;
+      const std::size_t numberOfVariables = elimination.Variables.size();
+
+      Eigen::MatrixXd front = Eigen::MatrixXd::Zero(numberOfVariables + elimination.Boundary.size(), numberOfColumns);
+      for(std::size_t variable = 0; variable < numberOfVariables; ++variable)
+      {
+        front.row(variable) = X.row(ids[elimination.Variables[variable]]);
+      }
+
+      std::vector<int> positions;
+      for(unsigned int child = 0; child < 2; ++child)
+      {
+        const int childId = subdomain.Children[child];
+        if(childId < 0)
+        {
+          continue;
+        }
+
+        ComputeFrontPositions(elimination, this->Subdomains[childId].Eliminated->Boundary, positions);
+        for(std::size_t row = 0; row < positions.size(); ++row)
+        {
+          front.row(positions[row]) += updates[childId].row(row);
+        }
+        updates[childId].resize(0, 0);
+      }
+
+      elimination.Factor.triangularView<Eigen::Lower>().solveInPlace(front.topRows(numberOfVariables));
+      for(std::size_t variable = 0; variable < numberOfVariables; ++variable)
+      {
+        X.row(ids[elimination.Variables[variable]]) = front.row(variable);
+      }
+
+      updates[subdomainId] = front.bottomRows(elimination.Boundary.size()) -
+                             elimination.Coupling.transpose() * front.topRows(numberOfVariables);
+    });
+  }
+
+  // Substitute backward from the root to the leaves. The boundary of each subdomain was solved for
+  // by its ancestors.
+  for(std::size_t level = 0; level < this->Levels.size(); ++level)
+  {
+    ForEachSubdomain(this->Levels[level], [&](const int subdomainId)
+    {
+      const Elimination& elimination = *this->Subdomains[subdomainId].Eliminated;
+      const std::size_t numberOfVariables = elimination.Variables.size();
+
+      Eigen::MatrixXd boundaryValues(elimination.Boundary.size(), numberOfColumns);
+      for(std::size_t variable = 0; variable < elimination.Boundary.size(); ++variable)
+      {
+        boundaryValues.row(variable) = X.row(ids[elimination.Boundary[variable]]);
+      }
+
+      Eigen::MatrixXd values(numberOfVariables, numberOfColumns);
+      for(std::size_t variable = 0; variable < numberOfVariables; ++variable)
+      {
+        values.row(variable) = X.row(ids[elimination.Variables[variable]]);
+      }
+      values.noalias() -= elimination.Coupling * boundaryValues;
+      elimination.Factor.triangularView<Eigen::Lower>().transpose().solveInPlace(values);
+
+      for(std::size_t variable = 0; variable < numberOfVariables; ++variable)
+      {
+        X.row(ids[elimination.Variables[variable]]) = values.row(variable);
+      }
+    });
+  }
+
+  // Check the result with the stencil
+  const std::size_t width = this->Region.GetSize()[0];
+  const std::size_t height = this->Region.GetSize()[1];
+  this->RelativeResidual = 0.0;
+  for(std::size_t column = 0; column < numberOfColumns; ++column)
+  {
+    double residualNorm = 0.0;
+    for(std::size_t offset = 0; offset < ids.size(); ++offset)
+    {
+      const int variableId = ids[offset];
+      if(variableId < 0)
+      {
+        continue;
+      }
+
+      const std::size_t x = offset % width;
+      const std::size_t y = offset / width;
+      const bool hasNeighbor[4] = {y > 0, x > 0, x + 1 < width, y + 1 < height};
+      const std::size_t neighborOffsets[4] = {offset - width, offset - 1, offset + 1, offset + width};
+      double stencilSum = -4.0 * X(variableId, column);
+      for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+      {
+        if(hasNeighbor[neighbor] && ids[neighborOffsets[neighbor]] >= 0)
+        {
+          stencilSum += X(ids[neighborOffsets[neighbor]], column);
+        }
+      }
+      residualNorm += (B(variableId, column) - stencilSum) * (B(variableId, column) - stencilSum);
+    }
+
+    if(B.col(column).norm() > 0.0)
+    {
+      this->RelativeResidual = std::max(this->RelativeResidual, std::sqrt(residualNorm) / B.col(column).norm());
+    }
+  }
+}
+
+inline double DomainDecompositionSolver::GetRelativeResidual() const
+{
+  return this->RelativeResidual;
+}
+
+inline std::size_t DomainDecompositionSolver::GetNumberOfSubdomains() const
+{
+  return this->Subdomains.size();
+}
+
+inline std::size_t DomainDecompositionSolver::GetNumberOfEliminatedSubdomains() const
+{
+  return this->NumberOfEliminatedSubdomains;
+}
+
+#endif
@@ -38,7 +38,7 @@ int main(int argc, char* argv[])
   // Verify arguments
   if(argc < 5)
   {
-    std::cout << "Usage: ./PoissonClone TargetImage SourceImage SourceImageMask OutputImage" << std::endl;
+    std::cout << "Usage: ./PoissonClone TargetImage SourceImage SourceImageMask OutputImage [solver (ldlt, mixed, dd, multigrid or cg), mvc (mean-value coordinates, no solver) or mixedgradients (with ldlt)]" << std::endl;
     std::cout << "argc = " << argc << std::endl;
     std::cout << "Provided arguments were: ";
     for(int i = 1; i < argc; ++i)
@@ -54,11 +54,37 @@ int main(int argc, char* argv[])
   std::string sourceImageMaskFilename = argv[3];
   std::string outputFilename = argv[4];
 
+  std::string solverName = "ldlt";
+  if(argc >= 6)
+  {
+    solverName = argv[5];
+  }
+
   // Output arguments
   std::cout << "Target image: " << targetImageFilename << std::endl
             << "Source image: " << sourceImageFilename << std::endl
             << "Source image mask: " << sourceImageMaskFilename << std::endl
-            << "Output image: " << outputFilename << std::endl;
+            << "Output image: " << outputFilename << std::endl
+            << "Solver: " << solverName << std::endl;
+
+  if(solverName == "mvc")
+  {
+    PoissonEditingParent::SetGlobalDefaultFillMethod(PoissonEditingParent::FillMethodEnum::MEAN_VALUE_COORDINATES);
+  }
+  else if(solverName == "mixedgradients")
+  {
+    PoissonEditingParent::SetGlobalDefaultFillMethod(PoissonEditingParent::FillMethodEnum::MIXED_GRADIENTS);
+  }
+  else
+  {
+    PoissonEditingParent::SetGlobalDefaultSolver(PoissonEditingParent::GetSolverFromName(solverName));
+  }
+
+  // PNG output is rounded to integers, so the iterative solvers can stop once no rounded pixel can change
+  if(Helpers::GetFileExtension(outputFilename) == "png")
+  {
+    PoissonEditingParent::SetGlobalDefaultQuantizationStep(1.0);
+  }
 
 //  typedef itk::VectorImage<float, 2> ImageType;
   typedef itk::Image<itk::CovariantVector<float, 3>, 2> ImageType;
@@ -97,13 +123,26 @@ int main(int argc, char* argv[])
 
   typedef PoissonEditingParent::GuidanceFieldType GuidanceFieldType;
 
-  std::vector<GuidanceFieldType::Pointer> guidanceFields =
-      PoissonEditingParent::ComputeGuidanceField(sourceImageReader->GetOutput());
-
   ImageType::Pointer output = ImageType::New();
 
+  // Mean-value coordinates interpolate from the source image itself rather than from its gradients,
+  // and mixed gradients compare its differences with those of the target, so neither needs the
+  // gradients of the source (null guidance fields)
+  const ImageType* sourceImage = nullptr;
+  std::vector<GuidanceFieldType::Pointer> guidanceFields(sourceImageReader->GetOutput()->GetNumberOfComponentsPerPixel());
+  const PoissonEditingParent::FillMethodEnum fillMethod = PoissonEditingParent::GetGlobalDefaultFillMethod();
+  if(fillMethod == PoissonEditingParent::FillMethodEnum::MEAN_VALUE_COORDINATES ||
+     fillMethod == PoissonEditingParent::FillMethodEnum::MIXED_GRADIENTS)
+  {
+    sourceImage = sourceImageReader->GetOutput();
+  }
+  else
+  {
+    guidanceFields = PoissonEditingParent::ComputeGuidanceField(sourceImageReader->GetOutput());
+  }
+
   FillImage(targetImageReader->GetOutput(), mask,
-            guidanceFields, output.GetPointer(), regionToProcess);
+            guidanceFields, output.GetPointer(), regionToProcess, sourceImage);
 
   // Make sure the output is in the valid pixel value range
   ITKHelpers::ClampAllChannelsTo255(output.GetPointer());
@@ -111,6 +150,7 @@ int main(int argc, char* argv[])
   // Write output
   if(Helpers::GetFileExtension(outputFilename) == "png")
   {
+    QuantizeToUnsignedChar(output.GetPointer());
     ITKHelpers::WriteRGBImage(output.GetPointer(), outputFilename);
   }
   else
@@ -21,6 +21,7 @@
 
 // STL
 #include <iostream>
+#include <sstream>
 
 // ITK
 #include "itkImage.h"
@@ -35,7 +36,7 @@ int main(int argc, char* argv[])
   // Verify arguments
   if(argc < 4)
   {
-    std::cout << "Usage: ImageToFill mask outputImage" << std::endl;
+    std::cout << "Usage: ImageToFill mask outputImage [solver (ldlt, mixed, dd, multigrid or cg)] [memoryBudgetInMB]" << std::endl;
     return EXIT_FAILURE;
   }
 
@@ -44,10 +45,36 @@ int main(int argc, char* argv[])
   std::string maskFilename = argv[2];
   std::string outputFilename = argv[3];
 
+  std::string solverName = "ldlt";
+  if(argc >= 5)
+  {
+    solverName = argv[4];
+  }
+
+  // Images that need more working memory than this are filled tile by tile (0 means no limit)
+  std::size_t memoryBudgetInMB = 0;
+  if(argc >= 6)
+  {
+    std::stringstream ssMemoryBudget;
+    ssMemoryBudget << argv[5];
+    ssMemoryBudget >> memoryBudgetInMB;
+  }
+
   // Output arguments
   std::cout << "Target image: " << targetImageFilename << std::endl
             << "Mask image: " << maskFilename << std::endl
-            << "Output image: " << outputFilename << std::endl;
+            << "Output image: " << outputFilename << std::endl
+            << "Solver: " << solverName << std::endl
+            << "Memory budget (MB): " << memoryBudgetInMB << std::endl;
+
+  PoissonEditingParent::SetGlobalDefaultSolver(PoissonEditingParent::GetSolverFromName(solverName));
+  PoissonEditingParent::SetGlobalMemoryBudget(memoryBudgetInMB * 1024 * 1024);
+
+  // PNG output is rounded to integers, so the iterative solvers can stop once no rounded pixel can change
+  if(Helpers::GetFileExtension(outputFilename) == "png")
+  {
+    PoissonEditingParent::SetGlobalDefaultQuantizationStep(1.0);
+  }
 
   typedef itk::VectorImage<float, 2> ImageType;
 
@@ -65,18 +92,28 @@ int main(int argc, char* argv[])
 
   std::cout << "Read mask." << std::endl;
 
-  PoissonEditing<float>::GuidanceFieldType::Pointer zeroGuidanceField =
-      PoissonEditing<float>::CreateZeroGuidanceField(targetImageReader->GetOutput());
-
   ImageType::Pointer output = ImageType::New();
 
+  // A null guidance field is zero, and is never allocated
+  PoissonEditingParent::FillStatistics statistics;
   FillImage(targetImageReader->GetOutput(), mask,
-            zeroGuidanceField.GetPointer(), output.GetPointer(),
-            targetImageReader->GetOutput()->GetLargestPossibleRegion());
+            static_cast<const PoissonEditingParent::GuidanceFieldType*>(nullptr), output.GetPointer(),
+            targetImageReader->GetOutput()->GetLargestPossibleRegion(),
+            static_cast<const ImageType*>(nullptr), &statistics);
+
+  std::cout << "Unknowns: " << statistics.NumberOfUnknowns << ", nonzeros: " << statistics.NumberOfNonZeros
+            << ", boundary pixels: " << statistics.NumberOfBoundaryPixels << ", fill-in: " << statistics.FillIn << std::endl
+            << "Times (s): mask scan " << statistics.MaskScanTime << ", copy-in " << statistics.CopyInTime
+            << ", Laplacian " << statistics.LaplacianTime
+            << ", assembly " << statistics.AssemblyTime << ", factorization " << statistics.FactorizationTime
+            << ", solve " << statistics.SolveTime << ", write-back " << statistics.WriteBackTime << std::endl
+            << "Iterations: " << statistics.NumberOfIterations << ", relative residual " << statistics.RelativeResidual
+            << std::endl;
 
   // Write output
   if(Helpers::GetFileExtension(outputFilename) == "png")
   {
+    QuantizeToUnsignedChar(output.GetPointer());
     ITKHelpers::WriteRGBImage(output.GetPointer(), outputFilename);
   }
   else
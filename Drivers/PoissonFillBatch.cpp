@@ -0,0 +1,166 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PoissonBatchFilling.h"
+#include "PoissonEditing.h"
+#include "PoissonEditingWrappers.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkVectorImage.h"
+
+/** Fill the same hole in many images. The images are listed after the other arguments, or read from
+  * the standard input (one filename per line) if there are none, for example:
+  * find frames -name "*.png" | PoissonFillBatch mask.png filled ldlt 8
+  * Each output is written to outputDirectory with the filename of its image. */
+int main(int argc, char* argv[])
+{
+  // Verify arguments
+  if(argc < 3)
+  {
+    std::cout << "Usage: PoissonFillBatch mask outputDirectory [solver (ldlt, mixed, dd, multigrid or cg)] [batchSize] [image ...]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Parse arguments
+  std::string maskFilename = argv[1];
+  std::string outputDirectory = argv[2];
+
+  std::string solverName = "ldlt";
+  if(argc >= 4)
+  {
+    solverName = argv[3];
+  }
+
+  // The number of images whose channels are solved together
+  unsigned int batchSize = 1;
+  if(argc >= 5)
+  {
+    std::stringstream ssBatchSize;
+    ssBatchSize << argv[4];
+    ssBatchSize >> batchSize;
+    batchSize = std::max(batchSize, 1u);
+  }
+
+  std::vector<std::string> imageFilenames(argv + std::min(argc, 5), argv + argc);
+  if(imageFilenames.empty())
+  {
+    std::string line;
+    while(std::getline(std::cin, line))
+    {
+      if(!line.empty())
+      {
+        imageFilenames.push_back(line);
+      }
+    }
+  }
+
+  // Output arguments
+  std::cout << "Mask image: " << maskFilename << std::endl
+            << "Output directory: " << outputDirectory << std::endl
+            << "Solver: " << solverName << std::endl
+            << "Batch size: " << batchSize << std::endl
+            << "Number of images: " << imageFilenames.size() << std::endl;
+
+  if(imageFilenames.empty())
+  {
+    std::cout << "No images to fill." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  PoissonEditingParent::SetGlobalDefaultSolver(PoissonEditingParent::GetSolverFromName(solverName));
+
+  typedef itk::VectorImage<float, 2> ImageType;
+
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+  // Read the mask and prepare its solver once for all of the images
+  Mask::Pointer mask = Mask::New();
+  mask->Read(maskFilename);
+
+  PoissonBatchFilling<ImageType> batchFilling;
+  batchFilling.SetBatchSize(batchSize);
+
+  double fillTime = 0.0;
+  for(std::size_t begin = 0; begin < imageFilenames.size(); begin += batchSize)
+  {
+    const std::size_t end = std::min<std::size_t>(begin + batchSize, imageFilenames.size());
+
+    // Read images
+    std::vector<ImageType::Pointer> images;
+    for(std::size_t image = begin; image < end; ++image)
+    {
+      typedef itk::ImageFileReader<ImageType> ImageReaderType;
+      ImageReaderType::Pointer imageReader = ImageReaderType::New();
+      imageReader->SetFileName(imageFilenames[image]);
+      imageReader->Update();
+      images.push_back(imageReader->GetOutput());
+    }
+
+    // PNG output is rounded to integers, so the iterative solvers can stop once no rounded pixel can change
+    if(begin == 0)
+    {
+      if(Helpers::GetFileExtension(imageFilenames[0]) == "png")
+      {
+        PoissonEditingParent::SetGlobalDefaultQuantizationStep(1.0);
+      }
+
+      batchFilling.SetMask(mask);
+    }
+
+    // Fill the images in place
+    std::vector<const ImageType*> targetImages(images.begin(), images.end());
+    std::vector<ImageType*> outputs(images.begin(), images.end());
+    std::chrono::high_resolution_clock::time_point fillStart = std::chrono::high_resolution_clock::now();
+    batchFilling.Fill(targetImages, outputs);
+    fillTime += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - fillStart).count();
+
+    // Write outputs
+    for(std::size_t image = begin; image < end; ++image)
+    {
+      const std::string& imageFilename = imageFilenames[image];
+      const std::string outputFilename = outputDirectory + "/" + imageFilename.substr(imageFilename.find_last_of("/\\") + 1);
+      if(Helpers::GetFileExtension(outputFilename) == "png")
+      {
+        QuantizeToUnsignedChar(images[image - begin].GetPointer());
+        ITKHelpers::WriteRGBImage(images[image - begin].GetPointer(), outputFilename);
+      }
+      else
+      {
+        ITKHelpers::WriteImage(images[image - begin].GetPointer(), outputFilename);
+      }
+    }
+  }
+
+  const double totalTime =
+      std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  const std::size_t numberOfImages = batchFilling.GetNumberOfFilledImages();
+  std::cout << "Filled " << numberOfImages << " images in " << totalTime << " s: "
+            << numberOfImages / totalTime << " images/s (" << numberOfImages / fillTime
+            << " images/s without reading and writing)." << std::endl;
+
+  return EXIT_SUCCESS;
+}
@@ -102,6 +102,7 @@ int main(int argc, char* argv[])
   // Write output
   if(pixelType == itk::ImageIOBase::UCHAR)
   {
+    QuantizeToUnsignedChar(output.GetPointer());
     ITKHelpers::WriteRGBImage(output.GetPointer(), outputFilename);
   }
   else
@@ -0,0 +1,392 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ParallelHelpers.h"
+#include "PoissonEditing.h"
+#include "PoissonEditingWrappers.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// STL
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkImageIOFactory.h"
+#include "itkVectorImage.h"
+
+typedef itk::VectorImage<float, 2> ImageType;
+typedef PoissonEditingParent::GuidanceFieldType GuidanceFieldType;
+
+/** A line of the manifest, and the images that the stages pass along. */
+struct Job
+{
+  std::size_t Line = 0;
+
+  /** "fill", "clone" or "guidance". */
+  std::string Kind;
+
+  /** The input files (in the order of the manifest), then the output file. */
+  std::vector<std::string> Filenames;
+
+  ImageType::Pointer TargetImage;
+  ImageType::Pointer SourceImage;
+  Mask::Pointer MaskImage;
+  GuidanceFieldType::Pointer GuidanceField;
+  ImageType::Pointer Output;
+};
+
+typedef ParallelHelpers::BoundedQueue<std::unique_ptr<Job> > JobQueue;
+
+/** The time that the threads of a stage spent waiting for a job, working on jobs, and waiting for
+  * room in the queue of the next stage (summed over the threads). */
+struct StageTimes
+{
+  double Waiting = 0.0;
+  double Busy = 0.0;
+  double Blocked = 0.0;
+  std::size_t NumberOfJobs = 0;
+  std::size_t NumberOfFailures = 0;
+};
+
+static double Seconds(const std::chrono::high_resolution_clock::time_point& start,
+                      const std::chrono::high_resolution_clock::time_point& end)
+{
+  return std::chrono::duration<double>(end - start).count();
+}
+
+/** Start 'numberOfThreads' threads that pop the jobs of 'input', call process(job) on each and push
+  * it to 'output' (if there is one). A job that throws is reported and dropped. If 'serialInside' is
+  * set, the parallel loops inside of process() run serially, as the threads of the stage already
+  * keep the cores busy. */
+template <typename TProcess>
+static void StartStage(const unsigned int numberOfThreads, const bool serialInside, JobQueue& input,
+                       JobQueue* const output, TProcess process, StageTimes& times, std::mutex& timesMutex,
+                       std::vector<std::thread>& threads)
+{
+  for(unsigned int thread = 0; thread < numberOfThreads; ++thread)
+  {
+    threads.push_back(std::thread([=, &input, &times, &timesMutex]()
+    {
+      ParallelHelpers::InParallelRegion() = serialInside;
+
+      StageTimes threadTimes;
+      std::unique_ptr<Job> job;
+      std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+      while(input.Pop(job))
+      {
+        const std::chrono::high_resolution_clock::time_point popped = std::chrono::high_resolution_clock::now();
+        threadTimes.Waiting += Seconds(start, popped);
+
+        bool succeeded = true;
+        try
+        {
+          process(*job);
+        }
+        catch(const std::exception& exception)
+        {
+          std::cerr << "Line " << job->Line << " of the manifest failed: " << exception.what() << std::endl;
+          succeeded = false;
+        }
+
+        const std::chrono::high_resolution_clock::time_point processed = std::chrono::high_resolution_clock::now();
+        threadTimes.Busy += Seconds(popped, processed);
+        ++threadTimes.NumberOfJobs;
+
+        if(!succeeded)
+        {
+          ++threadTimes.NumberOfFailures;
+        }
+        else if(output)
+        {
+          output->Push(std::move(job));
+        }
+
+        start = std::chrono::high_resolution_clock::now();
+        threadTimes.Blocked += Seconds(processed, start);
+      }
+      threadTimes.Waiting += Seconds(start, std::chrono::high_resolution_clock::now());
+
+      std::lock_guard<std::mutex> lock(timesMutex);
+      times.Waiting += threadTimes.Waiting;
+      times.Busy += threadTimes.Busy;
+      times.Blocked += threadTimes.Blocked;
+      times.NumberOfJobs += threadTimes.NumberOfJobs;
+      times.NumberOfFailures += threadTimes.NumberOfFailures;
+    }));
+  }
+}
+
+template <typename TImage>
+static typename TImage::Pointer ReadImage(const std::string& filename)
+{
+  typedef itk::ImageFileReader<TImage> ImageReaderType;
+  typename ImageReaderType::Pointer imageReader = ImageReaderType::New();
+  imageReader->SetFileName(filename);
+  imageReader->Update();
+  return imageReader->GetOutput();
+}
+
+/** Run the jobs of a manifest through a pipeline of three pools of threads: the readers decode the
+  * inputs, the solvers fill the holes and the writers encode the outputs. The pools are connected
+  * by bounded queues, so a fast stage waits for a slow one instead of piling up decoded images. Each
+  * line of the manifest is a job (empty lines and lines that start with # are skipped):
+  *
+  * fill image mask output
+  * clone targetImage sourceImage sourceImageMask output
+  * guidance image mask guidanceField output
+  *
+  * These do what PoissonFill, PoissonClone and PoissonFillWithGuidance do. Masks that are used by
+  * several jobs are only read once. At the end, the time that each stage spent working, waiting for
+  * input and waiting for room in the next queue is reported, to size the pools. */
+int main(int argc, char* argv[])
+{
+  // Verify arguments
+  if(argc < 2)
+  {
+    std::cout << "Usage: PoissonPipeline manifest [solver (ldlt, mixed, dd, multigrid or cg)] "
+              << "[numberOfReaders] [numberOfSolvers] [numberOfWriters] [queueCapacity]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Parse arguments
+  std::string manifestFilename = argv[1];
+
+  std::string solverName = "ldlt";
+  if(argc >= 3)
+  {
+    solverName = argv[2];
+  }
+
+  unsigned int numberOfThreads[3] = {2, 1, 2};
+  for(int stage = 0; stage < 3 && stage + 3 < argc; ++stage)
+  {
+    std::stringstream ssNumberOfThreads;
+    ssNumberOfThreads << argv[stage + 3];
+    ssNumberOfThreads >> numberOfThreads[stage];
+    numberOfThreads[stage] = std::max(numberOfThreads[stage], 1u);
+  }
+
+  std::size_t queueCapacity = 4;
+  if(argc >= 7)
+  {
+    std::stringstream ssQueueCapacity;
+    ssQueueCapacity << argv[6];
+    ssQueueCapacity >> queueCapacity;
+  }
+
+  // Read the manifest
+  std::ifstream manifest(manifestFilename.c_str());
+  if(!manifest)
+  {
+    throw std::runtime_error("Could not open the manifest " + manifestFilename);
+  }
+
+  std::vector<std::unique_ptr<Job> > jobs;
+  bool allOutputsArePNG = true;
+  std::string line;
+  for(std::size_t lineNumber = 1; std::getline(manifest, line); ++lineNumber)
+  {
+    std::unique_ptr<Job> job(new Job);
+    job->Line = lineNumber;
+    std::stringstream ssLine(line);
+    if(!(ssLine >> job->Kind) || job->Kind[0] == '#')
+    {
+      continue;
+    }
+
+    std::string filename;
+    while(ssLine >> filename)
+    {
+      job->Filenames.push_back(filename);
+    }
+
+    const std::size_t numberOfFilenames = job->Kind == "fill" ? 3 : 4;
+    if((job->Kind != "fill" && job->Kind != "clone" && job->Kind != "guidance") ||
+       job->Filenames.size() != numberOfFilenames)
+    {
+      std::stringstream ss;
+      ss << "Line " << lineNumber << " of the manifest is not a fill, clone or guidance job!";
+      throw std::runtime_error(ss.str());
+    }
+
+    allOutputsArePNG = allOutputsArePNG && Helpers::GetFileExtension(job->Filenames.back()) == "png";
+    jobs.push_back(std::move(job));
+  }
+
+  // Output arguments
+  std::cout << "Manifest: " << manifestFilename << " (" << jobs.size() << " jobs)" << std::endl
+            << "Solver: " << solverName << std::endl
+            << "Readers, solvers, writers: " << numberOfThreads[0] << ", " << numberOfThreads[1] << ", "
+            << numberOfThreads[2] << std::endl
+            << "Queue capacity: " << queueCapacity << std::endl;
+
+  if(jobs.empty())
+  {
+    return EXIT_SUCCESS;
+  }
+
+  PoissonEditingParent::SetGlobalDefaultSolver(PoissonEditingParent::GetSolverFromName(solverName));
+
+  // PNG output is rounded to integers, so the iterative solvers can stop once no rounded pixel can change
+  if(allOutputsArePNG)
+  {
+    PoissonEditingParent::SetGlobalDefaultQuantizationStep(1.0);
+  }
+
+  // Register the image IO factories once, before the readers and the writers look them up concurrently
+  itk::ImageIOFactory::CreateImageIO(jobs[0]->Filenames[0].c_str(), itk::ImageIOFactory::ReadMode);
+
+  JobQueue manifestQueue(jobs.size());
+  for(std::size_t job = 0; job < jobs.size(); ++job)
+  {
+    manifestQueue.Push(std::move(jobs[job]));
+  }
+  manifestQueue.Close();
+
+  JobQueue readQueue(queueCapacity);
+  JobQueue solvedQueue(queueCapacity);
+
+  std::map<std::string, Mask::Pointer> masks;
+  std::mutex masksMutex;
+  auto read = [&](Job& job)
+  {
+    job.TargetImage = ReadImage<ImageType>(job.Filenames[0]);
+
+    const std::string& maskFilename = job.Filenames[job.Kind == "clone" ? 2 : 1];
+    std::lock_guard<std::mutex> lock(masksMutex);
+    Mask::Pointer& mask = masks[maskFilename];
+    if(!mask)
+    {
+      mask = Mask::New();
+      mask->Read(maskFilename);
+    }
+    job.MaskImage = mask;
+
+    if(job.Kind == "clone")
+    {
+      job.SourceImage = ReadImage<ImageType>(job.Filenames[1]);
+    }
+    else if(job.Kind == "guidance")
+    {
+      job.GuidanceField = ReadImage<GuidanceFieldType>(job.Filenames[2]);
+    }
+  };
+
+  auto solve = [&](Job& job)
+  {
+    const ImageType* const targetImage = job.TargetImage.GetPointer();
+    job.Output = ImageType::New();
+    if(job.Kind == "clone")
+    {
+      // The source is pasted at the corner of the target, and its gradients are the guidance fields
+      if(job.SourceImage->GetNumberOfComponentsPerPixel() != targetImage->GetNumberOfComponentsPerPixel())
+      {
+        throw std::runtime_error("The source and target images must have the same number of channels!");
+      }
+
+      FillImage(targetImage, job.MaskImage.GetPointer(), PoissonEditingParent::ComputeGuidanceField(job.SourceImage.GetPointer()),
+                job.Output.GetPointer(), job.SourceImage->GetLargestPossibleRegion(), static_cast<const ImageType*>(nullptr));
+      ITKHelpers::ClampAllChannelsTo255(job.Output.GetPointer());
+    }
+    else
+    {
+      // A fill has zero (null) guidance fields
+      std::vector<GuidanceFieldType::Pointer> guidanceFields(targetImage->GetNumberOfComponentsPerPixel(),
+                                                             job.GuidanceField);
+      FillImage(targetImage, job.MaskImage.GetPointer(), guidanceFields, job.Output.GetPointer(),
+                targetImage->GetLargestPossibleRegion(), static_cast<const ImageType*>(nullptr));
+    }
+
+    // Only the output is needed from here on
+    job.TargetImage = nullptr;
+    job.SourceImage = nullptr;
+    job.MaskImage = nullptr;
+    job.GuidanceField = nullptr;
+  };
+
+  auto write = [&](Job& job)
+  {
+    if(Helpers::GetFileExtension(job.Filenames.back()) == "png")
+    {
+      QuantizeToUnsignedChar(job.Output.GetPointer());
+      ITKHelpers::WriteRGBImage(job.Output.GetPointer(), job.Filenames.back());
+    }
+    else
+    {
+      ITKHelpers::WriteImage(job.Output.GetPointer(), job.Filenames.back());
+    }
+    job.Output = nullptr;
+  };
+
+  // A single solver fills each hole with all of the threads, several solvers fill one hole each
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  StageTimes times[3];
+  std::mutex timesMutex;
+  std::vector<std::thread> stageThreads[3];
+  StartStage(numberOfThreads[0], false, manifestQueue, &readQueue, read, times[0], timesMutex, stageThreads[0]);
+  StartStage(numberOfThreads[1], numberOfThreads[1] > 1, readQueue, &solvedQueue, solve, times[1], timesMutex,
+             stageThreads[1]);
+  StartStage(numberOfThreads[2], false, solvedQueue, nullptr, write, times[2], timesMutex, stageThreads[2]);
+
+  // Each stage ends once the stage before it has ended and its queue is empty
+  JobQueue* const stageOutputs[3] = {&readQueue, &solvedQueue, nullptr};
+  for(unsigned int stage = 0; stage < 3; ++stage)
+  {
+    for(std::size_t thread = 0; thread < stageThreads[stage].size(); ++thread)
+    {
+      stageThreads[stage][thread].join();
+    }
+    if(stageOutputs[stage])
+    {
+      stageOutputs[stage]->Close();
+    }
+  }
+  const double totalTime = Seconds(start, std::chrono::high_resolution_clock::now());
+
+  // Report the utilization of each stage, as fractions of the time of all of its threads
+  const std::size_t numberOfFailures = times[0].NumberOfFailures + times[1].NumberOfFailures + times[2].NumberOfFailures;
+  std::cout << "Processed " << jobs.size() << " jobs (" << numberOfFailures << " failed) in " << totalTime
+            << " s: " << (jobs.size() - numberOfFailures) / totalTime << " jobs/s" << std::endl;
+  std::cout << "Stage   threads  jobs  busy  waiting for input  blocked by next stage" << std::endl;
+  const char* const stageNames[3] = {"read ", "solve", "write"};
+  for(unsigned int stage = 0; stage < 3; ++stage)
+  {
+    const double threadTime = numberOfThreads[stage] * totalTime;
+    std::cout << stageNames[stage] << std::setw(9) << numberOfThreads[stage] << std::setw(6) << times[stage].NumberOfJobs
+              << std::fixed << std::setprecision(0)
+              << std::setw(5) << 100.0 * times[stage].Busy / threadTime << "%"
+              << std::setw(18) << 100.0 * times[stage].Waiting / threadTime << "%"
+              << std::setw(22) << 100.0 * times[stage].Blocked / threadTime << "%" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6);
+  }
+
+  return numberOfFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -151,6 +151,7 @@ int main(int argc, char* argv[])
 
 
   // Write output
+  QuantizeToUnsignedChar(output.GetPointer());
   ITKHelpers::WriteRGBImage(output.GetPointer(), outputFilename);
 
   // Original tiled
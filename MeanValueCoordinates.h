@@ -0,0 +1,109 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef MeanValueCoordinates_H
+#define MeanValueCoordinates_H
+
+#include "VariableIdImage.h"
+
+// ITK
+#include "itkImageRegion.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <vector>
+
+/** This class interpolates values given on the boundary of a hole into the hole with mean-value
+  * coordinates, following "Coordinates for Instant Image Cloning" (Farbman et al., SIGGRAPH 2009).
+  * Seamless cloning adds the interpolation of the difference between the target and the source on the
+  * boundary to the source, which gives nearly the same result as solving the Poisson equation, with
+  * no linear system.
+  *
+  * The boundary of each connected component of the hole is the closed contour of the known pixels
+  * around it (known pixels enclosed by the hole do not constrain the interpolation). The weights
+  * only depend on the shape of the hole, so Compute() is done once and Interpolate() is cheap for
+  * any number of channels and boundary values. Two approximations keep the weights small:
+  * - The boundary is sampled hierarchically: each point uses every vertex of the contour close to it
+  *   and ever coarser (and smoothed) samples further away.
+  * - The weights are only computed exactly at the corners of square blocks of the hole that are far
+  *   enough from the boundary (at least their own size), and the pixels inside such a block are
+  *   interpolated bilinearly. Pixels near the boundary are computed exactly.
+  */
+class MeanValueCoordinates
+{
+public:
+  /** Find the boundaries of the hole numbered in 'variableIds' and compute the weights. */
+  void Compute(const VariableIdImage& variableIds);
+
+  /** Get the pixels of the boundaries, in the same coordinates as the pixels of the hole. Some of
+    * them may be outside of the image that the hole is in. */
+  const std::vector<itk::Index<2> >& GetBoundaryPixels() const;
+
+  /** Interpolate 'boundaryValues' (one row per boundary pixel, one column per channel) into the
+    * hole. Row i of 'X' is the value of the variable with id i. */
+  void Interpolate(const Eigen::MatrixXd& boundaryValues, Eigen::MatrixXd& X) const;
+
+protected:
+
+  /** A closed contour, made of the boundary pixels [Begin, Begin + Size). Its samples are numbered
+    * from SampleBegin, NumberOfLevels per vertex. */
+  struct Contour
+  {
+    std::size_t Begin = 0;
+    std::size_t Size = 0;
+    std::size_t SampleBegin = 0;
+    unsigned int NumberOfLevels = 0;
+  };
+
+  /** Compute the weights of the samples of 'contour' at 'point' (mean-value coordinates of the
+    * adaptively sampled contour), and add them to 'sampleIds' and 'weights'. */
+  void ComputeWeights(const Contour& contour, const double point[2], std::vector<int>& sampleIds,
+                      std::vector<double>& weights) const;
+
+  /** Trace the outer contour of the pixels within one pixel of the hole of 'component', and append
+    * it to BoundaryPixels. */
+  void TraceContour(const VariableIdImage& component);
+
+  /** The blocks larger than this are split, the blocks smaller than this are computed pixel by pixel. */
+  static const unsigned int MaximumBlockSize = 64;
+  static const unsigned int MinimumBlockSize = 8;
+
+  /** A point is compared with the vertices of a contour this many times the spacing of the samples
+    * apart. Closer samples are refined. */
+  static constexpr double RefinementDistance = 2.0;
+
+  std::vector<itk::Index<2> > BoundaryPixels;
+  std::vector<Contour> Contours;
+  std::size_t NumberOfSamples = 0;
+
+  /** The points at which the weights are computed exactly (the nodes), and their weights (in
+    * compressed rows: the samples of node i are [NodeOffsets[i], NodeOffsets[i+1])). */
+  std::vector<std::size_t> NodeOffsets;
+  std::vector<int> NodeSampleIds;
+  std::vector<double> NodeWeights;
+
+  /** The (up to 4) nodes that each variable is interpolated from, and their weights (-1 if unused). */
+  std::vector<int> VariableNodeIds;
+  std::vector<double> VariableNodeWeights;
+};
+
+#include "MeanValueCoordinates.hpp"
+
+#endif
@@ -0,0 +1,435 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef MeanValueCoordinates_HPP
+#define MeanValueCoordinates_HPP
+
+#include "MeanValueCoordinates.h" // Appease syntax parser
+
+#include "ParallelHelpers.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+inline void MeanValueCoordinates::Compute(const VariableIdImage& variableIds)
+{
+  this->BoundaryPixels.clear();
+  this->Contours.clear();
+  this->NumberOfSamples = 0;
+  this->NodeOffsets.assign(1, 0);
+  this->NodeSampleIds.clear();
+  this->NodeWeights.clear();
+  this->VariableNodeIds.assign(4 * variableIds.GetNumberOfVariables(), -1);
+  this->VariableNodeWeights.assign(4 * variableIds.GetNumberOfVariables(), 0.0);
+
+  // Each component is interpolated from its own boundary
+  std::vector<VariableIdImage> components;
+  variableIds.ComputeComponents(components);
+
+  // The points where the weights are computed exactly, and the contour that each of them uses
+  std::vector<itk::Index<2> > nodePixels;
+  std::vector<std::size_t> nodeContours;
+
+  for(std::size_t componentId = 0; componentId < components.size(); ++componentId)
+  {
+    const VariableIdImage& component = components[componentId];
+    TraceContour(component);
+
+    const itk::ImageRegion<2>& region = component.GetRegion();
+    const std::vector<int>& ids = component.GetIds();
+    const std::size_t width = region.GetSize()[0];
+    const std::size_t height = region.GetSize()[1];
+
+    // Count the hole pixels of any rectangle with a summed area table
+    std::vector<std::size_t> summedArea((width + 1) * (height + 1), 0);
+    for(std::size_t y = 0; y < height; ++y)
+    {
+      for(std::size_t x = 0; x < width; ++x)
+      {
+        summedArea[(y + 1) * (width + 1) + x + 1] = summedArea[y * (width + 1) + x + 1] +
+            summedArea[(y + 1) * (width + 1) + x] - summedArea[y * (width + 1) + x] + (ids[y * width + x] >= 0 ? 1 : 0);
+      }
+    }
+
+    // A block is interpolated from its corners if the block, grown by its size on every side, is all hole
+    auto isInterior = [&](const std::size_t x0, const std::size_t y0, const std::size_t blockSize)
+    {
+      if(x0 < blockSize || y0 < blockSize || x0 + 2 * blockSize > width || y0 + 2 * blockSize > height)
+      {
+        return false;
+      }
+      const std::size_t minimumX = x0 - blockSize;
+      const std::size_t minimumY = y0 - blockSize;
+      const std::size_t maximumX = x0 + 2 * blockSize;
+      const std::size_t maximumY = y0 + 2 * blockSize;
+      const std::size_t count = summedArea[maximumY * (width + 1) + maximumX] - summedArea[minimumY * (width + 1) + maximumX] -
+                                summedArea[maximumY * (width + 1) + minimumX] + summedArea[minimumY * (width + 1) + minimumX];
+      return count == 9 * blockSize * blockSize;
+    };
+
+    std::vector<int> nodeOfPixel(ids.size(), -1);
+    auto getNode = [&](const std::size_t x, const std::size_t y)
+    {
+      int& node = nodeOfPixel[y * width + x];
+      if(node < 0)
+      {
+        node = static_cast<int>(nodePixels.size());
+        nodePixels.push_back(component.GetPixel(y * width + x));
+        nodeContours.push_back(this->Contours.size() - 1);
+      }
+      return node;
+    };
+
+    // Split the bounding box into blocks, and the blocks that are too close to the boundary into smaller ones
+    std::vector<std::pair<std::pair<std::size_t, std::size_t>, std::size_t> > blocks;
+    for(std::size_t y0 = 0; y0 < height; y0 += MaximumBlockSize)
+    {
+      for(std::size_t x0 = 0; x0 < width; x0 += MaximumBlockSize)
+      {
+        blocks.push_back(std::make_pair(std::make_pair(x0, y0), static_cast<std::size_t>(MaximumBlockSize)));
+      }
+    }
+
+    while(!blocks.empty())
+    {
+      const std::size_t x0 = blocks.back().first.first;
+      const std::size_t y0 = blocks.back().first.second;
+      const std::size_t blockSize = blocks.back().second;
+      blocks.pop_back();
+      if(x0 >= width || y0 >= height)
+      {
+        continue;
+      }
+
+      if(isInterior(x0, y0, blockSize))
+      {
+        const int corners[4] = {getNode(x0, y0), getNode(x0 + blockSize, y0),
+                                getNode(x0, y0 + blockSize), getNode(x0 + blockSize, y0 + blockSize)};
+        for(std::size_t y = y0; y < y0 + blockSize; ++y)
+        {
+          for(std::size_t x = x0; x < x0 + blockSize; ++x)
+          {
+            const int variableId = variableIds.GetId(component.GetPixel(y * width + x));
+            const double u = static_cast<double>(x - x0) / blockSize;
+            const double v = static_cast<double>(y - y0) / blockSize;
+            const double cornerWeights[4] = {(1.0 - u) * (1.0 - v), u * (1.0 - v), (1.0 - u) * v, u * v};
+            for(unsigned int corner = 0; corner < 4; ++corner)
+            {
+              this->VariableNodeIds[4 * variableId + corner] = corners[corner];
+              this->VariableNodeWeights[4 * variableId + corner] = cornerWeights[corner];
+            }
+          }
+        }
+      }
+      else if(blockSize > MinimumBlockSize)
+      {
+        const std::size_t half = blockSize / 2;
+        blocks.push_back(std::make_pair(std::make_pair(x0, y0), half));
+        blocks.push_back(std::make_pair(std::make_pair(x0 + half, y0), half));
+        blocks.push_back(std::make_pair(std::make_pair(x0, y0 + half), half));
+        blocks.push_back(std::make_pair(std::make_pair(x0 + half, y0 + half), half));
+      }
+      else
+      {
+        for(std::size_t y = y0; y < std::min(y0 + blockSize, height); ++y)
+        {
+          for(std::size_t x = x0; x < std::min(x0 + blockSize, width); ++x)
+          {
+            if(ids[y * width + x] < 0)
+            {
+              continue;
+            }
+            const int variableId = variableIds.GetId(component.GetPixel(y * width + x));
+            this->VariableNodeIds[4 * variableId] = getNode(x, y);
+            this->VariableNodeWeights[4 * variableId] = 1.0;
+          }
+        }
+      }
+    }
+  }
+
+  // The weights of the nodes are independent of each other
+  std::vector<std::vector<int> > sampleIds(nodePixels.size());
+  std::vector<std::vector<double> > weights(nodePixels.size());
+  ParallelHelpers::ParallelFor(nodePixels.size(), [&](const std::size_t node)
+  {
+    const double point[2] = {static_cast<double>(nodePixels[node][0]), static_cast<double>(nodePixels[node][1])};
+    ComputeWeights(this->Contours[nodeContours[node]], point, sampleIds[node], weights[node]);
+  });
+
+  for(std::size_t node = 0; node < nodePixels.size(); ++node)
+  {
+    this->NodeSampleIds.insert(this->NodeSampleIds.end(), sampleIds[node].begin(), sampleIds[node].end());
+    this->NodeWeights.insert(this->NodeWeights.end(), weights[node].begin(), weights[node].end());
+    this->NodeOffsets.push_back(this->NodeSampleIds.size());
+  }
+}
+
+inline void MeanValueCoordinates::TraceContour(const VariableIdImage& component)
+{
+  const itk::ImageRegion<2>& region = component.GetRegion();
+  const std::vector<int>& ids = component.GetIds();
+  const std::size_t width = region.GetSize()[0];
+
+  // The grid covers the component and two pixels around it: one for the dilation, and one that is
+  // always outside, so the tracing never leaves the grid
+  const std::size_t gridWidth = width + 4;
+  const std::size_t gridHeight = region.GetSize()[1] + 4;
+  std::vector<unsigned char> inside(gridWidth * gridHeight, 0);
+  for(std::size_t offset = 0; offset < ids.size(); ++offset)
+  {
+    if(ids[offset] < 0)
+    {
+      continue;
+    }
+    const std::size_t gridOffset = (offset / width + 2) * gridWidth + offset % width + 2;
+    for(std::size_t row = gridOffset - gridWidth; row <= gridOffset + gridWidth; row += gridWidth)
+    {
+      inside[row - 1] = inside[row] = inside[row + 1] = 1;
+    }
+  }
+
+  // Moore neighbor tracing, clockwise: east, south east, south, south west, west, north west, north, north east
+  const std::ptrdiff_t step = static_cast<std::ptrdiff_t>(gridWidth);
+  const std::ptrdiff_t directions[8] = {1, step + 1, step, step - 1, -1, -step - 1, -step, -step + 1};
+
+  // Move from 'current' to the next pixel of the contour, sweeping clockwise from 'backtrack'
+  // (an outside neighbor of 'current'). 'backtrack' becomes the last outside pixel of the sweep.
+  auto advance = [&](std::size_t& current, std::size_t& backtrack)
+  {
+    const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(backtrack) - static_cast<std::ptrdiff_t>(current);
+    const unsigned int start = static_cast<unsigned int>(std::find(directions, directions + 8, difference) - directions);
+    for(unsigned int turn = 1; turn <= 8; ++turn)
+    {
+      const std::size_t next = current + directions[(start + turn) % 8];
+      if(inside[next])
+      {
+        backtrack = current + directions[(start + turn + 7) % 8];
+        current = next;
+        return;
+      }
+    }
+  };
+
+  // The first pixel in raster order is on the outer contour, and its west neighbor is outside
+  const std::size_t first = static_cast<std::size_t>(std::find(inside.begin(), inside.end(), 1) - inside.begin());
+  std::vector<std::size_t> contour(1, first);
+  std::size_t current = first;
+  std::size_t backtrack = first - 1;
+  while(contour.size() < inside.size())
+  {
+    advance(current, backtrack);
+    if(current == first)
+    {
+      // Stop when the contour would continue the way it started (it may pass through 'first' more than once)
+      std::size_t next = current;
+      std::size_t nextBacktrack = backtrack;
+      advance(next, nextBacktrack);
+      if(contour.size() == 1 || next == contour[1])
+      {
+        break;
+      }
+    }
+    contour.push_back(current);
+  }
+
+  Contour newContour;
+  newContour.Begin = this->BoundaryPixels.size();
+  newContour.Size = contour.size();
+  newContour.SampleBegin = this->NumberOfSamples;
+  // The coarsest spacing of the samples splits the contour into about 8 segments
+  newContour.NumberOfLevels = 1;
+  while((static_cast<std::size_t>(1) << newContour.NumberOfLevels) * 8 <= newContour.Size)
+  {
+    ++newContour.NumberOfLevels;
+  }
+  this->Contours.push_back(newContour);
+  this->NumberOfSamples += newContour.Size * newContour.NumberOfLevels;
+
+  for(std::size_t vertex = 0; vertex < contour.size(); ++vertex)
+  {
+    itk::Index<2> pixel = {{region.GetIndex()[0] + static_cast<itk::IndexValueType>(contour[vertex] % gridWidth) - 2,
+                            region.GetIndex()[1] + static_cast<itk::IndexValueType>(contour[vertex] / gridWidth) - 2}};
+    this->BoundaryPixels.push_back(pixel);
+  }
+}
+
+inline void MeanValueCoordinates::ComputeWeights(const Contour& contour, const double point[2], std::vector<int>& sampleIds,
+                                                 std::vector<double>& weights) const
+{
+  const itk::Index<2>* const pixels = &this->BoundaryPixels[contour.Begin];
+  const std::size_t size = contour.Size;
+
+  auto distance = [&](const std::size_t vertex)
+  {
+    const itk::Index<2>& pixel = pixels[vertex % size];
+    return std::sqrt((pixel[0] - point[0]) * (pixel[0] - point[0]) + (pixel[1] - point[1]) * (pixel[1] - point[1]));
+  };
+
+  // Sample the contour: a segment of the coarsest spacing is halved while one of its ends is close
+  // to the point. Each vertex is kept with the spacing of the segment that starts at it.
+  std::vector<std::pair<std::size_t, std::size_t> > vertices;
+  std::vector<std::pair<std::size_t, std::size_t> > segments;
+  const std::size_t coarsestSpacing = static_cast<std::size_t>(1) << (contour.NumberOfLevels - 1);
+  for(std::size_t start = 0; start < size; start += coarsestSpacing)
+  {
+    segments.push_back(std::make_pair(start, coarsestSpacing));
+    while(!segments.empty())
+    {
+      const std::size_t vertex = segments.back().first;
+      const std::size_t spacing = segments.back().second;
+      segments.pop_back();
+      if(spacing > 1 && std::min(distance(vertex), distance(std::min(vertex + spacing, size))) < RefinementDistance * spacing)
+      {
+        if(vertex + spacing / 2 < size)
+        {
+          segments.push_back(std::make_pair(vertex + spacing / 2, spacing / 2));
+        }
+        segments.push_back(std::make_pair(vertex, spacing / 2));
+      }
+      else
+      {
+        vertices.push_back(std::make_pair(vertex, spacing));
+      }
+    }
+  }
+
+  // Mean-value coordinates of the sampled polygon: w_i = (tan(a_{i-1} / 2) + tan(a_i / 2)) / r_i,
+  // where a_i is the angle at the point between vertex i and vertex i + 1, and r_i is the distance to vertex i
+  const std::size_t numberOfVertices = vertices.size();
+  std::vector<double> tangents(numberOfVertices);
+  std::vector<double> radii(numberOfVertices);
+  for(std::size_t vertex = 0; vertex < numberOfVertices; ++vertex)
+  {
+    radii[vertex] = distance(vertices[vertex].first);
+  }
+  for(std::size_t vertex = 0; vertex < numberOfVertices; ++vertex)
+  {
+    const std::size_t next = (vertex + 1) % numberOfVertices;
+    const itk::Index<2>& a = pixels[vertices[vertex].first];
+    const itk::Index<2>& b = pixels[vertices[next].first];
+    const double ax = a[0] - point[0];
+    const double ay = a[1] - point[1];
+    const double bx = b[0] - point[0];
+    const double by = b[1] - point[1];
+    // tan(a / 2) = sin(a) / (1 + cos(a)), which is well defined unless the point is on the segment
+    tangents[vertex] = (ax * by - ay * bx) / (radii[vertex] * radii[next] + ax * bx + ay * by);
+  }
+
+  const std::size_t firstWeight = weights.size();
+  double sum = 0.0;
+  for(std::size_t vertex = 0; vertex < numberOfVertices; ++vertex)
+  {
+    const std::size_t previous = (vertex + numberOfVertices - 1) % numberOfVertices;
+    const double weight = (tangents[previous] + tangents[vertex]) / radii[vertex];
+
+    // The value of a vertex is smoothed over the finer of the spacings on its two sides
+    const std::size_t spacing = std::min(vertices[previous].second, vertices[vertex].second);
+    unsigned int level = 0;
+    while((static_cast<std::size_t>(1) << level) < spacing)
+    {
+      ++level;
+    }
+
+    sampleIds.push_back(static_cast<int>(contour.SampleBegin + level * size + vertices[vertex].first));
+    weights.push_back(weight);
+    sum += weight;
+  }
+
+  for(std::size_t weight = firstWeight; weight < weights.size(); ++weight)
+  {
+    weights[weight] /= sum;
+  }
+}
+
+inline const std::vector<itk::Index<2> >& MeanValueCoordinates::GetBoundaryPixels() const
+{
+  return this->BoundaryPixels;
+}
+
+inline void MeanValueCoordinates::Interpolate(const Eigen::MatrixXd& boundaryValues, Eigen::MatrixXd& X) const
+{
+  if(static_cast<std::size_t>(boundaryValues.rows()) != this->BoundaryPixels.size())
+  {
+    throw std::runtime_error("MeanValueCoordinates: there must be one boundary value per boundary pixel!");
+  }
+
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrixType;
+  const Eigen::MatrixXd::Index numberOfChannels = boundaryValues.cols();
+
+  // The value of the sample of level l at vertex i is the mean of the 2^l boundary values centered on i
+  RowMajorMatrixType samples(this->NumberOfSamples, numberOfChannels);
+  for(std::size_t contourId = 0; contourId < this->Contours.size(); ++contourId)
+  {
+    const Contour& contour = this->Contours[contourId];
+    const std::size_t size = contour.Size;
+
+    RowMajorMatrixType prefixSums(2 * size + 1, numberOfChannels);
+    prefixSums.row(0).setZero();
+    for(std::size_t vertex = 0; vertex < 2 * size; ++vertex)
+    {
+      prefixSums.row(vertex + 1) = prefixSums.row(vertex) + boundaryValues.row(contour.Begin + vertex % size);
+    }
+
+    for(unsigned int level = 0; level < contour.NumberOfLevels; ++level)
+    {
+      const std::size_t windowSize = std::min(static_cast<std::size_t>(1) << level, size);
+      for(std::size_t vertex = 0; vertex < size; ++vertex)
+      {
+        const std::size_t windowBegin = (vertex + size - windowSize / 2) % size;
+        samples.row(contour.SampleBegin + level * size + vertex) =
+            (prefixSums.row(windowBegin + windowSize) - prefixSums.row(windowBegin)) / static_cast<double>(windowSize);
+      }
+    }
+  }
+
+  const std::size_t numberOfNodes = this->NodeOffsets.size() - 1;
+  RowMajorMatrixType nodeValues(numberOfNodes, numberOfChannels);
+  ParallelHelpers::ParallelFor(numberOfNodes, [&](const std::size_t node)
+  {
+    nodeValues.row(node).setZero();
+    for(std::size_t entry = this->NodeOffsets[node]; entry < this->NodeOffsets[node + 1]; ++entry)
+    {
+      nodeValues.row(node) += this->NodeWeights[entry] * samples.row(this->NodeSampleIds[entry]);
+    }
+  }, ParallelHelpers::MinimumPixelsPerThread);
+
+  const std::size_t numberOfVariables = this->VariableNodeIds.size() / 4;
+  X.resize(numberOfVariables, numberOfChannels);
+  ParallelHelpers::ParallelFor(numberOfVariables, [&](const std::size_t variableId)
+  {
+    for(Eigen::MatrixXd::Index channel = 0; channel < numberOfChannels; ++channel)
+    {
+      double value = 0.0;
+      for(unsigned int corner = 0; corner < 4; ++corner)
+      {
+        const int node = this->VariableNodeIds[4 * variableId + corner];
+        if(node >= 0)
+        {
+          value += this->VariableNodeWeights[4 * variableId + corner] * nodeValues(node, channel);
+        }
+      }
+      X(variableId, channel) = value;
+    }
+  }, ParallelHelpers::MinimumPixelsPerThread);
+}
+
+#endif
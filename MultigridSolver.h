@@ -0,0 +1,151 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef MultigridSolver_H
+#define MultigridSolver_H
+
+#include "VariableIdImage.h"
+
+// Eigen
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+// STL
+#include <memory>
+#include <vector>
+
+/** This class approximately inverts the 5-point Poisson system of a hole (the same system that
+  * PoissonEditing assembles) with a geometric multigrid V-cycle, without ever building the matrix.
+  * Only the hole pixels are stored on each level, so the memory use is proportional to the size of
+  * the hole.
+  *
+  * The levels are cell centered: a coarse cell covers a 2x2 block of fine cells and is part of the
+  * coarse hole if any of those cells are. Corrections are interpolated bilinearly from the coarse
+  * cells that are part of the hole (the weights are renormalized at the boundary of the hole), the
+  * restriction is the scaled transpose of the interpolation, and each coarse level re-discretizes the
+  * Laplacian with Dirichlet conditions outside of its hole. Red-black Gauss-Seidel is used as the
+  * smoother, and the coarsest level is solved with a direct factorization.
+  *
+  * The coarse holes only approximate the boundary of an irregular hole, so plain V-cycles can
+  * stall on deep hierarchies. The cycle is symmetric, so it is used as the preconditioner of
+  * ConjugateGradientSolver instead, which keeps the number of iterations small and nearly
+  * independent of the size of the hole.
+  *
+  * Several channels are preconditioned together in the interleaved layout of a multi-channel image
+  * (one row per variable), so each stencil application reads the neighbors of a variable once for
+  * all of the channels. The kernels are specialized for 1, 3 and 4 channels.
+  */
+class MultigridSolver
+{
+public:
+  /** The values of a variable in all of the channels are stored next to each other. */
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> InterleavedMatrixType;
+
+  /** Build the grid hierarchy for the hole numbered in 'variableIds'. */
+  void Compute(const VariableIdImage& variableIds);
+
+  /** Compute z ~= A^-1 r with one V-cycle starting from zero, where A is the matrix that
+    * PoissonEditing::AssembleSystem would build. */
+  void Precondition(const Eigen::VectorXd& r, Eigen::VectorXd& z);
+
+  /** Compute Z ~= A^-1 R for each column (channel) of R with one V-cycle for all of them. */
+  void Precondition(const InterleavedMatrixType& R, InterleavedMatrixType& Z);
+
+  /** Get the number of levels in the hierarchy. */
+  unsigned int GetNumberOfLevels() const;
+
+protected:
+
+  /** A level of the hierarchy. Level 0 is the hole itself. */
+  struct Level
+  {
+    /** The size of the grid. */
+    std::size_t Width = 0;
+    std::size_t Height = 0;
+
+    /** The variable id of each cell of the grid, or -1 if the cell is not part of the hole. */
+    std::vector<int> Ids;
+
+    /** The raster position of each variable in the grid. */
+    std::vector<std::size_t> Cells;
+
+    /** The ids of the (up, left, right, down) neighbors of each variable, or -1. */
+    std::vector<int> Neighbors;
+
+    /** The variables of each color, for red-black Gauss-Seidel. */
+    std::vector<int> ColorVariables[2];
+
+    /** The ids and weights of the (up to) 4 coarse variables each variable of this level is
+      * interpolated from. Unused entries have id -1. */
+    std::vector<int> InterpolationIds;
+    std::vector<double> InterpolationWeights;
+
+    /** The operator on this level is Scale times the 5-point stencil. */
+    double Scale = 1.0;
+
+    /** Work vectors, one column per channel. */
+    InterleavedMatrixType X;
+    InterleavedMatrixType B;
+    InterleavedMatrixType R;
+
+    unsigned int GetNumberOfVariables() const
+    {
+      return this->Cells.size();
+    }
+  };
+
+  /** Create the neighbor table and the color lists of a level from its ids. */
+  static void ComputeConnectivity(Level& level);
+
+  /** Create the coarse level of 'fine' and the interpolation weights between them. */
+  static void Coarsen(Level& fine, Level& coarse);
+
+  /** Red-black Gauss-Seidel sweeps. If 'reverse' is true the colors are visited in the opposite
+    * order, so a pre-smoothing and a reversed post-smoothing make a symmetric cycle.
+    * The kernels below take the number of channels as TChannels, or from the work vectors if it is 0. */
+  template <unsigned int TChannels>
+  static void Smooth(Level& level, const unsigned int numberOfSweeps, const bool reverse);
+
+  /** Compute y = A x on a level. */
+  template <unsigned int TChannels>
+  static void Apply(const Level& level, const InterleavedMatrixType& x, InterleavedMatrixType& y);
+
+  /** Compute level.R = level.B - A level.X */
+  template <unsigned int TChannels>
+  static void ComputeResidual(Level& level);
+
+  /** Run one V-cycle starting at 'levelId'. */
+  template <unsigned int TChannels>
+  void VCycle(const unsigned int levelId);
+
+  /** The levels, finest first. */
+  std::vector<Level> Levels;
+
+  /** The direct solver of the coarsest level. */
+  std::shared_ptr<Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > > CoarsestSolver;
+
+  /** The number of smoothing sweeps before and after the coarse grid correction. */
+  unsigned int NumberOfSmoothingSweeps = 2;
+
+  /** Stop coarsening once a level has at most this many variables. */
+  unsigned int MaximumCoarsestSize = 1000;
+};
+
+#include "MultigridSolver.hpp"
+
+#endif
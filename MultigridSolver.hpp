@@ -0,0 +1,372 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef MultigridSolver_HPP
+#define MultigridSolver_HPP
+
+#include "MultigridSolver.h" // Appease syntax parser
+
+#include "ParallelHelpers.h"
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+
+inline void MultigridSolver::Compute(const VariableIdImage& variableIds)
+{
+  this->Levels.clear();
+  this->CoarsestSolver.reset();
+
+  // The finest level is the hole itself
+  this->Levels.push_back(Level());
+  Level& finest = this->Levels.back();
+  finest.Width = variableIds.GetRegion().GetSize()[0];
+  finest.Height = variableIds.GetRegion().GetSize()[1];
+  finest.Ids = variableIds.GetIds();
+  finest.Cells.resize(variableIds.GetNumberOfVariables());
+  for(std::size_t cell = 0; cell < finest.Ids.size(); ++cell)
+  {
+    if(finest.Ids[cell] >= 0)
+    {
+      finest.Cells[finest.Ids[cell]] = cell;
+    }
+  }
+  ComputeConnectivity(finest);
+
+  // Coarsen until the problem is small enough to factorize
+  while(this->Levels.back().GetNumberOfVariables() > this->MaximumCoarsestSize &&
+        this->Levels.back().Width > 2 && this->Levels.back().Height > 2)
+  {
+    Level coarse;
+    Coarsen(this->Levels.back(), coarse);
+    this->Levels.push_back(coarse);
+  }
+
+  // Factorize the operator of the coarsest level
+  Level& coarsest = this->Levels.back();
+  std::vector<Eigen::Triplet<double> > triplets;
+  for(unsigned int variableId = 0; variableId < coarsest.GetNumberOfVariables(); ++variableId)
+  {
+    triplets.push_back(Eigen::Triplet<double>(variableId, variableId, -4.0 * coarsest.Scale));
+    for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+    {
+      const int neighborId = coarsest.Neighbors[4 * variableId + neighbor];
+      if(neighborId >= 0)
+      {
+        triplets.push_back(Eigen::Triplet<double>(variableId, neighborId, coarsest.Scale));
+      }
+    }
+  }
+  Eigen::SparseMatrix<double> coarsestMatrix(coarsest.GetNumberOfVariables(), coarsest.GetNumberOfVariables());
+  coarsestMatrix.setFromTriplets(triplets.begin(), triplets.end());
+
+  this->CoarsestSolver = std::make_shared<Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > >(coarsestMatrix);
+  if(this->CoarsestSolver->info() != Eigen::Success)
+  {
+    throw std::runtime_error("MultigridSolver: Decomposition of the coarsest level failed!");
+  }
+
+  // The work vectors are sized for the number of channels in Precondition()
+}
+
+inline void MultigridSolver::ComputeConnectivity(Level& level)
+{
+  const std::size_t width = level.Width;
+  const std::size_t height = level.Height;
+  const unsigned int numberOfVariables = level.GetNumberOfVariables();
+
+  level.Neighbors.assign(4 * numberOfVariables, -1);
+  level.ColorVariables[0].clear();
+  level.ColorVariables[1].clear();
+
+  for(unsigned int variableId = 0; variableId < numberOfVariables; ++variableId)
+  {
+    const std::size_t cell = level.Cells[variableId];
+    const std::size_t x = cell % width;
+    const std::size_t y = cell / width;
+
+    int* neighbors = &level.Neighbors[4 * variableId];
+    if(y > 0)
+    {
+      neighbors[0] = level.Ids[cell - width];
+    }
+    if(x > 0)
+    {
+      neighbors[1] = level.Ids[cell - 1];
+    }
+    if(x + 1 < width)
+    {
+      neighbors[2] = level.Ids[cell + 1];
+    }
+    if(y + 1 < height)
+    {
+      neighbors[3] = level.Ids[cell + width];
+    }
+
+    level.ColorVariables[(x + y) % 2].push_back(variableId);
+  }
+}
+
+inline void MultigridSolver::Coarsen(Level& fine, Level& coarse)
+{
+  coarse.Width = (fine.Width + 1) / 2;
+  coarse.Height = (fine.Height + 1) / 2;
+  coarse.Scale = fine.Scale / 4.0;
+
+  // A coarse cell is part of the hole if any of its 2x2 fine cells are
+  coarse.Ids.assign(coarse.Width * coarse.Height, -1);
+  for(unsigned int fineId = 0; fineId < fine.GetNumberOfVariables(); ++fineId)
+  {
+    const std::size_t x = fine.Cells[fineId] % fine.Width;
+    const std::size_t y = fine.Cells[fineId] / fine.Width;
+    coarse.Ids[(y / 2) * coarse.Width + x / 2] = 0;
+  }
+
+  coarse.Cells.clear();
+  for(std::size_t cell = 0; cell < coarse.Ids.size(); ++cell)
+  {
+    if(coarse.Ids[cell] >= 0)
+    {
+      coarse.Ids[cell] = coarse.Cells.size();
+      coarse.Cells.push_back(cell);
+    }
+  }
+  ComputeConnectivity(coarse);
+
+  // Bilinear interpolation weights from the coarse cells around each fine cell. The center of fine
+  // cell 2i is a quarter of a coarse cell before the center of coarse cell i, and the center of
+  // fine cell 2i+1 is a quarter after it.
+  fine.InterpolationIds.assign(4 * fine.GetNumberOfVariables(), -1);
+  fine.InterpolationWeights.assign(4 * fine.GetNumberOfVariables(), 0.0);
+  for(unsigned int fineId = 0; fineId < fine.GetNumberOfVariables(); ++fineId)
+  {
+    const long x = fine.Cells[fineId] % fine.Width;
+    const long y = fine.Cells[fineId] / fine.Width;
+    const long coarseX[2] = {x / 2, (x % 2 == 0) ? x / 2 - 1 : x / 2 + 1};
+    const long coarseY[2] = {y / 2, (y % 2 == 0) ? y / 2 - 1 : y / 2 + 1};
+    const double weights1D[2] = {0.75, 0.25};
+
+    double weightSum = 0.0;
+    for(unsigned int j = 0; j < 2; ++j)
+    {
+      for(unsigned int i = 0; i < 2; ++i)
+      {
+        if(coarseX[i] < 0 || coarseX[i] >= static_cast<long>(coarse.Width) ||
+           coarseY[j] < 0 || coarseY[j] >= static_cast<long>(coarse.Height))
+        {
+          continue;
+        }
+
+        const int coarseId = coarse.Ids[coarseY[j] * coarse.Width + coarseX[i]];
+        if(coarseId < 0)
+        {
+          continue; // Coarse cells outside of the hole do not contribute
+        }
+
+        fine.InterpolationIds[4 * fineId + 2 * j + i] = coarseId;
+        fine.InterpolationWeights[4 * fineId + 2 * j + i] = weights1D[i] * weights1D[j];
+        weightSum += weights1D[i] * weights1D[j];
+      }
+    }
+
+    // The parent cell is always part of the coarse hole, so weightSum > 0
+    for(unsigned int entry = 0; entry < 4; ++entry)
+    {
+      fine.InterpolationWeights[4 * fineId + entry] /= weightSum;
+    }
+  }
+}
+
+template <unsigned int TChannels>
+void MultigridSolver::Smooth(Level& level, const unsigned int numberOfSweeps, const bool reverse)
+{
+  const unsigned int numberOfChannels = TChannels > 0 ? TChannels : level.X.cols();
+  const double inverseScale = 1.0 / level.Scale;
+  for(unsigned int sweep = 0; sweep < numberOfSweeps; ++sweep)
+  {
+    for(unsigned int colorIndex = 0; colorIndex < 2; ++colorIndex)
+    {
+      // Variables of the same color are not neighbors, so they can be updated in parallel
+      const std::vector<int>& variables = level.ColorVariables[reverse ? 1 - colorIndex : colorIndex];
+      ParallelHelpers::ParallelFor(variables.size(), [&](const std::size_t item)
+      {
+        const int variableId = variables[item];
+        const int* neighbors = &level.Neighbors[4 * variableId];
+        for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+        {
+          double neighborSum = 0.0;
+          for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+          {
+            if(neighbors[neighbor] >= 0)
+            {
+              neighborSum += level.X.data()[neighbors[neighbor] * numberOfChannels + channel];
+            }
+          }
+          const std::size_t value = variableId * numberOfChannels + channel;
+          level.X.data()[value] = (neighborSum - level.B.data()[value] * inverseScale) / 4.0;
+        }
+      }, ParallelHelpers::MinimumPixelsPerThread);
+    }
+  }
+}
+
+template <unsigned int TChannels>
+void MultigridSolver::Apply(const Level& level, const InterleavedMatrixType& x, InterleavedMatrixType& y)
+{
+  const unsigned int numberOfChannels = TChannels > 0 ? TChannels : x.cols();
+  ParallelHelpers::ParallelFor(level.GetNumberOfVariables(), [&](const std::size_t variableId)
+  {
+    // The neighbor ids are loaded once for all of the channels
+    const int* neighbors = &level.Neighbors[4 * variableId];
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      double stencilSum = -4.0 * x.data()[variableId * numberOfChannels + channel];
+      for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+      {
+        if(neighbors[neighbor] >= 0)
+        {
+          stencilSum += x.data()[neighbors[neighbor] * numberOfChannels + channel];
+        }
+      }
+      y.data()[variableId * numberOfChannels + channel] = level.Scale * stencilSum;
+    }
+  }, ParallelHelpers::MinimumPixelsPerThread);
+}
+
+template <unsigned int TChannels>
+void MultigridSolver::ComputeResidual(Level& level)
+{
+  Apply<TChannels>(level, level.X, level.R);
+  level.R = level.B - level.R;
+}
+
+template <unsigned int TChannels>
+void MultigridSolver::VCycle(const unsigned int levelId)
+{
+  Level& level = this->Levels[levelId];
+  const unsigned int numberOfChannels = TChannels > 0 ? TChannels : level.X.cols();
+
+  if(levelId + 1 == this->Levels.size())
+  {
+    level.X = this->CoarsestSolver->solve(Eigen::MatrixXd(level.B));
+    return;
+  }
+
+  Smooth<TChannels>(level, this->NumberOfSmoothingSweeps, false);
+  ComputeResidual<TChannels>(level);
+
+  // Restrict the residual with the scaled transpose of the interpolation
+  Level& coarse = this->Levels[levelId + 1];
+  coarse.B.setZero();
+  for(unsigned int fineId = 0; fineId < level.GetNumberOfVariables(); ++fineId)
+  {
+    const double* const residual = level.R.data() + fineId * numberOfChannels;
+    for(unsigned int entry = 0; entry < 4; ++entry)
+    {
+      const int coarseId = level.InterpolationIds[4 * fineId + entry];
+      if(coarseId >= 0)
+      {
+        const double weight = 0.25 * level.InterpolationWeights[4 * fineId + entry];
+        double* const coarseB = coarse.B.data() + coarseId * numberOfChannels;
+        for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+        {
+          coarseB[channel] += weight * residual[channel];
+        }
+      }
+    }
+  }
+
+  coarse.X.setZero();
+  VCycle<TChannels>(levelId + 1);
+
+  // Interpolate the coarse correction
+  ParallelHelpers::ParallelFor(level.GetNumberOfVariables(), [&](const std::size_t fineId)
+  {
+    double* const x = level.X.data() + fineId * numberOfChannels;
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      double correction = 0.0;
+      for(unsigned int entry = 0; entry < 4; ++entry)
+      {
+        const int coarseId = level.InterpolationIds[4 * fineId + entry];
+        if(coarseId >= 0)
+        {
+          correction += level.InterpolationWeights[4 * fineId + entry] * coarse.X.data()[coarseId * numberOfChannels + channel];
+        }
+      }
+      x[channel] += correction;
+    }
+  }, ParallelHelpers::MinimumPixelsPerThread);
+
+  Smooth<TChannels>(level, this->NumberOfSmoothingSweeps, true);
+}
+
+inline void MultigridSolver::Precondition(const Eigen::VectorXd& r, Eigen::VectorXd& z)
+{
+  InterleavedMatrixType Z;
+  Precondition(InterleavedMatrixType(r), Z);
+  z = Z;
+}
+
+inline void MultigridSolver::Precondition(const InterleavedMatrixType& R, InterleavedMatrixType& Z)
+{
+  if(this->Levels.empty())
+  {
+    throw std::runtime_error("MultigridSolver: Compute() must be called before Precondition()!");
+  }
+
+  for(std::size_t levelId = 0; levelId < this->Levels.size(); ++levelId)
+  {
+    Level& level = this->Levels[levelId];
+    if(level.X.cols() != R.cols())
+    {
+      level.X = InterleavedMatrixType::Zero(level.GetNumberOfVariables(), R.cols());
+      level.B = InterleavedMatrixType::Zero(level.GetNumberOfVariables(), R.cols());
+      level.R = InterleavedMatrixType::Zero(level.GetNumberOfVariables(), R.cols());
+    }
+  }
+
+  Level& finest = this->Levels[0];
+  finest.B = R;
+  finest.X.setZero();
+
+  // The channel counts of common images get kernels with a fixed number of channels
+  switch(R.cols())
+  {
+    case 1:
+      VCycle<1>(0);
+      break;
+    case 3:
+      VCycle<3>(0);
+      break;
+    case 4:
+      VCycle<4>(0);
+      break;
+    default:
+      VCycle<0>(0);
+      break;
+  }
+  Z = finest.X;
+}
+
+inline unsigned int MultigridSolver::GetNumberOfLevels() const
+{
+  return this->Levels.size();
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ParallelHelpers_H
+#define ParallelHelpers_H
+
+// ITK
+#include "itkMultiThreader.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ParallelHelpers
+{
+
+/** Get the number of threads to use. This follows ITK's global default so that
+  * itk::MultiThreader::SetGlobalDefaultNumberOfThreads() controls all of the work. */
+inline unsigned int GetNumberOfThreads()
+{
+  return std::max(1, static_cast<int>(itk::MultiThreader::GetGlobalDefaultNumberOfThreads()));
+}
+
+/** The smallest number of pixels (or variables) that is worth handing to a thread. Waking a thread
+  * costs a few microseconds, so loops over fewer items than this run serially. */
+const std::size_t MinimumPixelsPerThread = 4096;
+
+/** Get the smallest number of rows of 'width' pixels that is worth handing to a thread. */
+inline std::size_t GetMinimumRowsPerThread(const std::size_t width)
+{
+  return std::max<std::size_t>(1, MinimumPixelsPerThread / std::max<std::size_t>(width, 1));
+}
+
+/** This flag is set on the threads that are running the work of a parallel loop. Loops that are
+  * started from such a thread run serially, so nested loops do not oversubscribe the cores. */
+inline bool& InParallelRegion()
+{
+  static thread_local bool inParallelRegion = false;
+  return inParallelRegion;
+}
+
+/** The worker threads that run the parallel loops. They are started the first time that they are
+  * needed and then wait for tasks until the program exits, so a parallel loop does not pay for
+  * creating and joining its threads (the solvers run several loops per iteration). Several threads
+  * can submit tasks at the same time, for example the jobs of a pipeline. */
+class ThreadPool
+{
+public:
+  /** Get the pool that is shared by all of the parallel loops. */
+  static ThreadPool& GetInstance()
+  {
+    static ThreadPool threadPool;
+    return threadPool;
+  }
+
+  /** Make sure that there are at least 'numberOfWorkers' worker threads. */
+  void Reserve(const std::size_t numberOfWorkers)
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    while(this->Workers.size() < numberOfWorkers)
+    {
+      this->Workers.push_back(std::thread([this]() { this->RunWorker(); }));
+    }
+  }
+
+  /** Queue 'task' to be run by the next free worker. */
+  void Submit(std::function<void()> task)
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Tasks.push_back(std::move(task));
+    this->TaskAvailable.notify_one();
+  }
+
+  /** Run the oldest queued task on the calling thread. Return false if there was none. Threads that
+    * wait for their own tasks help with the queue instead of idling. */
+  bool RunPendingTask()
+  {
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(this->Mutex);
+      if(this->Tasks.empty())
+      {
+        return false;
+      }
+      task = std::move(this->Tasks.front());
+      this->Tasks.pop_front();
+    }
+
+    task();
+    return true;
+  }
+
+private:
+  ThreadPool() {}
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(this->Mutex);
+      this->Stopping = true;
+      this->TaskAvailable.notify_all();
+    }
+
+    for(std::size_t worker = 0; worker < this->Workers.size(); ++worker)
+    {
+      this->Workers[worker].join();
+    }
+  }
+
+  void RunWorker()
+  {
+    while(true)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        this->TaskAvailable.wait(lock, [this]() { return !this->Tasks.empty() || this->Stopping; });
+        if(this->Tasks.empty())
+        {
+          return;
+        }
+        task = std::move(this->Tasks.front());
+        this->Tasks.pop_front();
+      }
+
+      task();
+    }
+  }
+
+  std::vector<std::thread> Workers;
+  std::deque<std::function<void()> > Tasks;
+  bool Stopping = false;
+  std::mutex Mutex;
+  std::condition_variable TaskAvailable;
+};
+
+/** Call function(threadId) for 'numberOfThreads' thread ids on the workers of the ThreadPool (the
+  * calling thread runs thread 0). If any call throws, the first exception is rethrown after all of
+  * the threads have finished. */
+template <typename TFunction>
+void RunOnThreads(const std::size_t numberOfThreads, TFunction function)
+{
+  std::vector<std::exception_ptr> exceptions(numberOfThreads);
+
+  auto runThread = [&](const std::size_t threadId)
+  {
+    const bool wasInParallelRegion = InParallelRegion();
+    InParallelRegion() = true;
+    try
+    {
+      function(threadId);
+    }
+    catch(...)
+    {
+      exceptions[threadId] = std::current_exception();
+    }
+    InParallelRegion() = wasInParallelRegion;
+  };
+
+  // The tasks only reference this frame, which is kept alive until all of them have finished
+  std::size_t numberOfRunningTasks = numberOfThreads - 1;
+  std::mutex finishedMutex;
+  std::condition_variable finished;
+
+  ThreadPool& threadPool = ThreadPool::GetInstance();
+  threadPool.Reserve(GetNumberOfThreads() - 1);
+  for(std::size_t threadId = 1; threadId < numberOfThreads; ++threadId)
+  {
+    threadPool.Submit([&, threadId]()
+    {
+      runThread(threadId);
+
+      std::lock_guard<std::mutex> lock(finishedMutex);
+      --numberOfRunningTasks;
+      finished.notify_all();
+    });
+  }
+  runThread(0);
+
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(finishedMutex);
+      if(numberOfRunningTasks == 0)
+      {
+        break;
+      }
+    }
+
+    if(!threadPool.RunPendingTask())
+    {
+      std::unique_lock<std::mutex> lock(finishedMutex);
+      finished.wait(lock, [&]() { return numberOfRunningTasks == 0; });
+      break;
+    }
+  }
+
+  for(std::size_t threadId = 0; threadId < numberOfThreads; ++threadId)
+  {
+    if(exceptions[threadId])
+    {
+      std::rethrow_exception(exceptions[threadId]);
+    }
+  }
+}
+
+/** Split [0, numberOfItems) into one contiguous block per thread and call function(begin, end)
+  * for each block. This is useful when each thread needs its own work space. Each thread gets at
+  * least 'minimumItemsPerThread' items, so small loops run serially. */
+template <typename TFunction>
+void ParallelForRange(const std::size_t numberOfItems, TFunction function,
+                      const std::size_t minimumItemsPerThread = 1)
+{
+  const std::size_t numberOfThreads = InParallelRegion() ? 1 :
+      std::min(static_cast<std::size_t>(GetNumberOfThreads()),
+               numberOfItems / std::max<std::size_t>(minimumItemsPerThread, 1));
+
+  if(numberOfThreads <= 1)
+  {
+    function(static_cast<std::size_t>(0), numberOfItems);
+    return;
+  }
+
+  RunOnThreads(numberOfThreads, [&](const std::size_t block)
+  {
+    function(numberOfItems * block / numberOfThreads, numberOfItems * (block + 1) / numberOfThreads);
+  });
+}
+
+/** Call function(item) for every item in [0, numberOfItems). Each thread takes the next item as
+  * soon as it has finished its previous one, so this balances items whose costs differ a lot (put
+  * the most expensive items first). If any call throws, the first exception is rethrown after all
+  * of the threads have finished. */
+template <typename TFunction>
+void ParallelForDynamic(const std::size_t numberOfItems, TFunction function)
+{
+  const std::size_t numberOfThreads = InParallelRegion() ? 1 :
+      std::min(static_cast<std::size_t>(GetNumberOfThreads()), numberOfItems);
+
+  if(numberOfThreads <= 1)
+  {
+    for(std::size_t item = 0; item < numberOfItems; ++item)
+    {
+      function(item);
+    }
+    return;
+  }
+
+  std::atomic<std::size_t> nextItem(0);
+  RunOnThreads(numberOfThreads, [&](const std::size_t)
+  {
+    for(std::size_t item = nextItem++; item < numberOfItems; item = nextItem++)
+    {
+      function(item);
+    }
+  });
+}
+
+/** Call function(item) for every item in [0, numberOfItems). The range is split into one
+  * contiguous block per thread, of at least 'minimumItemsPerThread' items. If any call throws, the
+  * first exception is rethrown after all of the threads have finished. */
+template <typename TFunction>
+void ParallelFor(const std::size_t numberOfItems, TFunction function, const std::size_t minimumItemsPerThread = 1)
+{
+  ParallelForRange(numberOfItems, [&](const std::size_t begin, const std::size_t end)
+  {
+    for(std::size_t item = begin; item < end; ++item)
+    {
+      function(item);
+    }
+  }, minimumItemsPerThread);
+}
+
+/** A first-in first-out queue between the threads of two stages of a pipeline. It holds at most
+  * 'capacity' items, so a producer that gets ahead of its consumers waits instead of filling up the
+  * memory. */
+template <typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(const std::size_t capacity) : Capacity(std::max<std::size_t>(capacity, 1)) {}
+
+  /** Wait until there is room, and add 'item'. Return false (and drop the item) if the queue was closed. */
+  bool Push(T item)
+  {
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    this->NotFull.wait(lock, [this]() { return this->Items.size() < this->Capacity || this->Closed; });
+    if(this->Closed)
+    {
+      return false;
+    }
+
+    this->Items.push_back(std::move(item));
+    this->NotEmpty.notify_one();
+    return true;
+  }
+
+  /** Wait for an item and move it into 'item'. Return false once the queue is closed and empty. */
+  bool Pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    this->NotEmpty.wait(lock, [this]() { return !this->Items.empty() || this->Closed; });
+    if(this->Items.empty())
+    {
+      return false;
+    }
+
+    item = std::move(this->Items.front());
+    this->Items.pop_front();
+    this->NotFull.notify_one();
+    return true;
+  }
+
+  /** Stop accepting items. The items in the queue can still be popped. */
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Closed = true;
+    this->NotEmpty.notify_all();
+    this->NotFull.notify_all();
+  }
+
+private:
+  const std::size_t Capacity;
+  std::deque<T> Items;
+  bool Closed = false;
+  std::mutex Mutex;
+  std::condition_variable NotEmpty;
+  std::condition_variable NotFull;
+};
+
+} // end namespace ParallelHelpers
+
+#endif
@@ -0,0 +1,105 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonBatchFilling_H
+#define PoissonBatchFilling_H
+
+#include "PoissonEditing.h"
+#include "PoissonPlan.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageRegion.h"
+
+// STL
+#include <vector>
+
+/** This class fills the same hole in many images (for example an overlay that is removed from every
+  * frame of a video). Everything that only depends on the mask (the numbering of the hole, and the
+  * factorization or the solver of each of its components, see PoissonPlan) is prepared once in
+  * SetMask(), and so are the Laplacians of the guidance fields. Each image then only needs the
+  * known pixels around the hole in its right hand side and a solve. The channels of BatchSize images
+  * are stacked as the columns of one right hand side, so that they share the substitutions (or the
+  * iterations) of a single solve.
+  *
+  * The solver and the fill method are the global defaults of PoissonEditingParent when SetMask() is
+  * called. MIXED_GRADIENTS is not supported, as it needs a source image.
+  */
+template <typename TImage>
+class PoissonBatchFilling
+{
+public:
+  typedef PoissonEditingParent::GuidanceFieldType GuidanceFieldType;
+  typedef typename TypeTraits<typename TImage::PixelType>::ComponentType ComponentType;
+  typedef itk::Image<ComponentType, 2> ScalarImageType;
+  typedef itk::Image<float, 2> FloatImageType;
+
+  /** Specify one guidance field per channel, on the grid of the images, that is shared by all of the
+    * images. The hole is filled with a zero guidance field if this is not called. This must be
+    * called before SetMask(). */
+  void SetGuidanceFields(const std::vector<GuidanceFieldType::Pointer>& guidanceFields);
+
+  /** Specify the hole, on the grid of the images, and prepare its solver. */
+  void SetMask(const Mask* const mask);
+
+  /** Set the number of images whose channels are solved together (1 by default). Larger batches
+    * share more of the work of each solve, but keep all of their working images in memory. */
+  void SetBatchSize(const unsigned int batchSize);
+  unsigned int GetBatchSize() const;
+
+  /** Fill the hole in each of 'images' and write the results to 'outputs' (which may be the images
+    * themselves). The images are processed BatchSize at a time. All of them must have the same
+    * number of channels, and cover the bounding box of the hole. */
+  void Fill(const std::vector<const TImage*>& images, const std::vector<TImage*>& outputs);
+
+  /** Get the number of images filled since SetMask(). */
+  std::size_t GetNumberOfFilledImages() const;
+
+protected:
+
+  /** Fill the images [begin, end) with one solve. */
+  void FillBatch(const std::vector<const TImage*>& images, const std::vector<TImage*>& outputs,
+                 const std::size_t begin, const std::size_t end);
+
+  std::vector<GuidanceFieldType::Pointer> GuidanceFields;
+
+  /** The bounding box of the hole and the ring of known pixels around it, on the grid of the
+    * images. The working images of each image are extracted from it, with their corner at zero. */
+  itk::ImageRegion<2> WorkingRegion;
+
+  /** The mask, cropped to the working region. */
+  Mask::Pointer CroppedMask;
+
+  /** The Laplacian of the guidance field of each channel in the working region (null for zero
+    * guidance fields, which all share ZeroLaplacian). */
+  std::vector<FloatImageType::Pointer> Laplacians;
+  FloatImageType::Pointer ZeroLaplacian;
+
+  PoissonPlan<ComponentType> Plan;
+
+  unsigned int BatchSize = 1;
+
+  std::size_t NumberOfFilledImages = 0;
+};
+
+#include "PoissonBatchFilling.hpp"
+
+#endif
@@ -0,0 +1,209 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonBatchFilling_HPP
+#define PoissonBatchFilling_HPP
+
+#include "PoissonBatchFilling.h" // Appease syntax parser
+
+#include "ParallelHelpers.h"
+#include "PoissonEditingWrappers.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+
+template <typename TImage>
+void PoissonBatchFilling<TImage>::SetGuidanceFields(const std::vector<GuidanceFieldType::Pointer>& guidanceFields)
+{
+  this->GuidanceFields = guidanceFields;
+}
+
+template <typename TImage>
+void PoissonBatchFilling<TImage>::SetMask(const Mask* const mask)
+{
+  if(PoissonEditingParent::GetGlobalDefaultFillMethod() == PoissonEditingParent::FillMethodEnum::MIXED_GRADIENTS)
+  {
+    throw std::runtime_error("PoissonBatchFilling: MIXED_GRADIENTS needs a source image, and cannot fill a batch!");
+  }
+
+  // Only the bounding box of the hole and the ring of known pixels around it are read by the solve
+  const itk::ImageRegion<2> holeBoundingBox = ITKHelpers::ComputeBoundingBox(mask, HoleMaskPixelTypeEnum::HOLE);
+  this->WorkingRegion = holeBoundingBox;
+  this->WorkingRegion.PadByRadius(1);
+  this->WorkingRegion.Crop(mask->GetLargestPossibleRegion());
+
+  this->CroppedMask = Mask::New();
+  ITKHelpers::ExtractRegion(mask, this->WorkingRegion, this->CroppedMask.GetPointer());
+
+  this->ZeroLaplacian = FloatImageType::New();
+  this->ZeroLaplacian->SetRegions(this->CroppedMask->GetLargestPossibleRegion());
+  this->ZeroLaplacian->Allocate();
+  this->ZeroLaplacian->FillBuffer(0.0f);
+
+  // The Laplacians of the guidance fields are shared by all of the images
+  this->Laplacians.assign(this->GuidanceFields.size(), FloatImageType::Pointer());
+  ParallelHelpers::ParallelForDynamic(this->GuidanceFields.size(), [&](const std::size_t channel)
+  {
+    if(!this->GuidanceFields[channel])
+    {
+      return;
+    }
+
+    if(!this->GuidanceFields[channel]->GetLargestPossibleRegion().IsInside(this->WorkingRegion))
+    {
+      throw std::runtime_error("PoissonBatchFilling: The guidance fields must cover the hole!");
+    }
+
+    GuidanceFieldType::Pointer croppedGuidanceField = GuidanceFieldType::New();
+    ITKHelpers::ExtractRegion(this->GuidanceFields[channel].GetPointer(), this->WorkingRegion,
+                              croppedGuidanceField.GetPointer());
+    this->Laplacians[channel] = FloatImageType::New();
+    PoissonEditing<ComponentType>::LaplacianFromGradient(croppedGuidanceField, this->Laplacians[channel]);
+  });
+
+  this->Plan.SetSolver(PoissonEditingParent::GetGlobalDefaultSolver());
+  this->Plan.SetFillMethod(PoissonEditingParent::GetGlobalDefaultFillMethod());
+  this->Plan.Compute(this->CroppedMask);
+
+  this->NumberOfFilledImages = 0;
+}
+
+template <typename TImage>
+void PoissonBatchFilling<TImage>::SetBatchSize(const unsigned int batchSize)
+{
+  this->BatchSize = std::max(batchSize, 1u);
+}
+
+template <typename TImage>
+unsigned int PoissonBatchFilling<TImage>::GetBatchSize() const
+{
+  return this->BatchSize;
+}
+
+template <typename TImage>
+std::size_t PoissonBatchFilling<TImage>::GetNumberOfFilledImages() const
+{
+  return this->NumberOfFilledImages;
+}
+
+template <typename TImage>
+void PoissonBatchFilling<TImage>::Fill(const std::vector<const TImage*>& images, const std::vector<TImage*>& outputs)
+{
+  if(!this->Plan.IsComputed())
+  {
+    throw std::runtime_error("PoissonBatchFilling: SetMask() must be called before Fill()!");
+  }
+
+  if(images.size() != outputs.size())
+  {
+    throw std::runtime_error("PoissonBatchFilling: There must be one output per image!");
+  }
+
+  for(std::size_t begin = 0; begin < images.size(); begin += this->BatchSize)
+  {
+    FillBatch(images, outputs, begin, std::min<std::size_t>(begin + this->BatchSize, images.size()));
+  }
+}
+
+template <typename TImage>
+void PoissonBatchFilling<TImage>::FillBatch(const std::vector<const TImage*>& images,
+                                            const std::vector<TImage*>& outputs,
+                                            const std::size_t begin, const std::size_t end)
+{
+  const std::size_t numberOfImages = end - begin;
+  const unsigned int numberOfChannels = images[begin]->GetNumberOfComponentsPerPixel();
+  for(std::size_t image = begin; image < end; ++image)
+  {
+    if(images[image]->GetNumberOfComponentsPerPixel() != numberOfChannels)
+    {
+      throw std::runtime_error("PoissonBatchFilling: All of the images must have the same number of channels!");
+    }
+  }
+
+  if(!this->GuidanceFields.empty() && this->GuidanceFields.size() != numberOfChannels)
+  {
+    throw std::runtime_error("PoissonBatchFilling: There must be one guidance field per channel!");
+  }
+
+  // Extract the working region of the channels of every image. They are filled in place, and the
+  // channel c of the image i is the column i * numberOfChannels + c of the right hand side.
+  std::vector<std::vector<typename ScalarImageType::Pointer> > channels(numberOfImages);
+  ParallelHelpers::ParallelForDynamic(numberOfImages, [&](const std::size_t image)
+  {
+    channels[image] = ExtractChannels<ScalarImageType>(images[begin + image], this->WorkingRegion);
+  });
+
+  std::vector<const ScalarImageType*> targetImages;
+  std::vector<ScalarImageType*> channelOutputs;
+  std::vector<const FloatImageType*> laplacians;
+  for(std::size_t image = 0; image < numberOfImages; ++image)
+  {
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      targetImages.push_back(channels[image][channel]);
+      channelOutputs.push_back(channels[image][channel]);
+      laplacians.push_back(this->GuidanceFields.empty() || !this->Laplacians[channel] ?
+                           this->ZeroLaplacian.GetPointer() : this->Laplacians[channel].GetPointer());
+    }
+  }
+
+  this->Plan.SetQuantizationStep(PoissonEditingParent::GetGlobalDefaultQuantizationStep());
+  this->Plan.Execute(targetImages, laplacians, channelOutputs);
+
+  // Start from the image (unless it is filled in place), and write the hole pixels with all of their
+  // channels. The images are independent, and so are the rows of each.
+  const itk::ImageRegion<2> maskRegion = this->CroppedMask->GetLargestPossibleRegion();
+  const itk::Offset<2> maskToImage = this->WorkingRegion.GetIndex() - maskRegion.GetIndex();
+  ParallelHelpers::ParallelForDynamic(numberOfImages, [&](const std::size_t image)
+  {
+    TImage* const output = outputs[begin + image];
+    if(output != images[begin + image])
+    {
+      ITKHelpers::DeepCopy(images[begin + image], output);
+    }
+
+    for(itk::IndexValueType row = 0; row < static_cast<itk::IndexValueType>(maskRegion.GetSize()[1]); ++row)
+    {
+      itk::Index<2> maskPixel = maskRegion.GetIndex();
+      maskPixel[1] += row;
+      for(std::size_t column = 0; column < maskRegion.GetSize()[0]; ++column, ++maskPixel[0])
+      {
+        if(this->CroppedMask->GetPixel(maskPixel) != HoleMaskPixelTypeEnum::HOLE)
+        {
+          continue;
+        }
+
+        const itk::Index<2> pixel = maskPixel + maskToImage;
+        typename TImage::PixelType value = output->GetPixel(pixel);
+        for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+        {
+          PoissonEditingParent::SetChannel(value, channel, channels[image][channel]->GetPixel(maskPixel));
+        }
+        output->SetPixel(pixel, value);
+      }
+    }
+  });
+
+  this->NumberOfFilledImages += numberOfImages;
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonCloningSession_H
+#define PoissonCloningSession_H
+
+#include "DomainDecompositionSolver.h"
+#include "PoissonEditing.h"
+#include "VariableIdImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageRegion.h"
+
+// Eigen
+#include <Eigen/Dense>
+
+// STL
+#include <vector>
+
+/** This class clones a source image into a target image at positions that change interactively
+  * (for example while the source is dragged). The system matrix only depends on the shape of the
+  * mask, not on where it is pasted, so it is factorized once in SetMask(). The part of the right hand
+  * side that comes from the Laplacian of the source is also computed once. Each Clone() only gathers
+  * the target pixels around the hole at the new position and substitutes forward and backward.
+  * The result is that of FillImage() with the gradients of the source as the guidance fields.
+  */
+template <typename TImage>
+class PoissonCloningSession
+{
+public:
+  typedef PoissonEditingParent::GuidanceFieldType GuidanceFieldType;
+  typedef itk::Image<float, 2> FloatImageType;
+
+  /** Specify the image to paste into. */
+  void SetTargetImage(const TImage* const targetImage);
+
+  /** Specify the image to paste. Its gradients are the guidance fields. */
+  void SetSourceImage(const TImage* const sourceImage);
+
+  /** Specify the pixels of the source image to paste, on the grid of the source image. The system is
+    * factorized here, once for all of the positions. */
+  void SetMask(const Mask* const mask);
+
+  /** Paste the source with its corner at 'position' in the target image, and write the result to
+    * 'output'. If 'output' is the image of the previous call, only the pixels of the previous and the
+    * new position are written. Otherwise the target image is first copied to it. */
+  void Clone(const itk::Index<2>& position, TImage* const output);
+
+protected:
+
+  /** The right hand sides at the current position (one column per channel). */
+  void AssembleRightHandSide(const itk::Index<2>& position, Eigen::MatrixXd& B) const;
+
+  /** Get the target pixel under the mask pixel at 'offset' of the id buffer, at 'position'. */
+  itk::Index<2> GetTargetPixel(const itk::Index<2>& position, const std::size_t offset) const;
+
+  const TImage* TargetImage = nullptr;
+
+  /** The gradients of the channels of the source image. */
+  std::vector<GuidanceFieldType::Pointer> GuidanceFields;
+
+  /** The corner of the mask. */
+  itk::Index<2> MaskCorner;
+
+  VariableIdImage VariableIds;
+  DomainDecompositionSolver Solver;
+  bool IsFactorized = false;
+
+  /** The Laplacian part of the right hand sides, which does not depend on the position. */
+  Eigen::MatrixXd LaplacianRightHandSide;
+
+  /** The known neighbors of the hole pixels: the variable of each, and its offset from the corner
+    * of the mask. Their target values are moved to the right hand side at each position. */
+  std::vector<int> BoundaryVariables;
+  std::vector<itk::Offset<2> > BoundaryPixels;
+
+  /** The output of the previous Clone(), and the position that was pasted into it. */
+  const TImage* PreviousOutput = nullptr;
+  itk::Index<2> PreviousPosition;
+};
+
+#include "PoissonCloningSession.hpp"
+
+#endif
@@ -0,0 +1,212 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonCloningSession_HPP
+#define PoissonCloningSession_HPP
+
+#include "PoissonCloningSession.h" // Appease syntax parser
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// STL
+#include <stdexcept>
+
+template <typename TImage>
+void PoissonCloningSession<TImage>::SetTargetImage(const TImage* const targetImage)
+{
+  this->TargetImage = targetImage;
+  this->PreviousOutput = nullptr;
+}
+
+template <typename TImage>
+void PoissonCloningSession<TImage>::SetSourceImage(const TImage* const sourceImage)
+{
+  // The guidance field of each channel is its gradient. Its Laplacian is computed in SetMask(), over
+  // the bounding box of the hole.
+  this->GuidanceFields = PoissonEditingParent::ComputeGuidanceField(sourceImage);
+  this->IsFactorized = false;
+}
+
+template <typename TImage>
+void PoissonCloningSession<TImage>::SetMask(const Mask* const mask)
+{
+  if(this->GuidanceFields.empty())
+  {
+    throw std::runtime_error("PoissonCloningSession: The source image must be set before the mask!");
+  }
+
+  if(!(mask->GetLargestPossibleRegion() == this->GuidanceFields[0]->GetLargestPossibleRegion()))
+  {
+    throw std::runtime_error("PoissonCloningSession: The mask must be the same size as the source image!");
+  }
+
+  this->MaskCorner = mask->GetLargestPossibleRegion().GetIndex();
+  this->VariableIds.Compute(mask);
+  this->Solver.Compute(this->VariableIds);
+
+  // Like FillImage(), which crops the guidance fields to the bounding box of the hole, the Laplacians
+  // only read the fields in the bounding box, and the fields are zero in the ring of pixels around it
+  const unsigned int numberOfChannels = this->GuidanceFields.size();
+  const itk::ImageRegion<2> holeRegion = this->VariableIds.GetRegion();
+  itk::ImageRegion<2> laplacianRegion = holeRegion;
+  laplacianRegion.PadByRadius(1);
+  std::vector<FloatImageType::Pointer> laplacians(numberOfChannels);
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    GuidanceFieldType::Pointer croppedGuidanceField = GuidanceFieldType::New();
+    croppedGuidanceField->SetRegions(laplacianRegion);
+    croppedGuidanceField->Allocate();
+    croppedGuidanceField->FillBuffer(itk::NumericTraits<GuidanceFieldType::PixelType>::Zero);
+    ITKHelpers::CopyRegion(this->GuidanceFields[channel].GetPointer(), croppedGuidanceField.GetPointer(),
+                           holeRegion, holeRegion);
+    laplacians[channel] = FloatImageType::New();
+    PoissonEditing<float>::LaplacianFromGradient(croppedGuidanceField, laplacians[channel]);
+  }
+
+  // Everything of the right hand side that does not depend on the position
+  const itk::Offset<2> neighborOffsets[4] = {{{0, -1}}, {{-1, 0}}, {{1, 0}}, {{0, 1}}};
+  const std::vector<int>& ids = this->VariableIds.GetIds();
+  this->LaplacianRightHandSide.resize(this->VariableIds.GetNumberOfVariables(), numberOfChannels);
+  this->BoundaryVariables.clear();
+  this->BoundaryPixels.clear();
+  for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+  {
+    const int variableId = ids[idOffset];
+    if(variableId < 0)
+    {
+      continue;
+    }
+
+    const itk::Index<2> pixel = this->VariableIds.GetPixel(idOffset);
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      this->LaplacianRightHandSide(variableId, channel) = laplacians[channel]->GetPixel(pixel);
+    }
+
+    for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+    {
+      const itk::Index<2> neighborPixel = pixel + neighborOffsets[neighbor];
+      if(this->VariableIds.GetId(neighborPixel) < 0)
+      {
+        this->BoundaryVariables.push_back(variableId);
+        this->BoundaryPixels.push_back(neighborPixel - this->MaskCorner);
+      }
+    }
+  }
+
+  this->IsFactorized = true;
+  this->PreviousOutput = nullptr;
+}
+
+template <typename TImage>
+itk::Index<2> PoissonCloningSession<TImage>::GetTargetPixel(const itk::Index<2>& position,
+                                                            const std::size_t offset) const
+{
+  return position + (this->VariableIds.GetPixel(offset) - this->MaskCorner);
+}
+
+template <typename TImage>
+void PoissonCloningSession<TImage>::AssembleRightHandSide(const itk::Index<2>& position, Eigen::MatrixXd& B) const
+{
+  // Move the known neighbors at this position to the right hand side (pixels outside of the image
+  // are ignored)
+  const itk::ImageRegion<2> targetRegion = this->TargetImage->GetLargestPossibleRegion();
+  B = this->LaplacianRightHandSide;
+  for(std::size_t boundaryPixel = 0; boundaryPixel < this->BoundaryPixels.size(); ++boundaryPixel)
+  {
+    const itk::Index<2> targetPixel = position + this->BoundaryPixels[boundaryPixel];
+    if(!targetRegion.IsInside(targetPixel))
+    {
+      continue;
+    }
+
+    const typename TImage::PixelType& value = this->TargetImage->GetPixel(targetPixel);
+    for(unsigned int channel = 0; channel < B.cols(); ++channel)
+    {
+      B(this->BoundaryVariables[boundaryPixel], channel) -= PoissonEditingParent::GetChannel(value, channel);
+    }
+  }
+}
+
+template <typename TImage>
+void PoissonCloningSession<TImage>::Clone(const itk::Index<2>& position, TImage* const output)
+{
+  if(!this->TargetImage || !this->IsFactorized)
+  {
+    throw std::runtime_error("PoissonCloningSession: The target image, the source image and the mask must be set!");
+  }
+
+  if(this->TargetImage->GetNumberOfComponentsPerPixel() != this->GuidanceFields.size())
+  {
+    throw std::runtime_error("PoissonCloningSession: The source and target images must have the same number of channels!");
+  }
+
+  const itk::ImageRegion<2> targetRegion = this->TargetImage->GetLargestPossibleRegion();
+  itk::ImageRegion<2> holeRegion = this->VariableIds.GetRegion();
+  holeRegion.SetIndex(position + (holeRegion.GetIndex() - this->MaskCorner));
+  if(this->VariableIds.GetNumberOfVariables() > 0 && !targetRegion.IsInside(holeRegion))
+  {
+    throw std::runtime_error("PoissonCloningSession: The hole is outside of the target image at this position!");
+  }
+
+  Eigen::MatrixXd B;
+  AssembleRightHandSide(position, B);
+
+  Eigen::MatrixXd X;
+  this->Solver.Solve(B, X);
+
+  // Only the hole pixels of the previous position have to be restored in the output of the previous call
+  const std::vector<int>& ids = this->VariableIds.GetIds();
+  if(output == this->PreviousOutput && output->GetLargestPossibleRegion() == targetRegion)
+  {
+    for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+    {
+      if(ids[idOffset] >= 0)
+      {
+        const itk::Index<2> targetPixel = GetTargetPixel(this->PreviousPosition, idOffset);
+        output->SetPixel(targetPixel, this->TargetImage->GetPixel(targetPixel));
+      }
+    }
+  }
+  else
+  {
+    ITKHelpers::DeepCopy(this->TargetImage, output);
+  }
+
+  for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+  {
+    if(ids[idOffset] < 0)
+    {
+      continue;
+    }
+
+    const itk::Index<2> targetPixel = GetTargetPixel(position, idOffset);
+    typename TImage::PixelType pixel = output->GetPixel(targetPixel);
+    for(unsigned int channel = 0; channel < X.cols(); ++channel)
+    {
+      PoissonEditingParent::SetChannel(pixel, channel, X(ids[idOffset], channel));
+    }
+    output->SetPixel(targetPixel, pixel);
+  }
+
+  this->PreviousOutput = output;
+  this->PreviousPosition = position;
+}
+
+#endif
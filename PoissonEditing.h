@@ -19,7 +19,12 @@
 #ifndef PoissonEditing_H
 #define PoissonEditing_H
 
+#include "ParallelHelpers.h"
+#include "VariableIdImage.h"
+
 // Submodules
+#include "Helpers/Helpers.h"
+#include "ITKHelpers/ITKHelpers.h"
 #include "Mask/Mask.h"
 
 // ITK
@@ -27,7 +32,18 @@
 #include "itkImage.h"
 #include "itkVectorImage.h"
 
+// Eigen
+#include <Eigen/Sparse>
+
 // STL
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 /** This class operates on a single channel image. If you would like to use this technique on a
@@ -49,28 +65,325 @@ public:
   typedef Vector2ImageType GuidanceFieldType;
   typedef Vector2ImageType GradientImageType;
 
+  /** Enumerate the solvers of the linear system. LDLT factorizes the system matrix.
+    * MIXED_PRECISION_LDLT factorizes and solves it in single precision, which halves the memory
+    * of the factor, and then refines the solution with double precision residuals.
+    * DOMAIN_DECOMPOSITION factorizes it on all of the threads with DomainDecompositionSolver.
+    * MULTIGRID and CONJUGATE_GRADIENT never build the matrix, so their memory use stays proportional
+    * to the size of the hole. Both are conjugate gradient iterations, preconditioned with a multigrid V-cycle and
+    * with the (constant) diagonal respectively. Holes that fill their bounding box are always solved
+    * with SineTransformSolver. */
+  enum class SolverEnum {LDLT, MIXED_PRECISION_LDLT, DOMAIN_DECOMPOSITION, MULTIGRID, CONJUGATE_GRADIENT};
+
+  /** Enumerate the potential fill methods. POISSON solves the Poisson equation with the chosen solver.
+    * MEAN_VALUE_COORDINATES solves no linear system: it adds the source image to the interpolation of
+    * the difference between the target and the source on the boundary of the hole (with
+    * MeanValueCoordinates). This looks nearly the same as POISSON cloning. It needs the source image
+    * (SetSourceImage()) rather than its guidance field; without one it interpolates the target.
+    * MIXED_GRADIENTS is POISSON cloning with the mixed gradients of Perez et al.: between each pair of
+    * neighboring pixels the guidance is the difference of the source or of the target image,
+    * whichever is stronger, so the texture of the target shows through the flat parts of the
+    * source. It is computed from the source image (SetSourceImage(), which is required) and the
+    * target image while the right hand side is assembled, and the guidance field is not used. */
+  enum class FillMethodEnum {VARIATIONAL, POISSON, MEAN_VALUE_COORDINATES, MIXED_GRADIENTS};
+
+  /** The counters and the wall times (in seconds) of the phases of a fill. They are only collected
+    * when they are asked for (see PoissonEditing::SetCollectStatistics()), and the clock is not read
+    * otherwise. The counters describe the hole, which all of the channels share: its unknowns, the
+    * nonzeros of its 5-point system (whether or not the solver builds the matrix), the known pixels
+    * that border it (counted once per hole pixel that they border, as they are moved to the right
+    * hand side) and the fill-in of the LDLT factorizations (the nonzeros of L that are not in the
+    * lower triangle of the matrix). The times cover all of the channels. The components of the hole
+    * that are processed concurrently add up their times, which can then exceed the wall time. */
+  struct FillStatistics
+  {
+    std::size_t NumberOfChannels = 0;
+    std::size_t NumberOfUnknowns = 0;
+    std::size_t NumberOfNonZeros = 0;
+    std::size_t NumberOfBoundaryPixels = 0;
+    std::size_t FillIn = 0;
+
+    /** Numbering the hole pixels, splitting them into components and finding their known neighbors. */
+    double MaskScanTime = 0.0;
+    /** Copying the images into the working images of the solve, if they are copied. */
+    double CopyInTime = 0.0;
+    /** Computing the Laplacians of the guidance fields. */
+    double LaplacianTime = 0.0;
+    /** Building the matrices and the right hand sides. */
+    double AssemblyTime = 0.0;
+    /** Factorizing the matrices (or preparing the other solvers). */
+    double FactorizationTime = 0.0;
+    /** Solving for all of the channels. */
+    double SolveTime = 0.0;
+    /** Writing the solutions into the output images. */
+    double WriteBackTime = 0.0;
+
+    /** The iterations of the iterative solvers and the relative residual that they stopped at (see
+      * PoissonEditing::GetNumberOfIterations() and PoissonEditing::GetRelativeResidual()). */
+    std::size_t NumberOfIterations = 0;
+    double RelativeResidual = 0.0;
+
+    /** Add the counters and the times of 'other' (and keep the larger of the residuals). */
+    FillStatistics& operator+=(const FillStatistics& other)
+    {
+      this->NumberOfChannels += other.NumberOfChannels;
+      this->NumberOfUnknowns += other.NumberOfUnknowns;
+      this->NumberOfNonZeros += other.NumberOfNonZeros;
+      this->NumberOfBoundaryPixels += other.NumberOfBoundaryPixels;
+      this->FillIn += other.FillIn;
+      this->MaskScanTime += other.MaskScanTime;
+      this->CopyInTime += other.CopyInTime;
+      this->LaplacianTime += other.LaplacianTime;
+      this->AssemblyTime += other.AssemblyTime;
+      this->FactorizationTime += other.FactorizationTime;
+      this->SolveTime += other.SolveTime;
+      this->WriteBackTime += other.WriteBackTime;
+      this->NumberOfIterations += other.NumberOfIterations;
+      this->RelativeResidual = std::max(this->RelativeResidual, other.RelativeResidual);
+      return *this;
+    }
+
+    /** Get the sum of the times of the phases. */
+    double GetTotalTime() const
+    {
+      return this->MaskScanTime + this->CopyInTime + this->LaplacianTime + this->AssemblyTime +
+             this->FactorizationTime + this->SolveTime + this->WriteBackTime;
+    }
+  };
+
+  /** A stopwatch for the phases of FillStatistics that only reads the clock if it is enabled. */
+  class PhaseTimer
+  {
+  public:
+    explicit PhaseTimer(const bool enabled) : Enabled(enabled)
+    {
+      if(this->Enabled)
+      {
+        this->Start = std::chrono::steady_clock::now();
+      }
+    }
+
+    /** Add the time since the construction (or the previous call) to 'time'. */
+    void Lap(double& time)
+    {
+      if(this->Enabled)
+      {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        time += std::chrono::duration<double>(now - this->Start).count();
+        this->Start = now;
+      }
+    }
+
+  private:
+    bool Enabled;
+    std::chrono::steady_clock::time_point Start;
+  };
+
+  /** Set the solver that new PoissonEditing objects use (this also affects the FillImage functions). */
+  static void SetGlobalDefaultSolver(const SolverEnum solver)
+  {
+    GlobalDefaultSolver() = solver;
+  }
+
+  /** Get the solver that new PoissonEditing objects use. */
+  static SolverEnum GetGlobalDefaultSolver()
+  {
+    return GlobalDefaultSolver();
+  }
+
+  /** Get the solver with the name 'name' ("ldlt", "mixed", "dd", "multigrid" or "cg"). */
+  static SolverEnum GetSolverFromName(const std::string& name)
+  {
+    if(name == "ldlt")
+    {
+      return SolverEnum::LDLT;
+    }
+    else if(name == "mixed")
+    {
+      return SolverEnum::MIXED_PRECISION_LDLT;
+    }
+    else if(name == "dd")
+    {
+      return SolverEnum::DOMAIN_DECOMPOSITION;
+    }
+    else if(name == "multigrid")
+    {
+      return SolverEnum::MULTIGRID;
+    }
+    else if(name == "cg")
+    {
+      return SolverEnum::CONJUGATE_GRADIENT;
+    }
+
+    throw std::runtime_error("Unknown solver " + name + "! Valid solvers are ldlt, mixed, dd, multigrid and cg.");
+  }
+
+  /** Set the fill method that new PoissonEditing objects use (this also affects the FillImage functions). */
+  static void SetGlobalDefaultFillMethod(const FillMethodEnum fillMethod)
+  {
+    GlobalDefaultFillMethod() = fillMethod;
+  }
+
+  /** Get the fill method that new PoissonEditing objects use. */
+  static FillMethodEnum GetGlobalDefaultFillMethod()
+  {
+    return GlobalDefaultFillMethod();
+  }
+
+  /** Set the quantization step that new PoissonEditing objects use (see SetQuantizationStep()). */
+  static void SetGlobalDefaultQuantizationStep(const double quantizationStep)
+  {
+    GlobalDefaultQuantizationStep() = quantizationStep;
+  }
+
+  /** Get the quantization step that new PoissonEditing objects use. */
+  static double GetGlobalDefaultQuantizationStep()
+  {
+    return GlobalDefaultQuantizationStep();
+  }
+
+  /** Set the number of bytes of working memory that the FillImage functions may use. Images that
+    * would need more are filled tile by tile with TiledPoissonFilling. 0 (the default) means no limit. */
+  static void SetGlobalMemoryBudget(const std::size_t memoryBudget)
+  {
+    GlobalMemoryBudget() = memoryBudget;
+  }
+
+  /** Get the memory budget of the FillImage functions. */
+  static std::size_t GetGlobalMemoryBudget()
+  {
+    return GlobalMemoryBudget();
+  }
+
+  /** Get or set one channel of a scalar or vector pixel. */
+  template <typename TPixel>
+  static typename std::enable_if<std::is_scalar<TPixel>::value, double>::type
+  GetChannel(const TPixel& pixel, const unsigned int)
+  {
+    return pixel;
+  }
+
+  template <typename TPixel>
+  static typename std::enable_if<!std::is_scalar<TPixel>::value, double>::type
+  GetChannel(const TPixel& pixel, const unsigned int channel)
+  {
+    return pixel[channel];
+  }
+
+  /** Convert a solved value to a channel of type TComponent. Integer channels are rounded to the
+    * nearest value (as the quantization of the iterative solvers assumes) and clamped to the range
+    * of the type, instead of being truncated and wrapped around. */
+  template <typename TComponent>
+  static typename std::enable_if<std::is_integral<TComponent>::value, TComponent>::type
+  ConvertToComponent(const double value)
+  {
+    const double rounded = std::floor(value + 0.5);
+    if(!(rounded > static_cast<double>(std::numeric_limits<TComponent>::lowest())))
+    {
+      return std::numeric_limits<TComponent>::lowest();
+    }
+    if(rounded >= static_cast<double>(std::numeric_limits<TComponent>::max()))
+    {
+      return std::numeric_limits<TComponent>::max();
+    }
+    return static_cast<TComponent>(rounded);
+  }
+
+  template <typename TComponent>
+  static typename std::enable_if<!std::is_integral<TComponent>::value, TComponent>::type
+  ConvertToComponent(const double value)
+  {
+    return static_cast<TComponent>(value);
+  }
+
+  template <typename TPixel>
+  static typename std::enable_if<std::is_scalar<TPixel>::value>::type
+  SetChannel(TPixel& pixel, const unsigned int, const double value)
+  {
+    pixel = ConvertToComponent<TPixel>(value);
+  }
+
+  template <typename TPixel>
+  static typename std::enable_if<!std::is_scalar<TPixel>::value>::type
+  SetChannel(TPixel& pixel, const unsigned int channel, const double value)
+  {
+    pixel[channel] = ConvertToComponent<typename std::remove_reference<decltype(pixel[channel])>::type>(value);
+  }
+
+  /** Compute the gradient of each channel of 'image' with central differences. The interleaved
+    * pixels are read once for all of the channels, and the rows are split across threads. At the
+    * edges of the image the missing neighbor is replaced by the pixel itself. */
   template <typename TImage>
   static std::vector<GuidanceFieldType::Pointer> ComputeGuidanceField(const TImage* const image)
   {
-    std::vector<GuidanceFieldType::Pointer> guidanceFields;
-    for(unsigned int channel = 0;
-        channel < image->GetNumberOfComponentsPerPixel(); ++channel)
+    typedef typename TypeTraits<typename TImage::PixelType>::ComponentType ComponentType;
+
+    const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+    if(image->GetBufferedRegion() != region)
+    {
+      throw std::runtime_error("ComputeGuidanceField: The whole image must be buffered!");
+    }
+
+    const std::size_t numberOfChannels = image->GetNumberOfComponentsPerPixel();
+    std::vector<GuidanceFieldType::Pointer> guidanceFields(numberOfChannels);
+    std::vector<float*> fields(numberOfChannels);
+    for(std::size_t channel = 0; channel < numberOfChannels; ++channel)
     {
-      typedef itk::Image<typename TImage::PixelType::ComponentType, 2> ScalarImageType;
-      typename ScalarImageType::Pointer imageChannel = ScalarImageType::New();
-      imageChannel->SetRegions(image->GetLargestPossibleRegion());
-      imageChannel->Allocate();
-      ITKHelpers::ExtractChannel(image, channel, imageChannel.GetPointer());
-
-      GuidanceFieldType::Pointer guidanceField =
-          GuidanceFieldType::New();
-      guidanceField->SetRegions(image->GetLargestPossibleRegion());
-      guidanceField->Allocate();
-
-      ITKHelpers::ComputeGradients(imageChannel.GetPointer(), guidanceField.GetPointer());
-      guidanceFields.push_back(guidanceField);
+      guidanceFields[channel] = GuidanceFieldType::New();
+      guidanceFields[channel]->SetRegions(region);
+      guidanceFields[channel]->Allocate();
+      fields[channel] = reinterpret_cast<float*>(guidanceFields[channel]->GetBufferPointer());
     }
 
+    const std::size_t width = region.GetSize()[0];
+    const std::size_t height = region.GetSize()[1];
+    const std::size_t rowLength = width * numberOfChannels;
+    const ComponentType* const pixels = reinterpret_cast<const ComponentType*>(image->GetBufferPointer());
+
+    ParallelHelpers::ParallelForRange(height, [&](const std::size_t firstRow, const std::size_t endRow)
+    {
+      // The derivatives of a row, in the interleaved order of its pixels
+      std::vector<float> xDerivatives(rowLength);
+      std::vector<float> yDerivatives(rowLength);
+      for(std::size_t y = firstRow; y < endRow; ++y)
+      {
+        const ComponentType* const center = pixels + y * rowLength;
+        const ComponentType* const up = pixels + (y > 0 ? y - 1 : y) * rowLength;
+        const ComponentType* const down = pixels + (y + 1 < height ? y + 1 : y) * rowLength;
+
+        // The horizontal neighbors of a component are 'numberOfChannels' components away, so all of
+        // the channels are differentiated by the same contiguous (vectorized) loop
+        for(std::size_t component = 0; component < rowLength; ++component)
+        {
+          yDerivatives[component] = 0.5f * (static_cast<float>(down[component]) - static_cast<float>(up[component]));
+        }
+        for(std::size_t component = numberOfChannels; component + numberOfChannels < rowLength; ++component)
+        {
+          xDerivatives[component] = 0.5f * (static_cast<float>(center[component + numberOfChannels]) -
+                                            static_cast<float>(center[component - numberOfChannels]));
+        }
+        for(std::size_t channel = 0; channel < numberOfChannels; ++channel)
+        {
+          const std::size_t last = rowLength - numberOfChannels + channel;
+          xDerivatives[channel] = 0.5f * (static_cast<float>(center[width > 1 ? channel + numberOfChannels : channel]) -
+                                          static_cast<float>(center[channel]));
+          xDerivatives[last] = 0.5f * (static_cast<float>(center[last]) -
+                                       static_cast<float>(center[width > 1 ? last - numberOfChannels : last]));
+        }
+
+        // Split the derivatives into the (x, y) pairs of the field of each channel
+        for(std::size_t channel = 0; channel < numberOfChannels; ++channel)
+        {
+          float* const field = fields[channel] + 2 * y * width;
+          for(std::size_t x = 0; x < width; ++x)
+          {
+            field[2 * x] = xDerivatives[x * numberOfChannels + channel];
+            field[2 * x + 1] = yDerivatives[x * numberOfChannels + channel];
+          }
+        }
+      }
+    }, ParallelHelpers::GetMinimumRowsPerThread(width));
+
     return guidanceFields;
   }
 
@@ -101,8 +414,40 @@ public:
 
     return guidanceFields;
   }
+
+protected:
+  /** The storage of the global default solver. */
+  static SolverEnum& GlobalDefaultSolver()
+  {
+    static SolverEnum globalDefaultSolver = SolverEnum::LDLT;
+    return globalDefaultSolver;
+  }
+
+  /** The storage of the global default fill method. */
+  static FillMethodEnum& GlobalDefaultFillMethod()
+  {
+    static FillMethodEnum globalDefaultFillMethod = FillMethodEnum::POISSON;
+    return globalDefaultFillMethod;
+  }
+
+  /** The storage of the global default quantization step. */
+  static double& GlobalDefaultQuantizationStep()
+  {
+    static double globalDefaultQuantizationStep = 0.0;
+    return globalDefaultQuantizationStep;
+  }
+
+  /** The storage of the global memory budget. */
+  static std::size_t& GlobalMemoryBudget()
+  {
+    static std::size_t globalMemoryBudget = 0;
+    return globalMemoryBudget;
+  }
 };
 
+template <typename TPixel>
+class PoissonPlan;
+
 template <typename TPixel>
 class PoissonEditing : public PoissonEditingParent
 {
@@ -120,9 +465,13 @@ public:
 
   typedef itk::Image<TPixel, 2> ImageType;
 
-  /** Enumerate the potential fill methods. */
-  enum class FillMethodEnum {VARIATIONAL, POISSON};
-  FillMethodEnum FillMethod = FillMethodEnum::POISSON;
+  typedef Eigen::SparseMatrix<double> SparseMatrixType;
+
+  /** The fill method to use. */
+  FillMethodEnum FillMethod = GetGlobalDefaultFillMethod();
+
+  /** The solver to use. */
+  SolverEnum Solver = GetGlobalDefaultSolver();
 
   /** Construtor. */
   PoissonEditing();
@@ -130,39 +479,122 @@ public:
   /** Specify which method to use. */
   void SetFillMethod(FillMethodEnum fillMethod);
 
-  /** Specify the image to fill. */
-  void SetTargetImage(const ImageType* const targetImage);
-
-  /** Specify the source image. */
-  void SetSourceImage(const ImageType* const sourceImage);
-
-  /** Specify the region in which to fill the image. */
+  /** Specify which solver to use. */
+  void SetSolver(const SolverEnum solver);
+
+  /** Specify the spacing of the values that the output will be rounded to (for example 1 for 8-bit
+    * output). The iterative solvers then stop as soon as further iterations can not change any
+    * rounded pixel. 0 (the default) disables this. */
+  void SetQuantizationStep(const double quantizationStep);
+
+  /** Specify a starting point for the iterative solvers. Only the hole pixels are used. */
+  void SetInitialGuess(const ImageType* const initialGuess, const unsigned int channel = 0);
+
+  /** Get the number of iterations that the iterative solvers needed in the last fill (the largest
+    * over the channels and the connected components of the hole). This is 0 for LDLT, and the number of refinement steps for
+    * MIXED_PRECISION_LDLT. */
+  unsigned int GetNumberOfIterations() const;
+
+  /** Get the relative residual |AX - B| / |B| of the last fill (the largest over the channels and
+    * the connected components of the hole).
+    * Rectangular holes are solved exactly with sine transforms, and report 0. */
+  double GetRelativeResidual() const;
+
+  /** Collect the FillStatistics of the fills (false by default, in which case the fills do not read
+    * the clock). */
+  void SetCollectStatistics(const bool collectStatistics);
+
+  /** Get the statistics of the last fill. The times of the numbering, the assembly of the matrix
+    * and the factorization are 0 if the fill reused the plan of an earlier one. */
+  const FillStatistics& GetStatistics() const;
+
+  /** Specify the image to fill. Several images (for example the channels of a color image) that
+    * share the same mask can be filled together by giving each of them a different channel. The
+    * system matrix only depends on the mask, so it is then factorized once for all of the channels. */
+  void SetTargetImage(const ImageType* const targetImage, const unsigned int channel = 0);
+
+  /** Like SetTargetImage(), but use 'targetImage' without copying it. It must not change until the
+    * fill is finished. */
+  void SetTargetImageReference(const ImageType* const targetImage, const unsigned int channel = 0);
+
+  /** Write the result of 'channel' straight into 'output' instead of into an image that is allocated
+    * and initialized with a copy of the target image. Only the hole pixels of 'output' are written, so
+    * it must already hold the target image in the rest of the mask region. It may be the target
+    * image itself (passed to SetTargetImageReference()) to fill it in place. */
+  void SetOutputImage(ImageType* const output, const unsigned int channel = 0);
+
+  /** Specify the source image. It is only used by MEAN_VALUE_COORDINATES and MIXED_GRADIENTS. */
+  void SetSourceImage(const ImageType* const sourceImage, const unsigned int channel = 0);
+
+  /** Specify the region in which to fill the image. Only the bounding box of the hole and the ring of
+    * known pixels around it are kept. Everything that only depends on the mask (see PoissonPlan) is
+    * prepared in the next fill, and kept for the fills after it as long as the mask, the solver and
+    * the fill method stay the same. */
   void SetMask(const Mask* const mask);
 
-  /** Specify a guidance field. */
-  void SetGuidanceField(const GuidanceFieldType* const field);
+  /** Specify a guidance field. It is not copied: the next fill computes its Laplacian around the
+    * hole only, so it must not change until then. Channels that are given the same guidance field
+    * share this Laplacian. */
+  void SetGuidanceField(const GuidanceFieldType* const field, const unsigned int channel = 0);
 
-  /** Perform the filling. Use a discretization of the Poisson equation. */
+  /** Perform the filling of all of the channels. Use a discretization of the Poisson equation. */
   void FillMaskedRegion();
   void FillMaskedRegionNoColorCorrection();
 
-  /** If no source image is provided, use a zero guidance field. */
-  void SetGuidanceFieldToZero();
+  /** If no source image is provided, use a zero guidance field (which is the default). */
+  void SetGuidanceFieldToZero(const unsigned int channel = 0);
 
   /** Get the filled image. */
-  ImageType* GetOutput();
+  ImageType* GetOutput(const unsigned int channel = 0);
 
   /** Set the Laplacian. */
-  void SetLaplacian(FloatScalarImageType* const laplacian);
+  void SetLaplacian(FloatScalarImageType* const laplacian, const unsigned int channel = 0);
+
+  /** Get the number of channels that will be filled. */
+  unsigned int GetNumberOfChannels() const;
 
   /** Set the destination location of the source image in the target image. */
   void SetRegionToProcess(const itk::ImageRegion<2>& regionToProcess);
 
+  /** Build the 5-point Laplacian system for the hole pixels numbered in 'variableIds'. The rows of A
+    * are written straight into compressed storage, in parallel over the rows of the hole, and the
+    * right hand sides are filled in the same pass (column c of B is the right hand side of
+    * targetImages[c] and laplacians[c]). Known pixels of the target images that border the hole
+    * are moved to the right hand side. */
+  static void AssembleSystem(const VariableIdImage& variableIds,
+                             const std::vector<const ImageType*>& targetImages,
+                             const std::vector<const FloatImageType*>& laplacians,
+                             SparseMatrixType& A, Eigen::MatrixXd& B);
+
+  /** Build only the matrix of the system that AssembleSystem() builds. */
+  static void AssembleMatrix(const VariableIdImage& variableIds, SparseMatrixType& A);
+
+  /** Build only the right hand sides of the system that AssembleSystem() builds. This is all that
+    * the matrix-free solvers need. */
+  static void AssembleRightHandSide(const VariableIdImage& variableIds,
+                                    const std::vector<const ImageType*>& targetImages,
+                                    const std::vector<const FloatImageType*>& laplacians,
+                                    Eigen::MatrixXd& B);
+
+  /** Compute the Laplacian (the divergence) of a gradient image with central differences, reading
+    * the gradients and writing the Laplacian once. At the edges of the gradient image the missing
+    * neighbor is replaced by the pixel itself. */
+  static void LaplacianFromGradient(const GradientImageType* const gradientImage,
+                                    FloatImageType* const outputLaplacian);
+
+  /** Compute the Laplacian only in 'region', which must be inside of the gradient image. */
+  static void LaplacianFromGradient(const GradientImageType* const gradientImage,
+                                    const itk::ImageRegion<2>& region,
+                                    FloatImageType* const outputLaplacian);
+
 protected:
 
-  /** Compute the Laplacian from the Gradient. */
-  void LaplacianFromGradient(const GradientImageType* const gradientImage,
-                             FloatImageType* const outputLaplacian);
+  /** The implementation of AssembleSystem(), AssembleMatrix() and AssembleRightHandSide(). A and B
+    * are skipped if they are null. */
+  static void Assemble(const VariableIdImage& variableIds,
+                       const std::vector<const ImageType*>& targetImages,
+                       const std::vector<const FloatImageType*>& laplacians,
+                       SparseMatrixType* const A, Eigen::MatrixXd* const B);
 
   /** Specify an image to act as the source image. */
   void CreateGuidanceFieldFromImage(const FloatScalarImageType* const sourceImage);
@@ -171,23 +603,63 @@ protected:
     * filled on the boundary of the image. */
   bool VerifyMask() const;
 
-  /** The image in which to fill pixels. */
-  typename ImageType::Pointer TargetImage;
+  /** Get the region of the target image that an image with 'region' (a mask, a guidance field or a
+    * source image) covers once it is pasted at RegionToProcess. */
+  itk::ImageRegion<2> GetRegionInTarget(const itk::ImageRegion<2>& region) const;
+
+  /** Copy the part of 'image' (pasted at RegionToProcess) that overlaps 'output' into 'output', which
+    * is in the coordinates of the target image. */
+  template <typename TImage>
+  void CopyOverlap(const TImage* const image, TImage* const output) const;
+
+  /** Make sure there is storage for at least 'numberOfChannels' channels. */
+  void ResizeChannels(const unsigned int numberOfChannels);
 
-  /** The image from which to take pixels. */
-  typename ImageType::Pointer SourceImage;
+  /** Solve for all of the channels with the plan of the mask (which is computed first if it is out
+    * of date). */
+  void FillChannels();
 
-  /** The result of the algorithm. */
-  typename ImageType::Pointer Output;
+  /** The images in which to fill pixels (one per channel). These are either copies or the images
+    * that were passed to SetTargetImageReference(). */
+  std::vector<typename ImageType::ConstPointer> TargetImages;
 
-  /** The guidance field. */
-  Vector2ImageType::Pointer GuidanceField;
+  /** The images from which to take pixels. Their regions are where they are pasted in the target images. */
+  std::vector<typename ImageType::Pointer> SourceImages;
 
-  /** The image specifying which pixels to fill. */
+  /** The results of the algorithm, and whether they were passed to SetOutputImage() (and so are
+    * not initialized from the target images). */
+  std::vector<typename ImageType::Pointer> Outputs;
+  std::vector<bool> OutputIsProvided;
+
+  /** The guidance fields that were passed to SetGuidanceField(), or null for a zero field. */
+  std::vector<GuidanceFieldType::ConstPointer> GuidanceFields;
+
+  /** The image specifying which pixels to fill. It only covers the bounding box of the hole and a one
+    * pixel ring around it (inside of the target image), in the coordinates of the target image. All
+    * of the other working images (the Laplacians, the guidance fields they are computed from and the
+    * plan) are kept to this region as well. */
   Mask::Pointer MaskImage;
 
-  /** The Laplacian. */
-  FloatScalarImageType* Laplacian = nullptr;
+  /** Everything that only depends on MaskImage, and whether it was computed from the current MaskImage. */
+  std::shared_ptr<PoissonPlan<TPixel> > Plan;
+  bool PlanIsCurrent = false;
+
+  /** The Laplacians, if they were provided directly. */
+  std::vector<FloatScalarImageType*> Laplacians;
+
+  /** The starting points of the iterative solvers, if they were provided. */
+  std::vector<const ImageType*> InitialGuesses;
+
+  /** The spacing of the output values. */
+  double QuantizationStep = GetGlobalDefaultQuantizationStep();
+
+  /** The state of the solver at the end of the last fill. */
+  unsigned int NumberOfIterations = 0;
+  double RelativeResidual = 0.0;
+
+  /** Whether the statistics are collected, and those of the last fill. */
+  bool CollectStatistics = false;
+  FillStatistics Statistics;
 
   /** The region in which to do the Poisson processing.
     * For Poisson filling, this should be the full image.
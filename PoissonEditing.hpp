@@ -21,36 +21,59 @@
 
 #include "PoissonEditing.h" // Appease syntax parser
 
+#include "ParallelHelpers.h"
+#include "PoissonPlan.h"
+
 // Submodules
 #include "Helpers/Helpers.h"
 #include "ITKHelpers/ITKHelpers.h"
 
 // ITK
-#include "itkAddImageFilter.h"
 #include "itkImageRegionConstIterator.h"
-#include "itkComposeImageFilter.h"
-#include "itkLaplacianOperator.h"
 #include "itkLaplacianImageFilter.h"
-#include "itkVectorIndexSelectionCastImageFilter.h"
 
 // Eigen
 #include <Eigen/Sparse>
 
+// STL
+#include <algorithm>
+#include <limits>
+
 template <typename TPixel>
 PoissonEditing<TPixel>::PoissonEditing()
 {
-  this->TargetImage = ImageType::New();
-  this->SourceImage = ImageType::New();
-  this->Output = ImageType::New();
+  ResizeChannels(1);
 
-  this->GuidanceField = GuidanceFieldType::New();
   this->MaskImage = Mask::New();
+  this->Plan = std::make_shared<PoissonPlan<TPixel> >();
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::ResizeChannels(const unsigned int numberOfChannels)
+{
+  while(this->TargetImages.size() < numberOfChannels)
+  {
+    this->TargetImages.push_back(ImageType::New());
+    this->SourceImages.push_back(ImageType::New());
+    this->Outputs.push_back(ImageType::New());
+    this->OutputIsProvided.push_back(false);
+    this->GuidanceFields.push_back(nullptr);
+    this->Laplacians.push_back(nullptr);
+    this->InitialGuesses.push_back(nullptr);
+  }
 }
 
 template <typename TPixel>
-void PoissonEditing<TPixel>::SetLaplacian(FloatScalarImageType* const laplacian)
+unsigned int PoissonEditing<TPixel>::GetNumberOfChannels() const
 {
-  this->Laplacian = laplacian;
+  return this->TargetImages.size();
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::SetLaplacian(FloatScalarImageType* const laplacian, const unsigned int channel)
+{
+  ResizeChannels(channel + 1);
+  this->Laplacians[channel] = laplacian;
 }
 
 template <typename TPixel>
@@ -60,13 +83,76 @@ void PoissonEditing<TPixel>::SetFillMethod(FillMethodEnum fillMethod)
 }
 
 template <typename TPixel>
-void PoissonEditing<TPixel>::SetTargetImage(const ImageType* const targetImage)
+void PoissonEditing<TPixel>::SetSolver(const SolverEnum solver)
+{
+  this->Solver = solver;
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::SetQuantizationStep(const double quantizationStep)
+{
+  this->QuantizationStep = quantizationStep;
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::SetInitialGuess(const ImageType* const initialGuess, const unsigned int channel)
+{
+  ResizeChannels(channel + 1);
+  this->InitialGuesses[channel] = initialGuess;
+}
+
+template <typename TPixel>
+unsigned int PoissonEditing<TPixel>::GetNumberOfIterations() const
+{
+  return this->NumberOfIterations;
+}
+
+template <typename TPixel>
+double PoissonEditing<TPixel>::GetRelativeResidual() const
 {
-  ITKHelpers::DeepCopy(targetImage, this->TargetImage.GetPointer());
+  return this->RelativeResidual;
 }
 
 template <typename TPixel>
-void PoissonEditing<TPixel>::SetSourceImage(const ImageType* const sourceImage)
+void PoissonEditing<TPixel>::SetCollectStatistics(const bool collectStatistics)
+{
+  this->CollectStatistics = collectStatistics;
+}
+
+template <typename TPixel>
+const typename PoissonEditing<TPixel>::FillStatistics& PoissonEditing<TPixel>::GetStatistics() const
+{
+  return this->Statistics;
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::SetTargetImage(const ImageType* const targetImage, const unsigned int channel)
+{
+  ResizeChannels(channel + 1);
+
+  // The previous target of this channel may be a reference to an image of the caller, so never copy into it
+  typename ImageType::Pointer targetImageCopy = ImageType::New();
+  ITKHelpers::DeepCopy(targetImage, targetImageCopy.GetPointer());
+  this->TargetImages[channel] = targetImageCopy;
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::SetTargetImageReference(const ImageType* const targetImage, const unsigned int channel)
+{
+  ResizeChannels(channel + 1);
+  this->TargetImages[channel] = targetImage;
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::SetOutputImage(ImageType* const output, const unsigned int channel)
+{
+  ResizeChannels(channel + 1);
+  this->Outputs[channel] = output;
+  this->OutputIsProvided[channel] = true;
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::SetSourceImage(const ImageType* const sourceImage, const unsigned int channel)
 {
 //  ITKHelpers::DeepCopy(sourceImage, this->SourceImage.GetPointer());
 
@@ -75,44 +161,42 @@ void PoissonEditing<TPixel>::SetSourceImage(const ImageType* const sourceImage)
     throw std::runtime_error("RegionToProcess must be set before calling SetSourceImage!");
   }
 
-  if(!this->TargetImage->GetLargestPossibleRegion().IsInside(sourceImage->GetLargestPossibleRegion()))
+  if(!this->TargetImages[0]->GetLargestPossibleRegion().IsInside(sourceImage->GetLargestPossibleRegion()))
   {
     throw std::runtime_error("Guidance field must be smaller than the target image!");
   }
 
-  // Make the guidance field the same size as the target image, and copy the data to the requested location
-  this->SourceImage->SetRegions(this->TargetImage->GetLargestPossibleRegion());
-  this->SourceImage->Allocate();
-  ITKHelpers::SetImageToConstant(this->SourceImage.GetPointer(), 0);
+  ResizeChannels(channel + 1);
 
-  ITKHelpers::CopyRegion(sourceImage, this->SourceImage.GetPointer(), sourceImage->GetLargestPossibleRegion(),
-                         this->RegionToProcess);
+  // Keep the source where it is pasted: its region becomes RegionToProcess
+  if(sourceImage->GetLargestPossibleRegion().GetSize() != this->RegionToProcess.GetSize())
+  {
+    throw std::runtime_error("SourceImage must be the same size as RegionToProcess!");
+  }
+
+  ITKHelpers::DeepCopy(sourceImage, this->SourceImages[channel].GetPointer());
+  this->SourceImages[channel]->SetRegions(this->RegionToProcess);
 }
 
 template <typename TPixel>
-void PoissonEditing<TPixel>::SetGuidanceField(const GuidanceFieldType* const field)
+void PoissonEditing<TPixel>::SetGuidanceField(const GuidanceFieldType* const field, const unsigned int channel)
 {
   if(this->RegionToProcess.GetSize()[0] == 0 || this->RegionToProcess.GetSize()[1] == 0)
   {
     throw std::runtime_error("RegionToProcess must be set before calling SetGuidanceField!");
   }
 
-  if(!this->TargetImage->GetLargestPossibleRegion().IsInside(field->GetLargestPossibleRegion()))
+  if(!this->TargetImages[0]->GetLargestPossibleRegion().IsInside(field->GetLargestPossibleRegion()))
   {
     throw std::runtime_error("Guidance field must be smaller than the target image!");
   }
 
-  // Make the guidance field the same size as the target image, and copy the data to the requested location
-  this->GuidanceField->SetRegions(this->TargetImage->GetLargestPossibleRegion());
-  this->GuidanceField->Allocate();
+  ResizeChannels(channel + 1);
 
-  SetGuidanceFieldToZero();
-
-  ITKHelpers::CopyRegion(field, this->GuidanceField.GetPointer(), field->GetLargestPossibleRegion(),
-                         this->RegionToProcess);
+  // The field is only read around the hole when the Laplacian is computed in FillChannels()
+  this->GuidanceFields[channel] = field;
 
 //  ITKHelpers::WriteImage(field, "Field.mha");
-//  ITKHelpers::WriteImage(this->GuidanceField.GetPointer(), "GuidanceFieldSet.mha");
 }
 
 template <typename TPixel>
@@ -123,318 +207,481 @@ void PoissonEditing<TPixel>::SetMask(const Mask* const mask)
     throw std::runtime_error("RegionToProcess must be set before calling SetMask!");
   }
 
-  if(!this->TargetImage->GetLargestPossibleRegion().IsInside(mask->GetLargestPossibleRegion()))
+  if(!this->TargetImages[0]->GetLargestPossibleRegion().IsInside(mask->GetLargestPossibleRegion()))
   {
     throw std::runtime_error("Guidance field must be smaller than the target image!");
   }
 
-  // Make the mask field the same size as the target image, and copy the data to the requested location
-  this->MaskImage->SetRegions(this->TargetImage->GetLargestPossibleRegion());
-  this->MaskImage->Allocate();
-  ITKHelpers::SetImageToConstant(this->MaskImage.GetPointer(), HoleMaskPixelTypeEnum::VALID);
+  // Find the bounding box of the hole
+  const itk::ImageRegion<2> maskRegion = mask->GetLargestPossibleRegion();
+  itk::Index<2> minimum = maskRegion.GetUpperIndex();
+  itk::Index<2> maximum = maskRegion.GetIndex();
+  bool hasHole = false;
+  itk::ImageRegionConstIterator<Mask> holeIterator(mask, maskRegion);
+  while(!holeIterator.IsAtEnd())
+  {
+    if(holeIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+    {
+      for(unsigned int dimension = 0; dimension < 2; ++dimension)
+      {
+        minimum[dimension] = std::min(minimum[dimension], holeIterator.GetIndex()[dimension]);
+        maximum[dimension] = std::max(maximum[dimension], holeIterator.GetIndex()[dimension]);
+      }
+      hasHole = true;
+    }
+    ++holeIterator;
+  }
+
+  // Only keep the bounding box and the ring of known pixels around it that the stencil reaches, in
+  // the coordinates of the target image. Without a hole the region stays empty.
+  itk::ImageRegion<2> workingRegion;
+  if(hasHole)
+  {
+    const itk::Offset<2> maskToTarget = this->RegionToProcess.GetIndex() - maskRegion.GetIndex();
+    const itk::Size<2> holeSize = {{static_cast<itk::SizeValueType>(maximum[0] - minimum[0] + 1),
+                                    static_cast<itk::SizeValueType>(maximum[1] - minimum[1] + 1)}};
+    workingRegion = itk::ImageRegion<2>(minimum + maskToTarget, holeSize);
+    workingRegion.PadByRadius(1);
+    workingRegion.Crop(this->TargetImages[0]->GetLargestPossibleRegion());
+  }
+
+  Mask::Pointer maskImage = Mask::New();
+  maskImage->SetRegions(workingRegion);
+  maskImage->Allocate();
+  ITKHelpers::SetImageToConstant(maskImage.GetPointer(), HoleMaskPixelTypeEnum::VALID);
+  CopyOverlap(mask, maskImage.GetPointer());
+
+  // The plan of the previous mask can be kept if the hole did not change
+  if(this->PlanIsCurrent &&
+     maskImage->GetLargestPossibleRegion() == this->MaskImage->GetLargestPossibleRegion())
+  {
+    itk::ImageRegionConstIterator<Mask> maskIterator(maskImage, maskImage->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator<Mask> previousMaskIterator(this->MaskImage, maskImage->GetLargestPossibleRegion());
+    while(!maskIterator.IsAtEnd() &&
+          (maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE) == (previousMaskIterator.Get() == HoleMaskPixelTypeEnum::HOLE))
+    {
+      ++maskIterator;
+      ++previousMaskIterator;
+    }
+    this->PlanIsCurrent = maskIterator.IsAtEnd();
+  }
+  else
+  {
+    this->PlanIsCurrent = false;
+  }
 
-  ITKHelpers::CopyRegion(mask, this->MaskImage.GetPointer(), mask->GetLargestPossibleRegion(),
-                         this->RegionToProcess);
+  this->MaskImage = maskImage;
 }
 
 template <typename TPixel>
-void PoissonEditing<TPixel>::SetGuidanceFieldToZero()
+void PoissonEditing<TPixel>::SetGuidanceFieldToZero(const unsigned int channel)
 {
-  // In the hole filling problem, we want the guidance field fo be zero
-  this->GuidanceField->SetRegions(this->TargetImage->GetLargestPossibleRegion());
-  this->GuidanceField->Allocate();
-  this->GuidanceField->FillBuffer(itk::NumericTraits<typename GuidanceFieldType::PixelType>::Zero);
+  ResizeChannels(channel + 1);
+
+  // In the hole filling problem, we want the guidance field fo be zero.
+  this->GuidanceFields[channel] = nullptr;
 }
 
 template <typename TPixel>
-void PoissonEditing<TPixel>::FillMaskedRegion()
+itk::ImageRegion<2> PoissonEditing<TPixel>::GetRegionInTarget(const itk::ImageRegion<2>& region) const
 {
-  // Create a map that stores the ID of each hole pixel
-  typedef std::map<itk::Index<2>, unsigned int, itk::Index<2>::LexicographicCompare> VariableIdMapType;
-  VariableIdMapType variableIdMap;
-
-  itk::ImageRegionIterator<Mask> maskIterator(this->MaskImage, this->MaskImage->GetLargestPossibleRegion());
+  return itk::ImageRegion<2>(this->RegionToProcess.GetIndex(), region.GetSize());
+}
 
-  while(!maskIterator.IsAtEnd())
+template <typename TPixel>
+template <typename TImage>
+void PoissonEditing<TPixel>::CopyOverlap(const TImage* const image, TImage* const output) const
+{
+  itk::ImageRegion<2> overlap = GetRegionInTarget(image->GetLargestPossibleRegion());
+  if(!overlap.Crop(output->GetLargestPossibleRegion()))
   {
-    itk::Index<2> pixelIndex = maskIterator.GetIndex();
+    return;
+  }
 
-    if(this->MaskImage->IsHole(pixelIndex))
+  itk::ImageRegion<2> imageOverlap = overlap;
+  imageOverlap.SetIndex(image->GetLargestPossibleRegion().GetIndex() + (overlap.GetIndex() - this->RegionToProcess.GetIndex()));
+  ITKHelpers::CopyRegion(image, output, imageOverlap, overlap);
+}
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::FillMaskedRegion()
+{
+  for(unsigned int channel = 0; channel < GetNumberOfChannels(); ++channel)
+  {
+    if(this->SourceImages[channel]->GetLargestPossibleRegion().GetSize()[0] != 0)
     {
-      //std::cout << "Adding variable " << variableIdMap.size() << std::endl;
-      // Add the pixel to the map, with ID equal to the next sequential integer.
-      variableIdMap.insert(VariableIdMapType::value_type(pixelIndex, variableIdMap.size()));
+      if(!this->TargetImages[0]->GetLargestPossibleRegion().IsInside(this->SourceImages[channel]->GetLargestPossibleRegion()))
+      {
+        std::cerr << "SourceImage is not inside the target image!"
+                  << "SourceImage region: " << this->SourceImages[channel]->GetLargestPossibleRegion() << std::endl
+                  << "Target image region: " << this->TargetImages[0]->GetLargestPossibleRegion() << std::endl
+                  << std::endl;
+        return;
+      }
     }
-    ++maskIterator;
   }
 
-  if(variableIdMap.size() == 0)
-  {
-    std::cerr << "PoissonEditing::FillMaskedRegion(): No masked pixels found!" << std::endl;
-    return;
-  }
+  FillChannels();
+} // end FillMaskedRegion
 
-  // Create a 3x3 Laplacian kernel
-  typedef itk::LaplacianOperator<float, 2> LaplacianOperatorType;
-  LaplacianOperatorType laplacianOperator;
-  itk::Size<2> radius;
-  radius.Fill(1);
-  laplacianOperator.CreateToRadius(radius);
-  unsigned int numberOfPixelsInKernel = laplacianOperator.GetSize()[0] * laplacianOperator.GetSize()[1];
-
-  // Create the sparse matrix
-  typedef Eigen::SparseMatrix<double> SparseMatrixType;
-  SparseMatrixType A(variableIdMap.size(), variableIdMap.size());
-  A.reserve(Eigen::VectorXi::Constant(variableIdMap.size(),5));
-
-  // Create the right-hand-side vector
-  Eigen::VectorXd b(variableIdMap.size());
-
-  // Create a laplacian image from the provided gradient field if it is not provided directly
-  FloatImageType::Pointer laplacian = FloatImageType::New();
-  laplacian->SetRegions(this->MaskImage->GetLargestPossibleRegion());
-  laplacian->Allocate();
-  if(!this->Laplacian)
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::FillMaskedRegionNoColorCorrection()
+{
+  //ITKHelpers::WriteImage(this->TargetImage, "FillMaskedRegion_TargetImage.mha");
+  //ITKHelpers::WriteImage(this->Output, "InitializedOutput.mha");
+
+  FillChannels();
+} // end FillMaskedRegionNoColorCorrection
+
+
+template <typename TPixel>
+void PoissonEditing<TPixel>::FillChannels()
+{
+  this->Statistics = FillStatistics();
+
+  // Number the hole pixels and prepare its solvers, unless this was already done for the same hole
+  // (with its statistics, if they are collected)
+  const bool computePlan = !this->PlanIsCurrent || this->Plan->GetSolver() != this->Solver ||
+                           this->Plan->GetFillMethod() != this->FillMethod ||
+                           (this->CollectStatistics && !this->Plan->GetCollectStatistics());
+  if(computePlan)
   {
-    std::cout << "Computing Laplacian from provided GuidanceField..." << std::endl;
-    //ITKHelpers::WriteImage(this->GuidanceField.GetPointer(), "guidance.mha");
-    LaplacianFromGradient(this->GuidanceField, laplacian);
+    this->Plan->SetSolver(this->Solver);
+    this->Plan->SetFillMethod(this->FillMethod);
+    this->Plan->SetCollectStatistics(this->CollectStatistics);
+    this->Plan->Compute(this->MaskImage);
+    this->PlanIsCurrent = true;
   }
-  else
+
+  if(this->Plan->GetNumberOfVariables() == 0)
   {
-    std::cout << "Using provided Laplacian..." << std::endl;
-    ITKHelpers::DeepCopy(this->Laplacian, laplacian.GetPointer());
+    std::cerr << "PoissonEditing::FillMaskedRegion(): No masked pixels found!" << std::endl;
+    return;
   }
 
-  //ITKHelpers::WriteImage(laplacian.GetPointer(), "laplacian.mha");
+  const unsigned int numberOfChannels = GetNumberOfChannels();
 
-  if(this->SourceImage->GetLargestPossibleRegion().GetSize()[0] != 0)
+  // Create a laplacian image from the provided gradient field if it is not provided directly.
+  // It is only read at the hole pixels, so it is computed in the region of the mask (the bounding box
+  // of the hole and the ring around it, which the central differences reach). Channels that share a
+  // guidance field also share its Laplacian, which is computed by the first of them.
+  const bool usesGuidanceField = this->FillMethod != FillMethodEnum::MEAN_VALUE_COORDINATES &&
+                                 this->FillMethod != FillMethodEnum::MIXED_GRADIENTS;
+  std::vector<unsigned int> laplacianChannels(numberOfChannels);
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
   {
-    if(this->SourceImage->GetLargestPossibleRegion().GetSize() !=
-       laplacian->GetLargestPossibleRegion().GetSize())
+    laplacianChannels[channel] = channel;
+    if(this->Laplacians[channel] || !usesGuidanceField)
     {
-      std::cerr << "SourceImage and laplacian are not the same size!"
-                << "SourceImage size: " << this->SourceImage->GetLargestPossibleRegion().GetSize() << std::endl
-                << "laplacian size: " << laplacian->GetLargestPossibleRegion().GetSize() << std::endl
-                << "GuidanceField size: " << this->GuidanceField->GetLargestPossibleRegion().GetSize() << std::endl
-                << std::endl;
-      return;
+      continue; // the interpolation and the mixed gradients do not use the Laplacian
     }
-  }
 
-  // Create the row of the matrix for each pixel
-  for(VariableIdMapType::const_iterator iter = variableIdMap.begin(); iter != variableIdMap.end(); ++iter)
-  {
-    //std::cout << "Creating equation for variable " << iter->second << std::endl;
-    itk::Index<2> originalPixel = iter->first;
-    unsigned int variableId = iter->second;
-
-    // The right hand side of the equation starts equal to the value of the guidance field
-    double bvalue = laplacian->GetPixel(originalPixel);
-
-    // Loop over the kernel around the current pixel
-    for(unsigned int offset = 0; offset < numberOfPixelsInKernel; ++offset)
+    for(unsigned int otherChannel = 0; otherChannel < channel; ++otherChannel)
     {
-      if(laplacianOperator.GetElement(offset) == 0)
+      if(!this->Laplacians[otherChannel] &&
+         this->GuidanceFields[otherChannel] == this->GuidanceFields[channel])
       {
-        continue; // this pixel isn't going to contribute anyway
+        laplacianChannels[channel] = otherChannel;
+        break;
       }
+    }
 
-      itk::Index<2> currentPixel = originalPixel + laplacianOperator.GetOffset(offset);
+    if(laplacianChannels[channel] == channel)
+    {
+      std::cout << "Computing Laplacian from provided GuidanceField..." << std::endl;
+    }
+  }
 
-      if(!this->MaskImage->GetLargestPossibleRegion().IsInside(currentPixel))
-      {
-        continue; // this pixel is on the border, just ignore it.
-      }
+  // The channels are independent until they are solved, so the outputs that were not provided are
+  // initialized concurrently (by copying the target image into them), and then their Laplacians are
+  // computed concurrently. Pixels that are not filled will remain the same in the output.
+  PhaseTimer timer(this->CollectStatistics);
+  double copyInTime = 0.0;
+  ParallelHelpers::ParallelForDynamic(numberOfChannels, [&](const std::size_t channel)
+  {
+    if(!this->OutputIsProvided[channel])
+    {
+      ITKHelpers::DeepCopy(this->TargetImages[channel].GetPointer(), this->Outputs[channel].GetPointer());
+    }
+  });
+  timer.Lap(copyInTime);
 
-      if(this->MaskImage->IsHole(currentPixel))
-      {
-        // If the pixel is masked, add it as part of the unknown matrix
-        double value = laplacianOperator.GetElement(offset);
-        A.coeffRef(variableId, variableIdMap[currentPixel]) += value;
-      }
-      else
-      {
-        // If the pixel is known, move its contribution to the known (right) side of the equation
-        bvalue -= this->TargetImage->GetPixel(currentPixel) * laplacianOperator.GetElement(offset);
-      }
+  double laplacianTime = 0.0;
+  std::vector<FloatImageType::Pointer> laplacians(numberOfChannels);
+  ParallelHelpers::ParallelForDynamic(numberOfChannels, [&](const std::size_t channel)
+  {
+    if(this->Laplacians[channel])
+    {
+      laplacians[channel] = this->Laplacians[channel];
+      return;
     }
-    b[variableId] = bvalue;
-  }// end for variables
 
-  // Solve the (symmetric) system
-  Eigen::SimplicialLDLT<SparseMatrixType> sparseSolver(A);
-  Eigen::VectorXd x = sparseSolver.solve(b);
-  if(sparseSolver.info() != Eigen::Success)
+    if(!usesGuidanceField || laplacianChannels[channel] != channel)
+    {
+      return;
+    }
+
+    //ITKHelpers::WriteImage(this->GuidanceField.GetPointer(), "guidance.mha");
+    FloatImageType::Pointer laplacian = FloatImageType::New();
+    laplacian->SetRegions(this->MaskImage->GetLargestPossibleRegion());
+    laplacian->Allocate();
+    laplacians[channel] = laplacian;
+    if(!this->GuidanceFields[channel])
+    {
+      laplacian->FillBuffer(0.0f);
+      return;
+    }
+
+    // The field is zero outside of where it is pasted
+    GuidanceFieldType::Pointer guidanceField = GuidanceFieldType::New();
+    guidanceField->SetRegions(this->MaskImage->GetLargestPossibleRegion());
+    guidanceField->Allocate();
+    guidanceField->FillBuffer(itk::NumericTraits<GuidanceFieldType::PixelType>::Zero);
+    CopyOverlap(this->GuidanceFields[channel].GetPointer(), guidanceField.GetPointer());
+    LaplacianFromGradient(guidanceField, laplacian);
+  });
+
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
   {
-    throw std::runtime_error("Decomposition failed!");
+    laplacians[channel] = laplacians[laplacianChannels[channel]];
   }
+  timer.Lap(laplacianTime);
 
-  // Convert solution vector back to image
-  // Initialize the output by copying the target image into the output.
-  // Pixels that are not filled will remain the same in the output.
-  ITKHelpers::DeepCopy(this->TargetImage.GetPointer(), this->Output.GetPointer());
+  //ITKHelpers::WriteImage(laplacian.GetPointer(), "laplacian.mha");
 
-  for(VariableIdMapType::const_iterator iter = variableIdMap.begin(); iter != variableIdMap.end(); ++iter)
+  std::vector<const ImageType*> targetImages(this->TargetImages.begin(), this->TargetImages.end());
+  std::vector<const FloatImageType*> laplacianImages(laplacians.begin(), laplacians.end());
+  std::vector<ImageType*> outputs(numberOfChannels);
+  std::vector<const ImageType*> sourceImages(numberOfChannels, nullptr);
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
   {
-    this->Output->SetPixel(iter->first, x(iter->second));
+    outputs[channel] = this->Outputs[channel];
+    if(this->SourceImages[channel]->GetLargestPossibleRegion().GetNumberOfPixels() > 0)
+    {
+      sourceImages[channel] = this->SourceImages[channel];
+    }
   }
-} // end FillMaskedRegion
 
+  this->Plan->SetQuantizationStep(this->QuantizationStep);
+  this->Plan->Execute(targetImages, laplacianImages, outputs, sourceImages, this->InitialGuesses);
+
+  this->NumberOfIterations = this->Plan->GetNumberOfIterations();
+  this->RelativeResidual = this->Plan->GetRelativeResidual();
+
+  if(this->CollectStatistics)
+  {
+    // The counters of the hole come from the plan, but the times of its preparation only belong to
+    // the fill that prepared it
+    this->Statistics = this->Plan->GetComputeStatistics();
+    if(!computePlan)
+    {
+      this->Statistics.MaskScanTime = 0.0;
+      this->Statistics.AssemblyTime = 0.0;
+      this->Statistics.FactorizationTime = 0.0;
+    }
+    this->Statistics += this->Plan->GetExecuteStatistics();
+    this->Statistics.CopyInTime = copyInTime;
+    this->Statistics.LaplacianTime = laplacianTime;
+    this->Statistics.NumberOfChannels = numberOfChannels;
+    this->Statistics.NumberOfIterations = this->NumberOfIterations;
+    this->Statistics.RelativeResidual = this->RelativeResidual;
+  }
+} // end FillChannels
 
 template <typename TPixel>
-void PoissonEditing<TPixel>::FillMaskedRegionNoColorCorrection()
+void PoissonEditing<TPixel>::AssembleSystem(const VariableIdImage& variableIds,
+                                            const std::vector<const ImageType*>& targetImages,
+                                            const std::vector<const FloatImageType*>& laplacians,
+                                            SparseMatrixType& A, Eigen::MatrixXd& B)
 {
-  //ITKHelpers::WriteImage(this->TargetImage, "FillMaskedRegion_TargetImage.mha");
-  //ITKHelpers::WriteImage(this->Output, "InitializedOutput.mha");
+  Assemble(variableIds, targetImages, laplacians, &A, &B);
+}
 
-  // Create a map that stores the ID of each hole pixel
-  typedef std::map<itk::Index<2>, unsigned int, itk::Index<2>::LexicographicCompare> VariableIdMapType;
-  VariableIdMapType variableIdMap;
+template <typename TPixel>
+void PoissonEditing<TPixel>::AssembleMatrix(const VariableIdImage& variableIds, SparseMatrixType& A)
+{
+  Assemble(variableIds, std::vector<const ImageType*>(), std::vector<const FloatImageType*>(), &A, nullptr);
+}
 
-  itk::ImageRegionIterator<Mask> maskIterator(this->MaskImage, this->MaskImage->GetLargestPossibleRegion());
+template <typename TPixel>
+void PoissonEditing<TPixel>::AssembleRightHandSide(const VariableIdImage& variableIds,
+                                                   const std::vector<const ImageType*>& targetImages,
+                                                   const std::vector<const FloatImageType*>& laplacians,
+                                                   Eigen::MatrixXd& B)
+{
+  Assemble(variableIds, targetImages, laplacians, nullptr, &B);
+}
 
-  while(!maskIterator.IsAtEnd())
+template <typename TPixel>
+void PoissonEditing<TPixel>::Assemble(const VariableIdImage& variableIds,
+                                      const std::vector<const ImageType*>& targetImages,
+                                      const std::vector<const FloatImageType*>& laplacians,
+                                      SparseMatrixType* const A, Eigen::MatrixXd* const B)
+{
+  const unsigned int numberOfVariables = variableIds.GetNumberOfVariables();
+  const unsigned int numberOfChannels = targetImages.size();
+  const std::vector<int>& ids = variableIds.GetIds();
+  const itk::ImageRegion<2> imageRegion = B ? targetImages[0]->GetLargestPossibleRegion() : itk::ImageRegion<2>();
+  const std::size_t width = variableIds.GetRegion().GetSize()[0];
+  const std::size_t height = variableIds.GetRegion().GetSize()[1];
+
+  // The 5-point stencil, in the order (up, left, center, right, down). Variables are numbered in
+  // raster order, so the column ids of a row come out of this loop already sorted.
+  const itk::Offset<2> stencilOffsets[5] = {{{0, -1}}, {{-1, 0}}, {{0, 0}}, {{1, 0}}, {{0, 1}}};
+  const double stencilWeights[5] = {1.0, 1.0, -4.0, 1.0, 1.0};
+
+  // Get the id of the stencil neighbor of the pixel at (x,y) in the id buffer, or -1 if it is not a hole pixel.
+  // Pixels outside of the bounding box are never hole pixels.
+  auto getNeighborId = [&](const std::size_t x, const std::size_t y, const unsigned int neighbor) -> int
   {
-    itk::Index<2> pixelIndex = maskIterator.GetIndex();
-
-    if(this->MaskImage->IsHole(pixelIndex))
+    const itk::Offset<2>& offset = stencilOffsets[neighbor];
+    if((offset[0] < 0 && x == 0) || (offset[0] > 0 && x + 1 == width) ||
+       (offset[1] < 0 && y == 0) || (offset[1] > 0 && y + 1 == height))
     {
-      //std::cout << "Adding variable " << variableIdMap.size() << std::endl;
-      // Add the pixel to the map, with ID equal to the next sequential integer.
-      variableIdMap.insert(VariableIdMapType::value_type(pixelIndex, variableIdMap.size()));
+      return -1;
     }
-    ++maskIterator;
-  }
+    return ids[(y + offset[1]) * width + x + offset[0]];
+  };
 
-  if(variableIdMap.size() == 0)
+  if(B)
   {
-    std::cerr << "PoissonEditing::FillMaskedRegion(): No masked pixels found!" << std::endl;
-    return;
+    B->resize(numberOfVariables, numberOfChannels);
   }
 
-  // Create a 3x3 Laplacian kernel
-  typedef itk::LaplacianOperator<float, 2> LaplacianOperatorType;
-  LaplacianOperatorType laplacianOperator;
-  itk::Size<2> radius;
-  radius.Fill(1);
-  laplacianOperator.CreateToRadius(radius);
-  unsigned int numberOfPixelsInKernel = laplacianOperator.GetSize()[0] * laplacianOperator.GetSize()[1];
-
-  // Create the sparse matrix
-  typedef Eigen::SparseMatrix<double> SparseMatrixType;
-  SparseMatrixType A(variableIdMap.size(), variableIdMap.size());
-  A.reserve(Eigen::VectorXi::Constant(variableIdMap.size(),5));
-
-  // Create the right-hand-side vector
-  Eigen::VectorXd b(variableIdMap.size());
-
-  // Create a laplacian image from the provided gradient field if it is not provided directly
-  FloatImageType::Pointer laplacian = FloatImageType::New();
-  laplacian->SetRegions(this->MaskImage->GetLargestPossibleRegion());
-  laplacian->Allocate();
-  if(!this->Laplacian)
-  {
-    LaplacianFromGradient(this->GuidanceField, laplacian);
-  }
-  else
+  // The matrix is symmetric, so we can write each row directly as a column of the
+  // (column major) compressed storage.
+  int* outerIndex = nullptr;
+  int* innerIndex = nullptr;
+  double* values = nullptr;
+  if(A)
   {
-    ITKHelpers::DeepCopy(this->Laplacian, laplacian.GetPointer());
-  }
+    A->resize(numberOfVariables, numberOfVariables);
+    outerIndex = A->outerIndexPtr();
+    outerIndex[0] = 0;
 
-  //ITKHelpers::WriteImage(laplacian.GetPointer(), "laplacian.mha");
+    // Count the non-zeros of each row
+    ParallelHelpers::ParallelFor(height, [&](const std::size_t y)
+    {
+      for(std::size_t x = 0; x < width; ++x)
+      {
+        const int variableId = ids[y * width + x];
+        if(variableId < 0)
+        {
+          continue; // this pixel is not part of the hole
+        }
+
+        int numberOfNonZeros = 0;
+        for(unsigned int neighbor = 0; neighbor < 5; ++neighbor)
+        {
+          if(getNeighborId(x, y, neighbor) >= 0)
+          {
+            ++numberOfNonZeros;
+          }
+        }
+        outerIndex[variableId + 1] = numberOfNonZeros;
+      }
+    }, ParallelHelpers::GetMinimumRowsPerThread(width));
 
-  // Create the row of the matrix for each pixel
-  for(VariableIdMapType::const_iterator iter = variableIdMap.begin(); iter != variableIdMap.end(); ++iter)
-  {
-    //std::cout << "Creating equation for variable " << iter->second << std::endl;
-    itk::Index<2> originalPixel = iter->first;
-    unsigned int variableId = iter->second;
-    //std::cout << "originalPixel " << originalPixel << std::endl;
+    for(unsigned int variableId = 0; variableId < numberOfVariables; ++variableId)
+    {
+      outerIndex[variableId + 1] += outerIndex[variableId];
+    }
 
-    // The right hand side of the equation starts equal to the value of the guidance field
-    double bvalue = laplacian->GetPixel(originalPixel);
+    A->resizeNonZeros(outerIndex[numberOfVariables]);
+    innerIndex = A->innerIndexPtr();
+    values = A->valuePtr();
+  }
 
-    // Loop over the kernel around the current pixel
-    for(unsigned int offset = 0; offset < numberOfPixelsInKernel; ++offset)
+  // Write the entries of each row and its right hand sides
+  ParallelHelpers::ParallelFor(height, [&](const std::size_t y)
+  {
+    for(std::size_t x = 0; x < width; ++x)
     {
-      if(laplacianOperator.GetElement(offset) == 0)
+      const std::size_t idOffset = y * width + x;
+      const int variableId = ids[idOffset];
+      if(variableId < 0)
       {
-        continue; // this pixel isn't going to contribute anyway
+        continue; // this pixel is not part of the hole
       }
 
-      itk::Index<2> currentPixel = originalPixel + laplacianOperator.GetOffset(offset);
+      const itk::Index<2> pixel = variableIds.GetPixel(idOffset);
 
-      if(!this->MaskImage->GetLargestPossibleRegion().IsInside(currentPixel))
-      {
-        continue; // this pixel is on the border, just ignore it.
-      }
+      // The known neighbors, whose values move to the right hand side
+      itk::Index<2> knownPixels[4];
+      unsigned int numberOfKnownPixels = 0;
 
-      if(this->MaskImage->IsHole(currentPixel))
+      int entry = A ? outerIndex[variableId] : 0;
+      for(unsigned int neighbor = 0; neighbor < 5; ++neighbor)
       {
-        // If the pixel is masked, add it as part of the unknown matrix
-        double value = laplacianOperator.GetElement(offset);
-//        A.insert(variableId, variableIdMap[currentPixel]) += laplacianOperator.GetElement(offset);
-        A.coeffRef(variableId, variableIdMap[currentPixel]) += value;
+        const int neighborId = getNeighborId(x, y, neighbor);
+        if(neighborId >= 0)
+        {
+          // If the pixel is masked, add it as part of the unknown matrix
+          if(A)
+          {
+            innerIndex[entry] = neighborId;
+            values[entry] = stencilWeights[neighbor];
+            ++entry;
+          }
+        }
+        else
+        {
+          const itk::Index<2> neighborPixel = pixel + stencilOffsets[neighbor];
+          if(imageRegion.IsInside(neighborPixel)) // pixels outside of the image are ignored
+          {
+            knownPixels[numberOfKnownPixels++] = neighborPixel;
+          }
+        }
       }
-      else
+
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
       {
-        // If the pixel is known, move its contribution to the known (right) side of the equation
-        bvalue -= this->TargetImage->GetPixel(currentPixel) * laplacianOperator.GetElement(offset);
+        // The right hand side of the equation starts equal to the value of the guidance field
+        double bValue = laplacians[channel]->GetPixel(pixel);
+
+        // If the pixel is known, move its contribution to the known (right) side of the equation.
+        // All of the neighbor weights are 1.
+        for(unsigned int knownPixel = 0; knownPixel < numberOfKnownPixels; ++knownPixel)
+        {
+          bValue -= targetImages[channel]->GetPixel(knownPixels[knownPixel]);
+        }
+        (*B)(variableId, channel) = bValue;
       }
     }
-    b[variableId] = bvalue;
-  }// end for variables
-
-  // Solve the (symmetric) system
-  Eigen::SimplicialLDLT<SparseMatrixType> sparseSolver(A);
-  Eigen::VectorXd x = sparseSolver.solve(b);
-  if(sparseSolver.info() != Eigen::Success)
-  {
-    throw std::runtime_error("Decomposition failed!");
-  }
-
-  // Convert solution vector back to image
-  // Initialize the output by copying the target image into the output.
-  // Pixels that are not filled will remain the same in the output.
-  ITKHelpers::DeepCopy(this->TargetImage.GetPointer(), this->Output.GetPointer());
-
-  for(VariableIdMapType::const_iterator iter = variableIdMap.begin(); iter != variableIdMap.end(); ++iter)
-  {
-    this->Output->SetPixel(iter->first, x(iter->second));
-  }
-} // end FillMaskedRegion
-
+  }, ParallelHelpers::GetMinimumRowsPerThread(width));
+}
 
 template <typename TPixel>
-typename PoissonEditing<TPixel>::ImageType* PoissonEditing<TPixel>::GetOutput()
+typename PoissonEditing<TPixel>::ImageType* PoissonEditing<TPixel>::GetOutput(const unsigned int channel)
 {
-  return this->Output;
+  return this->Outputs[channel];
 }
 
 template <typename TPixel>
 bool PoissonEditing<TPixel>::VerifyMask() const
 {
-  // This function checks that the mask is the same size as the image and that
-  // there is no mask on the boundary.
+  // This function checks that the mask is inside of the image and that
+  // there is no mask on the boundary of the image.
 
-  // Verify that the image and the mask are the same size
-  if(this->SourceImage->GetLargestPossibleRegion().GetSize() != this->MaskImage->GetLargestPossibleRegion().GetSize())
+  // Verify that the mask (which only covers the hole and the ring around it) is inside of the image
+  if(!this->TargetImages[0]->GetLargestPossibleRegion().IsInside(this->MaskImage->GetLargestPossibleRegion()))
   {
-    std::cout << "Image size: " << this->SourceImage->GetLargestPossibleRegion().GetSize() << std::endl;
-    std::cout << "Mask size: " << this->MaskImage->GetLargestPossibleRegion().GetSize() << std::endl;
+    std::cout << "Image region: " << this->TargetImages[0]->GetLargestPossibleRegion() << std::endl;
+    std::cout << "Mask region: " << this->MaskImage->GetLargestPossibleRegion() << std::endl;
     return false;
   }
 
   // Verify that no border pixels are masked
+  const itk::ImageRegion<2> imageRegion = this->TargetImages[0]->GetLargestPossibleRegion();
   itk::ImageRegionConstIterator<Mask> maskIterator(this->MaskImage, this->MaskImage->GetLargestPossibleRegion());
 
   while(!maskIterator.IsAtEnd())
   {
-    if(maskIterator.GetIndex()[0] == 0 ||
-       static_cast<unsigned int>(maskIterator.GetIndex()[0]) == this->MaskImage->GetLargestPossibleRegion().GetSize()[0]-1 ||
-       maskIterator.GetIndex()[1] == 0 ||
-       static_cast<unsigned int>(maskIterator.GetIndex()[1]) == this->MaskImage->GetLargestPossibleRegion().GetSize()[1]-1)
+    if(maskIterator.GetIndex()[0] == imageRegion.GetIndex()[0] ||
+       maskIterator.GetIndex()[0] == imageRegion.GetUpperIndex()[0] ||
+       maskIterator.GetIndex()[1] == imageRegion.GetIndex()[1] ||
+       maskIterator.GetIndex()[1] == imageRegion.GetUpperIndex()[1])
     {
       if(maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
       {
@@ -467,33 +714,65 @@ void
 PoissonEditing<TPixel>::LaplacianFromGradient(const typename PoissonEditing<TPixel>::GradientImageType* const gradientImage,
                                               FloatImageType* const outputLaplacian)
 {
-  typedef itk::VectorIndexSelectionCastImageFilter<GradientImageType, FloatImageType> IndexSelectionType;
-  
-  IndexSelectionType::Pointer xIndexSelectionFilter = IndexSelectionType::New();
-  xIndexSelectionFilter->SetIndex(0);
-  xIndexSelectionFilter->SetInput(gradientImage);
-  xIndexSelectionFilter->Update();
-
-  // The the x derivative of the x derivative (second x partial)
-  FloatImageType::Pointer xSecondDerivative = FloatImageType::New();
-  ITKHelpers::CentralDifferenceDerivative(xIndexSelectionFilter->GetOutput(), 0, xSecondDerivative.GetPointer());
-  
-  IndexSelectionType::Pointer yIndexSelectionFilter = IndexSelectionType::New();
-  yIndexSelectionFilter->SetIndex(1);
-  yIndexSelectionFilter->SetInput(gradientImage);
-  yIndexSelectionFilter->Update();
-
-  // The the y derivative of the y derivative (second y partial)
-  FloatImageType::Pointer ySecondDerivative = FloatImageType::New();
-  ITKHelpers::CentralDifferenceDerivative(yIndexSelectionFilter->GetOutput(), 1, ySecondDerivative.GetPointer());
-  
-  typedef itk::AddImageFilter<FloatImageType, FloatImageType> AddImageFilterType;
-  AddImageFilterType::Pointer addFilter = AddImageFilterType::New ();
-  addFilter->SetInput1(xSecondDerivative);
-  addFilter->SetInput2(ySecondDerivative);
-  addFilter->Update();
-
-  ITKHelpers::DeepCopy(addFilter->GetOutput(), outputLaplacian);
+  LaplacianFromGradient(gradientImage, gradientImage->GetLargestPossibleRegion(), outputLaplacian);
+}
+
+template <typename TPixel>
+void
+PoissonEditing<TPixel>::LaplacianFromGradient(const typename PoissonEditing<TPixel>::GradientImageType* const gradientImage,
+                                              const itk::ImageRegion<2>& region,
+                                              FloatImageType* const outputLaplacian)
+{
+  const itk::ImageRegion<2> fieldRegion = gradientImage->GetBufferedRegion();
+  if(!fieldRegion.IsInside(region))
+  {
+    throw std::runtime_error("LaplacianFromGradient: The region must be inside of the buffered region of the gradient image!");
+  }
+
+  outputLaplacian->SetRegions(region);
+  outputLaplacian->Allocate();
+  if(region.GetNumberOfPixels() == 0)
+  {
+    return;
+  }
+
+  // The field is read as interleaved (x, y) pairs of floats
+  const float* const field = reinterpret_cast<const float*>(gradientImage->GetBufferPointer());
+  const std::size_t fieldWidth = fieldRegion.GetSize()[0];
+  const std::ptrdiff_t width = region.GetSize()[0];
+
+  // At the edges of the field the missing neighbor is replaced by the pixel itself (zero flux)
+  const std::ptrdiff_t firstLeft = region.GetIndex()[0] > fieldRegion.GetIndex()[0] ? -1 : 0;
+  const std::ptrdiff_t lastRight = region.GetUpperIndex()[0] < fieldRegion.GetUpperIndex()[0] ? 1 : 0;
+
+  ParallelHelpers::ParallelFor(region.GetSize()[1], [&](const std::size_t row)
+  {
+    const itk::IndexValueType y = region.GetIndex()[1] + static_cast<itk::IndexValueType>(row);
+    auto getRow = [&](const itk::IndexValueType rowY) -> const float*
+    {
+      return field + 2 * ((rowY - fieldRegion.GetIndex()[1]) * fieldWidth +
+                          (region.GetIndex()[0] - fieldRegion.GetIndex()[0]));
+    };
+    const float* const center = getRow(y);
+    const float* const up = getRow(std::max(y - 1, fieldRegion.GetIndex()[1]));
+    const float* const down = getRow(std::min(y + 1, fieldRegion.GetUpperIndex()[1]));
+    float* const laplacian = outputLaplacian->GetBufferPointer() + row * width;
+
+    // d/dx of the x component plus d/dy of the y component, with central differences. The loop
+    // over the inside of the row has no branches, so it is vectorized.
+    for(std::ptrdiff_t x = 1; x < width - 1; ++x)
+    {
+      laplacian[x] = 0.5f * (center[2 * x + 2] - center[2 * x - 2]) + 0.5f * (down[2 * x + 1] - up[2 * x + 1]);
+    }
+
+    laplacian[0] = 0.5f * (center[2 * (width > 1 ? 1 : lastRight)] - center[2 * firstLeft]) +
+                   0.5f * (down[1] - up[1]);
+    if(width > 1)
+    {
+      const std::ptrdiff_t x = width - 1;
+      laplacian[x] = 0.5f * (center[2 * (x + lastRight)] - center[2 * x - 2]) + 0.5f * (down[2 * x + 1] - up[2 * x + 1]);
+    }
+  }, ParallelHelpers::GetMinimumRowsPerThread(width));
 }
 
 template <typename TPixel>
@@ -0,0 +1,131 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonEditingSession_H
+#define PoissonEditingSession_H
+
+#include "DomainDecompositionSolver.h"
+#include "PoissonEditing.h"
+#include "VariableIdImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageRegion.h"
+
+// STL
+#include <deque>
+#include <vector>
+
+/** This class fills the hole of an image that is edited interactively (for example with a brush),
+  * keeping the factorization of the system between the edits. Each SetMask() compares the new
+  * hole with the current one, and only the subdomains of the DomainDecompositionSolver around the
+  * pixels that entered or left the hole (and their ancestors) are eliminated again, so the time
+  * of an edit grows with the size of the edit rather than the size of the hole. The factorization
+  * covers the bounding box of the hole plus a margin. An edit that reaches outside of it is
+  * factorized from scratch over a new region.
+  *
+  * The states before the edits are kept for Undo(). The states share the parts of the
+  * factorization that did not change, so a state costs about as much memory as the subdomains
+  * that its edit eliminated again. The channels of the target image are only copied over the
+  * factorized region (and the ring of pixels around it), and the Laplacians of the guidance fields
+  * are only computed over the bounding box of the hole, as FillImage() computes them.
+  */
+template <typename TImage>
+class PoissonEditingSession
+{
+public:
+  typedef PoissonEditingParent::GuidanceFieldType GuidanceFieldType;
+  typedef itk::Image<float, 2> FloatImageType;
+
+  /** Specify the image to fill. */
+  void SetTargetImage(const TImage* const targetImage);
+
+  /** Specify one guidance field per channel, on the grid of the target image. The hole is filled
+    * with a zero guidance field if this is not called (a null field is zero too). */
+  void SetGuidanceFields(const std::vector<GuidanceFieldType::Pointer>& guidanceFields);
+
+  /** Specify the hole, on the grid of the target image. The state before the call is kept for Undo(). */
+  void SetMask(const Mask* const mask);
+
+  /** Go back to the hole (and the factorization) before the last SetMask(). Return false if there
+    * is no earlier state. */
+  bool Undo();
+
+  /** Set the number of states that Undo() can go back to. */
+  void SetMaximumNumberOfUndoSteps(const unsigned int maximumNumberOfUndoSteps);
+
+  /** Fill the current hole and write the result to 'output'. */
+  void Fill(TImage* const output);
+
+  /** Get the number of pixels that entered or left the hole in the last SetMask(). */
+  std::size_t GetNumberOfChangedPixels() const;
+
+  /** Get the fraction of the subdomains of the factorization that the last SetMask() eliminated
+    * (1 if it factorized from scratch, which it does when the hole grows out of the factorized region). */
+  double GetRefactorizedFraction() const;
+
+protected:
+
+  /** A hole and the factorization of its system. */
+  struct State
+  {
+    VariableIdImage VariableIds;
+    DomainDecompositionSolver Solver;
+  };
+
+  /** Factorize the hole of 'mask' from scratch, over its bounding box plus a margin. */
+  void Factorize(const Mask* const mask, State& state) const;
+
+  /** Copy 'region' of the channels of the target image. */
+  void BufferRegion(const itk::ImageRegion<2>& region);
+
+  /** Compute the Laplacians of the guidance fields at the pixels of 'holeRegion', the bounding box of
+    * the hole. Like FillImage(), which crops the guidance fields to it, they only read the fields in
+    * 'holeRegion', and the fields are zero around it. */
+  void ComputeLaplacians(const itk::ImageRegion<2>& holeRegion);
+
+  /** Get the bounding box of the hole pixels of 'variableIds'. */
+  static itk::ImageRegion<2> ComputeHoleRegion(const VariableIdImage& variableIds);
+
+  /** The channels of the target image over BufferedRegion. */
+  std::vector<FloatImageType::Pointer> TargetChannels;
+  itk::ImageRegion<2> BufferedRegion;
+
+  /** The Laplacians of the guidance fields, for the hole with the bounding box HoleRegion. */
+  std::vector<FloatImageType::Pointer> Laplacians;
+  itk::ImageRegion<2> HoleRegion;
+
+  const TImage* TargetImage = nullptr;
+  std::vector<GuidanceFieldType::Pointer> GuidanceFields;
+
+  /** The current state, and the earlier states (the most recent at the back). */
+  State Current;
+  bool HasState = false;
+  std::deque<State> UndoStates;
+
+  unsigned int MaximumNumberOfUndoSteps = 16;
+
+  std::size_t NumberOfChangedPixels = 0;
+};
+
+#include "PoissonEditingSession.hpp"
+
+#endif
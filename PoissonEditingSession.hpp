@@ -0,0 +1,328 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonEditingSession_HPP
+#define PoissonEditingSession_HPP
+
+#include "PoissonEditingSession.h" // Appease syntax parser
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// ITK
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::SetTargetImage(const TImage* const targetImage)
+{
+  // The channels are copied by the next Fill(), over the region that it needs
+  this->TargetImage = targetImage;
+  this->TargetChannels.clear();
+  this->Laplacians.clear();
+}
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::SetGuidanceFields(const std::vector<GuidanceFieldType::Pointer>& guidanceFields)
+{
+  // The Laplacians are computed by the next Fill(), over the hole that it fills
+  this->GuidanceFields = guidanceFields;
+  this->Laplacians.clear();
+}
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::BufferRegion(const itk::ImageRegion<2>& region)
+{
+  // The right hand sides are assembled from one image per channel
+  this->TargetChannels.resize(this->TargetImage->GetNumberOfComponentsPerPixel());
+  for(unsigned int channel = 0; channel < this->TargetChannels.size(); ++channel)
+  {
+    this->TargetChannels[channel] = FloatImageType::New();
+    this->TargetChannels[channel]->SetRegions(region);
+    this->TargetChannels[channel]->Allocate();
+
+    itk::ImageRegionConstIterator<TImage> targetIterator(this->TargetImage, region);
+    itk::ImageRegionIterator<FloatImageType> channelIterator(this->TargetChannels[channel], region);
+    while(!targetIterator.IsAtEnd())
+    {
+      channelIterator.Set(PoissonEditingParent::GetChannel(targetIterator.Get(), channel));
+      ++targetIterator;
+      ++channelIterator;
+    }
+  }
+
+  this->BufferedRegion = region;
+}
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::ComputeLaplacians(const itk::ImageRegion<2>& holeRegion)
+{
+  // The Laplacians are only read at the hole pixels, and they read the ring of pixels around them.
+  // Without a guidance field the Laplacian is zero.
+  itk::ImageRegion<2> region = holeRegion;
+  region.PadByRadius(1);
+  this->Laplacians.resize(this->TargetImage->GetNumberOfComponentsPerPixel());
+  for(unsigned int channel = 0; channel < this->Laplacians.size(); ++channel)
+  {
+    this->Laplacians[channel] = FloatImageType::New();
+    if(this->GuidanceFields.empty() || !this->GuidanceFields[channel])
+    {
+      this->Laplacians[channel]->SetRegions(region);
+      this->Laplacians[channel]->Allocate();
+      this->Laplacians[channel]->FillBuffer(0.0f);
+      continue;
+    }
+
+    GuidanceFieldType::Pointer croppedGuidanceField = GuidanceFieldType::New();
+    croppedGuidanceField->SetRegions(region);
+    croppedGuidanceField->Allocate();
+    croppedGuidanceField->FillBuffer(itk::NumericTraits<GuidanceFieldType::PixelType>::Zero);
+    ITKHelpers::CopyRegion(this->GuidanceFields[channel].GetPointer(), croppedGuidanceField.GetPointer(),
+                           holeRegion, holeRegion);
+    PoissonEditing<float>::LaplacianFromGradient(croppedGuidanceField, this->Laplacians[channel]);
+  }
+
+  this->HoleRegion = holeRegion;
+}
+
+template <typename TImage>
+itk::ImageRegion<2> PoissonEditingSession<TImage>::ComputeHoleRegion(const VariableIdImage& variableIds)
+{
+  if(variableIds.GetNumberOfVariables() == 0)
+  {
+    return itk::ImageRegion<2>();
+  }
+
+  const std::vector<int>& ids = variableIds.GetIds();
+  const itk::ImageRegion<2>& region = variableIds.GetRegion();
+  itk::Index<2> minimum = region.GetUpperIndex();
+  itk::Index<2> maximum = region.GetIndex();
+  for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+  {
+    if(ids[idOffset] < 0)
+    {
+      continue;
+    }
+
+    const itk::Index<2> pixel = variableIds.GetPixel(idOffset);
+    for(unsigned int dimension = 0; dimension < 2; ++dimension)
+    {
+      minimum[dimension] = std::min(minimum[dimension], pixel[dimension]);
+      maximum[dimension] = std::max(maximum[dimension], pixel[dimension]);
+    }
+  }
+
+  const itk::Size<2> size = {{static_cast<itk::SizeValueType>(maximum[0] - minimum[0] + 1),
+                              static_cast<itk::SizeValueType>(maximum[1] - minimum[1] + 1)}};
+  return itk::ImageRegion<2>(minimum, size);
+}
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::SetMaximumNumberOfUndoSteps(const unsigned int maximumNumberOfUndoSteps)
+{
+  this->MaximumNumberOfUndoSteps = maximumNumberOfUndoSteps;
+  while(this->UndoStates.size() > this->MaximumNumberOfUndoSteps)
+  {
+    this->UndoStates.pop_front();
+  }
+}
+
+template <typename TImage>
+std::size_t PoissonEditingSession<TImage>::GetNumberOfChangedPixels() const
+{
+  return this->NumberOfChangedPixels;
+}
+
+template <typename TImage>
+double PoissonEditingSession<TImage>::GetRefactorizedFraction() const
+{
+  const std::size_t numberOfSubdomains = this->Current.Solver.GetNumberOfSubdomains();
+  if(numberOfSubdomains == 0)
+  {
+    return 1.0;
+  }
+  return static_cast<double>(this->Current.Solver.GetNumberOfEliminatedSubdomains()) / numberOfSubdomains;
+}
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::Factorize(const Mask* const mask, State& state) const
+{
+  // The margin leaves room for the hole to grow without a new factorization
+  state.VariableIds.Compute(mask);
+  itk::ImageRegion<2> region = state.VariableIds.GetRegion();
+  const itk::SizeValueType largestSide = std::max(region.GetSize()[0], region.GetSize()[1]);
+  region.PadByRadius(std::max<itk::SizeValueType>(16, largestSide / 4));
+  region.Crop(mask->GetLargestPossibleRegion());
+
+  state.VariableIds.Compute(mask, region);
+  state.Solver.Compute(state.VariableIds, true);
+}
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::SetMask(const Mask* const mask)
+{
+  if(!this->TargetImage)
+  {
+    throw std::runtime_error("PoissonEditingSession: The target image must be set before the mask!");
+  }
+
+  if(!(mask->GetLargestPossibleRegion() == this->TargetImage->GetLargestPossibleRegion()))
+  {
+    throw std::runtime_error("PoissonEditingSession: The mask must be the same size as the target image!");
+  }
+
+  State state;
+  if(!this->HasState)
+  {
+    Factorize(mask, state);
+    this->Current = std::move(state);
+    this->HasState = true;
+    this->NumberOfChangedPixels = this->Current.VariableIds.GetNumberOfVariables();
+    return;
+  }
+
+  // Compare the new hole with the current one
+  const VariableIdImage& currentIds = this->Current.VariableIds;
+  const itk::ImageRegion<2> region = currentIds.GetRegion();
+  std::vector<itk::Index<2> > changedPixels;
+  bool isOutside = false;
+  itk::ImageRegionConstIterator<Mask> maskIterator(mask, mask->GetLargestPossibleRegion());
+  while(!maskIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = maskIterator.GetIndex();
+    const bool isHole = maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE;
+    if(isHole != (currentIds.GetId(pixel) >= 0))
+    {
+      changedPixels.push_back(pixel);
+      isOutside = isOutside || !region.IsInside(pixel);
+    }
+    ++maskIterator;
+  }
+
+  this->NumberOfChangedPixels = changedPixels.size();
+  if(changedPixels.empty())
+  {
+    return;
+  }
+
+  if(isOutside)
+  {
+    // The hole grew out of the factorized region
+    Factorize(mask, state);
+  }
+  else
+  {
+    // The unchanged subdomains are shared with the current state
+    state = this->Current;
+    state.VariableIds.Compute(mask, region);
+    state.Solver.Update(state.VariableIds, changedPixels);
+  }
+
+  this->UndoStates.push_back(std::move(this->Current));
+  if(this->UndoStates.size() > this->MaximumNumberOfUndoSteps)
+  {
+    this->UndoStates.pop_front();
+  }
+  this->Current = std::move(state);
+}
+
+template <typename TImage>
+bool PoissonEditingSession<TImage>::Undo()
+{
+  if(this->UndoStates.empty())
+  {
+    return false;
+  }
+
+  this->Current = std::move(this->UndoStates.back());
+  this->UndoStates.pop_back();
+  return true;
+}
+
+template <typename TImage>
+void PoissonEditingSession<TImage>::Fill(TImage* const output)
+{
+  if(!this->HasState)
+  {
+    throw std::runtime_error("PoissonEditingSession: The target image and the mask must be set!");
+  }
+
+  const unsigned int numberOfChannels = this->TargetImage->GetNumberOfComponentsPerPixel();
+  if(!this->GuidanceFields.empty() && this->GuidanceFields.size() != numberOfChannels)
+  {
+    throw std::runtime_error("PoissonEditingSession: There must be one guidance field per channel!");
+  }
+
+  // The right hand sides read the hole pixels and their known neighbors, so only the factorized
+  // region and the ring of pixels around it are copied (again when an edit outgrows them)
+  itk::ImageRegion<2> region = this->Current.VariableIds.GetRegion();
+  region.PadByRadius(1);
+  region.Crop(this->TargetImage->GetLargestPossibleRegion());
+  if(this->TargetChannels.empty() || !this->BufferedRegion.IsInside(region))
+  {
+    BufferRegion(region);
+  }
+
+  // The guidance fields do not change between the edits, so their Laplacians are only computed again
+  // when an edit changes the bounding box of the hole
+  const itk::ImageRegion<2> holeRegion = ComputeHoleRegion(this->Current.VariableIds);
+  if(this->Laplacians.empty() || !(holeRegion == this->HoleRegion))
+  {
+    ComputeLaplacians(holeRegion);
+  }
+
+  std::vector<const FloatImageType*> targetImages(numberOfChannels);
+  std::vector<const FloatImageType*> laplacians(numberOfChannels);
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    targetImages[channel] = this->TargetChannels[channel];
+    laplacians[channel] = this->Laplacians[channel];
+  }
+
+  const VariableIdImage& variableIds = this->Current.VariableIds;
+  Eigen::MatrixXd B;
+  PoissonEditing<float>::AssembleRightHandSide(variableIds, targetImages, laplacians, B);
+
+  Eigen::MatrixXd X;
+  this->Current.Solver.Solve(B, X);
+
+  ITKHelpers::DeepCopy(this->TargetImage, output);
+  const std::vector<int>& ids = variableIds.GetIds();
+  for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+  {
+    if(ids[idOffset] < 0)
+    {
+      continue;
+    }
+
+    const itk::Index<2> pixel = variableIds.GetPixel(idOffset);
+    typename TImage::PixelType outputPixel = output->GetPixel(pixel);
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      PoissonEditingParent::SetChannel(outputPixel, channel, X(ids[idOffset], channel));
+    }
+    output->SetPixel(pixel, outputPixel);
+  }
+}
+
+#endif
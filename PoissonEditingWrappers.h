@@ -36,13 +36,20 @@
 * This function performs the hole filling operation on each channel of a VectorImage independently.
 * The 'guidanceFields' argument must be the same length as the number of channels of 'image'.
 * Each element of the 'guidanceFields' vector is a 2-channel derivative image (channel 0 is the
-* x deriviative and channel 1 is the y deriviative.
+* x deriviative and channel 1 is the y deriviative. A null guidance field is zero (the fill methods
+* that do not use the guidance fields, see PoissonEditingParent::FillMethodEnum, need none).
+* If this would need more working memory than PoissonEditingParent::GetGlobalMemoryBudget(), the
+* image is filled tile by tile with TiledPoissonFilling instead.
+* If 'statistics' is given, the FillStatistics of the fill are written to it. The channels are solved
+* together, so its counters are those of the hole and its times add up all of the channels (and the
+* copies of the channels in and out of the working images). Tiled fills report no statistics.
 */
 template <typename TImage>
 static void FillVectorImage(const TImage* const targetImage, const Mask* const mask,
                             const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields, TImage* const output,
                             const itk::ImageRegion<2>& regionToProcess,
-                            const TImage* const sourceImage = nullptr);
+                            const TImage* const sourceImage = nullptr,
+                            PoissonEditingParent::FillStatistics* const statistics = nullptr);
 
 /** Overload for scalar images. Note that this takes only a single guidance field instead
   * of a vector of guidance fields. */
@@ -51,7 +58,8 @@ static void FillScalarImage(const itk::Image<TScalarPixel, 2>* const image, cons
                             const PoissonEditingParent::GuidanceFieldType* const guidanceField,
                             itk::Image<TScalarPixel, 2>* const output,
                             const itk::ImageRegion<2>& regionToProcess,
-                            const itk::Image<TScalarPixel, 2>* const sourceImage = nullptr);
+                            const itk::Image<TScalarPixel, 2>* const sourceImage = nullptr,
+                            PoissonEditingParent::FillStatistics* const statistics = nullptr);
 
 /** The following functions are overloads that call one of the above functions (FillVectorImage or FillScalarImage) based on the type of images that
   * are passed. */
@@ -62,7 +70,8 @@ static void FillImage(const itk::Image<TScalarPixel, 2>* const image, const Mask
                       const PoissonEditingParent::GuidanceFieldType* const guidanceField,
                       itk::Image<TScalarPixel, 2>* const output,
                       const itk::ImageRegion<2>& regionToProcess,
-                      const itk::Image<TScalarPixel, 2>* const sourceImage = nullptr);
+                      const itk::Image<TScalarPixel, 2>* const sourceImage = nullptr,
+                      PoissonEditingParent::FillStatistics* const statistics = nullptr);
 
 /** For multi-channel images with the same guidance field for each channel. */
 template <typename TImage>
@@ -70,14 +79,16 @@ static void FillImage(const TImage* const image, const Mask* const mask,
                       const PoissonEditingParent::GuidanceFieldType* const guidanceField,
                       TImage* const output,
                       const itk::ImageRegion<2>& regionToProcess,
-                      const TImage* const sourceImage = nullptr);
+                      const TImage* const sourceImage = nullptr,
+                      PoissonEditingParent::FillStatistics* const statistics = nullptr);
 
 /** For multi-channel images with different guidance fields for each channel. */
 template <typename TImage>
 static void FillImage(const TImage* const image, const Mask* const mask,
                       const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields,
                       TImage* const output, const itk::ImageRegion<2>& regionToProcess,
-                      const TImage* const sourceImage = nullptr);
+                      const TImage* const sourceImage = nullptr,
+                      PoissonEditingParent::FillStatistics* const statistics = nullptr);
 
 /** For Image<CovariantVector> images. This calls FillVectorImage with the same guidance field for each channel. */
 template <typename TComponent, unsigned int NumberOfComponents>
@@ -88,7 +99,8 @@ static void FillImage(const itk::Image<itk::CovariantVector<TComponent,
                       itk::Image<itk::CovariantVector<TComponent, NumberOfComponents>, 2>* const output,
                       const itk::ImageRegion<2>& regionToProcess,
                       const itk::Image<itk::CovariantVector<TComponent,
-                            NumberOfComponents>, 2>* const sourceImage = nullptr);
+                            NumberOfComponents>, 2>* const sourceImage = nullptr,
+                      PoissonEditingParent::FillStatistics* const statistics = nullptr);
 
 /** For VectorImage images with the same guidance field for each channel.*/
 template <typename TPixel>
@@ -98,7 +110,8 @@ FillImage(const itk::VectorImage<TPixel>* const image,
           const PoissonEditingParent::GuidanceFieldType* guidanceField,
           itk::VectorImage<TPixel>* const output,
           const itk::ImageRegion<2>& regionToProcess,
-          const itk::VectorImage<TPixel>* const sourceImage = nullptr);
+          const itk::VectorImage<TPixel>* const sourceImage = nullptr,
+          PoissonEditingParent::FillStatistics* const statistics = nullptr);
 
 
 /** For VectorImage images with differenct guidance fields for each channel.*/
@@ -109,7 +122,14 @@ FillImage(const itk::VectorImage<TPixel>* const image,
           const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields,
           itk::VectorImage<TPixel>* const output,
           const itk::ImageRegion<2>& regionToProcess,
-          const itk::VectorImage<TPixel>* const sourceImage = nullptr);
+          const itk::VectorImage<TPixel>* const sourceImage = nullptr,
+          PoissonEditingParent::FillStatistics* const statistics = nullptr);
+
+/** Round each channel of 'image' to the nearest integer and clamp it to [0, 255]. Writing a float
+  * image as an 8-bit image (ITKHelpers::WriteRGBImage) truncates and wraps its values, so call this
+  * first to store the nearest 8-bit values. */
+template <typename TImage>
+static void QuantizeToUnsignedChar(TImage* const image);
 
 
 #include "PoissonEditingWrappers.hpp"
@@ -21,19 +21,118 @@
 
 #include "PoissonEditingWrappers.h" // Appease syntax parser
 
+#include "ParallelHelpers.h"
+#include "TiledPoissonFilling.h"
+
 // Submodules
 #include "Helpers/Helpers.h"
 #include "ITKHelpers/ITKHelpers.h"
 
 // ITK
 #include "itkAddImageFilter.h"
-#include "itkImageRegionConstIterator.h"
-#include "itkComposeImageFilter.h"
-#include "itkVectorIndexSelectionCastImageFilter.h"
 
 // Eigen
 #include <Eigen/Sparse>
 
+// STL
+#include <map>
+
+/** If filling 'targetImage' in memory would need more than PoissonEditingParent::GetGlobalMemoryBudget(),
+  * fill it tile by tile with TiledPoissonFilling and return true. Otherwise return false. */
+template <typename TImage>
+static bool FillImageTiled(const TImage* const targetImage, const Mask* const mask,
+                           const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields,
+                           TImage* const output, const itk::ImageRegion<2>& regionToProcess)
+{
+  // Mean-value coordinates build no linear system, so they never need to be split into tiles. The
+  // tiles only know the guidance fields, so mixed gradients are not filled tile by tile either.
+  const std::size_t memoryBudget = PoissonEditingParent::GetGlobalMemoryBudget();
+  const PoissonEditingParent::FillMethodEnum fillMethod = PoissonEditingParent::GetGlobalDefaultFillMethod();
+  if(memoryBudget == 0 || fillMethod == PoissonEditingParent::FillMethodEnum::MEAN_VALUE_COORDINATES ||
+     fillMethod == PoissonEditingParent::FillMethodEnum::MIXED_GRADIENTS)
+  {
+    return false;
+  }
+
+  // FillVectorImage only extracts the bounding box of the hole and the ring of known pixels around it
+  const itk::ImageRegion<2> holeBoundingBox = ITKHelpers::ComputeBoundingBox(mask, HoleMaskPixelTypeEnum::HOLE);
+  itk::ImageRegion<2> workingRegion = holeBoundingBox;
+  workingRegion.SetIndex(regionToProcess.GetIndex() +
+                         (holeBoundingBox.GetIndex() - mask->GetLargestPossibleRegion().GetIndex()));
+  workingRegion.PadByRadius(1);
+  workingRegion.Crop(targetImage->GetLargestPossibleRegion());
+  if(TiledPoissonFilling<TImage>::EstimateInCoreMemory(workingRegion.GetNumberOfPixels(),
+                                                       holeBoundingBox.GetNumberOfPixels(),
+                                                       targetImage->GetNumberOfComponentsPerPixel()) <= memoryBudget)
+  {
+    return false;
+  }
+
+  // The null (zero) guidance fields stay null: the tiles give them a zero Laplacian
+  TiledPoissonFilling<TImage> tiledFilling;
+  tiledFilling.SetTargetImage(targetImage);
+  tiledFilling.SetMask(mask);
+  tiledFilling.SetGuidanceFields(guidanceFields);
+  tiledFilling.SetRegionToProcess(regionToProcess);
+  tiledFilling.SetMemoryBudget(memoryBudget);
+
+  // Stop once the remaining changes are far below the rounding of the output
+  const double quantizationStep = PoissonEditingParent::GetGlobalDefaultQuantizationStep();
+  if(quantizationStep > 0.0)
+  {
+    tiledFilling.SetTolerance(0.05 * quantizationStep);
+  }
+
+  tiledFilling.Fill(output);
+  return true;
+}
+
+/** Copy 'region' of each channel of 'image' into its own scalar image, whose region has the size of
+  * 'region' and starts at zero. The rows are split between the threads, and every pixel is read once
+  * for all of the channels. */
+template <typename TScalarImage, typename TImage>
+static std::vector<typename TScalarImage::Pointer> ExtractChannels(const TImage* const image,
+                                                                   const itk::ImageRegion<2>& region)
+{
+  typedef typename TypeTraits<typename TImage::PixelType>::ComponentType ComponentType;
+
+  const itk::ImageRegion<2> imageRegion = image->GetLargestPossibleRegion();
+  if(image->GetBufferedRegion() != imageRegion || !imageRegion.IsInside(region))
+  {
+    throw std::runtime_error("ExtractChannels: The region must be inside of the buffered image!");
+  }
+
+  const std::size_t numberOfChannels = image->GetNumberOfComponentsPerPixel();
+  std::vector<typename TScalarImage::Pointer> channels(numberOfChannels);
+  std::vector<ComponentType*> channelPixels(numberOfChannels);
+  for(std::size_t channel = 0; channel < numberOfChannels; ++channel)
+  {
+    channels[channel] = TScalarImage::New();
+    channels[channel]->SetRegions(itk::ImageRegion<2>(region.GetSize()));
+    channels[channel]->Allocate();
+    channelPixels[channel] = channels[channel]->GetBufferPointer();
+  }
+
+  const std::size_t width = region.GetSize()[0];
+  const std::size_t imageWidth = imageRegion.GetSize()[0];
+  const itk::Offset<2> corner = region.GetIndex() - imageRegion.GetIndex();
+  const ComponentType* const pixels = reinterpret_cast<const ComponentType*>(image->GetBufferPointer());
+  ParallelHelpers::ParallelFor(region.GetSize()[1], [&](const std::size_t y)
+  {
+    const ComponentType* const row = pixels + ((y + corner[1]) * imageWidth + corner[0]) * numberOfChannels;
+    for(std::size_t channel = 0; channel < numberOfChannels; ++channel)
+    {
+      ComponentType* const channelRow = channelPixels[channel] + y * width;
+      for(std::size_t x = 0; x < width; ++x)
+      {
+        channelRow[x] = row[x * numberOfChannels + channel];
+      }
+    }
+  }, ParallelHelpers::GetMinimumRowsPerThread(width));
+
+  return channels;
+}
+
 /** The terminology "targetImage" and "sourceImage" come from Poisson Cloning.
  * To interpret these arguments in a Poisson Filling context, there is no source image
  * (sourceImage must be nullptr), and the targetImage is the image to be filled.
@@ -42,7 +141,7 @@ template <typename TImage>
 void FillVectorImage(const TImage* const targetImage, const Mask* const mask,
                      const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields,
                      TImage* const output, const itk::ImageRegion<2>& regionToProcess,
-                     const TImage* const sourceImage)
+                     const TImage* const sourceImage, PoissonEditingParent::FillStatistics* const statistics)
 {
   std::cout << "FillVectorImage()" << std::endl;
   if(!mask)
@@ -58,6 +157,14 @@ void FillVectorImage(const TImage* const targetImage, const Mask* const mask,
     throw std::runtime_error(ss.str());
   }
 
+  // The phases of this function, which are added to those of the fill of the channels
+  PoissonEditingParent::FillStatistics wrapperStatistics;
+  PoissonEditingParent::PhaseTimer timer(statistics != nullptr);
+  if(statistics)
+  {
+    *statistics = PoissonEditingParent::FillStatistics();
+  }
+
   itk::ImageRegion<2> holeBoundingBox =
       ITKHelpers::ComputeBoundingBox(mask, HoleMaskPixelTypeEnum::HOLE);
 
@@ -72,95 +179,157 @@ void FillVectorImage(const TImage* const targetImage, const Mask* const mask,
     return;
   }
 
+  if(FillImageTiled(targetImage, mask, guidanceFields, output, regionToProcess))
+  {
+    return;
+  }
+
   // Crop the mask
   Mask::Pointer croppedMask = Mask::New();
   croppedMask->Allocate();
   ITKHelpers::ExtractRegion(mask, holeBoundingBox, croppedMask.GetPointer());
 //  std::cout << "croppedMask region: " << croppedMask->GetLargestPossibleRegion() << std::endl;
+  timer.Lap(wrapperStatistics.MaskScanTime);
 
   // Setup components of the channel-wise processing
   typedef itk::Image<typename TypeTraits<typename TImage::PixelType>::ComponentType, 2> ScalarImageType;
 
-  typedef itk::ComposeImageFilter<ScalarImageType, TImage> ReassemblerType;
-  typename ReassemblerType::Pointer reassembler = ReassemblerType::New();
-
-  // Perform the Poisson reconstruction on each channel independently
+  // Perform the Poisson reconstruction of all of the channels with a single filter. The system
+  // matrix only depends on the mask, so it is factorized once and shared by every channel, which
+  // are then solved concurrently.
   typedef typename TypeTraits<typename TImage::PixelType>::ComponentType ComponentType;
   typedef PoissonEditing<ComponentType> PoissonEditingFilterType;
 
-  std::vector<typename ScalarImageType::Pointer> outputChannels(targetImage->GetNumberOfComponentsPerPixel());
+  PoissonEditingFilterType poissonFilter;
+  poissonFilter.SetCollectStatistics(statistics != nullptr);
+
+  // Only the bounding box of the hole and the ring of known pixels around it are read by the solve,
+  // so only that region of the channels is extracted (in a single pass over the target image). The
+  // channels are filled in place in the coordinates of this region, and only their hole pixels are
+  // copied into the output.
+  itk::ImageRegion<2> workingRegion = holeBoundingBoxPositioned;
+  workingRegion.PadByRadius(1);
+  workingRegion.Crop(targetImage->GetLargestPossibleRegion());
+  const std::vector<typename ScalarImageType::Pointer> channels =
+      ExtractChannels<ScalarImageType>(targetImage, workingRegion);
+
+  const itk::Index<2> zeroIndex = {{0, 0}};
+  itk::ImageRegion<2> holeInWorkingRegion = holeBoundingBoxPositioned;
+  holeInWorkingRegion.SetIndex(zeroIndex + (holeBoundingBoxPositioned.GetIndex() - workingRegion.GetIndex()));
+
+  // The source image has the size of the mask, so its channels are cropped to the bounding box of the hole
+  std::vector<typename ScalarImageType::Pointer> croppedSourceImages;
+  if(sourceImage)
+  {
+    std::cout << "Using sourceImage..." << std::endl;
+    croppedSourceImages = ExtractChannels<ScalarImageType>(sourceImage, holeBoundingBox);
+  }
+  else
+  {
+    std::cout << "No source image provided - assuming Poisson Filling (versus Cloning)." << std::endl;
+  }
+  timer.Lap(wrapperStatistics.CopyInTime);
+
+  // Guidance fields that are used by several channels are only cropped once, and the distinct ones
+  // are cropped concurrently
+  std::map<const PoissonEditingParent::GuidanceFieldType*, PoissonEditingParent::GuidanceFieldType::Pointer>
+      croppedGuidanceFields;
+  std::vector<const PoissonEditingParent::GuidanceFieldType*> distinctGuidanceFields;
+  for(unsigned int component = 0; component < channels.size(); ++component)
+  {
+    if(guidanceFields[component] && croppedGuidanceFields.insert(std::make_pair(guidanceFields[component].GetPointer(),
+                                                   PoissonEditingParent::GuidanceFieldType::Pointer())).second)
+    {
+      distinctGuidanceFields.push_back(guidanceFields[component].GetPointer());
+    }
+  }
 
-  //std::cout << "There are " << targetImage->GetNumberOfComponentsPerPixel() << " components in the output image." << std::endl;
-  for(unsigned int component = 0;
-      component < targetImage->GetNumberOfComponentsPerPixel(); ++component)
+  for(std::size_t field = 0; field < distinctGuidanceFields.size(); ++field)
   {
-    std::cout << "Filling component " << component << std::endl;
-
-    // Disassemble the target image into its components
-    typedef itk::VectorIndexSelectionCastImageFilter<TImage, ScalarImageType>
-        TargetDisassemblerType;
-    typename TargetDisassemblerType::Pointer targetDisassembler =
-        TargetDisassemblerType::New();
-    targetDisassembler->SetIndex(component);
-    targetDisassembler->SetInput(targetImage);
-    targetDisassembler->Update();
-
-    PoissonEditingParent::GuidanceFieldType::Pointer croppedGuidanceField =
-        PoissonEditingParent::GuidanceFieldType::New();
+    croppedGuidanceFields[distinctGuidanceFields[field]] = PoissonEditingParent::GuidanceFieldType::New();
+  }
+
+  ParallelHelpers::ParallelForDynamic(distinctGuidanceFields.size(), [&](const std::size_t field)
+  {
+    // The map is not modified anymore, so the threads can look up their fields
+    PoissonEditingParent::GuidanceFieldType* const croppedGuidanceField =
+        croppedGuidanceFields.find(distinctGuidanceFields[field])->second.GetPointer();
     croppedGuidanceField->Allocate();
-    ITKHelpers::ExtractRegion(guidanceFields[component].GetPointer(), holeBoundingBox,
-                              croppedGuidanceField.GetPointer());
-//    ITKHelpers::WriteImage(croppedGuidanceField.GetPointer(), "CroppedGuidanceField_" + std::to_string(component) + ".mha");
+    ITKHelpers::ExtractRegion(distinctGuidanceFields[field], holeBoundingBox, croppedGuidanceField);
+  });
+  timer.Lap(wrapperStatistics.LaplacianTime);
+
+  //std::cout << "There are " << targetImage->GetNumberOfComponentsPerPixel() << " components in the output image." << std::endl;
+  for(unsigned int component = 0; component < channels.size(); ++component)
+  {
+    std::cout << "Setting up component " << component << std::endl;
+
+//    ITKHelpers::WriteImage(croppedGuidanceFields[guidanceFields[component].GetPointer()].GetPointer(), "CroppedGuidanceField_" + std::to_string(component) + ".mha");
 
-    // Perform the actual filling
-    PoissonEditingFilterType poissonFilter;
-    poissonFilter.SetTargetImage(targetDisassembler->GetOutput());
-    poissonFilter.SetRegionToProcess(holeBoundingBoxPositioned);
+    poissonFilter.SetTargetImageReference(channels[component], component);
+    poissonFilter.SetOutputImage(channels[component], component);
+    poissonFilter.SetRegionToProcess(holeInWorkingRegion);
 
-    // Disassemble the source image into its components
     if(sourceImage)
     {
-      std::cout << "Using sourceImage..." << std::endl;
-      typedef itk::VectorIndexSelectionCastImageFilter<TImage, ScalarImageType>
-          SourceDisassemblerType;
-      typename SourceDisassemblerType::Pointer sourceDisassembler =
-          SourceDisassemblerType::New();
-      sourceDisassembler->SetIndex(component);
-      sourceDisassembler->SetInput(sourceImage);
-      sourceDisassembler->Update();
-
-      typename ScalarImageType::Pointer croppedSourceImage =
-          ScalarImageType::New();
-      croppedSourceImage->Allocate();
-      ITKHelpers::ExtractRegion(sourceDisassembler->GetOutput(), holeBoundingBox,
-                                croppedSourceImage.GetPointer());
-
-      poissonFilter.SetSourceImage(croppedSourceImage.GetPointer());
+      poissonFilter.SetSourceImage(croppedSourceImages[component].GetPointer(), component);
+    }
+
+    if(guidanceFields[component])
+    {
+      poissonFilter.SetGuidanceField(croppedGuidanceFields[guidanceFields[component].GetPointer()].GetPointer(),
+                                     component);
     }
     else
     {
-        std::cout << "No source image provided - assuming Poisson Filling (versus Cloning)." << std::endl;
+      poissonFilter.SetGuidanceFieldToZero(component);
     }
-
-    poissonFilter.SetGuidanceField(croppedGuidanceField.GetPointer());
-    poissonFilter.SetMask(croppedMask.GetPointer());
-    poissonFilter.FillMaskedRegion();
-
-    outputChannels[component] = ScalarImageType::New();
-    ITKHelpers::DeepCopy(poissonFilter.GetOutput(), outputChannels[component].GetPointer());
-
-    reassembler->SetInput(component, outputChannels[component]);
-
   } // end loop over components
 
-  reassembler->Update();
-//   std::cout << "Output components per pixel: " << reassembler->GetOutput()->GetNumberOfComponentsPerPixel()
-//             << std::endl;
-//   std::cout << "Output size: " << reassembler->GetOutput()->GetLargestPossibleRegion().GetSize() << std::endl;
+  // Perform the actual filling
+  poissonFilter.SetMask(croppedMask.GetPointer());
+  poissonFilter.FillMaskedRegion();
+  PoissonEditingParent::PhaseTimer outputTimer(statistics != nullptr);
+
+  // Start from the target image (unless the target is filled in place), and write the hole pixels
+  if(output != targetImage)
+  {
+    ITKHelpers::DeepCopy(targetImage, output);
+  }
+  outputTimer.Lap(wrapperStatistics.CopyInTime);
 
-//  ITKHelpers::WriteImage(reassembler->GetOutput(), "Output.mha");
+  // The rows of the hole are written concurrently, each pixel with all of its channels
+  const itk::ImageRegion<2> maskRegion = croppedMask->GetLargestPossibleRegion();
+  const itk::Offset<2> maskToTarget = holeBoundingBoxPositioned.GetIndex() - maskRegion.GetIndex();
+  const itk::Offset<2> maskToChannels = holeInWorkingRegion.GetIndex() - maskRegion.GetIndex();
+  ParallelHelpers::ParallelFor(maskRegion.GetSize()[1], [&](const std::size_t row)
+  {
+    itk::Index<2> maskPixel = maskRegion.GetIndex();
+    maskPixel[1] += row;
+    for(std::size_t column = 0; column < maskRegion.GetSize()[0]; ++column, ++maskPixel[0])
+    {
+      if(croppedMask->GetPixel(maskPixel) != HoleMaskPixelTypeEnum::HOLE)
+      {
+        continue;
+      }
+
+      const itk::Index<2> pixel = maskPixel + maskToTarget;
+      typename TImage::PixelType value = output->GetPixel(pixel);
+      for(unsigned int component = 0; component < channels.size(); ++component)
+      {
+        value[component] = channels[component]->GetPixel(maskPixel + maskToChannels);
+      }
+      output->SetPixel(pixel, value);
+    }
+  }, ParallelHelpers::GetMinimumRowsPerThread(maskRegion.GetSize()[0]));
+  outputTimer.Lap(wrapperStatistics.WriteBackTime);
 
-  ITKHelpers::DeepCopy(reassembler->GetOutput(), output);
+  // All of the channels were filled together, so the counters are those of the hole
+  if(statistics)
+  {
+    *statistics = poissonFilter.GetStatistics();
+    *statistics += wrapperStatistics;
+  }
 }
 
 /** Specialization for scalar images */
@@ -170,14 +339,44 @@ void FillScalarImage(const itk::Image<TScalarPixel, 2>* const image,
                      const PoissonEditingParent::GuidanceFieldType* const guidanceField,
                      itk::Image<TScalarPixel, 2>* const output,
                      const itk::ImageRegion<2>& regionToProcess,
-                     const itk::Image<TScalarPixel, 2>* const sourceImage)
+                     const itk::Image<TScalarPixel, 2>* const sourceImage,
+                     PoissonEditingParent::FillStatistics* const statistics)
 {
+  if(statistics)
+  {
+    *statistics = PoissonEditingParent::FillStatistics();
+  }
+
+  std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>
+      guidanceFields(1, const_cast<PoissonEditingParent::GuidanceFieldType*>(guidanceField));
+  if(FillImageTiled(image, mask, guidanceFields, output, regionToProcess))
+  {
+    return;
+  }
+
   typedef PoissonEditing<TScalarPixel> PoissonEditingFilterType;
   PoissonEditingFilterType poissonFilter;
+  poissonFilter.SetCollectStatistics(statistics != nullptr);
 
-  poissonFilter.SetTargetImage(image);
+  // Write the result straight into the output (or fill the image in place if it is the output)
+  PoissonEditingParent::FillStatistics wrapperStatistics;
+  PoissonEditingParent::PhaseTimer timer(statistics != nullptr);
+  if(output != image)
+  {
+    ITKHelpers::DeepCopy(image, output);
+  }
+  timer.Lap(wrapperStatistics.CopyInTime);
+  poissonFilter.SetTargetImageReference(image);
+  poissonFilter.SetOutputImage(output);
   poissonFilter.SetRegionToProcess(regionToProcess);
-  poissonFilter.SetGuidanceField(guidanceField);
+  if(guidanceField)
+  {
+    poissonFilter.SetGuidanceField(guidanceField);
+  }
+  else
+  {
+    poissonFilter.SetGuidanceFieldToZero();
+  }
   poissonFilter.SetMask(mask);
 
   if(sourceImage)
@@ -188,7 +387,11 @@ void FillScalarImage(const itk::Image<TScalarPixel, 2>* const image,
   // Perform the actual filling
   poissonFilter.FillMaskedRegion();
 
-  ITKHelpers::DeepCopy(poissonFilter.GetOutput(), output);
+  if(statistics)
+  {
+    *statistics = poissonFilter.GetStatistics();
+    *statistics += wrapperStatistics;
+  }
 }
 
 
@@ -198,9 +401,10 @@ void FillImage(const itk::Image<TScalarPixel, 2>* const image, const Mask* const
                const PoissonEditingParent::GuidanceFieldType* const guidanceField,
                itk::Image<TScalarPixel, 2>* const output,
                const itk::ImageRegion<2>& regionToProcess,
-               const itk::Image<TScalarPixel, 2>* const sourceImage)
+               const itk::Image<TScalarPixel, 2>* const sourceImage,
+               PoissonEditingParent::FillStatistics* const statistics)
 {
-  FillScalarImage(image, mask, guidanceField, output, regionToProcess, sourceImage);
+  FillScalarImage(image, mask, guidanceField, output, regionToProcess, sourceImage, statistics);
 }
 
 /** For multi-channel images with the same guidance field for each channel. */
@@ -209,7 +413,8 @@ void
 FillImage(const TImage* const image, const Mask* const mask,
           const PoissonEditingParent::GuidanceFieldType* guidanceField,
           TImage* const output, const itk::ImageRegion<2>& regionToProcess,
-          const TImage* const sourceImage)
+          const TImage* const sourceImage,
+          PoissonEditingParent::FillStatistics* const statistics)
 {
   std::cout << "FillImage with same guidance field for each channel." << std::endl;
   std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>
@@ -217,7 +422,7 @@ FillImage(const TImage* const image, const Mask* const mask,
                      const_cast<PoissonEditingParent::GuidanceFieldType*>(guidanceField));
   std::cout << "Duplicated guidance field for each of the "
             << image->GetNumberOfComponentsPerPixel() << " channels." << std::endl;
-  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage);
+  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage, statistics);
 }
 
 /** For multi-channel images with different guidance fields for each channel. */
@@ -226,11 +431,12 @@ void
 FillImage(const TImage* const image, const Mask* const mask,
           const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields,
           TImage* const output, const itk::ImageRegion<2>& regionToProcess,
-          const TImage* const sourceImage)
+          const TImage* const sourceImage,
+          PoissonEditingParent::FillStatistics* const statistics)
 {
   // Always call the vector version, as it is the only one that makes sense
   // to have passed a collection of guidance fields.
-  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage);
+  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage, statistics);
 }
 
 /** For Image<CovariantVector> images. */
@@ -243,12 +449,13 @@ void FillImage(const itk::Image<itk::CovariantVector<TComponent,
                      NumberOfComponents>, 2>* const output,
                const itk::ImageRegion<2>& regionToProcess,
                const itk::Image<itk::CovariantVector<TComponent,
-                     NumberOfComponents>, 2>* const sourceImage)
+                     NumberOfComponents>, 2>* const sourceImage,
+               PoissonEditingParent::FillStatistics* const statistics)
 {
   std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>
       guidanceFields(image->GetNumberOfComponentsPerPixel(),
                      const_cast<PoissonEditingParent::GuidanceFieldType*>(guidanceField));
-  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage);
+  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage, statistics);
 }
 
 /** For VectorImage images with the same guidance field for each channel.*/
@@ -259,12 +466,13 @@ FillImage(const itk::VectorImage<TPixel>* const image,
           const PoissonEditingParent::GuidanceFieldType* guidanceField,
           itk::VectorImage<TPixel>* const output,
           const itk::ImageRegion<2>& regionToProcess,
-          const itk::VectorImage<TPixel>* const sourceImage)
+          const itk::VectorImage<TPixel>* const sourceImage,
+          PoissonEditingParent::FillStatistics* const statistics)
 {
     std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>
         guidanceFields(image->GetNumberOfComponentsPerPixel(),
                        const_cast<PoissonEditingParent::GuidanceFieldType*>(guidanceField));
-    FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage);
+    FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage, statistics);
 }
 
 /** For VectorImages with different guidance fields for each channel. */
@@ -275,9 +483,27 @@ FillImage(const itk::VectorImage<TPixel>* const image,
           const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields,
           itk::VectorImage<TPixel>* const output,
           const itk::ImageRegion<2>& regionToProcess,
-          const itk::VectorImage<TPixel>* const sourceImage)
+          const itk::VectorImage<TPixel>* const sourceImage,
+          PoissonEditingParent::FillStatistics* const statistics)
+{
+  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage, statistics);
+}
+
+template <typename TImage>
+static void QuantizeToUnsignedChar(TImage* const image)
 {
-  FillVectorImage(image, mask, guidanceFields, output, regionToProcess, sourceImage);
+  typedef typename TypeTraits<typename TImage::PixelType>::ComponentType ComponentType;
+
+  const itk::ImageRegion<2> region = image->GetBufferedRegion();
+  const std::size_t rowLength = region.GetSize()[0] * image->GetNumberOfComponentsPerPixel();
+  ComponentType* const components = reinterpret_cast<ComponentType*>(image->GetBufferPointer());
+  ParallelHelpers::ParallelFor(region.GetSize()[1], [&](const std::size_t y)
+  {
+    for(ComponentType* component = components + y * rowLength; component < components + (y + 1) * rowLength; ++component)
+    {
+      *component = static_cast<ComponentType>(PoissonEditingParent::ConvertToComponent<unsigned char>(*component));
+    }
+  }, ParallelHelpers::GetMinimumRowsPerThread(rowLength));
 }
 
 #endif
@@ -0,0 +1,209 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonPlan_H
+#define PoissonPlan_H
+
+#include "ConjugateGradientSolver.h"
+#include "DomainDecompositionSolver.h"
+#include "MeanValueCoordinates.h"
+#include "PoissonEditing.h"
+#include "SineTransformSolver.h"
+#include "VariableIdImage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImage.h"
+
+// Eigen
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+// STL
+#include <memory>
+#include <vector>
+
+/** This class holds everything of a Poisson fill that only depends on the mask: the numbering of
+  * the hole pixels, its connected components, the known neighbors of each hole pixel, and the
+  * assembled and factorized system of each component (or the state of the iterative solver, or the
+  * mean-value coordinates). Compute() does this work once. Execute() then only builds the right
+  * hand sides, solves with the prepared factorizations and writes the hole pixels, for any number of
+  * (target, Laplacian) sets that share the mask.
+  */
+template <typename TPixel>
+class PoissonPlan : public PoissonEditingParent
+{
+public:
+  typedef itk::Image<TPixel, 2> ImageType;
+  typedef itk::Image<float, 2> FloatImageType;
+  typedef Eigen::SparseMatrix<double> SparseMatrixType;
+
+  /** Specify which solver to use. This must be called before Compute(). */
+  void SetSolver(const SolverEnum solver);
+  SolverEnum GetSolver() const;
+
+  /** Specify which method to use. This must be called before Compute(). */
+  void SetFillMethod(const FillMethodEnum fillMethod);
+  FillMethodEnum GetFillMethod() const;
+
+  /** Specify the spacing of the values that the output will be rounded to (see
+    * PoissonEditing::SetQuantizationStep()). This can be changed between calls to Execute(). */
+  void SetQuantizationStep(const double quantizationStep);
+
+  /** Number, split, assemble and factorize the hole of 'mask'. The images given to Execute() must
+    * cover the region of 'mask'. */
+  void Compute(const Mask* const mask);
+
+  /** Check if Compute() was called. */
+  bool IsComputed() const;
+
+  /** Get the number of hole pixels. */
+  unsigned int GetNumberOfVariables() const;
+
+  /** Fill the hole in each of the channels. Only the hole pixels of 'outputs' are written, so the
+    * outputs may be the target images themselves. 'sourceImages' (used by MEAN_VALUE_COORDINATES
+    * and required by MIXED_GRADIENTS, see FillMethodEnum) and 'initialGuesses' (used by the
+    * iterative solvers) may be empty or contain null pointers. 'laplacians' may be empty with either
+    * of these fill methods. */
+  void Execute(const std::vector<const ImageType*>& targetImages,
+               const std::vector<const FloatImageType*>& laplacians,
+               const std::vector<ImageType*>& outputs,
+               const std::vector<const ImageType*>& sourceImages = std::vector<const ImageType*>(),
+               const std::vector<const ImageType*>& initialGuesses = std::vector<const ImageType*>());
+
+  /** Get the number of iterations that the iterative solvers needed in the last Execute() (the
+    * largest over the connected components of the hole). */
+  unsigned int GetNumberOfIterations() const;
+
+  /** Get the relative residual |AX - B| / |B| of the last Execute() (the largest over the channels
+    * and the connected components of the hole). */
+  double GetRelativeResidual() const;
+
+  /** Collect the FillStatistics of Compute() and of Execute() (false by default, in which case
+    * neither reads the clock). */
+  void SetCollectStatistics(const bool collectStatistics);
+  bool GetCollectStatistics() const;
+
+  /** Get the statistics of the last Compute(): the counters of the hole, and the times of the mask
+    * scan, of the assembly of the matrices and of their factorizations. */
+  const FillStatistics& GetComputeStatistics() const;
+
+  /** Get the statistics of the last Execute(): the times of the assembly of the right hand sides, of
+    * the solve and of the write-back (its counters are 0). */
+  const FillStatistics& GetExecuteStatistics() const;
+
+protected:
+
+  /** A connected component of the hole, and whatever its solver prepared. Only one of the solvers
+    * is set. */
+  struct Component
+  {
+    VariableIdImage VariableIds;
+
+    /** The known neighbors of the hole pixels inside the mask region, in compressed rows: the
+      * neighbors of variable i are [BoundaryOffsets[i], BoundaryOffsets[i+1]). */
+    std::vector<std::size_t> BoundaryOffsets;
+    std::vector<itk::Index<2> > BoundaryPixels;
+
+    std::shared_ptr<SineTransformSolver> SineTransform;
+    std::shared_ptr<DomainDecompositionSolver> DomainDecomposition;
+    std::shared_ptr<ConjugateGradientSolver> ConjugateGradient;
+    std::shared_ptr<MeanValueCoordinates> Interpolation;
+
+    /** The pixels whose values are averaged for each boundary pixel of Interpolation, in compressed
+      * rows like BoundaryPixels. The contour of a component is 8-connected, so it can run through a
+      * pixel of a diagonally touching component, which is replaced by its known 4-neighbors. */
+    std::vector<std::size_t> InterpolationBoundaryOffsets;
+    std::vector<itk::Index<2> > InterpolationBoundaryPixels;
+
+    /** The system matrix, and its factorization in double or in single precision. */
+    SparseMatrixType A;
+    std::shared_ptr<Eigen::SimplicialLDLT<SparseMatrixType> > LDLT;
+    std::shared_ptr<Eigen::SimplicialLDLT<Eigen::SparseMatrix<float> > > FloatLDLT;
+  };
+
+  /** Call function(component) for each component. The components that are large enough to keep all
+    * of the threads busy are processed one after another (each one in parallel), and the rest are
+    * processed concurrently, one per thread. */
+  template <typename TFunction>
+  void ForEachComponent(TFunction function);
+
+  /** Prepare the solver of 'component' ('holeIds' numbers the whole hole), and add its counters and
+    * times to 'statistics'. */
+  void Prepare(Component& component, const VariableIdImage& holeIds, FillStatistics& statistics) const;
+
+  /** Build the right hand sides of 'component' (column c is the right hand side of targetImages[c]
+    * and laplacians[c]). With MIXED_GRADIENTS the guidance comes straight from the differences of
+    * sourceImages[c] and targetImages[c] around each hole pixel, and 'laplacians' is not used. */
+  void AssembleRightHandSide(const Component& component,
+                             const std::vector<const ImageType*>& targetImages,
+                             const std::vector<const FloatImageType*>& laplacians,
+                             const std::vector<const ImageType*>& sourceImages,
+                             Eigen::MatrixXd& B) const;
+
+  /** Solve for all of the channels of 'component', and add the times of the assembly of the right
+    * hand sides and of the solve to 'statistics'. */
+  void Solve(Component& component,
+             const std::vector<const ImageType*>& targetImages,
+             const std::vector<const FloatImageType*>& laplacians,
+             const std::vector<const ImageType*>& sourceImages,
+             const std::vector<const ImageType*>& initialGuesses,
+             Eigen::MatrixXd& X, unsigned int& numberOfIterations, double& relativeResidual,
+             FillStatistics& statistics) const;
+
+  /** Interpolate the difference between the target and the source images on the boundary of
+    * 'component' into it with mean-value coordinates, and add the source. */
+  static void Interpolate(const Component& component,
+                          const std::vector<const ImageType*>& targetImages,
+                          const std::vector<const ImageType*>& sourceImages, Eigen::MatrixXd& X);
+
+  /** Get the value of 'image' at its pixel nearest to 'pixel'. */
+  static double GetNearestValue(const ImageType* const image, itk::Index<2> pixel);
+
+  /** Solve A X = B with the single precision factorization of A, and refine X with double precision
+    * residuals until the relative residual of every column is below 'tolerance' (or stops
+    * decreasing). Return the number of refinement steps. */
+  static unsigned int SolveMixedPrecision(const Component& component, const Eigen::MatrixXd& B,
+                                          Eigen::MatrixXd& X, const double tolerance = 1e-10);
+
+  SolverEnum Solver = GetGlobalDefaultSolver();
+  FillMethodEnum FillMethod = GetGlobalDefaultFillMethod();
+  double QuantizationStep = GetGlobalDefaultQuantizationStep();
+
+  /** The region of the mask. */
+  itk::ImageRegion<2> MaskRegion;
+
+  /** The components, from the largest to the smallest. */
+  std::vector<Component> Components;
+  unsigned int NumberOfVariables = 0;
+  bool Computed = false;
+
+  /** The state of the solver at the end of the last Execute(). */
+  unsigned int NumberOfIterations = 0;
+  double RelativeResidual = 0.0;
+
+  bool CollectStatistics = false;
+  FillStatistics ComputeStatistics;
+  FillStatistics ExecuteStatistics;
+};
+
+#include "PoissonPlan.hpp"
+
+#endif
@@ -0,0 +1,635 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PoissonPlan_HPP
+#define PoissonPlan_HPP
+
+#include "PoissonPlan.h" // Appease syntax parser
+
+#include "ParallelHelpers.h"
+
+// STL
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::SetSolver(const SolverEnum solver)
+{
+  this->Solver = solver;
+  this->Computed = false;
+}
+
+template <typename TPixel>
+typename PoissonPlan<TPixel>::SolverEnum PoissonPlan<TPixel>::GetSolver() const
+{
+  return this->Solver;
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::SetFillMethod(const FillMethodEnum fillMethod)
+{
+  this->FillMethod = fillMethod;
+  this->Computed = false;
+}
+
+template <typename TPixel>
+typename PoissonPlan<TPixel>::FillMethodEnum PoissonPlan<TPixel>::GetFillMethod() const
+{
+  return this->FillMethod;
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::SetQuantizationStep(const double quantizationStep)
+{
+  this->QuantizationStep = quantizationStep;
+}
+
+template <typename TPixel>
+bool PoissonPlan<TPixel>::IsComputed() const
+{
+  return this->Computed;
+}
+
+template <typename TPixel>
+unsigned int PoissonPlan<TPixel>::GetNumberOfVariables() const
+{
+  return this->NumberOfVariables;
+}
+
+template <typename TPixel>
+unsigned int PoissonPlan<TPixel>::GetNumberOfIterations() const
+{
+  return this->NumberOfIterations;
+}
+
+template <typename TPixel>
+double PoissonPlan<TPixel>::GetRelativeResidual() const
+{
+  return this->RelativeResidual;
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::SetCollectStatistics(const bool collectStatistics)
+{
+  this->CollectStatistics = collectStatistics;
+}
+
+template <typename TPixel>
+bool PoissonPlan<TPixel>::GetCollectStatistics() const
+{
+  return this->CollectStatistics;
+}
+
+template <typename TPixel>
+const typename PoissonPlan<TPixel>::FillStatistics& PoissonPlan<TPixel>::GetComputeStatistics() const
+{
+  return this->ComputeStatistics;
+}
+
+template <typename TPixel>
+const typename PoissonPlan<TPixel>::FillStatistics& PoissonPlan<TPixel>::GetExecuteStatistics() const
+{
+  return this->ExecuteStatistics;
+}
+
+template <typename TPixel>
+template <typename TFunction>
+void PoissonPlan<TPixel>::ForEachComponent(TFunction function)
+{
+  const std::size_t largeComponentSize = this->NumberOfVariables / ParallelHelpers::GetNumberOfThreads();
+  std::size_t numberOfLargeComponents = 0;
+  while(numberOfLargeComponents < this->Components.size() &&
+        this->Components[numberOfLargeComponents].VariableIds.GetNumberOfVariables() > largeComponentSize)
+  {
+    function(numberOfLargeComponents++);
+  }
+
+  ParallelHelpers::ParallelForDynamic(this->Components.size() - numberOfLargeComponents, [&](const std::size_t item)
+  {
+    function(numberOfLargeComponents + item);
+  });
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::Compute(const Mask* const mask)
+{
+  this->MaskRegion = mask->GetLargestPossibleRegion();
+  this->ComputeStatistics = FillStatistics();
+  PhaseTimer timer(this->CollectStatistics);
+
+  // Number the hole pixels. Holes that do not touch each other are independent systems, so each
+  // one gets its own (small) solver.
+  VariableIdImage variableIds;
+  variableIds.Compute(mask);
+  this->NumberOfVariables = variableIds.GetNumberOfVariables();
+
+  std::vector<VariableIdImage> components;
+  variableIds.ComputeComponents(components);
+  this->Components.clear();
+  this->Components.resize(components.size());
+  for(std::size_t componentId = 0; componentId < components.size(); ++componentId)
+  {
+    this->Components[componentId].VariableIds = std::move(components[componentId]);
+  }
+  timer.Lap(this->ComputeStatistics.MaskScanTime);
+
+  // Each component collects its own statistics, as they may be prepared concurrently
+  std::vector<FillStatistics> componentStatistics(this->Components.size());
+  ForEachComponent([&](const std::size_t componentId)
+  {
+    Prepare(this->Components[componentId], variableIds, componentStatistics[componentId]);
+  });
+
+  for(std::size_t componentId = 0; componentId < componentStatistics.size(); ++componentId)
+  {
+    this->ComputeStatistics += componentStatistics[componentId];
+  }
+  this->ComputeStatistics.NumberOfUnknowns = this->NumberOfVariables;
+
+  this->Computed = true;
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::Prepare(Component& component, const VariableIdImage& holeIds,
+                                  FillStatistics& statistics) const
+{
+  PhaseTimer timer(this->CollectStatistics);
+  const VariableIdImage& variableIds = component.VariableIds;
+  const std::vector<int>& ids = variableIds.GetIds();
+
+  // The known neighbors of each variable, in the order (up, left, right, down) of the stencil.
+  // Pixels outside of the mask region are ignored.
+  const itk::Offset<2> neighborOffsets[4] = {{{0, -1}}, {{-1, 0}}, {{1, 0}}, {{0, 1}}};
+  component.BoundaryOffsets.assign(1, 0);
+  component.BoundaryPixels.clear();
+  std::size_t numberOfNonZeros = 0;
+  for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+  {
+    if(ids[idOffset] < 0)
+    {
+      continue;
+    }
+
+    const itk::Index<2> pixel = variableIds.GetPixel(idOffset);
+    ++numberOfNonZeros;
+    for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+    {
+      const itk::Index<2> neighborPixel = pixel + neighborOffsets[neighbor];
+      if(variableIds.GetId(neighborPixel) >= 0)
+      {
+        ++numberOfNonZeros;
+      }
+      else if(this->MaskRegion.IsInside(neighborPixel))
+      {
+        component.BoundaryPixels.push_back(neighborPixel);
+      }
+    }
+    component.BoundaryOffsets.push_back(component.BoundaryPixels.size());
+  }
+  statistics.NumberOfNonZeros += numberOfNonZeros;
+  statistics.NumberOfBoundaryPixels += component.BoundaryPixels.size();
+  timer.Lap(statistics.MaskScanTime);
+
+  if(this->FillMethod == FillMethodEnum::MEAN_VALUE_COORDINATES)
+  {
+    component.Interpolation = std::make_shared<MeanValueCoordinates>();
+    component.Interpolation->Compute(variableIds);
+
+    // Only known pixels give boundary values: the other components of the hole are not filled yet
+    // (or are being filled concurrently)
+    const std::vector<itk::Index<2> >& contourPixels = component.Interpolation->GetBoundaryPixels();
+    component.InterpolationBoundaryOffsets.assign(1, 0);
+    component.InterpolationBoundaryPixels.clear();
+    for(std::size_t contourPixel = 0; contourPixel < contourPixels.size(); ++contourPixel)
+    {
+      if(holeIds.GetId(contourPixels[contourPixel]) < 0)
+      {
+        component.InterpolationBoundaryPixels.push_back(contourPixels[contourPixel]);
+      }
+      else
+      {
+        for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+        {
+          const itk::Index<2> neighborPixel = contourPixels[contourPixel] + neighborOffsets[neighbor];
+          if(holeIds.GetId(neighborPixel) < 0 && this->MaskRegion.IsInside(neighborPixel))
+          {
+            component.InterpolationBoundaryPixels.push_back(neighborPixel);
+          }
+        }
+      }
+      component.InterpolationBoundaryOffsets.push_back(component.InterpolationBoundaryPixels.size());
+    }
+  }
+  else if(SineTransformSolver::IsRectangle(variableIds))
+  {
+    // A hole that fills its bounding box is solved exactly with sine transforms, whichever solver was chosen
+    component.SineTransform = std::make_shared<SineTransformSolver>();
+    component.SineTransform->Compute(variableIds);
+  }
+  else if(this->Solver == SolverEnum::DOMAIN_DECOMPOSITION)
+  {
+    component.DomainDecomposition = std::make_shared<DomainDecompositionSolver>();
+    component.DomainDecomposition->Compute(variableIds);
+  }
+  else if(this->Solver == SolverEnum::LDLT || this->Solver == SolverEnum::MIXED_PRECISION_LDLT)
+  {
+    PoissonEditing<TPixel>::AssembleMatrix(variableIds, component.A);
+    timer.Lap(statistics.AssemblyTime);
+
+    if(this->Solver == SolverEnum::MIXED_PRECISION_LDLT)
+    {
+      // The entries of A are small integers, so the single precision matrix is exact
+      component.FloatLDLT = std::make_shared<Eigen::SimplicialLDLT<Eigen::SparseMatrix<float> > >(
+          component.A.template cast<float>());
+      if(component.FloatLDLT->info() != Eigen::Success)
+      {
+        throw std::runtime_error("Decomposition failed!");
+      }
+    }
+    else
+    {
+      // Factorize the (symmetric) system once for all of the channels
+      component.LDLT = std::make_shared<Eigen::SimplicialLDLT<SparseMatrixType> >(component.A);
+      if(component.LDLT->info() != Eigen::Success)
+      {
+        throw std::runtime_error("Decomposition failed!");
+      }
+    }
+
+    if(this->CollectStatistics)
+    {
+      // L has a unit diagonal, which is not stored
+      const std::size_t factorNonZeros = component.LDLT ? component.LDLT->matrixL().nestedExpression().nonZeros() :
+                                                          component.FloatLDLT->matrixL().nestedExpression().nonZeros();
+      statistics.FillIn += factorNonZeros - (component.A.nonZeros() - component.A.rows()) / 2;
+    }
+  }
+  else
+  {
+    component.ConjugateGradient = std::make_shared<ConjugateGradientSolver>();
+    component.ConjugateGradient->SetPreconditioner(this->Solver == SolverEnum::MULTIGRID ?
+                                                   ConjugateGradientSolver::PreconditionerEnum::MULTIGRID :
+                                                   ConjugateGradientSolver::PreconditionerEnum::JACOBI);
+    component.ConjugateGradient->Compute(variableIds);
+  }
+  timer.Lap(statistics.FactorizationTime);
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::Execute(const std::vector<const ImageType*>& targetImages,
+                                  const std::vector<const FloatImageType*>& laplacians,
+                                  const std::vector<ImageType*>& outputs,
+                                  const std::vector<const ImageType*>& sourceImages,
+                                  const std::vector<const ImageType*>& initialGuesses)
+{
+  if(!this->Computed)
+  {
+    throw std::runtime_error("PoissonPlan: Compute() must be called before Execute()!");
+  }
+
+  const unsigned int numberOfChannels = targetImages.size();
+  if(outputs.size() != numberOfChannels ||
+     (this->FillMethod != FillMethodEnum::MEAN_VALUE_COORDINATES &&
+      this->FillMethod != FillMethodEnum::MIXED_GRADIENTS && laplacians.size() != numberOfChannels))
+  {
+    throw std::runtime_error("PoissonPlan: There must be one Laplacian and one output per target image!");
+  }
+
+  if(this->FillMethod == FillMethodEnum::MIXED_GRADIENTS)
+  {
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      if(channel >= sourceImages.size() || !sourceImages[channel])
+      {
+        throw std::runtime_error("PoissonPlan: MIXED_GRADIENTS needs a source image per target image!");
+      }
+    }
+  }
+
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    if(!targetImages[channel]->GetLargestPossibleRegion().IsInside(this->MaskRegion) ||
+       !outputs[channel]->GetLargestPossibleRegion().IsInside(this->MaskRegion))
+    {
+      throw std::runtime_error("PoissonPlan: The target images and the outputs must cover the mask!");
+    }
+  }
+
+  std::vector<unsigned int> numberOfIterations(this->Components.size(), 0);
+  std::vector<double> relativeResiduals(this->Components.size(), 0.0);
+  std::vector<FillStatistics> componentStatistics(this->Components.size());
+  ForEachComponent([&](const std::size_t componentId)
+  {
+    Component& component = this->Components[componentId];
+    Eigen::MatrixXd X;
+    Solve(component, targetImages, laplacians, sourceImages, initialGuesses, X,
+          numberOfIterations[componentId], relativeResiduals[componentId], componentStatistics[componentId]);
+    PhaseTimer timer(this->CollectStatistics);
+
+    // Convert solution vectors back to images, rounding and clamping them for integer pixels. The
+    // components do not share any pixels, and neither do the channels.
+    const std::vector<int>& ids = component.VariableIds.GetIds();
+    ParallelHelpers::ParallelFor(numberOfChannels, [&](const std::size_t channel)
+    {
+      for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+      {
+        if(ids[idOffset] >= 0)
+        {
+          outputs[channel]->SetPixel(component.VariableIds.GetPixel(idOffset),
+                                     ConvertToComponent<TPixel>(X(ids[idOffset], channel)));
+        }
+      }
+    });
+    timer.Lap(componentStatistics[componentId].WriteBackTime);
+  });
+
+  this->ExecuteStatistics = FillStatistics();
+  for(std::size_t componentId = 0; componentId < componentStatistics.size(); ++componentId)
+  {
+    this->ExecuteStatistics += componentStatistics[componentId];
+  }
+
+  this->NumberOfIterations = 0;
+  this->RelativeResidual = 0.0;
+  if(!this->Components.empty())
+  {
+    this->NumberOfIterations = *std::max_element(numberOfIterations.begin(), numberOfIterations.end());
+    this->RelativeResidual = *std::max_element(relativeResiduals.begin(), relativeResiduals.end());
+  }
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::AssembleRightHandSide(const Component& component,
+                                                const std::vector<const ImageType*>& targetImages,
+                                                const std::vector<const FloatImageType*>& laplacians,
+                                                const std::vector<const ImageType*>& sourceImages,
+                                                Eigen::MatrixXd& B) const
+{
+  const bool mixedGradients = this->FillMethod == FillMethodEnum::MIXED_GRADIENTS;
+  const itk::Offset<2> neighborOffsets[4] = {{{0, -1}}, {{-1, 0}}, {{1, 0}}, {{0, 1}}};
+
+  const unsigned int numberOfChannels = targetImages.size();
+  const VariableIdImage& variableIds = component.VariableIds;
+  const std::vector<int>& ids = variableIds.GetIds();
+  const std::size_t width = variableIds.GetRegion().GetSize()[0];
+
+  B.resize(variableIds.GetNumberOfVariables(), numberOfChannels);
+  ParallelHelpers::ParallelFor(variableIds.GetRegion().GetSize()[1], [&](const std::size_t y)
+  {
+    for(std::size_t idOffset = y * width; idOffset < (y + 1) * width; ++idOffset)
+    {
+      const int variableId = ids[idOffset];
+      if(variableId < 0)
+      {
+        continue; // this pixel is not part of the hole
+      }
+
+      const itk::Index<2> pixel = variableIds.GetPixel(idOffset);
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        // The right hand side of the equation starts equal to the value of the guidance field, and
+        // the known neighbors (all of weight 1) move to the right hand side
+        double bValue = 0.0;
+        if(mixedGradients)
+        {
+          // The guidance field between the pixel and each of its neighbors is the difference of the
+          // source or of the target, whichever is stronger (the neighbors outside of the mask region
+          // are not part of the equation, and the source is extended with its nearest pixel)
+          const ImageType* const sourceImage = sourceImages[channel];
+          const ImageType* const targetImage = targetImages[channel];
+          const double sourceValue = GetNearestValue(sourceImage, pixel);
+          const double targetValue = targetImage->GetPixel(pixel);
+          for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+          {
+            const itk::Index<2> neighborPixel = pixel + neighborOffsets[neighbor];
+            if(this->MaskRegion.IsInside(neighborPixel))
+            {
+              const double sourceDifference = GetNearestValue(sourceImage, neighborPixel) - sourceValue;
+              const double targetDifference = targetImage->GetPixel(neighborPixel) - targetValue;
+              bValue += std::abs(targetDifference) > std::abs(sourceDifference) ? targetDifference : sourceDifference;
+            }
+          }
+        }
+        else
+        {
+          bValue = laplacians[channel]->GetPixel(pixel);
+        }
+        for(std::size_t boundaryPixel = component.BoundaryOffsets[variableId];
+            boundaryPixel < component.BoundaryOffsets[variableId + 1]; ++boundaryPixel)
+        {
+          bValue -= targetImages[channel]->GetPixel(component.BoundaryPixels[boundaryPixel]);
+        }
+        B(variableId, channel) = bValue;
+      }
+    }
+  }, ParallelHelpers::GetMinimumRowsPerThread(width));
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::Solve(Component& component,
+                                const std::vector<const ImageType*>& targetImages,
+                                const std::vector<const FloatImageType*>& laplacians,
+                                const std::vector<const ImageType*>& sourceImages,
+                                const std::vector<const ImageType*>& initialGuesses,
+                                Eigen::MatrixXd& X, unsigned int& numberOfIterations, double& relativeResidual,
+                                FillStatistics& statistics) const
+{
+  const unsigned int numberOfChannels = targetImages.size();
+  numberOfIterations = 0;
+  relativeResidual = 0.0;
+  PhaseTimer timer(this->CollectStatistics);
+
+  if(component.Interpolation)
+  {
+    Interpolate(component, targetImages, sourceImages, X);
+    timer.Lap(statistics.SolveTime);
+    return;
+  }
+
+  Eigen::MatrixXd B;
+  AssembleRightHandSide(component, targetImages, laplacians, sourceImages, B);
+  timer.Lap(statistics.AssemblyTime);
+
+  if(component.SineTransform)
+  {
+    component.SineTransform->Solve(B, X);
+  }
+  else if(component.DomainDecomposition)
+  {
+    component.DomainDecomposition->Solve(B, X);
+    relativeResidual = component.DomainDecomposition->GetRelativeResidual();
+  }
+  else if(component.LDLT || component.FloatLDLT)
+  {
+    // The factorization is only read by the substitutions, so the channels are solved concurrently
+    // (this only uses several threads if the components are not already solved concurrently)
+    X.resize(B.rows(), numberOfChannels);
+    std::vector<unsigned int> channelIterations(numberOfChannels, 0);
+    std::vector<double> channelResiduals(numberOfChannels, 0.0);
+    ParallelHelpers::ParallelFor(numberOfChannels, [&](const std::size_t channel)
+    {
+      if(component.FloatLDLT)
+      {
+        Eigen::MatrixXd x;
+        channelIterations[channel] = SolveMixedPrecision(component, B.col(channel), x);
+        X.col(channel) = x;
+      }
+      else
+      {
+        X.col(channel) = component.LDLT->solve(B.col(channel));
+      }
+
+      if(B.col(channel).norm() > 0.0)
+      {
+        channelResiduals[channel] = (component.A * X.col(channel) - B.col(channel)).norm() / B.col(channel).norm();
+      }
+    });
+
+    if(numberOfChannels > 0)
+    {
+      numberOfIterations = *std::max_element(channelIterations.begin(), channelIterations.end());
+      relativeResidual = *std::max_element(channelResiduals.begin(), channelResiduals.end());
+    }
+  }
+  else
+  {
+    // Start from the initial guesses that were provided (and from zero in the other channels)
+    const VariableIdImage& variableIds = component.VariableIds;
+    const std::vector<int>& ids = variableIds.GetIds();
+    X = Eigen::MatrixXd::Zero(variableIds.GetNumberOfVariables(), numberOfChannels);
+    for(unsigned int channel = 0; channel < std::min<std::size_t>(numberOfChannels, initialGuesses.size()); ++channel)
+    {
+      if(initialGuesses[channel])
+      {
+        for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+        {
+          if(ids[idOffset] >= 0)
+          {
+            X(ids[idOffset], channel) = initialGuesses[channel]->GetPixel(variableIds.GetPixel(idOffset));
+          }
+        }
+      }
+    }
+
+    component.ConjugateGradient->SetQuantizationStep(this->QuantizationStep);
+    component.ConjugateGradient->Solve(B, X);
+
+    numberOfIterations = component.ConjugateGradient->GetNumberOfIterations();
+    relativeResidual = component.ConjugateGradient->GetRelativeResidual();
+  }
+  timer.Lap(statistics.SolveTime);
+}
+
+template <typename TPixel>
+void PoissonPlan<TPixel>::Interpolate(const Component& component,
+                                      const std::vector<const ImageType*>& targetImages,
+                                      const std::vector<const ImageType*>& sourceImages, Eigen::MatrixXd& X)
+{
+  const unsigned int numberOfChannels = targetImages.size();
+
+  // Get the value of the source image of 'channel' at 'pixel', or 0 if there is no source image
+  auto getSourceValue = [&](const unsigned int channel, const itk::Index<2>& pixel) -> double
+  {
+    if(channel >= sourceImages.size() || !sourceImages[channel])
+    {
+      return 0.0;
+    }
+    return GetNearestValue(sourceImages[channel], pixel);
+  };
+
+  // The boundary of a hole that touches the border of the image is partly outside of it, and takes
+  // the value of the nearest pixel inside. A boundary pixel in another component of the hole takes
+  // the mean of its known neighbors.
+  const std::vector<std::size_t>& offsets = component.InterpolationBoundaryOffsets;
+  const std::vector<itk::Index<2> >& boundaryPixels = component.InterpolationBoundaryPixels;
+  Eigen::MatrixXd boundaryValues(offsets.size() - 1, numberOfChannels);
+  for(std::size_t contourPixel = 0; contourPixel + 1 < offsets.size(); ++contourPixel)
+  {
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      double sum = 0.0;
+      for(std::size_t boundaryPixel = offsets[contourPixel]; boundaryPixel < offsets[contourPixel + 1]; ++boundaryPixel)
+      {
+        sum += GetNearestValue(targetImages[channel], boundaryPixels[boundaryPixel]) -
+               getSourceValue(channel, boundaryPixels[boundaryPixel]);
+      }
+      boundaryValues(contourPixel, channel) = sum / (offsets[contourPixel + 1] - offsets[contourPixel]);
+    }
+  }
+
+  component.Interpolation->Interpolate(boundaryValues, X);
+
+  const VariableIdImage& variableIds = component.VariableIds;
+  const std::vector<int>& ids = variableIds.GetIds();
+  for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+  {
+    if(ids[idOffset] >= 0)
+    {
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        X(ids[idOffset], channel) += getSourceValue(channel, variableIds.GetPixel(idOffset));
+      }
+    }
+  }
+}
+
+template <typename TPixel>
+double PoissonPlan<TPixel>::GetNearestValue(const ImageType* const image, itk::Index<2> pixel)
+{
+  const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+  for(unsigned int dimension = 0; dimension < 2; ++dimension)
+  {
+    pixel[dimension] = std::max(pixel[dimension], region.GetIndex()[dimension]);
+    pixel[dimension] = std::min(pixel[dimension], region.GetUpperIndex()[dimension]);
+  }
+  return image->GetPixel(pixel);
+}
+
+template <typename TPixel>
+unsigned int PoissonPlan<TPixel>::SolveMixedPrecision(const Component& component, const Eigen::MatrixXd& B,
+                                                      Eigen::MatrixXd& X, const double tolerance)
+{
+  X = component.FloatLDLT->solve(B.cast<float>().eval()).template cast<double>();
+
+  Eigen::VectorXd bNorms = B.colwise().norm().transpose();
+  bNorms = bNorms.cwiseMax(std::numeric_limits<double>::min());
+
+  // Each step only reduces the error by a factor that depends on the conditioning of A, so stop
+  // once the residual no longer decreases
+  const unsigned int maximumNumberOfSteps = 10;
+  double previousResidual = std::numeric_limits<double>::infinity();
+  unsigned int numberOfSteps = 0;
+  for(; numberOfSteps < maximumNumberOfSteps; ++numberOfSteps)
+  {
+    const Eigen::MatrixXd R = B - component.A * X;
+    const double relativeResidual = (R.colwise().norm().transpose().cwiseQuotient(bNorms)).maxCoeff();
+    if(relativeResidual <= tolerance || relativeResidual >= previousResidual)
+    {
+      break;
+    }
+    previousResidual = relativeResidual;
+
+    X += component.FloatLDLT->solve(R.cast<float>().eval()).template cast<double>();
+  }
+
+  return numberOfSteps;
+}
+
+#endif
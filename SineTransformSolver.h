@@ -0,0 +1,83 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef SineTransformSolver_H
+#define SineTransformSolver_H
+
+#include "VariableIdImage.h"
+
+// Eigen
+#include <Eigen/Dense>
+#include <unsupported/Eigen/FFT>
+
+// STL
+#include <complex>
+#include <vector>
+
+/** This class solves the 5-point Poisson system of a hole that fills its whole bounding box (the
+  * same system that PoissonEditing assembles) exactly, without a matrix. With Dirichlet boundaries
+  * the second difference along x is diagonalized by the discrete sine transform (DST-I), so after
+  * transforming each row of the right hand side, every frequency leaves an independent tridiagonal
+  * system along y. These are eliminated with the Thomas algorithm and the rows are transformed back.
+  *
+  * The row transforms are computed with Eigen's FFT module when the FFT length 2 (Width + 1) factors
+  * into small primes. Otherwise the FFT falls back to O(n^2) butterflies, so the rows are multiplied
+  * by the dense Width x Width sine matrix instead.
+  */
+class SineTransformSolver
+{
+public:
+  /** Check if every pixel in the bounding box of the hole is a hole pixel. */
+  static bool IsRectangle(const VariableIdImage& variableIds);
+
+  /** Prepare the solver for the hole numbered in 'variableIds', which must be a rectangle. This
+    * eliminates the tridiagonal systems once for all of the right hand sides. */
+  void Compute(const VariableIdImage& variableIds);
+
+  /** Solve A X = B for each column of B. */
+  void Solve(const Eigen::MatrixXd& B, Eigen::MatrixXd& X) const;
+
+protected:
+
+  /** Replace each of the 'numberOfRows' rows of length Width in 'values' with its DST-I, scaled so
+    * that applying it twice is the identity. */
+  void SineTransformRows(double* const values, const std::size_t numberOfRows) const;
+
+  /** Replace the 'length' values in 'values' with their (unnormalized) DST-I. 'extended' and
+    * 'spectrum' are work space. */
+  static void SineTransform(Eigen::FFT<double>& fft, std::vector<double>& extended,
+                            std::vector<std::complex<double> >& spectrum,
+                            double* const values, const std::size_t length);
+
+  /** Get the estimated cost per value of a DST-I of 'length' values with the FFT. */
+  static double GetFFTCost(const std::size_t length);
+
+  /** The size of the rectangle. */
+  std::size_t Width = 0;
+  std::size_t Height = 0;
+
+  /** The normalized DST-I matrix, if the rows are transformed without the FFT. */
+  Eigen::MatrixXd TransformMatrix;
+
+  /** The reciprocal pivots of the tridiagonal system of each frequency (Height x Width, x fastest). */
+  std::vector<double> Pivots;
+};
+
+#include "SineTransformSolver.hpp"
+
+#endif
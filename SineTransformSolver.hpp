@@ -0,0 +1,213 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef SineTransformSolver_HPP
+#define SineTransformSolver_HPP
+
+#include "SineTransformSolver.h" // Appease syntax parser
+
+#include "ParallelHelpers.h"
+
+// STL
+#include <cmath>
+#include <stdexcept>
+
+inline bool SineTransformSolver::IsRectangle(const VariableIdImage& variableIds)
+{
+  return variableIds.GetNumberOfVariables() > 0 &&
+         variableIds.GetNumberOfVariables() == variableIds.GetRegion().GetNumberOfPixels();
+}
+
+inline void SineTransformSolver::Compute(const VariableIdImage& variableIds)
+{
+  if(!IsRectangle(variableIds))
+  {
+    throw std::runtime_error("SineTransformSolver: The hole must be a rectangle!");
+  }
+
+  const std::size_t width = variableIds.GetRegion().GetSize()[0];
+  const std::size_t height = variableIds.GetRegion().GetSize()[1];
+  this->Width = width;
+  this->Height = height;
+
+  // sin(pi (n+1) (k+1) / (Width+1)) is an eigenvector of the second difference along x with zero
+  // boundaries, with eigenvalue -4 sin^2(pi (k+1) / (2 (Width+1)))
+  const double pi = 3.14159265358979323846;
+  std::vector<double> eigenvalues(width);
+  for(std::size_t k = 0; k < width; ++k)
+  {
+    eigenvalues[k] = -4.0 * std::pow(std::sin(pi * (k + 1) / (2.0 * (width + 1))), 2);
+  }
+
+  // The dense transform costs Width multiply-adds per value
+  if(GetFFTCost(width) > static_cast<double>(width))
+  {
+    this->TransformMatrix.resize(width, width);
+    for(std::size_t k = 0; k < width; ++k)
+    {
+      for(std::size_t n = 0; n < width; ++n)
+      {
+        this->TransformMatrix(k, n) = std::sqrt(2.0 / (width + 1)) * std::sin(pi * (n + 1) * (k + 1) / (width + 1));
+      }
+    }
+  }
+  else
+  {
+    this->TransformMatrix.resize(0, 0);
+  }
+
+  // Frequency k leaves the tridiagonal system (1, eigenvalues[k] - 2, 1) along y. Its pivots only
+  // depend on the hole, so they are computed once here.
+  this->Pivots.resize(width * height);
+  for(std::size_t k = 0; k < width; ++k)
+  {
+    this->Pivots[k] = 1.0 / (eigenvalues[k] - 2.0);
+  }
+  for(std::size_t y = 1; y < height; ++y)
+  {
+    for(std::size_t k = 0; k < width; ++k)
+    {
+      this->Pivots[y * width + k] = 1.0 / (eigenvalues[k] - 2.0 - this->Pivots[(y - 1) * width + k]);
+    }
+  }
+}
+
+inline double SineTransformSolver::GetFFTCost(const std::size_t length)
+{
+  // A mixed radix FFT does about one butterfly of size p per value for each prime factor p of its
+  // length. Each complex butterfly step costs several times a real multiply-add.
+  std::size_t remaining = 2 * (length + 1);
+  std::size_t sumOfFactors = 0;
+  for(std::size_t factor = 2; factor * factor <= remaining; ++factor)
+  {
+    while(remaining % factor == 0)
+    {
+      sumOfFactors += factor;
+      remaining /= factor;
+    }
+  }
+  if(remaining > 1)
+  {
+    sumOfFactors += remaining;
+  }
+
+  return 8.0 * sumOfFactors;
+}
+
+inline void SineTransformSolver::SineTransform(Eigen::FFT<double>& fft, std::vector<double>& extended,
+                                               std::vector<std::complex<double> >& spectrum,
+                                               double* const values, const std::size_t length)
+{
+  // The DST-I of x is (up to a factor of -2i) the FFT of the odd extension [0, x, 0, -reverse(x)]
+  extended.assign(2 * (length + 1), 0.0);
+  for(std::size_t n = 0; n < length; ++n)
+  {
+    extended[n + 1] = values[n];
+    extended[2 * (length + 1) - 1 - n] = -values[n];
+  }
+
+  fft.fwd(spectrum, extended);
+
+  for(std::size_t k = 0; k < length; ++k)
+  {
+    values[k] = -0.5 * spectrum[k + 1].imag();
+  }
+}
+
+inline void SineTransformSolver::SineTransformRows(double* const values, const std::size_t numberOfRows) const
+{
+  const std::size_t width = this->Width;
+
+  if(this->TransformMatrix.size() > 0)
+  {
+    // The rows are the columns of a column major Width x numberOfRows matrix
+    Eigen::Map<Eigen::MatrixXd> rows(values, width, numberOfRows);
+    ParallelHelpers::ParallelForRange(numberOfRows, [&](const std::size_t begin, const std::size_t end)
+    {
+      rows.middleCols(begin, end - begin) = this->TransformMatrix * rows.middleCols(begin, end - begin);
+    }, ParallelHelpers::GetMinimumRowsPerThread(width));
+    return;
+  }
+
+  // Each thread uses its own FFT (it caches its plans) and work space
+  const double normalization = std::sqrt(2.0 / (width + 1));
+  ParallelHelpers::ParallelForRange(numberOfRows, [&](const std::size_t begin, const std::size_t end)
+  {
+    Eigen::FFT<double> fft;
+    std::vector<double> extended;
+    std::vector<std::complex<double> > spectrum;
+    for(std::size_t row = begin; row < end; ++row)
+    {
+      double* const rowValues = values + row * width;
+      SineTransform(fft, extended, spectrum, rowValues, width);
+      for(std::size_t x = 0; x < width; ++x)
+      {
+        rowValues[x] *= normalization;
+      }
+    }
+  }, ParallelHelpers::GetMinimumRowsPerThread(width));
+}
+
+inline void SineTransformSolver::Solve(const Eigen::MatrixXd& B, Eigen::MatrixXd& X) const
+{
+  const std::size_t width = this->Width;
+  const std::size_t height = this->Height;
+
+  if(static_cast<std::size_t>(B.rows()) != width * height)
+  {
+    throw std::runtime_error("SineTransformSolver: The right hand side does not match the hole!");
+  }
+
+  // The variables of a rectangular hole are numbered in raster order, so each column of B is the
+  // right hand side image with x fastest, and the rows of all of the channels follow each other.
+  X = B;
+  SineTransformRows(X.data(), height * X.cols());
+
+  // Eliminate the tridiagonal system of each frequency. The frequencies are independent, so the
+  // inner loops run along the rows.
+  for(int channel = 0; channel < X.cols(); ++channel)
+  {
+    double* const values = X.col(channel).data();
+    ParallelHelpers::ParallelForRange(width, [&](const std::size_t begin, const std::size_t end)
+    {
+      const double* const pivots = this->Pivots.data();
+      for(std::size_t k = begin; k < end; ++k)
+      {
+        values[k] *= pivots[k];
+      }
+      for(std::size_t y = 1; y < height; ++y)
+      {
+        for(std::size_t k = begin; k < end; ++k)
+        {
+          values[y * width + k] = (values[y * width + k] - values[(y - 1) * width + k]) * pivots[y * width + k];
+        }
+      }
+      for(std::size_t y = height - 1; y-- > 0;)
+      {
+        for(std::size_t k = begin; k < end; ++k)
+        {
+          values[y * width + k] -= pivots[y * width + k] * values[(y + 1) * width + k];
+        }
+      }
+    }, ParallelHelpers::GetMinimumRowsPerThread(height));
+  }
+
+  SineTransformRows(X.data(), height * X.cols());
+}
+
+#endif
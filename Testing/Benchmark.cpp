@@ -0,0 +1,1426 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ConjugateGradientSolver.h"
+#include "PoissonBatchFilling.h"
+#include "PoissonCloningSession.h"
+#include "PoissonEditing.h"
+#include "PoissonEditingSession.h"
+#include "PoissonEditingWrappers.h"
+
+// Submodules
+#include "Mask/ITKHelpers/ITKHelpers.h"
+
+// ITK
+#include "itkAddImageFilter.h"
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkMultiThreader.h"
+#include "itkVectorImage.h"
+#include "itkVectorIndexSelectionCastImageFilter.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+typedef PoissonEditing<float> PoissonEditingType;
+typedef PoissonEditingType::ImageType ImageType;
+typedef PoissonEditingType::FloatImageType FloatImageType;
+typedef PoissonEditingType::SparseMatrixType SparseMatrixType;
+typedef itk::VectorImage<float, 2> VectorImageType;
+
+/** Time a function call in seconds. */
+template <typename TFunction>
+static double Time(TFunction function)
+{
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  function();
+  std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+/** Get a field of /proc/self/status (for example "VmRSS" or "VmHWM") in bytes, or 0 if it is not
+  * available (it only is on Linux). */
+static std::size_t GetProcessStatus(const std::string& field)
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while(std::getline(status, line))
+  {
+    if(line.compare(0, field.size() + 1, field + ":") == 0)
+    {
+      std::stringstream ss(line.substr(field.size() + 1));
+      std::size_t kilobytes = 0;
+      ss >> kilobytes;
+      return kilobytes * 1024;
+    }
+  }
+  return 0;
+}
+
+/** Reset the peak resident set size (VmHWM) to the current one, so that the peak of the next step
+  * can be measured on its own. */
+static void ResetPeakResidentSetSize()
+{
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5" << std::endl;
+}
+
+/** Run a function and get by how many bytes it raised the peak resident set size above the
+  * resident set size before it. */
+template <typename TFunction>
+static std::size_t PeakMemory(TFunction function)
+{
+  ResetPeakResidentSetSize();
+  const std::size_t residentSetSize = GetProcessStatus("VmRSS");
+  function();
+  const std::size_t peakResidentSetSize = GetProcessStatus("VmHWM");
+  return peakResidentSetSize > residentSetSize ? peakResidentSetSize - residentSetSize : 0;
+}
+
+/** Create a square image with a smooth pattern, a mask with a disc (or square) shaped hole in its
+  * center and a zero Laplacian. */
+static void CreateScene(const unsigned int imageSize, const unsigned int holeRadius,
+                        ImageType* const image, Mask* const mask, FloatImageType* const laplacian,
+                        const bool squareHole = false)
+{
+  itk::Index<2> corner = {{0, 0}};
+  itk::Size<2> size = {{imageSize, imageSize}};
+  itk::ImageRegion<2> region(corner, size);
+
+  image->SetRegions(region);
+  image->Allocate();
+  itk::ImageRegionIterator<ImageType> imageIterator(image, region);
+  while(!imageIterator.IsAtEnd())
+  {
+    imageIterator.Set(100.0f + 50.0f * std::sin(imageIterator.GetIndex()[0] * 0.01f) *
+                      std::cos(imageIterator.GetIndex()[1] * 0.02f));
+    ++imageIterator;
+  }
+
+  mask->SetRegions(region);
+  mask->Allocate();
+  itk::ImageRegionIterator<Mask> maskIterator(mask, region);
+  const double center = imageSize / 2.0;
+  while(!maskIterator.IsAtEnd())
+  {
+    const double dx = maskIterator.GetIndex()[0] - center;
+    const double dy = maskIterator.GetIndex()[1] - center;
+    const bool inside = squareHole ? (std::abs(dx) < holeRadius && std::abs(dy) < holeRadius) :
+                                     (dx * dx + dy * dy < holeRadius * holeRadius);
+    maskIterator.Set(inside ? HoleMaskPixelTypeEnum::HOLE : HoleMaskPixelTypeEnum::VALID);
+    ++maskIterator;
+  }
+
+  laplacian->SetRegions(region);
+  laplacian->Allocate();
+  laplacian->FillBuffer(0.0f);
+}
+
+/** Copy 'image' into every channel of a vector image, scaled differently so that the channels differ. */
+static VectorImageType::Pointer CreateVectorImage(const ImageType* const image, const unsigned int numberOfChannels)
+{
+  VectorImageType::Pointer vectorImage = VectorImageType::New();
+  vectorImage->SetRegions(image->GetLargestPossibleRegion());
+  vectorImage->SetNumberOfComponentsPerPixel(numberOfChannels);
+  vectorImage->Allocate();
+  const float* const values = image->GetBufferPointer();
+  float* const vectorValues = vectorImage->GetBufferPointer();
+  for(std::size_t pixel = 0; pixel < image->GetLargestPossibleRegion().GetNumberOfPixels(); ++pixel)
+  {
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      vectorValues[pixel * numberOfChannels + channel] = values[pixel] * (channel + 1);
+    }
+  }
+
+  return vectorImage;
+}
+
+/** The original assembly loop: one coeffRef() insertion per stencil entry. */
+static void AssembleSystemWithCoeffRef(const VariableIdImage& variableIds, const ImageType* const targetImage,
+                                       const FloatImageType* const laplacian,
+                                       SparseMatrixType& A, Eigen::VectorXd& b)
+{
+  const itk::Offset<2> stencilOffsets[5] = {{{0, -1}}, {{-1, 0}}, {{0, 0}}, {{1, 0}}, {{0, 1}}};
+  const double stencilWeights[5] = {1.0, 1.0, -4.0, 1.0, 1.0};
+
+  A.resize(variableIds.GetNumberOfVariables(), variableIds.GetNumberOfVariables());
+  A.reserve(Eigen::VectorXi::Constant(variableIds.GetNumberOfVariables(), 5));
+  b.resize(variableIds.GetNumberOfVariables());
+
+  const std::vector<int>& ids = variableIds.GetIds();
+  for(std::size_t idOffset = 0; idOffset < ids.size(); ++idOffset)
+  {
+    if(ids[idOffset] < 0)
+    {
+      continue;
+    }
+
+    const itk::Index<2> pixel = variableIds.GetPixel(idOffset);
+    double bValue = laplacian->GetPixel(pixel);
+    for(unsigned int neighbor = 0; neighbor < 5; ++neighbor)
+    {
+      const itk::Index<2> neighborPixel = pixel + stencilOffsets[neighbor];
+      if(!targetImage->GetLargestPossibleRegion().IsInside(neighborPixel))
+      {
+        continue;
+      }
+
+      const int neighborId = variableIds.GetId(neighborPixel);
+      if(neighborId >= 0)
+      {
+        A.coeffRef(ids[idOffset], neighborId) += stencilWeights[neighbor];
+      }
+      else
+      {
+        bValue -= targetImage->GetPixel(neighborPixel) * stencilWeights[neighbor];
+      }
+    }
+    b[ids[idOffset]] = bValue;
+  }
+}
+
+/** The original Laplacian of a guidance field: a filter for each component, a derivative of each and
+  * their sum. */
+static void LaplacianFromGradientWithFilters(const PoissonEditingType::GradientImageType* const gradientImage,
+                                             FloatImageType* const outputLaplacian)
+{
+  typedef itk::VectorIndexSelectionCastImageFilter<PoissonEditingType::GradientImageType, FloatImageType> IndexSelectionType;
+
+  IndexSelectionType::Pointer xIndexSelectionFilter = IndexSelectionType::New();
+  xIndexSelectionFilter->SetIndex(0);
+  xIndexSelectionFilter->SetInput(gradientImage);
+  xIndexSelectionFilter->Update();
+
+  FloatImageType::Pointer xSecondDerivative = FloatImageType::New();
+  ITKHelpers::CentralDifferenceDerivative(xIndexSelectionFilter->GetOutput(), 0, xSecondDerivative.GetPointer());
+
+  IndexSelectionType::Pointer yIndexSelectionFilter = IndexSelectionType::New();
+  yIndexSelectionFilter->SetIndex(1);
+  yIndexSelectionFilter->SetInput(gradientImage);
+  yIndexSelectionFilter->Update();
+
+  FloatImageType::Pointer ySecondDerivative = FloatImageType::New();
+  ITKHelpers::CentralDifferenceDerivative(yIndexSelectionFilter->GetOutput(), 1, ySecondDerivative.GetPointer());
+
+  typedef itk::AddImageFilter<FloatImageType, FloatImageType> AddImageFilterType;
+  AddImageFilterType::Pointer addFilter = AddImageFilterType::New();
+  addFilter->SetInput1(xSecondDerivative);
+  addFilter->SetInput2(ySecondDerivative);
+  addFilter->Update();
+
+  ITKHelpers::DeepCopy(addFilter->GetOutput(), outputLaplacian);
+}
+
+/** Compare the original filter chain with PoissonEditing::LaplacianFromGradient(), over the whole
+  * image and over the bounding box of the hole only. */
+static void BenchmarkDivergence(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  PoissonEditingType::GradientImageType::Pointer gradientImage = PoissonEditingType::GradientImageType::New();
+  gradientImage->SetRegions(image->GetLargestPossibleRegion());
+  gradientImage->Allocate();
+  ITKHelpers::ComputeGradients(image.GetPointer(), gradientImage.GetPointer());
+
+  std::cout << "Divergence: " << imageSize << "x" << imageSize << " guidance field" << std::endl;
+
+  FloatImageType::Pointer referenceLaplacian = FloatImageType::New();
+  double filterTime = Time([&]()
+  {
+    LaplacianFromGradientWithFilters(gradientImage, referenceLaplacian);
+  });
+  std::cout << "  filter chain:          " << filterTime << " s" << std::endl;
+
+  itk::ImageRegion<2> holeBoundingBox = ITKHelpers::ComputeBoundingBox(mask.GetPointer(), HoleMaskPixelTypeEnum::HOLE);
+  holeBoundingBox.PadByRadius(1);
+  holeBoundingBox.Crop(image->GetLargestPossibleRegion());
+
+  const unsigned int maximumNumberOfThreads = ParallelHelpers::GetNumberOfThreads();
+  for(unsigned int numberOfThreads = 1; numberOfThreads <= maximumNumberOfThreads; numberOfThreads *= 2)
+  {
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(numberOfThreads);
+
+    FloatImageType::Pointer fusedLaplacian = FloatImageType::New();
+    double fusedTime = Time([&]()
+    {
+      PoissonEditingType::LaplacianFromGradient(gradientImage, fusedLaplacian);
+    });
+
+    FloatImageType::Pointer holeLaplacian = FloatImageType::New();
+    double holeTime = Time([&]()
+    {
+      PoissonEditingType::LaplacianFromGradient(gradientImage, holeBoundingBox, holeLaplacian);
+    });
+
+    double maximumDifference = 0.0;
+    itk::ImageRegionConstIterator<FloatImageType> referenceIterator(referenceLaplacian, referenceLaplacian->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator<FloatImageType> fusedIterator(fusedLaplacian, referenceLaplacian->GetLargestPossibleRegion());
+    while(!referenceIterator.IsAtEnd())
+    {
+      maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(referenceIterator.Get()) -
+                                                               fusedIterator.Get()));
+      ++referenceIterator;
+      ++fusedIterator;
+    }
+
+    std::cout << "  fused, " << numberOfThreads << " thread(s):     " << fusedTime << " s (speedup "
+              << filterTime / fusedTime << ", max difference " << maximumDifference << "), hole bounding box only "
+              << holeTime << " s" << std::endl;
+  }
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads(maximumNumberOfThreads);
+}
+
+/** The original guidance fields of a multi-channel image: each channel is copied out of the image
+  * and differentiated on its own. */
+template <typename TImage>
+static std::vector<PoissonEditingType::GuidanceFieldType::Pointer> ComputeGuidanceFieldPerChannel(const TImage* const image)
+{
+  std::vector<PoissonEditingType::GuidanceFieldType::Pointer> guidanceFields;
+  for(unsigned int channel = 0; channel < image->GetNumberOfComponentsPerPixel(); ++channel)
+  {
+    FloatImageType::Pointer imageChannel = FloatImageType::New();
+    imageChannel->SetRegions(image->GetLargestPossibleRegion());
+    imageChannel->Allocate();
+    ITKHelpers::ExtractChannel(image, channel, imageChannel.GetPointer());
+
+    PoissonEditingType::GuidanceFieldType::Pointer guidanceField = PoissonEditingType::GuidanceFieldType::New();
+    guidanceField->SetRegions(image->GetLargestPossibleRegion());
+    guidanceField->Allocate();
+    ITKHelpers::ComputeGradients(imageChannel.GetPointer(), guidanceField.GetPointer());
+    guidanceFields.push_back(guidanceField);
+  }
+  return guidanceFields;
+}
+
+/** Compare computing the guidance fields of an RGB image channel by channel with
+  * PoissonEditingParent::ComputeGuidanceField(). */
+static void BenchmarkGradients(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  const unsigned int numberOfChannels = 3;
+  VectorImageType::Pointer vectorImage = CreateVectorImage(image, numberOfChannels);
+
+  std::cout << "Gradients: " << imageSize << "x" << imageSize << " image, " << numberOfChannels << " channels" << std::endl;
+
+  std::vector<PoissonEditingType::GuidanceFieldType::Pointer> referenceFields;
+  double perChannelTime = Time([&]()
+  {
+    referenceFields = ComputeGuidanceFieldPerChannel(vectorImage.GetPointer());
+  });
+  std::cout << "  channel by channel:    " << perChannelTime << " s" << std::endl;
+
+  const unsigned int maximumNumberOfThreads = ParallelHelpers::GetNumberOfThreads();
+  for(unsigned int numberOfThreads = 1; numberOfThreads <= maximumNumberOfThreads; numberOfThreads *= 2)
+  {
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(numberOfThreads);
+
+    std::vector<PoissonEditingType::GuidanceFieldType::Pointer> fields;
+    double fusedTime = Time([&]()
+    {
+      fields = PoissonEditingParent::ComputeGuidanceField(vectorImage.GetPointer());
+    });
+
+    double maximumDifference = 0.0;
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      itk::ImageRegionConstIterator<PoissonEditingType::GuidanceFieldType> referenceIterator(
+          referenceFields[channel], referenceFields[channel]->GetLargestPossibleRegion());
+      itk::ImageRegionConstIterator<PoissonEditingType::GuidanceFieldType> fieldIterator(
+          fields[channel], referenceFields[channel]->GetLargestPossibleRegion());
+      while(!referenceIterator.IsAtEnd())
+      {
+        for(unsigned int dimension = 0; dimension < 2; ++dimension)
+        {
+          maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(referenceIterator.Get()[dimension]) -
+                                                                   fieldIterator.Get()[dimension]));
+        }
+        ++referenceIterator;
+        ++fieldIterator;
+      }
+    }
+
+    std::cout << "  fused, " << numberOfThreads << " thread(s):     " << fusedTime << " s (speedup "
+              << perChannelTime / fusedTime << ", max difference " << maximumDifference << ")" << std::endl;
+  }
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads(maximumNumberOfThreads);
+}
+
+/** Fill an image with 8 channels (as in multispectral imagery) that each have their own guidance
+  * field, with an increasing number of threads. */
+static void BenchmarkChannels(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  const unsigned int numberOfChannels = 8;
+  VectorImageType::Pointer vectorImage = CreateVectorImage(image, numberOfChannels);
+  const std::vector<PoissonEditingType::GuidanceFieldType::Pointer> guidanceFields =
+      PoissonEditingParent::ComputeGuidanceField(vectorImage.GetPointer());
+
+  std::cout << "Channels: " << imageSize << "x" << imageSize << " image, " << numberOfChannels
+            << " channels, hole radius " << holeRadius << std::endl;
+
+  const itk::ImageRegion<2> region = vectorImage->GetLargestPossibleRegion();
+  VectorImageType::Pointer referenceOutput;
+  double serialTime = 0.0;
+  const unsigned int maximumNumberOfThreads = ParallelHelpers::GetNumberOfThreads();
+  for(unsigned int numberOfThreads = 1; numberOfThreads <= maximumNumberOfThreads; numberOfThreads *= 2)
+  {
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(numberOfThreads);
+
+    VectorImageType::Pointer output = VectorImageType::New();
+    double fillTime = Time([&]()
+    {
+      FillImage(vectorImage.GetPointer(), mask.GetPointer(), guidanceFields, output.GetPointer(), region,
+                static_cast<const VectorImageType*>(nullptr));
+    });
+
+    if(!referenceOutput)
+    {
+      referenceOutput = output;
+      serialTime = fillTime;
+    }
+
+    double maximumDifference = 0.0;
+    const float* const referenceValues = referenceOutput->GetBufferPointer();
+    const float* const values = output->GetBufferPointer();
+    for(std::size_t value = 0; value < region.GetNumberOfPixels() * numberOfChannels; ++value)
+    {
+      maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(referenceValues[value]) - values[value]));
+    }
+
+    std::cout << "  " << numberOfThreads << " thread(s): " << fillTime << " s (speedup "
+              << serialTime / fillTime << ", max difference " << maximumDifference << ")" << std::endl;
+  }
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads(maximumNumberOfThreads);
+}
+
+/** Compare filling the same hole in 16 RGB frames with FillImage(), which prepares the solver of the
+  * hole for every frame, with PoissonBatchFilling, which prepares it once and solves several frames
+  * together. */
+static void BenchmarkBatch(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  // Frames that differ by a brightness change
+  const unsigned int numberOfFrames = 16;
+  const unsigned int numberOfChannels = 3;
+  std::vector<VectorImageType::Pointer> frames(numberOfFrames);
+  for(unsigned int frame = 0; frame < numberOfFrames; ++frame)
+  {
+    frames[frame] = CreateVectorImage(image, numberOfChannels);
+    float* const values = frames[frame]->GetBufferPointer();
+    for(std::size_t value = 0; value < image->GetLargestPossibleRegion().GetNumberOfPixels() * numberOfChannels; ++value)
+    {
+      values[value] += frame;
+    }
+  }
+
+  std::cout << "Batch: " << imageSize << "x" << imageSize << " image, hole radius " << holeRadius << ", "
+            << numberOfFrames << " frames" << std::endl;
+
+  const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+  PoissonEditingType::GuidanceFieldType::Pointer zeroGuidanceField =
+      PoissonEditingType::CreateZeroGuidanceField(frames[0].GetPointer());
+  std::vector<VectorImageType::Pointer> referenceOutputs(numberOfFrames);
+  double referenceTime = Time([&]()
+  {
+    for(unsigned int frame = 0; frame < numberOfFrames; ++frame)
+    {
+      referenceOutputs[frame] = VectorImageType::New();
+      FillImage(frames[frame].GetPointer(), mask.GetPointer(), zeroGuidanceField.GetPointer(),
+                referenceOutputs[frame].GetPointer(), region, static_cast<const VectorImageType*>(nullptr));
+    }
+  });
+  std::cout << "  FillImage per frame:  " << numberOfFrames / referenceTime << " images/s" << std::endl;
+
+  const unsigned int batchSizes[3] = {1, 4, 16};
+  for(unsigned int batchSize : batchSizes)
+  {
+    std::vector<const VectorImageType*> images(frames.begin(), frames.end());
+    std::vector<VectorImageType::Pointer> outputs(numberOfFrames);
+    std::vector<VectorImageType*> outputPointers(numberOfFrames);
+    for(unsigned int frame = 0; frame < numberOfFrames; ++frame)
+    {
+      outputs[frame] = VectorImageType::New();
+      outputPointers[frame] = outputs[frame];
+    }
+
+    PoissonBatchFilling<VectorImageType> batchFilling;
+    batchFilling.SetBatchSize(batchSize);
+    double batchTime = Time([&]()
+    {
+      batchFilling.SetMask(mask);
+      batchFilling.Fill(images, outputPointers);
+    });
+
+    double maximumDifference = 0.0;
+    for(unsigned int frame = 0; frame < numberOfFrames; ++frame)
+    {
+      const float* const referenceValues = referenceOutputs[frame]->GetBufferPointer();
+      const float* const values = outputs[frame]->GetBufferPointer();
+      for(std::size_t value = 0; value < region.GetNumberOfPixels() * numberOfChannels; ++value)
+      {
+        maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(referenceValues[value]) - values[value]));
+      }
+    }
+
+    std::cout << "  batches of " << batchSize << ":" << std::string(batchSize < 10 ? 6 : 5, ' ')
+              << numberOfFrames / batchTime << " images/s (speedup " << referenceTime / batchTime
+              << ", max difference " << maximumDifference << ")" << std::endl;
+  }
+}
+
+/** Compare solving 3 channels one after the other with solving them together in the interleaved
+  * layout, with both preconditioners of the conjugate gradient solver. Plain conjugate gradient
+  * would take thousands of iterations, so the number of iterations is limited to 200. */
+static void BenchmarkInterleaved(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  VariableIdImage variableIds;
+  variableIds.Compute(mask);
+
+  const unsigned int numberOfChannels = 3;
+  std::cout << "Interleaved: " << imageSize << "x" << imageSize << " image, "
+            << variableIds.GetNumberOfVariables() << " unknowns, " << numberOfChannels << " channels" << std::endl;
+
+  const Eigen::MatrixXd B = Eigen::MatrixXd::Random(variableIds.GetNumberOfVariables(), numberOfChannels);
+  const ConjugateGradientSolver::PreconditionerEnum preconditioners[2] =
+      {ConjugateGradientSolver::PreconditionerEnum::JACOBI, ConjugateGradientSolver::PreconditionerEnum::MULTIGRID};
+  const char* const preconditionerNames[2] = {"Jacobi", "multigrid"};
+  for(unsigned int preconditioner = 0; preconditioner < 2; ++preconditioner)
+  {
+    ConjugateGradientSolver solver;
+    solver.SetPreconditioner(preconditioners[preconditioner]);
+    solver.SetMaximumNumberOfIterations(200);
+    solver.Compute(variableIds);
+
+    Eigen::MatrixXd perChannelX(B.rows(), numberOfChannels);
+    double perChannelTime = Time([&]()
+    {
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        Eigen::MatrixXd x;
+        solver.Solve(B.col(channel), x);
+        perChannelX.col(channel) = x;
+      }
+    });
+
+    Eigen::MatrixXd X;
+    solver.SetMinimumNumberOfInterleavedVariables(0);
+    double interleavedTime = Time([&]()
+    {
+      solver.Solve(B, X);
+    });
+
+    std::cout << "  " << preconditionerNames[preconditioner] << ", channel by channel: " << perChannelTime << " s" << std::endl;
+    std::cout << "  " << preconditionerNames[preconditioner] << ", interleaved:        " << interleavedTime
+              << " s (speedup " << perChannelTime / interleavedTime << ", " << solver.GetNumberOfIterations()
+              << " iterations, max difference " << (X - perChannelX).cwiseAbs().maxCoeff() << ")" << std::endl;
+  }
+}
+
+/** Compare the original coeffRef() assembly loop with PoissonEditing::AssembleSystem(). */
+static void BenchmarkAssembly(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  VariableIdImage variableIds;
+  variableIds.Compute(mask);
+
+  std::cout << "Assembly: " << imageSize << "x" << imageSize << " image, "
+            << variableIds.GetNumberOfVariables() << " unknowns" << std::endl;
+
+  SparseMatrixType referenceA;
+  Eigen::VectorXd referenceB;
+  double coeffRefTime = Time([&]()
+  {
+    AssembleSystemWithCoeffRef(variableIds, image, laplacian, referenceA, referenceB);
+  });
+  referenceA.makeCompressed();
+  std::cout << "  coeffRef loop:            " << coeffRefTime << " s" << std::endl;
+
+  const unsigned int maximumNumberOfThreads = ParallelHelpers::GetNumberOfThreads();
+  for(unsigned int numberOfThreads = 1; numberOfThreads <= maximumNumberOfThreads; numberOfThreads *= 2)
+  {
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(numberOfThreads);
+
+    std::vector<const ImageType*> targetImages(1, image.GetPointer());
+    std::vector<const FloatImageType*> laplacians(1, laplacian.GetPointer());
+    SparseMatrixType A;
+    Eigen::MatrixXd B;
+    double directTime = Time([&]()
+    {
+      PoissonEditingType::AssembleSystem(variableIds, targetImages, laplacians, A, B);
+    });
+
+    const double difference = (A - referenceA).norm() + (B.col(0) - referenceB).norm();
+    std::cout << "  direct CSR, " << numberOfThreads << " thread(s): " << directTime << " s"
+              << " (speedup " << coeffRefTime / directTime << ", difference " << difference << ")" << std::endl;
+  }
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads(maximumNumberOfThreads);
+}
+
+/** Compare LDLT with the sine transform solver on a square hole. */
+static void BenchmarkRectangle(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian, true);
+
+  VariableIdImage variableIds;
+  variableIds.Compute(mask);
+
+  std::cout << "Rectangle: " << variableIds.GetRegion().GetSize() << " hole, "
+            << variableIds.GetNumberOfVariables() << " unknowns" << std::endl;
+
+  std::vector<const ImageType*> targetImages(1, image.GetPointer());
+  std::vector<const FloatImageType*> laplacians(1, laplacian.GetPointer());
+  SparseMatrixType A;
+  Eigen::MatrixXd B;
+  PoissonEditingType::AssembleSystem(variableIds, targetImages, laplacians, A, B);
+
+  Eigen::MatrixXd ldltX;
+  double ldltTime = Time([&]()
+  {
+    Eigen::SimplicialLDLT<SparseMatrixType> sparseSolver(A);
+    ldltX = sparseSolver.solve(B);
+  });
+  std::cout << "  LDLT (factorize and solve): " << ldltTime << " s" << std::endl;
+
+  Eigen::MatrixXd sineTransformX;
+  double sineTransformTime = Time([&]()
+  {
+    SineTransformSolver sineTransformSolver;
+    sineTransformSolver.Compute(variableIds);
+    sineTransformSolver.Solve(B, sineTransformX);
+  });
+  std::cout << "  sine transform:             " << sineTransformTime << " s"
+            << " (speedup " << ldltTime / sineTransformTime
+            << ", max difference " << (sineTransformX - ldltX).cwiseAbs().maxCoeff() << ")" << std::endl;
+}
+
+/** Compare LDLT with the domain decomposition solver on a disc shaped hole, from 1 to the maximum
+  * number of threads. */
+static void BenchmarkDomainDecomposition(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  VariableIdImage variableIds;
+  variableIds.Compute(mask);
+
+  std::cout << "Domain decomposition: " << imageSize << "x" << imageSize << " image, "
+            << variableIds.GetNumberOfVariables() << " unknowns" << std::endl;
+
+  std::vector<const ImageType*> targetImages(1, image.GetPointer());
+  std::vector<const FloatImageType*> laplacians(1, laplacian.GetPointer());
+  SparseMatrixType A;
+  Eigen::MatrixXd B;
+  PoissonEditingType::AssembleSystem(variableIds, targetImages, laplacians, A, B);
+
+  Eigen::MatrixXd ldltX;
+  double ldltTime = Time([&]()
+  {
+    Eigen::SimplicialLDLT<SparseMatrixType> sparseSolver(A);
+    ldltX = sparseSolver.solve(B);
+  });
+  std::cout << "  LDLT (factorize and solve): " << ldltTime << " s" << std::endl;
+
+  const unsigned int maximumNumberOfThreads = ParallelHelpers::GetNumberOfThreads();
+  double singleThreadTime = 0.0;
+  for(unsigned int numberOfThreads = 1; numberOfThreads <= maximumNumberOfThreads; numberOfThreads *= 2)
+  {
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(numberOfThreads);
+
+    Eigen::MatrixXd domainDecompositionX;
+    DomainDecompositionSolver domainDecompositionSolver;
+    double domainDecompositionTime = Time([&]()
+    {
+      domainDecompositionSolver.Compute(variableIds);
+      domainDecompositionSolver.Solve(B, domainDecompositionX);
+    });
+    if(numberOfThreads == 1)
+    {
+      singleThreadTime = domainDecompositionTime;
+    }
+
+    std::cout << "  domain decomposition, " << numberOfThreads << " thread(s): " << domainDecompositionTime << " s"
+              << " (speedup " << ldltTime / domainDecompositionTime
+              << ", scaling " << singleThreadTime / domainDecompositionTime
+              << ", " << domainDecompositionSolver.GetNumberOfSubdomains() << " subdomains"
+              << ", max difference " << (domainDecompositionX - ldltX).cwiseAbs().maxCoeff() << ")" << std::endl;
+  }
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads(maximumNumberOfThreads);
+}
+
+/** Time a PoissonEditingSession over a sequence of brush strokes that grow a disc shaped hole,
+  * against factorizing each stroke from scratch, and then undo the strokes. */
+static void BenchmarkSession(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  PoissonEditingSession<ImageType> session;
+  session.SetTargetImage(image.GetPointer());
+
+  ImageType::Pointer output = ImageType::New();
+  double factorizeTime = Time([&]()
+  {
+    session.SetMask(mask.GetPointer());
+  });
+  double fillTime = Time([&]()
+  {
+    session.Fill(output.GetPointer());
+  });
+  std::cout << "Session: " << imageSize << "x" << imageSize << " image, " << session.GetNumberOfChangedPixels()
+            << " unknowns, factorize " << factorizeTime << " s, fill " << fillTime << " s" << std::endl;
+
+  // Brush strokes (discs of radius 8) around the rim of the hole
+  const unsigned int numberOfStrokes = 8;
+  const int brushRadius = 8;
+  for(unsigned int stroke = 0; stroke < numberOfStrokes; ++stroke)
+  {
+    const double angle = 2.0 * 3.14159265358979 * stroke / numberOfStrokes;
+    const int centerX = static_cast<int>(imageSize / 2.0 + holeRadius * std::cos(angle));
+    const int centerY = static_cast<int>(imageSize / 2.0 + holeRadius * std::sin(angle));
+    for(int y = centerY - brushRadius; y <= centerY + brushRadius; ++y)
+    {
+      for(int x = centerX - brushRadius; x <= centerX + brushRadius; ++x)
+      {
+        itk::Index<2> pixel = {{x, y}};
+        if((x - centerX) * (x - centerX) + (y - centerY) * (y - centerY) <= brushRadius * brushRadius &&
+           mask->GetLargestPossibleRegion().IsInside(pixel))
+        {
+          mask->SetPixel(pixel, HoleMaskPixelTypeEnum::HOLE);
+        }
+      }
+    }
+
+    double updateTime = Time([&]()
+    {
+      session.SetMask(mask.GetPointer());
+    });
+    fillTime = Time([&]()
+    {
+      session.Fill(output.GetPointer());
+    });
+    std::cout << "  stroke " << stroke << ": " << session.GetNumberOfChangedPixels() << " pixels, update "
+              << updateTime << " s (" << 100.0 * session.GetRefactorizedFraction() << "% of the subdomains), fill "
+              << fillTime << " s" << std::endl;
+  }
+
+  // The result must match a factorization from scratch
+  PoissonEditingSession<ImageType> freshSession;
+  freshSession.SetTargetImage(image.GetPointer());
+  ImageType::Pointer freshOutput = ImageType::New();
+  factorizeTime = Time([&]()
+  {
+    freshSession.SetMask(mask.GetPointer());
+  });
+  freshSession.Fill(freshOutput.GetPointer());
+
+  double maximumDifference = 0.0;
+  itk::ImageRegionConstIterator<ImageType> outputIterator(output.GetPointer(), output->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<ImageType> freshOutputIterator(freshOutput.GetPointer(), freshOutput->GetLargestPossibleRegion());
+  while(!outputIterator.IsAtEnd())
+  {
+    maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(outputIterator.Get()) -
+                                                             freshOutputIterator.Get()));
+    ++outputIterator;
+    ++freshOutputIterator;
+  }
+  std::cout << "  factorize from scratch: " << factorizeTime << " s, max difference " << maximumDifference << std::endl;
+
+  unsigned int numberOfUndoSteps = 0;
+  double undoTime = Time([&]()
+  {
+    while(session.Undo())
+    {
+      ++numberOfUndoSteps;
+    }
+  });
+  std::cout << "  undo " << numberOfUndoSteps << " strokes: " << undoTime << " s" << std::endl;
+}
+
+/** Time a PoissonCloningSession that pastes a disc shaped source at a sequence of positions, and
+  * compare its result with FillImage(). */
+static void BenchmarkCloning(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer target = ImageType::New();
+  Mask::Pointer targetMask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, target, targetMask, laplacian);
+
+  // The source is the disc and a margin around it
+  ImageType::Pointer source = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  CreateScene(2 * holeRadius + 8, holeRadius, source, mask, laplacian);
+
+  PoissonCloningSession<ImageType> session;
+  session.SetTargetImage(target.GetPointer());
+  session.SetSourceImage(source.GetPointer());
+  double factorizeTime = Time([&]()
+  {
+    session.SetMask(mask.GetPointer());
+  });
+  std::cout << "Cloning: " << imageSize << "x" << imageSize << " target, " << 2 * holeRadius + 8 << "x"
+            << 2 * holeRadius + 8 << " source, factorize " << factorizeTime << " s" << std::endl;
+
+  // Drag the source along the diagonal
+  ImageType::Pointer output = ImageType::New();
+  const unsigned int numberOfPositions = 8;
+  itk::Index<2> position = {{0, 0}};
+  for(unsigned int step = 0; step < numberOfPositions; ++step)
+  {
+    position[0] = position[1] = step * (imageSize - 2 * holeRadius - 8) / (numberOfPositions - 1);
+    double cloneTime = Time([&]()
+    {
+      session.Clone(position, output.GetPointer());
+    });
+    std::cout << "  position " << position << ": " << cloneTime << " s" << std::endl;
+  }
+
+  // Clone the same way at the last position from scratch
+  itk::ImageRegion<2> regionToProcess = source->GetLargestPossibleRegion();
+  regionToProcess.SetIndex(position);
+  PoissonEditingType::GuidanceFieldType::Pointer guidanceField = PoissonEditingType::GuidanceFieldType::New();
+  guidanceField->SetRegions(source->GetLargestPossibleRegion());
+  guidanceField->Allocate();
+  ITKHelpers::ComputeGradients(source.GetPointer(), guidanceField.GetPointer());
+  ImageType::Pointer filled = ImageType::New();
+  double fillTime = 0.0;
+  const std::size_t fillMemory = PeakMemory([&]()
+  {
+    fillTime = Time([&]()
+    {
+      FillImage(target.GetPointer(), mask.GetPointer(), guidanceField.GetPointer(), filled.GetPointer(), regionToProcess);
+    });
+  });
+
+  double maximumDifference = 0.0;
+  itk::ImageRegionConstIterator<ImageType> outputIterator(output.GetPointer(), output->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<ImageType> filledIterator(filled.GetPointer(), output->GetLargestPossibleRegion());
+  while(!outputIterator.IsAtEnd())
+  {
+    maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(outputIterator.Get()) -
+                                                             filledIterator.Get()));
+    ++outputIterator;
+    ++filledIterator;
+  }
+  std::cout << "  FillImage from scratch: " << fillTime << " s, peak memory +" << fillMemory / 1e6
+            << " MB, max difference " << maximumDifference << std::endl;
+}
+
+/** Compare LDLT with mean-value coordinate interpolation on a disc shaped hole. */
+static void BenchmarkMeanValueCoordinates(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  std::cout << "Mean-value coordinates: " << imageSize << "x" << imageSize << " image" << std::endl;
+
+  itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+  PoissonEditingType::FillMethodEnum fillMethods[2] = {PoissonEditingType::FillMethodEnum::POISSON,
+                                                       PoissonEditingType::FillMethodEnum::MEAN_VALUE_COORDINATES};
+  ImageType::Pointer outputs[2];
+  double times[2];
+  for(unsigned int method = 0; method < 2; ++method)
+  {
+    PoissonEditingType poissonEditing;
+    poissonEditing.SetTargetImage(image.GetPointer());
+    poissonEditing.SetRegionToProcess(region);
+    poissonEditing.SetMask(mask);
+    poissonEditing.SetLaplacian(laplacian);
+    poissonEditing.SetSolver(PoissonEditingType::SolverEnum::LDLT);
+    poissonEditing.SetFillMethod(fillMethods[method]);
+    times[method] = Time([&]()
+    {
+      poissonEditing.FillMaskedRegion();
+    });
+
+    outputs[method] = ImageType::New();
+    ITKHelpers::DeepCopy(poissonEditing.GetOutput(), outputs[method].GetPointer());
+  }
+
+  double maximumDifference = 0.0;
+  double sumOfSquaredDifferences = 0.0;
+  std::size_t numberOfHolePixels = 0;
+  itk::ImageRegionConstIterator<Mask> maskIterator(mask.GetPointer(), region);
+  while(!maskIterator.IsAtEnd())
+  {
+    if(maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+    {
+      const double difference = outputs[1]->GetPixel(maskIterator.GetIndex()) - outputs[0]->GetPixel(maskIterator.GetIndex());
+      maximumDifference = std::max(maximumDifference, std::abs(difference));
+      sumOfSquaredDifferences += difference * difference;
+      ++numberOfHolePixels;
+    }
+    ++maskIterator;
+  }
+
+  std::cout << "  LDLT: " << times[0] << " s" << std::endl;
+  std::cout << "  mean-value coordinates: " << times[1] << " s (speedup " << times[0] / times[1]
+            << ", max difference " << maximumDifference << ", PSNR "
+            << 10.0 * std::log10(255.0 * 255.0 * numberOfHolePixels / sumOfSquaredDifferences) << " dB)" << std::endl;
+}
+
+/** Compare cloning with mixed gradients by building the guidance field from the full gradient images
+  * of the source and of the target with the MIXED_GRADIENTS fill method, which picks the stronger
+  * difference while it assembles the right hand side. */
+static void BenchmarkMixedGradients(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  // A source with finer texture than the target, so that neither always wins
+  const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+  ImageType::Pointer source = ImageType::New();
+  source->SetRegions(region);
+  source->Allocate();
+  itk::ImageRegionIterator<ImageType> sourceIterator(source, region);
+  while(!sourceIterator.IsAtEnd())
+  {
+    sourceIterator.Set(100.0f + 20.0f * std::sin(sourceIterator.GetIndex()[0] * 0.3f + sourceIterator.GetIndex()[1] * 0.1f));
+    ++sourceIterator;
+  }
+
+  std::cout << "Mixed gradients: " << imageSize << "x" << imageSize << " image" << std::endl;
+
+  ImageType::Pointer outputs[2];
+  double times[2];
+  for(unsigned int method = 0; method < 2; ++method)
+  {
+    PoissonEditingType poissonEditing;
+    poissonEditing.SetTargetImage(image.GetPointer());
+    poissonEditing.SetRegionToProcess(region);
+    poissonEditing.SetMask(mask);
+    poissonEditing.SetSolver(PoissonEditingType::SolverEnum::LDLT);
+
+    PoissonEditingType::GuidanceFieldType::Pointer guidanceField;
+    times[method] = Time([&]()
+    {
+      if(method == 0)
+      {
+        guidanceField = PoissonEditingParent::ComputeGuidanceField(source.GetPointer())[0];
+        PoissonEditingType::GuidanceFieldType::Pointer targetField =
+            PoissonEditingParent::ComputeGuidanceField(image.GetPointer())[0];
+        itk::ImageRegionIterator<PoissonEditingType::GuidanceFieldType> fieldIterator(guidanceField, region);
+        itk::ImageRegionConstIterator<PoissonEditingType::GuidanceFieldType> targetFieldIterator(targetField, region);
+        while(!fieldIterator.IsAtEnd())
+        {
+          if(targetFieldIterator.Get().GetNorm() > fieldIterator.Get().GetNorm())
+          {
+            fieldIterator.Set(targetFieldIterator.Get());
+          }
+          ++fieldIterator;
+          ++targetFieldIterator;
+        }
+        poissonEditing.SetGuidanceField(guidanceField);
+        poissonEditing.SetFillMethod(PoissonEditingType::FillMethodEnum::POISSON);
+      }
+      else
+      {
+        poissonEditing.SetSourceImage(source.GetPointer());
+        poissonEditing.SetFillMethod(PoissonEditingType::FillMethodEnum::MIXED_GRADIENTS);
+      }
+      poissonEditing.FillMaskedRegion();
+    });
+
+    outputs[method] = ImageType::New();
+    ITKHelpers::DeepCopy(poissonEditing.GetOutput(), outputs[method].GetPointer());
+  }
+
+  // The two differ in how they discretize the field (central differences and a vector norm, and the
+  // differences between neighbors), so only their magnitude is compared
+  double maximumDifference = 0.0;
+  itk::ImageRegionConstIterator<Mask> maskIterator(mask.GetPointer(), region);
+  while(!maskIterator.IsAtEnd())
+  {
+    if(maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+    {
+      maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(
+          outputs[1]->GetPixel(maskIterator.GetIndex()) - outputs[0]->GetPixel(maskIterator.GetIndex()))));
+    }
+    ++maskIterator;
+  }
+
+  std::cout << "  gradient images: " << times[0] << " s" << std::endl;
+  std::cout << "  fused:           " << times[1] << " s (speedup " << times[0] / times[1]
+            << ", max difference " << maximumDifference << ")" << std::endl;
+}
+
+/** Compare filling a copy of the target image and copying the result into the output of the caller
+  * with filling the caller's image in place (SetTargetImageReference() and SetOutputImage()). */
+static void BenchmarkCopies(const unsigned int imageSize, const unsigned int holeRadius)
+{
+  ImageType::Pointer image = ImageType::New();
+  Mask::Pointer mask = Mask::New();
+  FloatImageType::Pointer laplacian = FloatImageType::New();
+  CreateScene(imageSize, holeRadius, image, mask, laplacian);
+
+  std::cout << "Copies: " << imageSize << "x" << imageSize << " image ("
+            << image->GetLargestPossibleRegion().GetNumberOfPixels() * sizeof(ImageType::PixelType) / 1e6
+            << " MB)" << std::endl;
+
+  const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+  ImageType::Pointer copiedOutput = ImageType::New();
+  double copyTime = 0.0;
+  const std::size_t copyMemory = PeakMemory([&]()
+  {
+    copyTime = Time([&]()
+    {
+      PoissonEditingType poissonEditing;
+      poissonEditing.SetTargetImage(image.GetPointer());
+      poissonEditing.SetRegionToProcess(region);
+      poissonEditing.SetMask(mask);
+      poissonEditing.SetLaplacian(laplacian);
+      poissonEditing.FillMaskedRegion();
+      ITKHelpers::DeepCopy(poissonEditing.GetOutput(), copiedOutput.GetPointer());
+    });
+  });
+
+  double inPlaceTime = 0.0;
+  const std::size_t inPlaceMemory = PeakMemory([&]()
+  {
+    inPlaceTime = Time([&]()
+    {
+      PoissonEditingType poissonEditing;
+      poissonEditing.SetTargetImageReference(image.GetPointer());
+      poissonEditing.SetOutputImage(image.GetPointer());
+      poissonEditing.SetRegionToProcess(region);
+      poissonEditing.SetMask(mask);
+      poissonEditing.SetLaplacian(laplacian);
+      poissonEditing.FillMaskedRegion();
+    });
+  });
+
+  double maximumDifference = 0.0;
+  itk::ImageRegionConstIterator<ImageType> copiedIterator(copiedOutput.GetPointer(), region);
+  itk::ImageRegionConstIterator<ImageType> inPlaceIterator(image.GetPointer(), region);
+  while(!copiedIterator.IsAtEnd())
+  {
+    maximumDifference = std::max(maximumDifference, std::abs(static_cast<double>(copiedIterator.Get()) -
+                                                             inPlaceIterator.Get()));
+    ++copiedIterator;
+    ++inPlaceIterator;
+  }
+
+  std::cout << "  copy in and out: " << copyTime << " s, peak memory +" << copyMemory / 1e6 << " MB" << std::endl;
+  std::cout << "  in place:        " << inPlaceTime << " s, peak memory +" << inPlaceMemory / 1e6
+            << " MB, max difference " << maximumDifference << std::endl;
+}
+
+/** The shapes of the holes of the benchmark suite. */
+enum class SuiteTopology {RECTANGLE, BLOB, COMPONENTS};
+
+static std::string GetTopologyName(const SuiteTopology topology)
+{
+  switch(topology)
+  {
+    case SuiteTopology::RECTANGLE:
+      return "rectangle";
+    case SuiteTopology::BLOB:
+      return "blob";
+    default:
+      return "components";
+  }
+}
+
+/** Create a mask with a hole of about 'numberOfHolePixels' pixels of the given shape: a 2:1
+  * rectangle, an irregular star shaped blob, or a grid of small discs (about 80 pixels each, as the
+  * specks of a dust mask). The image is about four times as large as the hole. */
+static Mask::Pointer CreateSyntheticMask(const SuiteTopology topology, const std::size_t numberOfHolePixels)
+{
+  const double pi = std::acos(-1.0);
+  const double holeSide = std::sqrt(static_cast<double>(numberOfHolePixels));
+  const double componentRadius = 5.0;
+  const double componentSpacing = 16.0;
+  unsigned int imageSize = std::max(64u, static_cast<unsigned int>(2.0 * holeSide));
+  unsigned int componentsPerRow = 0;
+  if(topology == SuiteTopology::COMPONENTS)
+  {
+    const double numberOfComponents = numberOfHolePixels / (pi * componentRadius * componentRadius);
+    componentsPerRow = std::max(1u, static_cast<unsigned int>(std::ceil(std::sqrt(numberOfComponents))));
+    imageSize = static_cast<unsigned int>(componentSpacing * (componentsPerRow + 1));
+  }
+
+  itk::Index<2> corner = {{0, 0}};
+  itk::Size<2> size = {{imageSize, imageSize}};
+  itk::ImageRegion<2> region(corner, size);
+
+  Mask::Pointer mask = Mask::New();
+  mask->SetRegions(region);
+  mask->Allocate();
+
+  // The radius of the blob, r(theta) = R (1 + 0.3 sin(5 theta) + 0.15 sin(3 theta + 1)), is scaled
+  // so that its area is numberOfHolePixels
+  const double blobRadius = std::sqrt(numberOfHolePixels / (pi * (1.0 + 0.3 * 0.3 / 2.0 + 0.15 * 0.15 / 2.0)));
+  const double rectangleWidth = std::sqrt(2.0) * holeSide;
+  const double rectangleHeight = holeSide / std::sqrt(2.0);
+  const double center = imageSize / 2.0;
+
+  itk::ImageRegionIterator<Mask> maskIterator(mask, region);
+  while(!maskIterator.IsAtEnd())
+  {
+    const double dx = maskIterator.GetIndex()[0] + 0.5 - center;
+    const double dy = maskIterator.GetIndex()[1] + 0.5 - center;
+    bool inside = false;
+    switch(topology)
+    {
+      case SuiteTopology::RECTANGLE:
+        inside = std::abs(dx) < rectangleWidth / 2.0 && std::abs(dy) < rectangleHeight / 2.0;
+        break;
+      case SuiteTopology::BLOB:
+      {
+        const double theta = std::atan2(dy, dx);
+        const double radius = blobRadius * (1.0 + 0.3 * std::sin(5.0 * theta) + 0.15 * std::sin(3.0 * theta + 1.0));
+        inside = dx * dx + dy * dy < radius * radius;
+        break;
+      }
+      case SuiteTopology::COMPONENTS:
+      {
+        // The distance to the center of the nearest cell of the grid
+        const double cellX = std::fmod(maskIterator.GetIndex()[0] + 0.5, componentSpacing) - componentSpacing / 2.0;
+        const double cellY = std::fmod(maskIterator.GetIndex()[1] + 0.5, componentSpacing) - componentSpacing / 2.0;
+        const bool inGrid = maskIterator.GetIndex()[0] >= componentSpacing / 2.0 &&
+                            maskIterator.GetIndex()[1] >= componentSpacing / 2.0 &&
+                            maskIterator.GetIndex()[0] < componentSpacing * componentsPerRow + componentSpacing / 2.0 &&
+                            maskIterator.GetIndex()[1] < componentSpacing * componentsPerRow + componentSpacing / 2.0;
+        inside = inGrid && cellX * cellX + cellY * cellY < componentRadius * componentRadius;
+        break;
+      }
+    }
+    maskIterator.Set(inside ? HoleMaskPixelTypeEnum::HOLE : HoleMaskPixelTypeEnum::VALID);
+    ++maskIterator;
+  }
+
+  return mask;
+}
+
+/** Create an image of type TImage on 'region' with a smooth pattern, scaled differently in each
+  * channel. */
+template <typename TImage>
+static typename TImage::Pointer CreateSuiteImage(const itk::ImageRegion<2>& region, const unsigned int numberOfChannels)
+{
+  typedef typename TypeTraits<typename TImage::PixelType>::ComponentType ComponentType;
+
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions(region);
+  image->SetNumberOfComponentsPerPixel(numberOfChannels);
+  image->Allocate();
+
+  ComponentType* const values = reinterpret_cast<ComponentType*>(image->GetBufferPointer());
+  for(std::size_t row = 0; row < region.GetSize()[1]; ++row)
+  {
+    for(std::size_t column = 0; column < region.GetSize()[0]; ++column)
+    {
+      const float value = 100.0f + 50.0f * std::sin(column * 0.01f) * std::cos(row * 0.02f);
+      const std::size_t pixel = row * region.GetSize()[0] + column;
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        values[pixel * numberOfChannels + channel] = static_cast<ComponentType>(value * (channel + 1) / numberOfChannels);
+      }
+    }
+  }
+
+  return image;
+}
+
+/** Fill a multi-channel image with one guidance field per channel. */
+template <typename TImage>
+static void FillSuiteImage(const TImage* const image, const Mask* const mask,
+                           const std::vector<PoissonEditingType::GuidanceFieldType::Pointer>& guidanceFields,
+                           TImage* const output)
+{
+  FillImage(image, mask, guidanceFields, output, image->GetLargestPossibleRegion(), static_cast<const TImage*>(nullptr));
+}
+
+/** Fill a scalar image with its only guidance field. */
+static void FillSuiteImage(const ImageType* const image, const Mask* const mask,
+                           const std::vector<PoissonEditingType::GuidanceFieldType::Pointer>& guidanceFields,
+                           ImageType* const output)
+{
+  FillImage(image, mask, guidanceFields[0].GetPointer(), output, image->GetLargestPossibleRegion());
+}
+
+/** Time each phase of filling 'mask' in an image of type TImage, and print one row of the suite:
+  * the guidance fields (ComputeGuidanceField), their Laplacians on the bounding box of the hole
+  * (LaplacianFromGradient), the assembly of the matrix of the whole hole (numbering and
+  * AssembleMatrix), the preparation of the solver (PoissonPlan::Compute, which splits the hole into
+  * its components and factorizes or sets up the solver of each), the solve of all of the channels
+  * (PoissonPlan::Execute), and the whole FillImage() path with the peak resident set size that it
+  * added. The row is returned, as the fill prints its progress. */
+template <typename TImage>
+static std::string RunSuiteCase(const Mask* const mask, const std::string& topologyName, const std::string& typeName,
+                                const unsigned int numberOfChannels)
+{
+  typedef typename TypeTraits<typename TImage::PixelType>::ComponentType ComponentType;
+  typedef itk::Image<ComponentType, 2> ScalarImageType;
+
+  const itk::ImageRegion<2> region = mask->GetLargestPossibleRegion();
+  typename TImage::Pointer image = CreateSuiteImage<TImage>(region, numberOfChannels);
+
+  std::vector<PoissonEditingType::GuidanceFieldType::Pointer> guidanceFields;
+  const double gradientTime = Time([&]()
+  {
+    guidanceFields = PoissonEditingParent::ComputeGuidanceField(image.GetPointer());
+  });
+
+  itk::ImageRegion<2> workingRegion = ITKHelpers::ComputeBoundingBox(mask, HoleMaskPixelTypeEnum::HOLE);
+  workingRegion.PadByRadius(1);
+  workingRegion.Crop(region);
+
+  std::vector<FloatImageType::Pointer> laplacians(numberOfChannels);
+  const double laplacianTime = Time([&]()
+  {
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      laplacians[channel] = FloatImageType::New();
+      PoissonEditing<ComponentType>::LaplacianFromGradient(guidanceFields[channel], workingRegion, laplacians[channel]);
+    }
+  });
+
+  VariableIdImage variableIds;
+  SparseMatrixType A;
+  const double assemblyTime = Time([&]()
+  {
+    variableIds.Compute(mask);
+    PoissonEditing<ComponentType>::AssembleMatrix(variableIds, A);
+  });
+  const std::size_t numberOfNonZeros = A.nonZeros();
+  A = SparseMatrixType();
+
+  PoissonPlan<ComponentType> plan;
+  plan.SetSolver(PoissonEditingParent::GetGlobalDefaultSolver());
+  const double prepareTime = Time([&]()
+  {
+    plan.Compute(mask);
+  });
+
+  // The plan solves on the grid of the mask, so the channels are extracted from the whole image
+  std::vector<typename ScalarImageType::Pointer> channels = ExtractChannels<ScalarImageType>(image.GetPointer(), region);
+  std::vector<const ScalarImageType*> targetImages(channels.begin(), channels.end());
+  std::vector<ScalarImageType*> outputs(channels.begin(), channels.end());
+  std::vector<const FloatImageType*> laplacianPointers(laplacians.begin(), laplacians.end());
+  const double solveTime = Time([&]()
+  {
+    plan.Execute(targetImages, laplacianPointers, outputs);
+  });
+  channels.clear();
+  plan = PoissonPlan<ComponentType>();
+
+  typename TImage::Pointer output = TImage::New();
+  double fillTime = 0.0;
+  const std::size_t fillMemory = PeakMemory([&]()
+  {
+    fillTime = Time([&]()
+    {
+      FillSuiteImage(image.GetPointer(), mask, guidanceFields, output.GetPointer());
+    });
+  });
+
+  std::stringstream row;
+  row << std::fixed << std::setprecision(4)
+      << std::setw(10) << variableIds.GetNumberOfVariables() << std::setw(12) << topologyName
+      << std::setw(11) << typeName << std::setw(4) << numberOfChannels
+      << std::setw(11) << numberOfNonZeros << std::setw(11) << gradientTime << std::setw(11) << laplacianTime
+      << std::setw(11) << assemblyTime << std::setw(11) << prepareTime << std::setw(11) << solveTime
+      << std::setw(11) << fillTime << std::setw(11) << std::setprecision(1) << fillMemory / (1024.0 * 1024.0);
+  return row.str();
+}
+
+/** Time each phase of a fill over hole sizes from 1K pixels up to 'maximumNumberOfHolePixels' (by
+  * factors of 10) and the three hole topologies of CreateSyntheticMask(), with an RGB VectorImage,
+  * and then over the number of channels and the image types at a hole size of 100K pixels (or the
+  * largest one below it), with the solver 'solverName'. Times are in seconds, and the peak memory of the fill in MB. */
+static void BenchmarkSuite(const std::size_t maximumNumberOfHolePixels, const std::string& solverName)
+{
+  typedef itk::Image<itk::CovariantVector<float, 3>, 2> CovariantVectorImageType;
+
+  PoissonEditingParent::SetGlobalDefaultSolver(PoissonEditingParent::GetSolverFromName(solverName));
+
+  std::vector<std::string> rows;
+  const SuiteTopology topologies[3] = {SuiteTopology::RECTANGLE, SuiteTopology::BLOB, SuiteTopology::COMPONENTS};
+
+  std::size_t channelSweepHolePixels = 1000;
+  for(std::size_t numberOfHolePixels = 1000; numberOfHolePixels <= maximumNumberOfHolePixels; numberOfHolePixels *= 10)
+  {
+    if(numberOfHolePixels <= 100000)
+    {
+      channelSweepHolePixels = numberOfHolePixels;
+    }
+
+    for(unsigned int topology = 0; topology < 3; ++topology)
+    {
+      Mask::Pointer mask = CreateSyntheticMask(topologies[topology], numberOfHolePixels);
+      rows.push_back(RunSuiteCase<VectorImageType>(mask, GetTopologyName(topologies[topology]), "vector", 3));
+    }
+  }
+
+  Mask::Pointer mask = CreateSyntheticMask(SuiteTopology::BLOB, channelSweepHolePixels);
+  const std::string topologyName = GetTopologyName(SuiteTopology::BLOB);
+  rows.push_back(RunSuiteCase<ImageType>(mask, topologyName, "scalar", 1));
+  rows.push_back(RunSuiteCase<VectorImageType>(mask, topologyName, "vector", 1));
+  rows.push_back(RunSuiteCase<CovariantVectorImageType>(mask, topologyName, "covariant", 3));
+  rows.push_back(RunSuiteCase<VectorImageType>(mask, topologyName, "vector", 8));
+
+  std::cout << "Suite: solver " << solverName << ", " << ParallelHelpers::GetNumberOfThreads() << " thread(s)" << std::endl;
+  std::cout << std::setw(10) << "unknowns" << std::setw(12) << "topology" << std::setw(11) << "type"
+            << std::setw(4) << "c" << std::setw(11) << "nonzeros" << std::setw(11) << "gradients"
+            << std::setw(11) << "laplacian" << std::setw(11) << "assembly" << std::setw(11) << "prepare"
+            << std::setw(11) << "solve" << std::setw(11) << "fill" << std::setw(11) << "peak MB" << std::endl;
+  for(std::size_t row = 0; row < rows.size(); ++row)
+  {
+    std::cout << rows[row] << std::endl;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2)
+  {
+    std::cout << "Usage: Benchmark assembly|rectangle|dd|session|clone|mvc|mixedgradients|copies|divergence|gradients|channels|interleaved|batch [imageSize holeRadius]" << std::endl
+              << "       Benchmark suite [maximumNumberOfHolePixels [solver]]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::string scenario = argv[1];
+
+  // The suite sweeps its own hole sizes, up to 1M pixels by default (10M needs a lot of memory with LDLT)
+  if(scenario == "suite")
+  {
+    std::size_t maximumNumberOfHolePixels = 1000000;
+    if(argc >= 3)
+    {
+      std::stringstream ss;
+      ss << argv[2];
+      ss >> maximumNumberOfHolePixels;
+    }
+
+    const std::string solverName = argc >= 4 ? argv[3] : "multigrid";
+    BenchmarkSuite(maximumNumberOfHolePixels, solverName);
+    return EXIT_SUCCESS;
+  }
+
+  unsigned int imageSize = 2000;
+  unsigned int holeRadius = 500;
+  if(argc >= 4)
+  {
+    std::stringstream ss;
+    ss << argv[2] << " " << argv[3];
+    ss >> imageSize >> holeRadius;
+  }
+
+  if(scenario == "assembly")
+  {
+    BenchmarkAssembly(imageSize, holeRadius);
+  }
+  else if(scenario == "rectangle")
+  {
+    BenchmarkRectangle(imageSize, holeRadius);
+  }
+  else if(scenario == "dd")
+  {
+    BenchmarkDomainDecomposition(imageSize, holeRadius);
+  }
+  else if(scenario == "session")
+  {
+    BenchmarkSession(imageSize, holeRadius);
+  }
+  else if(scenario == "clone")
+  {
+    BenchmarkCloning(imageSize, holeRadius);
+  }
+  else if(scenario == "mvc")
+  {
+    BenchmarkMeanValueCoordinates(imageSize, holeRadius);
+  }
+  else if(scenario == "mixedgradients")
+  {
+    BenchmarkMixedGradients(imageSize, holeRadius);
+  }
+  else if(scenario == "copies")
+  {
+    BenchmarkCopies(imageSize, holeRadius);
+  }
+  else if(scenario == "divergence")
+  {
+    BenchmarkDivergence(imageSize, holeRadius);
+  }
+  else if(scenario == "gradients")
+  {
+    BenchmarkGradients(imageSize, holeRadius);
+  }
+  else if(scenario == "channels")
+  {
+    BenchmarkChannels(imageSize, holeRadius);
+  }
+  else if(scenario == "interleaved")
+  {
+    BenchmarkInterleaved(imageSize, holeRadius);
+  }
+  else if(scenario == "batch")
+  {
+    BenchmarkBatch(imageSize, holeRadius);
+  }
+  else
+  {
+    std::cerr << "Unknown scenario " << scenario << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PoissonEditing.h"
+#include "PoissonEditingWrappers.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageRegionIterator.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+typedef itk::Image<float, 2> ImageType;
+
+/** Two square holes that touch at a corner, so they are separate (4-connected) components: the first
+  * is [8, 24) x [8, 24) and the second [24, 40) x [24, 40). The known pixels are a smooth ramp, and the
+  * hole pixels are set to 'holeValue', which no fill may read. */
+static void CreateScene(const float holeValue, ImageType* const image, Mask* const mask)
+{
+  const itk::Index<2> corner = {{0, 0}};
+  const itk::Size<2> size = {{48, 48}};
+  const itk::ImageRegion<2> region(corner, size);
+
+  image->SetRegions(region);
+  image->Allocate();
+  mask->SetRegions(region);
+  mask->Allocate();
+
+  itk::ImageRegionIterator<Mask> maskIterator(mask, region);
+  while(!maskIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = maskIterator.GetIndex();
+    const bool inFirstHole = pixel[0] >= 8 && pixel[0] < 24 && pixel[1] >= 8 && pixel[1] < 24;
+    const bool inSecondHole = pixel[0] >= 24 && pixel[0] < 40 && pixel[1] >= 24 && pixel[1] < 40;
+    maskIterator.Set(inFirstHole || inSecondHole ? HoleMaskPixelTypeEnum::HOLE : HoleMaskPixelTypeEnum::VALID);
+    image->SetPixel(pixel, inFirstHole || inSecondHole ? holeValue : 2.0f * pixel[0] + 3.0f * pixel[1]);
+    ++maskIterator;
+  }
+}
+
+/** Fill two diagonally touching holes with mean-value coordinates, and check that the result does
+  * not depend on the values that are in the holes before the fill. The contour of each hole runs
+  * through a corner pixel of the other one, which must not be used as a boundary value. */
+int main(int, char* [])
+{
+  PoissonEditingParent::SetGlobalDefaultFillMethod(PoissonEditingParent::FillMethodEnum::MEAN_VALUE_COORDINATES);
+
+  const float holeValues[2] = {0.0f, 1000.0f};
+  ImageType::Pointer outputs[2];
+  for(unsigned int test = 0; test < 2; ++test)
+  {
+    ImageType::Pointer image = ImageType::New();
+    Mask::Pointer mask = Mask::New();
+    CreateScene(holeValues[test], image, mask);
+
+    outputs[test] = ImageType::New();
+    FillImage(image.GetPointer(), mask.GetPointer(),
+              static_cast<const PoissonEditingParent::GuidanceFieldType*>(nullptr),
+              outputs[test].GetPointer(), image->GetLargestPossibleRegion());
+  }
+
+  // The known pixels range over [0, 235], and so does any interpolation of them
+  float largestDifference = 0.0f;
+  itk::ImageRegionIterator<ImageType> outputIterator(outputs[0], outputs[0]->GetLargestPossibleRegion());
+  while(!outputIterator.IsAtEnd())
+  {
+    const float value = outputIterator.Get();
+    if(!(value >= -0.5f && value <= 235.5f))
+    {
+      std::cerr << "The fill at " << outputIterator.GetIndex() << " is " << value
+                << ", outside of the range of the known pixels!" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    largestDifference = std::max(largestDifference,
+                                 std::abs(value - outputs[1]->GetPixel(outputIterator.GetIndex())));
+    ++outputIterator;
+  }
+
+  std::cout << "Largest difference: " << largestDifference << std::endl;
+  if(largestDifference > 1e-3f)
+  {
+    std::cerr << "The fill depends on the values in the holes!" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
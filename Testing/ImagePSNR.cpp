@@ -0,0 +1,105 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkVectorImage.h"
+
+// STL
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+/** Compute the peak signal to noise ratio of a test image against a baseline image (over the hole
+  * pixels of a mask, if one is given), and fail if it is below a minimum. This compares methods that
+  * approximate the baseline result rather than reproduce it, where ImageCompare would fail. */
+int main(int argc, char* argv[])
+{
+  if(argc < 4)
+  {
+    std::cerr << "Usage: ImagePSNR testImage baselineImage minimumPSNR [mask]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  typedef itk::VectorImage<double, 2> ImageType;
+  typedef itk::ImageFileReader<ImageType> ReaderType;
+
+  ReaderType::Pointer testReader = ReaderType::New();
+  testReader->SetFileName(argv[1]);
+  testReader->Update();
+
+  ReaderType::Pointer baselineReader = ReaderType::New();
+  baselineReader->SetFileName(argv[2]);
+  baselineReader->Update();
+
+  double minimumPSNR = 0.0;
+  std::stringstream ss;
+  ss << argv[3];
+  ss >> minimumPSNR;
+
+  const ImageType* testImage = testReader->GetOutput();
+  const ImageType* baselineImage = baselineReader->GetOutput();
+  if(testImage->GetLargestPossibleRegion() != baselineImage->GetLargestPossibleRegion() ||
+     testImage->GetNumberOfComponentsPerPixel() != baselineImage->GetNumberOfComponentsPerPixel())
+  {
+    std::cerr << "The test and baseline images must have the same size and number of channels!" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Mask::Pointer mask;
+  if(argc >= 5)
+  {
+    mask = Mask::New();
+    mask->Read(argv[4]);
+  }
+
+  double sumOfSquaredDifferences = 0.0;
+  std::size_t numberOfValues = 0;
+  itk::ImageRegionConstIteratorWithIndex<ImageType> testIterator(testImage, testImage->GetLargestPossibleRegion());
+  while(!testIterator.IsAtEnd())
+  {
+    if(!mask || (mask->GetLargestPossibleRegion().IsInside(testIterator.GetIndex()) &&
+                 mask->IsHole(testIterator.GetIndex())))
+    {
+      const ImageType::PixelType testPixel = testIterator.Get();
+      const ImageType::PixelType baselinePixel = baselineImage->GetPixel(testIterator.GetIndex());
+      for(unsigned int channel = 0; channel < testImage->GetNumberOfComponentsPerPixel(); ++channel)
+      {
+        sumOfSquaredDifferences += (testPixel[channel] - baselinePixel[channel]) *
+                                   (testPixel[channel] - baselinePixel[channel]);
+        ++numberOfValues;
+      }
+    }
+    ++testIterator;
+  }
+
+  // 8-bit images have a peak value of 255
+  const double meanSquaredError = sumOfSquaredDifferences / std::max<std::size_t>(numberOfValues, 1);
+  const double psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) :
+                                               std::numeric_limits<double>::infinity();
+
+  std::cout << "<DartMeasurement name=\"PSNR\" type=\"numeric/double\">" << psnr << "</DartMeasurement>" << std::endl;
+  std::cout << "PSNR over " << numberOfValues << " values: " << psnr << " dB (minimum " << minimumPSNR << " dB)" << std::endl;
+
+  return psnr >= minimumPSNR ? EXIT_SUCCESS : EXIT_FAILURE;
+}
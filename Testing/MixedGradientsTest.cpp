@@ -0,0 +1,177 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PoissonEditing.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+typedef PoissonEditing<float> PoissonEditingType;
+typedef PoissonEditingType::ImageType ImageType;
+
+static const itk::ImageRegion<2> Region(itk::Index<2>{{0, 0}}, itk::Size<2>{{64, 48}});
+
+/** Create an image that is 'texture' times a pattern of waves plus 'offset'. */
+static ImageType::Pointer CreateImage(const float texture, const float offset)
+{
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(Region);
+  image->Allocate();
+
+  itk::ImageRegionIterator<ImageType> imageIterator(image, Region);
+  while(!imageIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = imageIterator.GetIndex();
+    imageIterator.Set(texture * std::sin(0.3f * pixel[0]) * std::cos(0.2f * pixel[1]) + offset);
+    ++imageIterator;
+  }
+  return image;
+}
+
+/** Create a round hole, away from the edges of the image. */
+static Mask::Pointer CreateMask()
+{
+  Mask::Pointer mask = Mask::New();
+  mask->SetRegions(Region);
+  mask->Allocate();
+
+  itk::ImageRegionIterator<Mask> maskIterator(mask, Region);
+  while(!maskIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = maskIterator.GetIndex();
+    const bool inside = (pixel[0] - 30) * (pixel[0] - 30) + (pixel[1] - 22) * (pixel[1] - 22) < 150;
+    maskIterator.Set(inside ? HoleMaskPixelTypeEnum::HOLE : HoleMaskPixelTypeEnum::VALID);
+    ++maskIterator;
+  }
+  return mask;
+}
+
+/** Clone 'sourceImage' into 'targetImage' with mixed gradients. */
+static ImageType::Pointer CloneMixedGradients(const ImageType* const targetImage, const ImageType* const sourceImage,
+                                              const Mask* const mask)
+{
+  PoissonEditingType poissonEditing;
+  poissonEditing.SetFillMethod(PoissonEditingParent::FillMethodEnum::MIXED_GRADIENTS);
+  poissonEditing.SetRegionToProcess(Region);
+  poissonEditing.SetTargetImage(targetImage);
+  poissonEditing.SetSourceImage(sourceImage);
+  poissonEditing.SetMask(mask);
+  poissonEditing.FillMaskedRegion();
+
+  ImageType::Pointer output = ImageType::New();
+  ITKHelpers::DeepCopy(poissonEditing.GetOutput(), output.GetPointer());
+  return output;
+}
+
+/** Clone the gradients of 'sourceImage' into 'targetImage' (plain Poisson cloning). The guidance is
+  * the 5-point Laplacian of the source, the same differences that mixed gradients choose from. */
+static ImageType::Pointer CloneGradients(const ImageType* const targetImage, const ImageType* const sourceImage,
+                                         const Mask* const mask)
+{
+  PoissonEditingType::FloatScalarImageType::Pointer laplacian = PoissonEditingType::FloatScalarImageType::New();
+  laplacian->SetRegions(Region);
+  laplacian->Allocate();
+
+  // Like mixed gradients, the Laplacian ignores the neighbors outside of the image
+  const itk::Offset<2> neighborOffsets[4] = {{{0, -1}}, {{-1, 0}}, {{1, 0}}, {{0, 1}}};
+  itk::ImageRegionIterator<PoissonEditingType::FloatScalarImageType> laplacianIterator(laplacian, Region);
+  while(!laplacianIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = laplacianIterator.GetIndex();
+    float value = 0.0f;
+    for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+    {
+      if(Region.IsInside(pixel + neighborOffsets[neighbor]))
+      {
+        value += sourceImage->GetPixel(pixel + neighborOffsets[neighbor]) - sourceImage->GetPixel(pixel);
+      }
+    }
+    laplacianIterator.Set(value);
+    ++laplacianIterator;
+  }
+
+  PoissonEditingType poissonEditing;
+  poissonEditing.SetFillMethod(PoissonEditingParent::FillMethodEnum::POISSON);
+  poissonEditing.SetRegionToProcess(Region);
+  poissonEditing.SetTargetImage(targetImage);
+  poissonEditing.SetLaplacian(laplacian);
+  poissonEditing.SetMask(mask);
+  poissonEditing.FillMaskedRegion();
+
+  ImageType::Pointer output = ImageType::New();
+  ITKHelpers::DeepCopy(poissonEditing.GetOutput(), output.GetPointer());
+  return output;
+}
+
+/** Get the largest difference between two images. */
+static float GetLargestDifference(const ImageType* const image, const ImageType* const otherImage)
+{
+  float largestDifference = 0.0f;
+  itk::ImageRegionConstIterator<ImageType> imageIterator(image, Region);
+  while(!imageIterator.IsAtEnd())
+  {
+    largestDifference = std::max(largestDifference,
+                                 std::abs(imageIterator.Get() - otherImage->GetPixel(imageIterator.GetIndex())));
+    ++imageIterator;
+  }
+  return largestDifference;
+}
+
+/** Check the two limits of mixed gradients: where the target is flat the gradients of the source
+  * always dominate, so the result is plain gradient cloning, and where the source is flat the
+  * gradients of the target always dominate, so the target is reproduced. */
+int main(int, char* [])
+{
+  const Mask::Pointer mask = CreateMask();
+  bool passed = true;
+
+  const ImageType::Pointer flatTarget = CreateImage(0.0f, 100.0f);
+  const ImageType::Pointer texturedSource = CreateImage(30.0f, 50.0f);
+  const float sourceDominatesDifference =
+      GetLargestDifference(CloneMixedGradients(flatTarget, texturedSource, mask),
+                           CloneGradients(flatTarget, texturedSource, mask));
+  std::cout << "Largest difference from gradient cloning: " << sourceDominatesDifference << std::endl;
+  if(sourceDominatesDifference > 1e-3f)
+  {
+    std::cerr << "Where the source dominates, mixed gradients must equal gradient cloning!" << std::endl;
+    passed = false;
+  }
+
+  const ImageType::Pointer texturedTarget = CreateImage(30.0f, 100.0f);
+  const ImageType::Pointer flatSource = CreateImage(0.0f, 50.0f);
+  const float targetDominatesDifference =
+      GetLargestDifference(CloneMixedGradients(texturedTarget, flatSource, mask), texturedTarget);
+  std::cout << "Largest difference from the target: " << targetDominatesDifference << std::endl;
+  if(targetDominatesDifference > 1e-3f)
+  {
+    std::cerr << "Where the target dominates, mixed gradients must reproduce the target!" << std::endl;
+    passed = false;
+  }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
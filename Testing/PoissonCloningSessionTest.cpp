@@ -0,0 +1,135 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PoissonCloningSession.h"
+#include "PoissonEditing.h"
+#include "PoissonEditingWrappers.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkCovariantVector.h"
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+typedef itk::Image<itk::CovariantVector<float, 3>, 2> ImageType;
+
+/** Create an image of 'size' with a different pattern of waves in each channel, of 'frequency'. */
+static ImageType::Pointer CreateImage(const itk::Size<2>& size, const float frequency)
+{
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(itk::ImageRegion<2>(itk::Index<2>{{0, 0}}, size));
+  image->Allocate();
+
+  itk::ImageRegionIterator<ImageType> imageIterator(image, image->GetLargestPossibleRegion());
+  while(!imageIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = imageIterator.GetIndex();
+    ImageType::PixelType value;
+    for(unsigned int channel = 0; channel < 3; ++channel)
+    {
+      value[channel] = 100.0f + 40.0f * std::sin((frequency + 0.05f * channel) * pixel[0]) *
+                                  std::cos((1.5f * frequency - 0.03f * channel) * pixel[1]);
+    }
+    imageIterator.Set(value);
+    ++imageIterator;
+  }
+  return image;
+}
+
+/** Create a mask on the grid of 'sourceImage' with an elliptic hole, away from its edges. */
+static Mask::Pointer CreateMask(const ImageType* const sourceImage)
+{
+  Mask::Pointer mask = Mask::New();
+  mask->SetRegions(sourceImage->GetLargestPossibleRegion());
+  mask->Allocate();
+
+  itk::ImageRegionIterator<Mask> maskIterator(mask, mask->GetLargestPossibleRegion());
+  while(!maskIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = maskIterator.GetIndex();
+    const bool inside = (pixel[0] - 16) * (pixel[0] - 16) / 144.0 + (pixel[1] - 14) * (pixel[1] - 14) / 81.0 < 1.0;
+    maskIterator.Set(inside ? HoleMaskPixelTypeEnum::HOLE : HoleMaskPixelTypeEnum::VALID);
+    ++maskIterator;
+  }
+  return mask;
+}
+
+/** Get the largest difference between the channels of two images. */
+static float GetLargestDifference(const ImageType* const image, const ImageType* const otherImage)
+{
+  float largestDifference = 0.0f;
+  itk::ImageRegionConstIterator<ImageType> imageIterator(image, image->GetLargestPossibleRegion());
+  while(!imageIterator.IsAtEnd())
+  {
+    const ImageType::PixelType& otherValue = otherImage->GetPixel(imageIterator.GetIndex());
+    for(unsigned int channel = 0; channel < 3; ++channel)
+    {
+      largestDifference = std::max(largestDifference, std::abs(imageIterator.Get()[channel] - otherValue[channel]));
+    }
+    ++imageIterator;
+  }
+  return largestDifference;
+}
+
+/** Clone a source at two positions with a session, the second time into the output of the first
+  * (which only restores the pixels of the first position), and compare each result with FillImage()
+  * at the same position with the gradients of the source as the guidance fields. */
+int main(int, char* [])
+{
+  const ImageType::Pointer targetImage = CreateImage(itk::Size<2>{{96, 80}}, 0.1f);
+  const ImageType::Pointer sourceImage = CreateImage(itk::Size<2>{{32, 28}}, 0.3f);
+  const Mask::Pointer mask = CreateMask(sourceImage);
+  const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer> guidanceFields =
+      PoissonEditingParent::ComputeGuidanceField(sourceImage.GetPointer());
+
+  PoissonCloningSession<ImageType> session;
+  session.SetTargetImage(targetImage);
+  session.SetSourceImage(sourceImage);
+  session.SetMask(mask);
+
+  bool passed = true;
+  ImageType::Pointer sessionOutput = ImageType::New();
+  const itk::Index<2> positions[2] = {{{10, 8}}, {{50, 40}}};
+  for(unsigned int step = 0; step < 2; ++step)
+  {
+    session.Clone(positions[step], sessionOutput);
+
+    itk::ImageRegion<2> regionToProcess = sourceImage->GetLargestPossibleRegion();
+    regionToProcess.SetIndex(positions[step]);
+    ImageType::Pointer output = ImageType::New();
+    FillImage(targetImage.GetPointer(), mask.GetPointer(), guidanceFields, output.GetPointer(), regionToProcess);
+
+    const float largestDifference = GetLargestDifference(sessionOutput, output);
+    std::cout << "Position " << positions[step] << ": largest difference " << largestDifference << std::endl;
+    if(largestDifference > 1e-3f)
+    {
+      std::cerr << "Position " << positions[step] << ": the session does not match FillImage()!" << std::endl;
+      passed = false;
+    }
+  }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,158 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PoissonEditing.h"
+#include "PoissonEditingSession.h"
+#include "PoissonEditingWrappers.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkCovariantVector.h"
+#include "itkImage.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+typedef itk::Image<itk::CovariantVector<float, 3>, 2> ImageType;
+
+static const itk::ImageRegion<2> Region(itk::Index<2>{{0, 0}}, itk::Size<2>{{96, 80}});
+
+/** Create an image with a different pattern of waves in each channel, of amplitude 'amplitude'. */
+static ImageType::Pointer CreateImage(const float amplitude)
+{
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(Region);
+  image->Allocate();
+
+  itk::ImageRegionIterator<ImageType> imageIterator(image, Region);
+  while(!imageIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = imageIterator.GetIndex();
+    ImageType::PixelType value;
+    for(unsigned int channel = 0; channel < 3; ++channel)
+    {
+      value[channel] = 100.0f + amplitude * std::sin((0.1f + 0.05f * channel) * pixel[0]) *
+                                    std::cos((0.15f - 0.03f * channel) * pixel[1]);
+    }
+    imageIterator.Set(value);
+    ++imageIterator;
+  }
+  return image;
+}
+
+/** Create a mask with a round hole of 'radius' around (30, 30), and (if 'withRectangle') the
+  * rectangle [60, 80) x [50, 70), which is outside of the region that the round hole factorizes. */
+static Mask::Pointer CreateMask(const int radius, const bool withRectangle)
+{
+  Mask::Pointer mask = Mask::New();
+  mask->SetRegions(Region);
+  mask->Allocate();
+
+  itk::ImageRegionIterator<Mask> maskIterator(mask, Region);
+  while(!maskIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = maskIterator.GetIndex();
+    const bool inCircle = (pixel[0] - 30) * (pixel[0] - 30) + (pixel[1] - 30) * (pixel[1] - 30) < radius * radius;
+    const bool inRectangle = withRectangle && pixel[0] >= 60 && pixel[0] < 80 && pixel[1] >= 50 && pixel[1] < 70;
+    maskIterator.Set(inCircle || inRectangle ? HoleMaskPixelTypeEnum::HOLE : HoleMaskPixelTypeEnum::VALID);
+    ++maskIterator;
+  }
+  return mask;
+}
+
+/** Get the largest difference between the channels of two images. */
+static float GetLargestDifference(const ImageType* const image, const ImageType* const otherImage)
+{
+  float largestDifference = 0.0f;
+  itk::ImageRegionConstIterator<ImageType> imageIterator(image, Region);
+  while(!imageIterator.IsAtEnd())
+  {
+    const ImageType::PixelType& otherValue = otherImage->GetPixel(imageIterator.GetIndex());
+    for(unsigned int channel = 0; channel < 3; ++channel)
+    {
+      largestDifference = std::max(largestDifference, std::abs(imageIterator.Get()[channel] - otherValue[channel]));
+    }
+    ++imageIterator;
+  }
+  return largestDifference;
+}
+
+/** Fill the hole of the session, and compare it with a fill of 'mask' from scratch. */
+static bool CheckFill(PoissonEditingSession<ImageType>& session, const ImageType* const targetImage,
+                      const Mask* const mask,
+                      const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer>& guidanceFields,
+                      const std::string& step)
+{
+  ImageType::Pointer sessionOutput = ImageType::New();
+  session.Fill(sessionOutput);
+
+  ImageType::Pointer output = ImageType::New();
+  FillImage(targetImage, mask, guidanceFields, output.GetPointer(), Region);
+
+  const float largestDifference = GetLargestDifference(sessionOutput, output);
+  std::cout << step << ": largest difference " << largestDifference << std::endl;
+  if(largestDifference > 1e-3f)
+  {
+    std::cerr << step << ": the session does not match the fill from scratch!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/** Edit the hole of a session like brush strokes (grow it in place, then add a part outside of its
+  * factorized region), undo the edits, and compare the fill of each state with FillImage() of the
+  * same mask and guidance fields. */
+int main(int, char* [])
+{
+  const ImageType::Pointer targetImage = CreateImage(40.0f);
+  const std::vector<PoissonEditingParent::GuidanceFieldType::Pointer> guidanceFields =
+      PoissonEditingParent::ComputeGuidanceField(CreateImage(-25.0f).GetPointer());
+  const Mask::Pointer masks[3] = {CreateMask(8, false), CreateMask(10, false), CreateMask(10, true)};
+
+  PoissonEditingSession<ImageType> session;
+  session.SetTargetImage(targetImage);
+  session.SetGuidanceFields(guidanceFields);
+
+  bool passed = true;
+  const char* const steps[3] = {"Initial hole", "Grown hole", "Hole with a rectangle"};
+  for(unsigned int step = 0; step < 3; ++step)
+  {
+    session.SetMask(masks[step]);
+    passed = CheckFill(session, targetImage, masks[step], guidanceFields, steps[step]) && passed;
+  }
+
+  const char* const undoSteps[2] = {"Undo to the grown hole", "Undo to the initial hole"};
+  for(unsigned int step = 0; step < 2; ++step)
+  {
+    if(!session.Undo())
+    {
+      std::cerr << undoSteps[step] << ": there is no earlier state!" << std::endl;
+      return EXIT_FAILURE;
+    }
+    passed = CheckFill(session, targetImage, masks[1 - step], guidanceFields, undoSteps[step]) && passed;
+  }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
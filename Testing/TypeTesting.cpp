@@ -18,6 +18,9 @@
 
 #include "PoissonEditing.h"
 #include "PoissonEditingWrappers.h"
+#include "PoissonBatchFilling.h"
+#include "PoissonCloningSession.h"
+#include "PoissonEditingSession.h"
 
 // Submodules
 #include "Mask/ITKHelpers/ITKHelpers.h"
@@ -30,6 +33,17 @@
 #include "itkVectorImage.h"
 #include "itkCovariantVector.h"
 
+// Instantiate all of the members of the session classes
+template class PoissonEditingSession<itk::VectorImage<float, 2> >;
+template class PoissonEditingSession<itk::Image<itk::CovariantVector<float, 3>, 2> >;
+template class PoissonEditingSession<itk::Image<float, 2> >;
+template class PoissonCloningSession<itk::VectorImage<float, 2> >;
+template class PoissonCloningSession<itk::Image<itk::CovariantVector<float, 3>, 2> >;
+template class PoissonCloningSession<itk::Image<float, 2> >;
+template class PoissonBatchFilling<itk::VectorImage<float, 2> >;
+template class PoissonBatchFilling<itk::Image<itk::CovariantVector<float, 3>, 2> >;
+template class PoissonBatchFilling<itk::Image<float, 2> >;
+
 static void TestVectorImage();
 static void TestCovariantVectorImage();
 static void TestScalarImage();
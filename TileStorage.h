@@ -0,0 +1,101 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+
+#ifndef TileStorage_H
+#define TileStorage_H
+
+// ITK
+#include "itkImageRegion.h"
+
+// STL
+#include <cstdio>
+#include <list>
+#include <vector>
+
+/** This class stores a multi-channel float image on disk, in square tiles. Only a fixed number of
+  * tiles are kept in memory at a time: reading or writing a tile that is not in memory loads it,
+  * and the least recently used tile is written back to disk to make room. The file is a temporary
+  * file that is removed when the storage is destroyed. Tiles that were never written read as 0.
+  */
+class TileStorage
+{
+public:
+  /** Store 'numberOfChannels' channels over 'region' in tiles of 'tileSize' x 'tileSize' pixels,
+    * keeping at most 'maximumNumberOfCachedTiles' (at least 1) of them in memory. */
+  TileStorage(const itk::ImageRegion<2>& region, const unsigned int tileSize,
+              const unsigned int numberOfChannels, const std::size_t maximumNumberOfCachedTiles);
+
+  ~TileStorage();
+
+  TileStorage(const TileStorage&) = delete;
+  TileStorage& operator=(const TileStorage&) = delete;
+
+  /** Copy the values of 'region' (which must be inside the stored region) into 'values', in
+    * raster order with the channels of each pixel next to each other. */
+  void Read(const itk::ImageRegion<2>& region, std::vector<float>& values);
+
+  /** Copy 'values' (in the layout that Read() produces) into 'region'. */
+  void Write(const itk::ImageRegion<2>& region, const std::vector<float>& values);
+
+  /** Get the number of bytes of memory that one cached tile uses. */
+  std::size_t GetTileMemory() const;
+
+protected:
+
+  /** Copy the pixels of 'region' that fall in tile (tileX, tileY) from the tile to 'readValues', or
+    * from 'writeValues' to the tile if it is not null. */
+  void Transfer(const itk::ImageRegion<2>& region, const std::size_t tileX, const std::size_t tileY,
+                float* const readValues, const float* const writeValues);
+
+  /** Get the cache slot that holds 'tile', loading it from disk if necessary. */
+  std::size_t GetSlot(const std::size_t tile);
+
+  /** The stored region. */
+  itk::ImageRegion<2> Region;
+
+  unsigned int TileSize;
+  unsigned int NumberOfChannels;
+
+  /** The number of tiles along each axis. */
+  std::size_t NumberOfTilesX;
+  std::size_t NumberOfTilesY;
+
+  /** The backing file. The tiles are stored at fixed positions in it. */
+  std::FILE* File = nullptr;
+
+  /** Whether each tile has ever been written to the file. */
+  std::vector<bool> IsStored;
+
+  /** The cache slot of each tile, or -1 if the tile is not in memory. */
+  std::vector<int> Slots;
+
+  /** The values of the cached tiles, one tile after another. */
+  std::vector<float> SlotValues;
+
+  /** The tile in each cache slot, whether it was modified since it was loaded, and the slots
+    * from the most to the least recently used. */
+  std::vector<std::size_t> SlotTiles;
+  std::vector<bool> SlotIsModified;
+  std::list<std::size_t> RecentlyUsedSlots;
+  std::vector<std::list<std::size_t>::iterator> SlotPositions;
+};
+
+#include "TileStorage.hpp"
+
+#endif
@@ -0,0 +1,211 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+
+#ifndef TileStorage_HPP
+#define TileStorage_HPP
+
+#include "TileStorage.h" // Appease syntax parser
+
+// STL
+#include <algorithm>
+#include <stdexcept>
+
+inline TileStorage::TileStorage(const itk::ImageRegion<2>& region, const unsigned int tileSize,
+                                const unsigned int numberOfChannels, const std::size_t maximumNumberOfCachedTiles) :
+  Region(region), TileSize(tileSize), NumberOfChannels(numberOfChannels)
+{
+  if(tileSize == 0 || numberOfChannels == 0)
+  {
+    throw std::runtime_error("TileStorage: The tile size and the number of channels must be positive!");
+  }
+
+  this->NumberOfTilesX = (region.GetSize()[0] + tileSize - 1) / tileSize;
+  this->NumberOfTilesY = (region.GetSize()[1] + tileSize - 1) / tileSize;
+  const std::size_t numberOfTiles = this->NumberOfTilesX * this->NumberOfTilesY;
+
+  this->File = std::tmpfile();
+  if(!this->File)
+  {
+    throw std::runtime_error("TileStorage: Could not create the temporary file!");
+  }
+
+  this->IsStored.assign(numberOfTiles, false);
+  this->Slots.assign(numberOfTiles, -1);
+
+  const std::size_t numberOfSlots = std::max<std::size_t>(1, std::min(maximumNumberOfCachedTiles, numberOfTiles));
+  this->SlotValues.resize(numberOfSlots * tileSize * tileSize * numberOfChannels);
+  this->SlotTiles.assign(numberOfSlots, numberOfTiles);
+  this->SlotIsModified.assign(numberOfSlots, false);
+  this->SlotPositions.resize(numberOfSlots);
+  for(std::size_t slot = 0; slot < numberOfSlots; ++slot)
+  {
+    this->SlotPositions[slot] = this->RecentlyUsedSlots.insert(this->RecentlyUsedSlots.end(), slot);
+  }
+}
+
+inline TileStorage::~TileStorage()
+{
+  std::fclose(this->File); // this also removes the file
+}
+
+inline std::size_t TileStorage::GetTileMemory() const
+{
+  return static_cast<std::size_t>(this->TileSize) * this->TileSize * this->NumberOfChannels * sizeof(float);
+}
+
+inline std::size_t TileStorage::GetSlot(const std::size_t tile)
+{
+  const std::size_t tileValues = static_cast<std::size_t>(this->TileSize) * this->TileSize * this->NumberOfChannels;
+
+  // Positions in the file can be larger than a long on some platforms
+  auto seek = [this, tileValues](const std::size_t fileTile)
+  {
+    const long long position = static_cast<long long>(fileTile * tileValues * sizeof(float));
+#ifdef _WIN32
+    const int status = _fseeki64(this->File, position, SEEK_SET);
+#else
+    const int status = fseeko(this->File, static_cast<off_t>(position), SEEK_SET);
+#endif
+    if(status != 0)
+    {
+      throw std::runtime_error("TileStorage: Could not seek in the temporary file!");
+    }
+  };
+
+  std::size_t slot = 0;
+  if(this->Slots[tile] >= 0)
+  {
+    slot = static_cast<std::size_t>(this->Slots[tile]);
+  }
+  else
+  {
+    // Reuse the least recently used slot, writing its tile back if it changed
+    slot = this->RecentlyUsedSlots.back();
+    float* const slotValues = &this->SlotValues[slot * tileValues];
+    const std::size_t evictedTile = this->SlotTiles[slot];
+    if(evictedTile < this->Slots.size())
+    {
+      if(this->SlotIsModified[slot])
+      {
+        seek(evictedTile);
+        if(std::fwrite(slotValues, sizeof(float), tileValues, this->File) != tileValues)
+        {
+          throw std::runtime_error("TileStorage: Could not write to the temporary file!");
+        }
+        this->IsStored[evictedTile] = true;
+      }
+      this->Slots[evictedTile] = -1;
+    }
+
+    if(this->IsStored[tile])
+    {
+      seek(tile);
+      if(std::fread(slotValues, sizeof(float), tileValues, this->File) != tileValues)
+      {
+        throw std::runtime_error("TileStorage: Could not read from the temporary file!");
+      }
+    }
+    else
+    {
+      std::fill(slotValues, slotValues + tileValues, 0.0f);
+    }
+
+    this->Slots[tile] = static_cast<int>(slot);
+    this->SlotTiles[slot] = tile;
+    this->SlotIsModified[slot] = false;
+  }
+
+  this->RecentlyUsedSlots.splice(this->RecentlyUsedSlots.begin(), this->RecentlyUsedSlots, this->SlotPositions[slot]);
+  return slot;
+}
+
+inline void TileStorage::Transfer(const itk::ImageRegion<2>& region, const std::size_t tileX, const std::size_t tileY,
+                                  float* const readValues, const float* const writeValues)
+{
+  // The part of the region in this tile, relative to the corner of the stored region
+  const std::size_t regionX = region.GetIndex()[0] - this->Region.GetIndex()[0];
+  const std::size_t regionY = region.GetIndex()[1] - this->Region.GetIndex()[1];
+  const std::size_t beginX = std::max(regionX, tileX * this->TileSize);
+  const std::size_t endX = std::min(regionX + region.GetSize()[0], (tileX + 1) * this->TileSize);
+  const std::size_t beginY = std::max(regionY, tileY * this->TileSize);
+  const std::size_t endY = std::min(regionY + region.GetSize()[1], (tileY + 1) * this->TileSize);
+
+  const std::size_t slot = GetSlot(tileY * this->NumberOfTilesX + tileX);
+  float* const tileValues = &this->SlotValues[slot * this->TileSize * this->TileSize * this->NumberOfChannels];
+  if(writeValues)
+  {
+    this->SlotIsModified[slot] = true;
+  }
+
+  const std::size_t rowValues = (endX - beginX) * this->NumberOfChannels;
+  for(std::size_t y = beginY; y < endY; ++y)
+  {
+    float* const tileRow = tileValues +
+        ((y - tileY * this->TileSize) * this->TileSize + beginX - tileX * this->TileSize) * this->NumberOfChannels;
+    const std::size_t regionRow = ((y - regionY) * region.GetSize()[0] + beginX - regionX) * this->NumberOfChannels;
+    if(writeValues)
+    {
+      std::copy(writeValues + regionRow, writeValues + regionRow + rowValues, tileRow);
+    }
+    else
+    {
+      std::copy(tileRow, tileRow + rowValues, readValues + regionRow);
+    }
+  }
+}
+
+inline void TileStorage::Read(const itk::ImageRegion<2>& region, std::vector<float>& values)
+{
+  if(!this->Region.IsInside(region))
+  {
+    throw std::runtime_error("TileStorage: The region is not inside the stored region!");
+  }
+
+  values.resize(region.GetNumberOfPixels() * this->NumberOfChannels);
+
+  const std::size_t regionX = region.GetIndex()[0] - this->Region.GetIndex()[0];
+  const std::size_t regionY = region.GetIndex()[1] - this->Region.GetIndex()[1];
+  for(std::size_t tileY = regionY / this->TileSize; tileY * this->TileSize < regionY + region.GetSize()[1]; ++tileY)
+  {
+    for(std::size_t tileX = regionX / this->TileSize; tileX * this->TileSize < regionX + region.GetSize()[0]; ++tileX)
+    {
+      Transfer(region, tileX, tileY, values.data(), nullptr);
+    }
+  }
+}
+
+inline void TileStorage::Write(const itk::ImageRegion<2>& region, const std::vector<float>& values)
+{
+  if(!this->Region.IsInside(region) || values.size() != region.GetNumberOfPixels() * this->NumberOfChannels)
+  {
+    throw std::runtime_error("TileStorage: The region is not inside the stored region, or has the wrong number of values!");
+  }
+
+  const std::size_t regionX = region.GetIndex()[0] - this->Region.GetIndex()[0];
+  const std::size_t regionY = region.GetIndex()[1] - this->Region.GetIndex()[1];
+  for(std::size_t tileY = regionY / this->TileSize; tileY * this->TileSize < regionY + region.GetSize()[1]; ++tileY)
+  {
+    for(std::size_t tileX = regionX / this->TileSize; tileX * this->TileSize < regionX + region.GetSize()[0]; ++tileX)
+    {
+      Transfer(region, tileX, tileY, nullptr, values.data());
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef TiledPoissonFilling_H
+#define TiledPoissonFilling_H
+
+#include "PoissonEditing.h"
+#include "TileStorage.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImage.h"
+#include "itkImageRegion.h"
+
+// Eigen
+#include <Eigen/Sparse>
+
+// STL
+#include <memory>
+#include <vector>
+
+/** This class fills the hole of a very large image without ever allocating a buffer the size of the
+  * image, so that its working memory stays below a budget (the input and output images themselves
+  * are not counted). The inputs are read one region at a time: images that are the output of a
+  * streaming pipeline (for example an ImageFileReader that has not been updated) are updated one
+  * requested region at a time, and fully buffered images are read directly.
+  *
+  * The bounding box of the hole is split into square tiles, and the current values of the hole
+  * pixels are kept in a TileStorage on disk. Each sweep starts with a coarse-grid correction: the
+  * residual of the hole pixels is restricted to a grid of cells that fits in the budget, the coarse
+  * (Galerkin) system of the error is solved, and its bilinear interpolation is added to the values.
+  * From values of zero, the first correction is the interpolated solution of a coarse version of the
+  * problem. Then overlapping subdomains (a tile plus a margin of a quarter of a tile) are solved one
+  * after another with PoissonEditing, taking the current values of their neighbors as boundary
+  * conditions (multiplicative Schwarz). Only the hole pixels of the tile itself are written back.
+  * The subdomain solves alone only move information by about a tile per sweep. The coarse correction
+  * (two-level Schwarz) moves it across the whole hole, so the number of sweeps depends on the ratio
+  * of the cells to the tiles instead of on the number of tiles. The sweeps stop once the estimated
+  * error is below the tolerance. Finally the output is written tile by tile.
+  */
+template <typename TImage>
+class TiledPoissonFilling
+{
+public:
+  typedef PoissonEditingParent::GuidanceFieldType GuidanceFieldType;
+  typedef itk::Image<float, 2> FloatImageType;
+
+  /** Specify the image to fill. */
+  void SetTargetImage(const TImage* const targetImage);
+
+  /** Specify the hole. Its pixels are positioned in the target image by SetRegionToProcess(). */
+  void SetMask(const Mask* const mask);
+
+  /** Specify one guidance field per channel, on the same grid as the mask. A null field is zero, and
+    * is never allocated (its tiles get a zero Laplacian). */
+  void SetGuidanceFields(const std::vector<GuidanceFieldType::Pointer>& guidanceFields);
+
+  /** Set the location of the mask in the target image. */
+  void SetRegionToProcess(const itk::ImageRegion<2>& regionToProcess);
+
+  /** Set the number of bytes of working memory to use. */
+  void SetMemoryBudget(const std::size_t memoryBudget);
+
+  /** Stop the sweeps once the error of every pixel is estimated to be below 'tolerance' (in the
+    * units of the pixels). The error is extrapolated from how fast the changes of the sweeps shrink. */
+  void SetTolerance(const double tolerance);
+
+  /** Set the largest number of sweeps over the tiles. If the tolerance is not met after this many
+    * sweeps, Fill() still writes the output, and then throws. */
+  void SetMaximumNumberOfSweeps(const unsigned int maximumNumberOfSweeps);
+
+  /** Fill the hole and write the result to 'output'. */
+  void Fill(TImage* const output);
+
+  /** Get the number of sweeps over the tiles of the last fill. */
+  unsigned int GetNumberOfSweeps() const;
+
+  /** Get the estimated number of bytes of working memory that FillVectorImage() needs, given the
+    * number of pixels of its working region (the bounding box of the hole padded by one pixel). */
+  static std::size_t EstimateInCoreMemory(const std::size_t numberOfWorkingPixels,
+                                          const std::size_t numberOfHolePixels,
+                                          const unsigned int numberOfChannels);
+
+protected:
+
+  /** The estimated working memory of solving for a pixel of a subdomain with PoissonEditing,
+    * including the factorization of the system matrix. */
+  static const std::size_t SolverBytesPerPixel = 512;
+
+  /** Make sure that 'region' of 'image' is buffered, updating its pipeline if it is not. */
+  template <typename TInputImage>
+  static void BufferRegion(const TInputImage* const image, const itk::ImageRegion<2>& region);
+
+  /** Check if the mask pixel 'pixel' is a hole pixel. 'pixel' must be buffered. */
+  bool IsHole(const itk::Index<2>& pixel) const;
+
+  /** Get the target pixel under the mask pixel 'pixel'. */
+  itk::Index<2> GetTargetPixel(const itk::Index<2>& pixel) const;
+
+  /** Get the tile (of the grid that starts at the corner of the mask) with index (tileX, tileY). */
+  itk::ImageRegion<2> GetTile(const std::size_t tileX, const std::size_t tileY) const;
+
+  /** Choose the tile size and find the tiles that contain hole pixels. */
+  void FindHoleTiles();
+
+  /** Get the Laplacian of the buffered 'field' at 'pixel', with central differences. Neighbors outside
+    * of 'fieldRegion' are replaced by 'pixel'. */
+  static double GetLaplacian(const GuidanceFieldType* const field, const itk::Index<2>& pixel,
+                             const itk::ImageRegion<2>& fieldRegion);
+
+  /** Get the (up to) four cells of the coarse grid whose centers 'pixel' is bilinearly interpolated
+    * from, and their weights. */
+  void GetInterpolationWeights(const itk::Index<2>& pixel, std::size_t cells[4], double weights[4]) const;
+
+  /** Choose the coarse grid, and assemble and factorize the coarse system: the fine system restricted
+    * to the bilinear interpolations of the cell centers. */
+  void FactorizeCoarseSystem();
+
+  /** Restrict the residual of the current values to the coarse grid, solve the coarse system of the
+    * error, and add its interpolation to the stored values. Return the largest correction. */
+  double CorrectCoarseError();
+
+  /** Solve the subdomain around 'tile' with the current values of its neighbors, and store the new
+    * values of the hole pixels of 'tile'. Return the largest change. */
+  double SolveSubdomain(const itk::ImageRegion<2>& tile);
+
+  /** Copy the target image to 'output' tile by tile, replacing the hole pixels by the stored values. */
+  void WriteOutput(TImage* const output);
+
+  /** The inputs. */
+  const TImage* TargetImage = nullptr;
+  const Mask* MaskImage = nullptr;
+  std::vector<GuidanceFieldType::Pointer> GuidanceFields;
+  itk::ImageRegion<2> RegionToProcess;
+
+  /** The settings. */
+  std::size_t MemoryBudget = 256 * 1024 * 1024;
+  double Tolerance = 1e-3;
+  unsigned int MaximumNumberOfSweeps = 100;
+
+  /** The side of a tile, and the margin that is added to make a subdomain. */
+  unsigned int TileSize = 0;
+  unsigned int Overlap = 0;
+
+  /** The number of tiles over the mask, and which of them contain hole pixels. */
+  std::size_t NumberOfTilesX = 0;
+  std::size_t NumberOfTilesY = 0;
+  std::vector<bool> IsHoleTile;
+
+  /** The smallest tile aligned region that contains the hole. */
+  itk::ImageRegion<2> HoleRegion;
+
+  /** The side of the cells of the coarse grid over HoleRegion, and their number. */
+  std::size_t CoarseFactor = 0;
+  itk::Size<2> CoarseSize;
+
+  /** The unknown of each cell of the coarse grid (-1 if no hole pixel is interpolated from it), and
+    * the factorization of the coarse system. */
+  std::vector<int> CoarseIds;
+  std::unique_ptr<Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > > CoarseSolver;
+
+  /** The current values of the pixels of HoleRegion. */
+  std::unique_ptr<TileStorage> Values;
+
+  unsigned int NumberOfSweeps = 0;
+};
+
+#include "TiledPoissonFilling.hpp"
+
+#endif
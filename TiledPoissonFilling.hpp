@@ -0,0 +1,791 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef TiledPoissonFilling_HPP
+#define TiledPoissonFilling_HPP
+
+#include "TiledPoissonFilling.h" // Appease syntax parser
+
+// ITK
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::SetTargetImage(const TImage* const targetImage)
+{
+  this->TargetImage = targetImage;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::SetMask(const Mask* const mask)
+{
+  this->MaskImage = mask;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::SetGuidanceFields(const std::vector<GuidanceFieldType::Pointer>& guidanceFields)
+{
+  this->GuidanceFields = guidanceFields;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::SetRegionToProcess(const itk::ImageRegion<2>& regionToProcess)
+{
+  this->RegionToProcess = regionToProcess;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::SetMemoryBudget(const std::size_t memoryBudget)
+{
+  this->MemoryBudget = memoryBudget;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::SetTolerance(const double tolerance)
+{
+  this->Tolerance = tolerance;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::SetMaximumNumberOfSweeps(const unsigned int maximumNumberOfSweeps)
+{
+  this->MaximumNumberOfSweeps = maximumNumberOfSweeps;
+}
+
+template <typename TImage>
+unsigned int TiledPoissonFilling<TImage>::GetNumberOfSweeps() const
+{
+  return this->NumberOfSweeps;
+}
+
+template <typename TImage>
+std::size_t TiledPoissonFilling<TImage>::EstimateInCoreMemory(const std::size_t numberOfWorkingPixels,
+                                                              const std::size_t numberOfHolePixels,
+                                                              const unsigned int numberOfChannels)
+{
+  // Each channel is extracted, given a guidance field and a Laplacian, and filled in place, all at
+  // the size of the working region (the output is the caller's)
+  return numberOfWorkingPixels * (4 + 48 * numberOfChannels) + numberOfHolePixels * SolverBytesPerPixel;
+}
+
+template <typename TImage>
+template <typename TInputImage>
+void TiledPoissonFilling<TImage>::BufferRegion(const TInputImage* const image, const itk::ImageRegion<2>& region)
+{
+  if(image->GetBufferedRegion().IsInside(region))
+  {
+    return;
+  }
+
+  if(!image->GetSource())
+  {
+    throw std::runtime_error("TiledPoissonFilling: An input is neither buffered nor the output of a pipeline!");
+  }
+
+  TInputImage* const streamedImage = const_cast<TInputImage*>(image);
+  streamedImage->SetRequestedRegion(region);
+  streamedImage->Update();
+}
+
+template <typename TImage>
+bool TiledPoissonFilling<TImage>::IsHole(const itk::Index<2>& pixel) const
+{
+  return this->MaskImage->GetPixel(pixel) == HoleMaskPixelTypeEnum::HOLE;
+}
+
+template <typename TImage>
+itk::Index<2> TiledPoissonFilling<TImage>::GetTargetPixel(const itk::Index<2>& pixel) const
+{
+  return this->RegionToProcess.GetIndex() + (pixel - this->MaskImage->GetLargestPossibleRegion().GetIndex());
+}
+
+template <typename TImage>
+itk::ImageRegion<2> TiledPoissonFilling<TImage>::GetTile(const std::size_t tileX, const std::size_t tileY) const
+{
+  const itk::ImageRegion<2> maskRegion = this->MaskImage->GetLargestPossibleRegion();
+  itk::Index<2> corner = {{maskRegion.GetIndex()[0] + static_cast<itk::IndexValueType>(tileX * this->TileSize),
+                           maskRegion.GetIndex()[1] + static_cast<itk::IndexValueType>(tileY * this->TileSize)}};
+  itk::Size<2> size = {{this->TileSize, this->TileSize}};
+  itk::ImageRegion<2> tile(corner, size);
+  tile.Crop(maskRegion);
+  return tile;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::FindHoleTiles()
+{
+  const unsigned int numberOfChannels = this->TargetImage->GetNumberOfComponentsPerPixel();
+
+  // Half of the budget is for solving a subdomain (a tile, its margins and a ring of boundary pixels)
+  const double subdomainSide = std::sqrt(0.5 * this->MemoryBudget / (SolverBytesPerPixel + 24 * numberOfChannels));
+  this->TileSize = std::max(16u, static_cast<unsigned int>(std::max(subdomainSide - 2.0, 0.0) / 1.5));
+  this->Overlap = this->TileSize / 4;
+
+  const itk::ImageRegion<2> maskRegion = this->MaskImage->GetLargestPossibleRegion();
+  this->NumberOfTilesX = (maskRegion.GetSize()[0] + this->TileSize - 1) / this->TileSize;
+  this->NumberOfTilesY = (maskRegion.GetSize()[1] + this->TileSize - 1) / this->TileSize;
+  this->IsHoleTile.assign(this->NumberOfTilesX * this->NumberOfTilesY, false);
+
+  std::size_t minimumTileX = this->NumberOfTilesX;
+  std::size_t minimumTileY = this->NumberOfTilesY;
+  std::size_t maximumTileX = 0;
+  std::size_t maximumTileY = 0;
+
+  // Read the mask one row of tiles at a time
+  for(std::size_t tileY = 0; tileY < this->NumberOfTilesY; ++tileY)
+  {
+    itk::ImageRegion<2> band = GetTile(0, tileY);
+    band.SetSize(0, maskRegion.GetSize()[0]);
+    BufferRegion(this->MaskImage, band);
+
+    itk::ImageRegionConstIterator<Mask> maskIterator(this->MaskImage, band);
+    while(!maskIterator.IsAtEnd())
+    {
+      if(maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+      {
+        const std::size_t tileX = (maskIterator.GetIndex()[0] - maskRegion.GetIndex()[0]) / this->TileSize;
+        this->IsHoleTile[tileY * this->NumberOfTilesX + tileX] = true;
+        minimumTileX = std::min(minimumTileX, tileX);
+        minimumTileY = std::min(minimumTileY, tileY);
+        maximumTileX = std::max(maximumTileX, tileX);
+        maximumTileY = std::max(maximumTileY, tileY);
+      }
+      ++maskIterator;
+    }
+  }
+
+  if(minimumTileX > maximumTileX)
+  {
+    this->HoleRegion = itk::ImageRegion<2>();
+    return;
+  }
+
+  const itk::ImageRegion<2> lastTile = GetTile(maximumTileX, maximumTileY);
+  this->HoleRegion.SetIndex(GetTile(minimumTileX, minimumTileY).GetIndex());
+  this->HoleRegion.SetUpperIndex(lastTile.GetUpperIndex());
+}
+
+template <typename TImage>
+double TiledPoissonFilling<TImage>::GetLaplacian(const GuidanceFieldType* const field, const itk::Index<2>& pixel,
+                                                 const itk::ImageRegion<2>& fieldRegion)
+{
+  itk::Index<2> neighbors[4] = {pixel, pixel, pixel, pixel};
+  neighbors[0][0] -= 1;
+  neighbors[1][0] += 1;
+  neighbors[2][1] -= 1;
+  neighbors[3][1] += 1;
+  for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+  {
+    if(!fieldRegion.IsInside(neighbors[neighbor]))
+    {
+      neighbors[neighbor] = pixel;
+    }
+  }
+  return 0.5 * (field->GetPixel(neighbors[1])[0] - field->GetPixel(neighbors[0])[0]) +
+         0.5 * (field->GetPixel(neighbors[3])[1] - field->GetPixel(neighbors[2])[1]);
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::GetInterpolationWeights(const itk::Index<2>& pixel, std::size_t cells[4],
+                                                          double weights[4]) const
+{
+  // The position of the pixel in units of cells, from the center of the first cell
+  std::size_t cell0[2];
+  std::size_t cell1[2];
+  double weight[2];
+  for(unsigned int dimension = 0; dimension < 2; ++dimension)
+  {
+    const double coordinate = (pixel[dimension] - this->HoleRegion.GetIndex()[dimension] -
+                               0.5 * (this->CoarseFactor - 1)) / this->CoarseFactor;
+    const double clampedCoordinate =
+        std::max(0.0, std::min(coordinate, static_cast<double>(this->CoarseSize[dimension] - 1)));
+    cell0[dimension] = static_cast<std::size_t>(clampedCoordinate);
+    cell1[dimension] = std::min(cell0[dimension] + 1, this->CoarseSize[dimension] - 1);
+    weight[dimension] = clampedCoordinate - cell0[dimension];
+  }
+
+  cells[0] = cell0[1] * this->CoarseSize[0] + cell0[0];
+  cells[1] = cell0[1] * this->CoarseSize[0] + cell1[0];
+  cells[2] = cell1[1] * this->CoarseSize[0] + cell0[0];
+  cells[3] = cell1[1] * this->CoarseSize[0] + cell1[0];
+  weights[0] = (1 - weight[0]) * (1 - weight[1]);
+  weights[1] = weight[0] * (1 - weight[1]);
+  weights[2] = (1 - weight[0]) * weight[1];
+  weights[3] = weight[0] * weight[1];
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::FactorizeCoarseSystem()
+{
+  const unsigned int numberOfChannels = this->TargetImage->GetNumberOfComponentsPerPixel();
+  const itk::ImageRegion<2> maskRegion = this->MaskImage->GetLargestPossibleRegion();
+  const std::size_t width = this->HoleRegion.GetSize()[0];
+  const std::size_t height = this->HoleRegion.GetSize()[1];
+
+  // Use the smallest factor for which the coarse problem fits in half of the budget. Its stencils
+  // have up to 25 points instead of 5, which about doubles the memory of the factorization, and
+  // they are accumulated as blocks of 25 coefficients.
+  const std::size_t bytesPerCell = 2 * SolverBytesPerPixel + 25 * sizeof(double) + 16 * numberOfChannels;
+  std::size_t factor = 2;
+  while(((width + factor - 1) / factor) * ((height + factor - 1) / factor) * bytesPerCell > this->MemoryBudget / 2)
+  {
+    ++factor;
+  }
+  this->CoarseFactor = factor;
+  this->CoarseSize[0] = (width + factor - 1) / factor;
+  this->CoarseSize[1] = (height + factor - 1) / factor;
+  const std::size_t numberOfCells = this->CoarseSize[0] * this->CoarseSize[1];
+
+  // Interpolation moves a pixel by less than 1/factor of a cell, so the cells that two neighboring
+  // pixels are interpolated from are at most 2 cells apart. The coarse stencil of each cell is kept
+  // as a 5 x 5 block of coefficients.
+  std::vector<double> stencils(numberOfCells * 25, 0.0);
+  this->CoarseIds.assign(numberOfCells, -1);
+  const itk::Offset<2> stencilOffsets[5] = {{{0, 0}}, {{-1, 0}}, {{1, 0}}, {{0, -1}}, {{0, 1}}};
+  const double stencilWeights[5] = {-4.0, 1.0, 1.0, 1.0, 1.0};
+  for(std::size_t tile = 0; tile < this->IsHoleTile.size(); ++tile)
+  {
+    if(!this->IsHoleTile[tile])
+    {
+      continue;
+    }
+
+    const itk::ImageRegion<2> tileRegion = GetTile(tile % this->NumberOfTilesX, tile / this->NumberOfTilesX);
+    itk::ImageRegion<2> region = tileRegion;
+    region.PadByRadius(1);
+    region.Crop(maskRegion);
+    BufferRegion(this->MaskImage, region);
+
+    itk::ImageRegionConstIterator<Mask> maskIterator(this->MaskImage, tileRegion);
+    for(; !maskIterator.IsAtEnd(); ++maskIterator)
+    {
+      if(maskIterator.Get() != HoleMaskPixelTypeEnum::HOLE)
+      {
+        continue;
+      }
+
+      const itk::Index<2> pixel = maskIterator.GetIndex();
+      std::size_t cells[4];
+      double weights[4];
+      GetInterpolationWeights(pixel, cells, weights);
+
+      // Add weights[row] * stencilWeight * neighborWeights[column] for each hole pixel of the stencil
+      for(unsigned int neighbor = 0; neighbor < 5; ++neighbor)
+      {
+        const itk::Index<2> neighborPixel = pixel + stencilOffsets[neighbor];
+        if(!region.IsInside(neighborPixel) || !IsHole(neighborPixel))
+        {
+          continue;
+        }
+
+        std::size_t neighborCells[4];
+        double neighborWeights[4];
+        GetInterpolationWeights(neighborPixel, neighborCells, neighborWeights);
+        for(unsigned int row = 0; row < 4; ++row)
+        {
+          if(weights[row] == 0.0)
+          {
+            continue;
+          }
+
+          this->CoarseIds[cells[row]] = 0;
+          for(unsigned int column = 0; column < 4; ++column)
+          {
+            const std::ptrdiff_t offsetX = static_cast<std::ptrdiff_t>(neighborCells[column] % this->CoarseSize[0]) -
+                                           static_cast<std::ptrdiff_t>(cells[row] % this->CoarseSize[0]);
+            const std::ptrdiff_t offsetY = static_cast<std::ptrdiff_t>(neighborCells[column] / this->CoarseSize[0]) -
+                                           static_cast<std::ptrdiff_t>(cells[row] / this->CoarseSize[0]);
+            stencils[cells[row] * 25 + (offsetY + 2) * 5 + offsetX + 2] +=
+                weights[row] * stencilWeights[neighbor] * neighborWeights[column];
+          }
+        }
+      }
+    }
+  }
+
+  int numberOfUnknowns = 0;
+  for(std::size_t cell = 0; cell < numberOfCells; ++cell)
+  {
+    if(this->CoarseIds[cell] >= 0)
+    {
+      this->CoarseIds[cell] = numberOfUnknowns++;
+    }
+  }
+
+  std::vector<Eigen::Triplet<double> > coefficients;
+  for(std::size_t cell = 0; cell < numberOfCells; ++cell)
+  {
+    if(this->CoarseIds[cell] < 0)
+    {
+      continue;
+    }
+
+    for(std::size_t entry = 0; entry < 25; ++entry)
+    {
+      if(stencils[cell * 25 + entry] != 0.0)
+      {
+        const std::size_t otherCell = cell + (entry / 5 - 2) * this->CoarseSize[0] + entry % 5 - 2;
+        coefficients.push_back(Eigen::Triplet<double>(this->CoarseIds[cell], this->CoarseIds[otherCell],
+                                                      stencils[cell * 25 + entry]));
+      }
+    }
+  }
+
+  Eigen::SparseMatrix<double> coarseMatrix(numberOfUnknowns, numberOfUnknowns);
+  coarseMatrix.setFromTriplets(coefficients.begin(), coefficients.end());
+  this->CoarseSolver.reset(new Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> >(coarseMatrix));
+  if(this->CoarseSolver->info() != Eigen::Success)
+  {
+    throw std::runtime_error("TiledPoissonFilling: The factorization of the coarse system failed!");
+  }
+}
+
+template <typename TImage>
+double TiledPoissonFilling<TImage>::CorrectCoarseError()
+{
+  const unsigned int numberOfChannels = this->TargetImage->GetNumberOfComponentsPerPixel();
+  const itk::ImageRegion<2> maskRegion = this->MaskImage->GetLargestPossibleRegion();
+
+  // Restrict the residual (the Laplacian minus the 5-point stencil of the current values) of the hole
+  // pixels with the transpose of the interpolation
+  Eigen::MatrixXd coarseResiduals = Eigen::MatrixXd::Zero(this->CoarseSolver->rows(), numberOfChannels);
+  std::vector<float> storedValues;
+  for(std::size_t tile = 0; tile < this->IsHoleTile.size(); ++tile)
+  {
+    if(!this->IsHoleTile[tile])
+    {
+      continue;
+    }
+
+    // The tile and its neighbors
+    const itk::ImageRegion<2> tileRegion = GetTile(tile % this->NumberOfTilesX, tile / this->NumberOfTilesX);
+    itk::ImageRegion<2> region = tileRegion;
+    region.PadByRadius(1);
+    region.Crop(maskRegion);
+
+    itk::ImageRegion<2> storedRegion = region;
+    storedRegion.Crop(this->HoleRegion);
+    this->Values->Read(storedRegion, storedValues);
+    auto getStoredValue = [&](const itk::Index<2>& pixel, const unsigned int channel) -> double
+    {
+      return storedValues[((pixel[1] - storedRegion.GetIndex()[1]) * storedRegion.GetSize()[0] +
+                           (pixel[0] - storedRegion.GetIndex()[0])) * numberOfChannels + channel];
+    };
+
+    BufferRegion(this->MaskImage, region);
+    itk::ImageRegion<2> targetRegion = region;
+    targetRegion.SetIndex(GetTargetPixel(region.GetIndex()));
+    BufferRegion(this->TargetImage, targetRegion);
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      if(this->GuidanceFields[channel])
+      {
+        BufferRegion(this->GuidanceFields[channel].GetPointer(), region);
+      }
+    }
+
+    itk::ImageRegionConstIterator<Mask> maskIterator(this->MaskImage, tileRegion);
+    for(; !maskIterator.IsAtEnd(); ++maskIterator)
+    {
+      if(maskIterator.Get() != HoleMaskPixelTypeEnum::HOLE)
+      {
+        continue;
+      }
+
+      const itk::Index<2> pixel = maskIterator.GetIndex();
+      std::size_t cells[4];
+      double weights[4];
+      GetInterpolationWeights(pixel, cells, weights);
+
+      // As in the solves, the neighbors outside of the image are left out of the stencil
+      itk::Index<2> neighbors[4] = {pixel, pixel, pixel, pixel};
+      neighbors[0][0] -= 1;
+      neighbors[1][0] += 1;
+      neighbors[2][1] -= 1;
+      neighbors[3][1] += 1;
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        const GuidanceFieldType* const field = this->GuidanceFields[channel].GetPointer();
+        double residual = (field ? GetLaplacian(field, pixel, region) : 0.0) + 4.0 * getStoredValue(pixel, channel);
+        for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+        {
+          if(!region.IsInside(neighbors[neighbor]))
+          {
+            continue;
+          }
+
+          residual -= IsHole(neighbors[neighbor]) ? getStoredValue(neighbors[neighbor], channel) :
+              PoissonEditingParent::GetChannel(this->TargetImage->GetPixel(GetTargetPixel(neighbors[neighbor])), channel);
+        }
+
+        for(unsigned int corner = 0; corner < 4; ++corner)
+        {
+          if(weights[corner] != 0.0)
+          {
+            coarseResiduals(this->CoarseIds[cells[corner]], channel) += weights[corner] * residual;
+          }
+        }
+      }
+    }
+  }
+
+  const Eigen::MatrixXd coarseErrors = this->CoarseSolver->solve(coarseResiduals);
+
+  // Add the interpolated error to the hole pixels of each tile
+  double largestCorrection = 0.0;
+  std::vector<float> values;
+  for(std::size_t tile = 0; tile < this->IsHoleTile.size(); ++tile)
+  {
+    if(!this->IsHoleTile[tile])
+    {
+      continue;
+    }
+
+    const itk::ImageRegion<2> tileRegion = GetTile(tile % this->NumberOfTilesX, tile / this->NumberOfTilesX);
+    BufferRegion(this->MaskImage, tileRegion);
+    this->Values->Read(tileRegion, values);
+
+    itk::ImageRegionConstIterator<Mask> maskIterator(this->MaskImage, tileRegion);
+    for(std::size_t pixelId = 0; !maskIterator.IsAtEnd(); ++maskIterator, ++pixelId)
+    {
+      if(maskIterator.Get() != HoleMaskPixelTypeEnum::HOLE)
+      {
+        continue;
+      }
+
+      std::size_t cells[4];
+      double weights[4];
+      GetInterpolationWeights(maskIterator.GetIndex(), cells, weights);
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        double correction = 0.0;
+        for(unsigned int corner = 0; corner < 4; ++corner)
+        {
+          if(weights[corner] != 0.0)
+          {
+            correction += weights[corner] * coarseErrors(this->CoarseIds[cells[corner]], channel);
+          }
+        }
+        values[pixelId * numberOfChannels + channel] += static_cast<float>(correction);
+        largestCorrection = std::max(largestCorrection, std::abs(correction));
+      }
+    }
+
+    this->Values->Write(tileRegion, values);
+  }
+
+  return largestCorrection;
+}
+
+template <typename TImage>
+double TiledPoissonFilling<TImage>::SolveSubdomain(const itk::ImageRegion<2>& tile)
+{
+  const unsigned int numberOfChannels = this->TargetImage->GetNumberOfComponentsPerPixel();
+
+  // The subdomain, and the region that also holds its boundary pixels
+  itk::ImageRegion<2> subdomain = tile;
+  subdomain.PadByRadius(this->Overlap);
+  subdomain.Crop(this->HoleRegion);
+
+  itk::ImageRegion<2> region = subdomain;
+  region.PadByRadius(1);
+  region.Crop(this->MaskImage->GetLargestPossibleRegion());
+
+  // Hole pixels are only stored inside HoleRegion
+  itk::ImageRegion<2> storedRegion = region;
+  storedRegion.Crop(this->HoleRegion);
+  std::vector<float> storedValues;
+  this->Values->Read(storedRegion, storedValues);
+
+  BufferRegion(this->MaskImage, region);
+  itk::ImageRegion<2> targetRegion = region;
+  targetRegion.SetIndex(GetTargetPixel(region.GetIndex()));
+  BufferRegion(this->TargetImage, targetRegion);
+
+  // Copy the subdomain to images that start at (0,0). Hole pixels outside of the subdomain take their
+  // current values, and become boundary conditions.
+  const itk::ImageRegion<2> localRegion(region.GetSize());
+
+  Mask::Pointer localMask = Mask::New();
+  localMask->SetRegions(localRegion);
+  localMask->Allocate();
+
+  std::vector<FloatImageType::Pointer> localTargets(numberOfChannels);
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    localTargets[channel] = FloatImageType::New();
+    localTargets[channel]->SetRegions(localRegion);
+    localTargets[channel]->Allocate();
+  }
+
+  itk::ImageRegionConstIterator<Mask> maskIterator(this->MaskImage, region);
+  itk::ImageRegionIterator<Mask> localMaskIterator(localMask, localRegion);
+  while(!maskIterator.IsAtEnd())
+  {
+    const itk::Index<2> pixel = maskIterator.GetIndex();
+    const itk::Index<2> localPixel = localMaskIterator.GetIndex();
+    if(maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+    {
+      localMaskIterator.Set(subdomain.IsInside(pixel) ? HoleMaskPixelTypeEnum::HOLE : HoleMaskPixelTypeEnum::VALID);
+      const std::size_t storedPixel = (pixel[1] - storedRegion.GetIndex()[1]) * storedRegion.GetSize()[0] +
+                                      (pixel[0] - storedRegion.GetIndex()[0]);
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        localTargets[channel]->SetPixel(localPixel, storedValues[storedPixel * numberOfChannels + channel]);
+      }
+    }
+    else
+    {
+      localMaskIterator.Set(HoleMaskPixelTypeEnum::VALID);
+      const typename TImage::PixelType targetPixel = this->TargetImage->GetPixel(GetTargetPixel(pixel));
+      for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+      {
+        localTargets[channel]->SetPixel(localPixel, PoissonEditingParent::GetChannel(targetPixel, channel));
+      }
+    }
+    ++maskIterator;
+    ++localMaskIterator;
+  }
+
+  // Solve all of the channels together. Guidance fields that are used by several channels are only
+  // copied once, and the null (zero) ones are not copied at all.
+  PoissonEditing<float> poissonFilter;
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    poissonFilter.SetTargetImage(localTargets[channel].GetPointer(), channel);
+  }
+  poissonFilter.SetRegionToProcess(localRegion);
+
+  std::map<const GuidanceFieldType*, GuidanceFieldType::Pointer> localGuidanceFields;
+  for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+  {
+    const GuidanceFieldType* const field = this->GuidanceFields[channel].GetPointer();
+    if(!field)
+    {
+      poissonFilter.SetGuidanceFieldToZero(channel);
+      continue;
+    }
+
+    GuidanceFieldType::Pointer& localField = localGuidanceFields[field];
+    if(!localField)
+    {
+      BufferRegion(field, region);
+      localField = GuidanceFieldType::New();
+      localField->SetRegions(localRegion);
+      localField->Allocate();
+
+      itk::ImageRegionConstIterator<GuidanceFieldType> fieldIterator(field, region);
+      itk::ImageRegionIterator<GuidanceFieldType> localFieldIterator(localField, localRegion);
+      while(!fieldIterator.IsAtEnd())
+      {
+        localFieldIterator.Set(fieldIterator.Get());
+        ++fieldIterator;
+        ++localFieldIterator;
+      }
+    }
+    poissonFilter.SetGuidanceField(localField.GetPointer(), channel);
+  }
+
+  poissonFilter.SetMask(localMask.GetPointer());
+  poissonFilter.FillMaskedRegion();
+
+  // Store the new values of the hole pixels of the tile
+  std::vector<float> tileValues(tile.GetNumberOfPixels() * numberOfChannels);
+  double largestChange = 0.0;
+  itk::ImageRegionConstIterator<Mask> tileMaskIterator(this->MaskImage, tile);
+  for(std::size_t pixelId = 0; !tileMaskIterator.IsAtEnd(); ++tileMaskIterator, ++pixelId)
+  {
+    const itk::Index<2> pixel = tileMaskIterator.GetIndex();
+    const std::size_t storedPixel = (pixel[1] - storedRegion.GetIndex()[1]) * storedRegion.GetSize()[0] +
+                                    (pixel[0] - storedRegion.GetIndex()[0]);
+    const itk::Index<2> localPixel = {{pixel[0] - region.GetIndex()[0], pixel[1] - region.GetIndex()[1]}};
+    for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+    {
+      float& value = tileValues[pixelId * numberOfChannels + channel];
+      value = storedValues[storedPixel * numberOfChannels + channel];
+      if(tileMaskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+      {
+        const float newValue = poissonFilter.GetOutput(channel)->GetPixel(localPixel);
+        largestChange = std::max(largestChange, static_cast<double>(std::abs(newValue - value)));
+        value = newValue;
+      }
+    }
+  }
+
+  this->Values->Write(tile, tileValues);
+  return largestChange;
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::WriteOutput(TImage* const output)
+{
+  const unsigned int numberOfChannels = this->TargetImage->GetNumberOfComponentsPerPixel();
+  const itk::ImageRegion<2> targetRegion = this->TargetImage->GetLargestPossibleRegion();
+
+  output->SetRegions(targetRegion);
+  output->SetNumberOfComponentsPerPixel(numberOfChannels);
+  output->Allocate();
+
+  std::vector<float> values;
+  for(itk::IndexValueType tileY = 0; tileY < static_cast<itk::IndexValueType>(targetRegion.GetSize()[1]); tileY += this->TileSize)
+  {
+    for(itk::IndexValueType tileX = 0; tileX < static_cast<itk::IndexValueType>(targetRegion.GetSize()[0]); tileX += this->TileSize)
+    {
+      itk::Index<2> corner = {{targetRegion.GetIndex()[0] + tileX, targetRegion.GetIndex()[1] + tileY}};
+      itk::Size<2> size = {{this->TileSize, this->TileSize}};
+      itk::ImageRegion<2> tile(corner, size);
+      tile.Crop(targetRegion);
+
+      BufferRegion(this->TargetImage, tile);
+      itk::ImageRegionConstIterator<TImage> targetIterator(this->TargetImage, tile);
+      itk::ImageRegionIterator<TImage> outputIterator(output, tile);
+      while(!targetIterator.IsAtEnd())
+      {
+        outputIterator.Set(targetIterator.Get());
+        ++targetIterator;
+        ++outputIterator;
+      }
+
+      // The part of the tile that holds hole pixels, in mask coordinates
+      itk::ImageRegion<2> holeTile = tile;
+      holeTile.SetIndex(this->MaskImage->GetLargestPossibleRegion().GetIndex() +
+                        (tile.GetIndex() - this->RegionToProcess.GetIndex()));
+      if(!this->Values || !holeTile.Crop(this->HoleRegion))
+      {
+        continue;
+      }
+
+      BufferRegion(this->MaskImage, holeTile);
+      this->Values->Read(holeTile, values);
+
+      itk::ImageRegionConstIterator<Mask> maskIterator(this->MaskImage, holeTile);
+      for(std::size_t pixelId = 0; !maskIterator.IsAtEnd(); ++maskIterator, ++pixelId)
+      {
+        if(maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+        {
+          const itk::Index<2> targetPixel = GetTargetPixel(maskIterator.GetIndex());
+          typename TImage::PixelType pixel = output->GetPixel(targetPixel);
+          for(unsigned int channel = 0; channel < numberOfChannels; ++channel)
+          {
+            PoissonEditingParent::SetChannel(pixel, channel, values[pixelId * numberOfChannels + channel]);
+          }
+          output->SetPixel(targetPixel, pixel);
+        }
+      }
+    }
+  }
+}
+
+template <typename TImage>
+void TiledPoissonFilling<TImage>::Fill(TImage* const output)
+{
+  if(!this->TargetImage || !this->MaskImage)
+  {
+    throw std::runtime_error("TiledPoissonFilling: The target image and the mask must be set!");
+  }
+
+  // The pipelines of streamed inputs only need their meta data at this point
+  const_cast<TImage*>(this->TargetImage)->UpdateOutputInformation();
+  const_cast<Mask*>(this->MaskImage)->UpdateOutputInformation();
+
+  const unsigned int numberOfChannels = this->TargetImage->GetNumberOfComponentsPerPixel();
+  if(this->GuidanceFields.size() != numberOfChannels)
+  {
+    throw std::runtime_error("TiledPoissonFilling: There must be one guidance field per channel!");
+  }
+
+  if(this->RegionToProcess.GetNumberOfPixels() == 0)
+  {
+    this->RegionToProcess = this->TargetImage->GetLargestPossibleRegion();
+  }
+
+  this->NumberOfSweeps = 0;
+  FindHoleTiles();
+  bool converged = true;
+
+  if(this->HoleRegion.GetNumberOfPixels() > 0)
+  {
+    // The other half of the budget holds the tiles of the current values
+    const std::size_t tileMemory = static_cast<std::size_t>(this->TileSize) * this->TileSize * numberOfChannels * sizeof(float);
+    this->Values.reset(new TileStorage(this->HoleRegion, this->TileSize, numberOfChannels,
+                                       this->MemoryBudget / 2 / tileMemory));
+
+    const std::size_t bytesPerPixel = SolverBytesPerPixel + 24 * numberOfChannels;
+    if((this->HoleRegion.GetSize()[0] + 2) * (this->HoleRegion.GetSize()[1] + 2) * bytesPerPixel <= this->MemoryBudget / 2)
+    {
+      // The whole hole fits in a single subdomain
+      SolveSubdomain(this->HoleRegion);
+      this->NumberOfSweeps = 1;
+    }
+    else
+    {
+      FactorizeCoarseSystem();
+
+      std::vector<itk::ImageRegion<2> > holeTiles;
+      for(std::size_t tile = 0; tile < this->IsHoleTile.size(); ++tile)
+      {
+        if(this->IsHoleTile[tile])
+        {
+          holeTiles.push_back(GetTile(tile % this->NumberOfTilesX, tile / this->NumberOfTilesX));
+        }
+      }
+
+      // Alternate the direction of the sweeps, so that information travels both ways equally fast
+      double previousLargestChange = 0.0;
+      converged = false;
+      while(!converged && this->NumberOfSweeps < this->MaximumNumberOfSweeps)
+      {
+        double largestChange = CorrectCoarseError();
+        for(std::size_t tileId = 0; tileId < holeTiles.size(); ++tileId)
+        {
+          const std::size_t tile = this->NumberOfSweeps % 2 == 0 ? tileId : holeTiles.size() - 1 - tileId;
+          largestChange = std::max(largestChange, SolveSubdomain(holeTiles[tile]));
+        }
+        ++this->NumberOfSweeps;
+
+        // The changes shrink geometrically, so once their rate is known the remaining error is
+        // about largestChange * rate / (1 - rate), which is much larger than the last change
+        double remainingError = largestChange;
+        if(this->NumberOfSweeps > 1 && largestChange < previousLargestChange)
+        {
+          const double rate = largestChange / previousLargestChange;
+          remainingError = std::max(largestChange, largestChange * rate / (1.0 - rate));
+        }
+        previousLargestChange = largestChange;
+        converged = remainingError <= this->Tolerance;
+      }
+      this->CoarseSolver.reset();
+    }
+  }
+
+  WriteOutput(output);
+  this->Values.reset();
+
+  if(!converged)
+  {
+    throw std::runtime_error("TiledPoissonFilling: The error is still above the tolerance after the maximum number of sweeps!");
+  }
+}
+
+#endif
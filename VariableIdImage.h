@@ -0,0 +1,290 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2012 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef VariableIdImage_H
+#define VariableIdImage_H
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImageRegion.h"
+#include "itkImageRegionConstIterator.h"
+
+// STL
+#include <algorithm>
+#include <vector>
+
+/** This class assigns a variable id to each hole pixel of a mask. The ids are stored in a flat
+  * buffer that covers only the bounding box of the hole (pixels that are not part of the hole
+  * store -1), so finding the variable of a pixel is a single array access. Variables are numbered
+  * in raster order (x fastest), so the ids of the neighbors of a pixel in the buffer are always
+  * ordered up < left < center < right < down.
+  */
+class VariableIdImage
+{
+public:
+  /** Number the hole pixels of 'mask'. */
+  void Compute(const Mask* const mask)
+  {
+    const itk::ImageRegion<2> maskRegion = mask->GetLargestPossibleRegion();
+
+    // Find the bounding box of the hole
+    itk::Index<2> minimum = maskRegion.GetUpperIndex();
+    itk::Index<2> maximum = maskRegion.GetIndex();
+    minimum[0] += 1;
+    minimum[1] += 1;
+    maximum[0] -= 1;
+    maximum[1] -= 1;
+
+    itk::ImageRegionConstIterator<Mask> maskIterator(mask, maskRegion);
+    for(itk::IndexValueType y = maskRegion.GetIndex()[1];
+        y < maskRegion.GetIndex()[1] + static_cast<itk::IndexValueType>(maskRegion.GetSize()[1]); ++y)
+    {
+      for(itk::IndexValueType x = maskRegion.GetIndex()[0];
+          x < maskRegion.GetIndex()[0] + static_cast<itk::IndexValueType>(maskRegion.GetSize()[0]); ++x)
+      {
+        if(maskIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+        {
+          minimum[0] = std::min(minimum[0], x);
+          minimum[1] = std::min(minimum[1], y);
+          maximum[0] = std::max(maximum[0], x);
+          maximum[1] = std::max(maximum[1], y);
+        }
+        ++maskIterator;
+      }
+    }
+
+    if(maximum[0] < minimum[0])
+    {
+      // There are no hole pixels
+      this->Region = itk::ImageRegion<2>();
+      this->Ids.clear();
+      this->NumberOfVariables = 0;
+      return;
+    }
+
+    itk::Size<2> size = {{static_cast<itk::SizeValueType>(maximum[0] - minimum[0] + 1),
+                          static_cast<itk::SizeValueType>(maximum[1] - minimum[1] + 1)}};
+    Compute(mask, itk::ImageRegion<2>(minimum, size));
+  }
+
+  /** Number the hole pixels of 'mask' inside 'region', which the id buffer then covers (rather than
+    * the bounding box of the hole). Hole pixels outside of 'region' are ignored. */
+  void Compute(const Mask* const mask, const itk::ImageRegion<2>& region)
+  {
+    this->Region = region;
+    this->NumberOfVariables = 0;
+
+    this->Ids.resize(this->Region.GetNumberOfPixels());
+    itk::ImageRegionConstIterator<Mask> regionIterator(mask, this->Region);
+    for(std::vector<int>::iterator idIterator = this->Ids.begin(); idIterator != this->Ids.end(); ++idIterator)
+    {
+      if(regionIterator.Get() == HoleMaskPixelTypeEnum::HOLE)
+      {
+        *idIterator = static_cast<int>(this->NumberOfVariables++);
+      }
+      else
+      {
+        *idIterator = -1;
+      }
+      ++regionIterator;
+    }
+  }
+
+  /** Get the variable id of 'pixel', or -1 if 'pixel' is not a hole pixel. */
+  int GetId(const itk::Index<2>& pixel) const
+  {
+    if(!this->Region.IsInside(pixel))
+    {
+      return -1;
+    }
+    return this->Ids[GetOffset(pixel)];
+  }
+
+  /** Get the position of 'pixel' in the id buffer. 'pixel' must be inside the bounding box. */
+  std::size_t GetOffset(const itk::Index<2>& pixel) const
+  {
+    return static_cast<std::size_t>(pixel[1] - this->Region.GetIndex()[1]) * this->Region.GetSize()[0] +
+           static_cast<std::size_t>(pixel[0] - this->Region.GetIndex()[0]);
+  }
+
+  /** Get the pixel at a position in the id buffer. */
+  itk::Index<2> GetPixel(const std::size_t offset) const
+  {
+    itk::Index<2> pixel = {{this->Region.GetIndex()[0] + static_cast<itk::IndexValueType>(offset % this->Region.GetSize()[0]),
+                            this->Region.GetIndex()[1] + static_cast<itk::IndexValueType>(offset / this->Region.GetSize()[0])}};
+    return pixel;
+  }
+
+  /** Get the ids of the (up, left, right, down) neighbors of each variable, 4 entries per
+    * variable. Neighbors that are not hole pixels have id -1. */
+  void ComputeNeighborIds(std::vector<int>& neighborIds) const
+  {
+    const std::size_t width = this->Region.GetSize()[0];
+    const std::size_t height = this->Region.GetSize()[1];
+
+    neighborIds.assign(4 * this->NumberOfVariables, -1);
+    for(std::size_t offset = 0; offset < this->Ids.size(); ++offset)
+    {
+      const int variableId = this->Ids[offset];
+      if(variableId < 0)
+      {
+        continue;
+      }
+
+      const std::size_t x = offset % width;
+      const std::size_t y = offset / width;
+      int* neighbors = &neighborIds[4 * variableId];
+      if(y > 0)
+      {
+        neighbors[0] = this->Ids[offset - width];
+      }
+      if(x > 0)
+      {
+        neighbors[1] = this->Ids[offset - 1];
+      }
+      if(x + 1 < width)
+      {
+        neighbors[2] = this->Ids[offset + 1];
+      }
+      if(y + 1 < height)
+      {
+        neighbors[3] = this->Ids[offset + width];
+      }
+    }
+  }
+
+  /** Split the hole into its connected components (pixels are connected to their up, left, right
+    * and down neighbors, like the 5-point stencil). Each component gets its own bounding box and
+    * numbering, so the components can be solved independently. They are sorted from the largest to
+    * the smallest. */
+  void ComputeComponents(std::vector<VariableIdImage>& components) const
+  {
+    const std::size_t width = this->Region.GetSize()[0];
+    const std::size_t height = this->Region.GetSize()[1];
+
+    // Label the components with a flood fill, and find their bounding boxes (in buffer coordinates)
+    std::vector<int> labels(this->Ids.size(), -1);
+    std::vector<std::size_t> minimumX, minimumY, maximumX, maximumY;
+    std::vector<std::size_t> stack;
+    for(std::size_t seed = 0; seed < this->Ids.size(); ++seed)
+    {
+      if(this->Ids[seed] < 0 || labels[seed] >= 0)
+      {
+        continue;
+      }
+
+      const int label = static_cast<int>(minimumX.size());
+      minimumX.push_back(width);
+      minimumY.push_back(height);
+      maximumX.push_back(0);
+      maximumY.push_back(0);
+
+      labels[seed] = label;
+      stack.push_back(seed);
+      while(!stack.empty())
+      {
+        const std::size_t offset = stack.back();
+        stack.pop_back();
+
+        const std::size_t x = offset % width;
+        const std::size_t y = offset / width;
+        minimumX[label] = std::min(minimumX[label], x);
+        minimumY[label] = std::min(minimumY[label], y);
+        maximumX[label] = std::max(maximumX[label], x);
+        maximumY[label] = std::max(maximumY[label], y);
+
+        const bool hasNeighbor[4] = {y > 0, x > 0, x + 1 < width, y + 1 < height};
+        const std::size_t neighborOffsets[4] = {offset - width, offset - 1, offset + 1, offset + width};
+        for(unsigned int neighbor = 0; neighbor < 4; ++neighbor)
+        {
+          if(hasNeighbor[neighbor] && this->Ids[neighborOffsets[neighbor]] >= 0 &&
+             labels[neighborOffsets[neighbor]] < 0)
+          {
+            labels[neighborOffsets[neighbor]] = label;
+            stack.push_back(neighborOffsets[neighbor]);
+          }
+        }
+      }
+    }
+
+    components.clear();
+    components.resize(minimumX.size());
+    for(std::size_t label = 0; label < components.size(); ++label)
+    {
+      VariableIdImage& component = components[label];
+      itk::Index<2> corner = {{this->Region.GetIndex()[0] + static_cast<itk::IndexValueType>(minimumX[label]),
+                               this->Region.GetIndex()[1] + static_cast<itk::IndexValueType>(minimumY[label])}};
+      itk::Size<2> size = {{maximumX[label] - minimumX[label] + 1, maximumY[label] - minimumY[label] + 1}};
+      component.Region = itk::ImageRegion<2>(corner, size);
+      component.Ids.assign(component.Region.GetNumberOfPixels(), -1);
+      component.NumberOfVariables = 0;
+    }
+
+    // Number the pixels of each component in raster order
+    for(std::size_t offset = 0; offset < this->Ids.size(); ++offset)
+    {
+      if(labels[offset] < 0)
+      {
+        continue;
+      }
+
+      VariableIdImage& component = components[labels[offset]];
+      const std::size_t x = offset % width - minimumX[labels[offset]];
+      const std::size_t y = offset / width - minimumY[labels[offset]];
+      component.Ids[y * component.Region.GetSize()[0] + x] = static_cast<int>(component.NumberOfVariables++);
+    }
+
+    std::stable_sort(components.begin(), components.end(),
+                     [](const VariableIdImage& a, const VariableIdImage& b)
+                     {
+                       return a.NumberOfVariables > b.NumberOfVariables;
+                     });
+  }
+
+  /** Get the number of hole pixels. */
+  unsigned int GetNumberOfVariables() const
+  {
+    return this->NumberOfVariables;
+  }
+
+  /** Get the region that the id buffer covers (the bounding box of the hole, unless a region was given). */
+  const itk::ImageRegion<2>& GetRegion() const
+  {
+    return this->Region;
+  }
+
+  /** Get the id buffer (in raster order over GetRegion()). */
+  const std::vector<int>& GetIds() const
+  {
+    return this->Ids;
+  }
+
+private:
+  /** The region that the id buffer covers. */
+  itk::ImageRegion<2> Region;
+
+  /** The variable id of each pixel in Region, or -1 if the pixel is not a hole pixel. */
+  std::vector<int> Ids;
+
+  /** The number of hole pixels. */
+  unsigned int NumberOfVariables = 0;
+};
+
+#endif